@@ -33,6 +33,8 @@
 #cmakedefine HAVE_CLOCK_GETTIME
 
 #cmakedefine HAVE_RESINIT
+#cmakedefine HAVE_EPOLL
+#cmakedefine HAVE_EVENTFD
 
 #cmakedefine HAVE_TUNNEL
 #cmakedefine HAVE_ZLIB
@@ -48,6 +48,43 @@ typedef void (*belle_sip_callback_t)(void *user_data);
 
 typedef struct belle_sip_main_loop belle_sip_main_loop_t;
 
+/**
+ * Mechanism used by a main loop to wait for events on its sources.
+**/
+typedef enum belle_sip_main_loop_backend{
+	BELLE_SIP_MAIN_LOOP_BACKEND_DEFAULT, /**<the most efficient backend available on the platform*/
+	BELLE_SIP_MAIN_LOOP_BACKEND_POLL, /**<poll(), or WaitForMultipleObjectsEx() on windows*/
+	BELLE_SIP_MAIN_LOOP_BACKEND_EPOLL /**<linux epoll: sources are registered once, and an iteration only examines ready sources*/
+}belle_sip_main_loop_backend_t;
+
+/**
+ * Counters of a main loop, allowing to compare the number of wake ups with the amount of useful work.
+**/
+typedef struct belle_sip_main_loop_stats{
+	uint64_t iterations;
+	uint64_t idle_iterations; /**<iterations that did not notify any source nor run any task*/
+	uint64_t wakeup_requests; /**<wake ups requested by other threads when adding a source or posting a task*/
+	uint64_t wakeups; /**<wake ups actually written to the control file descriptor, requests being coalesced until the main loop reads it*/
+	uint64_t wakeups_received; /**<iterations interrupted by a wake up*/
+	uint64_t spurious_wakeups; /**<iterations interrupted by a wake up that found nothing to do*/
+}belle_sip_main_loop_stats_t;
+
+#define BELLE_SIP_MAIN_LOOP_HISTOGRAM_BUCKETS 24
+
+/**
+ * Distribution of durations measured by an instrumented main loop.
+ * Bucket 0 counts durations below 1 microsecond, bucket i counts durations in [2^(i-1), 2^i) microseconds, and the last
+ * bucket also counts all longer durations.
+**/
+typedef struct belle_sip_main_loop_histogram{
+	uint64_t count;
+	uint64_t total_us;
+	uint64_t max_us;
+	uint64_t buckets[BELLE_SIP_MAIN_LOOP_HISTOGRAM_BUCKETS];
+}belle_sip_main_loop_histogram_t;
+
+typedef void (*belle_sip_main_loop_histogram_func_t)(const char *name, const belle_sip_main_loop_histogram_t *histogram, void *user_data);
+
 #define BELLE_SIP_CONTINUE_WITHOUT_CATCHUP 2
 #define BELLE_SIP_CONTINUE	1
 #define BELLE_SIP_STOP		0
@@ -63,6 +100,23 @@ BELLESIP_EXPORT void belle_sip_main_loop_remove_source(belle_sip_main_loop_t *ml
 **/
 BELLESIP_EXPORT belle_sip_main_loop_t *belle_sip_main_loop_new(void);
 
+/**
+ * Creates a mainloop using a specific backend.
+ * If the requested backend is not available, the main loop falls back to the poll() backend.
+**/
+BELLESIP_EXPORT belle_sip_main_loop_t *belle_sip_main_loop_new_with_backend(belle_sip_main_loop_backend_t backend);
+
+/**
+ * Returns the backend actually used by the main loop.
+**/
+BELLESIP_EXPORT belle_sip_main_loop_backend_t belle_sip_main_loop_get_backend(const belle_sip_main_loop_t *ml);
+
+/**
+ * Sets the backend used by main loops created with belle_sip_main_loop_new(), including the ones created by belle_sip_stack_new().
+ * Default value is BELLE_SIP_MAIN_LOOP_BACKEND_DEFAULT.
+**/
+BELLESIP_EXPORT void belle_sip_main_loop_set_default_backend(belle_sip_main_loop_backend_t backend);
+
 /**
  * Adds a timeout into the main loop
  * @param ml
@@ -164,6 +218,72 @@ BELLESIP_EXPORT int belle_sip_main_loop_quit(belle_sip_main_loop_t *ml);
 **/
 BELLESIP_EXPORT void belle_sip_main_loop_cancel_source(belle_sip_main_loop_t *ml, unsigned long id);
 
+/**
+ * Gets the counters of the main loop since its creation or the last call to belle_sip_main_loop_reset_stats().
+**/
+BELLESIP_EXPORT void belle_sip_main_loop_get_stats(const belle_sip_main_loop_t *ml, belle_sip_main_loop_stats_t *stats);
+
+BELLESIP_EXPORT void belle_sip_main_loop_reset_stats(belle_sip_main_loop_t *ml);
+
+/**
+ * Sets the maximum number of expired timers notified by a main loop iteration, 0 for no limit. The other ones are
+ * notified by the following iterations, in expiration order, so that a burst of timers does not delay the processing
+ * of network events. The default is 256.
+**/
+BELLESIP_EXPORT void belle_sip_main_loop_set_timer_budget(belle_sip_main_loop_t *ml, int max_timers);
+
+BELLESIP_EXPORT int belle_sip_main_loop_get_timer_budget(const belle_sip_main_loop_t *ml);
+
+/**
+ * Returns the current time in milliseconds, with the same origin as belle_sip_time_ms().
+ * When called from a callback of the main loop, this is the time read once after the main loop was woken up, so that
+ * sources, transactions and channels share it without reading the clock again. Elsewhere, the clock is read.
+**/
+BELLESIP_EXPORT uint64_t belle_sip_main_loop_get_time_ms(belle_sip_main_loop_t *ml);
+
+/**
+ * Makes the main loop read a coarse clock, cheaper but only updated every few milliseconds (CLOCK_REALTIME_COARSE on
+ * Linux). Timers may then fire a few milliseconds late. Has no effect where such a clock is not available.
+ * Disabled by default.
+**/
+BELLESIP_EXPORT void belle_sip_main_loop_enable_coarse_clock(belle_sip_main_loop_t *ml, int enabled);
+
+BELLESIP_EXPORT int belle_sip_main_loop_coarse_clock_enabled(const belle_sip_main_loop_t *ml);
+
+/**
+ * Enables measurement of:
+ * - loop lag: delay between the expiration of timers and the call of their callback,
+ * - poll wait: time spent waiting for events,
+ * - callback durations, by kind of source. Timers are identified by their name (for example "timer_K"), other sources
+ * by their type (channels, resolver contexts...), and tasks posted with belle_sip_main_loop_do_later() are gathered
+ * under "defered task".
+ * Instrumentation is disabled by default, and costs a test per notified source in this case.
+**/
+BELLESIP_EXPORT void belle_sip_main_loop_enable_instrumentation(belle_sip_main_loop_t *ml, int enabled);
+
+BELLESIP_EXPORT int belle_sip_main_loop_instrumentation_enabled(const belle_sip_main_loop_t *ml);
+
+BELLESIP_EXPORT void belle_sip_main_loop_get_loop_lag(const belle_sip_main_loop_t *ml, belle_sip_main_loop_histogram_t *histogram);
+
+BELLESIP_EXPORT void belle_sip_main_loop_get_poll_wait(const belle_sip_main_loop_t *ml, belle_sip_main_loop_histogram_t *histogram);
+
+/**
+ * Calls func for each kind of source whose callback duration has been measured.
+**/
+BELLESIP_EXPORT void belle_sip_main_loop_foreach_callback_duration(const belle_sip_main_loop_t *ml, belle_sip_main_loop_histogram_func_t func, void *user_data);
+
+BELLESIP_EXPORT void belle_sip_main_loop_reset_instrumentation(belle_sip_main_loop_t *ml);
+
+/**
+ * Logs the measurements of an instrumented main loop.
+**/
+BELLESIP_EXPORT void belle_sip_main_loop_dump_instrumentation(const belle_sip_main_loop_t *ml);
+
+/**
+ * Logs the measurements every interval_ms milliseconds, 0 to stop.
+**/
+BELLESIP_EXPORT void belle_sip_main_loop_set_instrumentation_dump_interval(belle_sip_main_loop_t *ml, unsigned int interval_ms);
+
 BELLE_SIP_END_DECLS
 #ifndef BELLE_SIP_USE_STL
 #define BELLE_SIP_USE_STL 1
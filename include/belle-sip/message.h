@@ -38,6 +38,40 @@ BELLESIP_EXPORT belle_sip_message_t* belle_sip_message_parse(const char* raw);
  */
 BELLESIP_EXPORT belle_sip_message_t* belle_sip_message_parse_raw (const char* buff, size_t buff_length,size_t* message_length );
 
+/**
+ * Makes belle_sip_message_parse() and belle_sip_message_parse_raw() allocate the objects they create for a message
+ * (headers, uris, parameters...) from a single arena, instead of allocating each of them separately.
+ * The arena is freed at once when the last of these objects is destroyed, so an object kept after the message, such as
+ * a header taken by a dialog, keeps the whole arena in memory: the initial size plus every block the message grew by,
+ * for as long as this object lives. Objects are not moved out of the arena when the message is destroyed; an
+ * application keeping small parts of many messages for a long time should keep clones of them, which are allocated
+ * separately, or use a small arena size.
+ * @param size size of the arena, it grows by blocks of this size when a message needs more. 0 disables arenas, which
+ * is the default.
+ */
+BELLESIP_EXPORT void belle_sip_message_set_parse_arena_size(size_t size);
+
+BELLESIP_EXPORT size_t belle_sip_message_get_parse_arena_size(void);
+
+/**
+ * Parser used by belle_sip_message_parse() and belle_sip_message_parse_raw().
+ */
+typedef enum belle_sip_message_parser{
+	BELLE_SIP_MESSAGE_PARSER_ANTLR, /**<the grammar generated parser, default*/
+	BELLE_SIP_MESSAGE_PARSER_FAST, /**<a hand-written parser for the common start-line and headers, which hands over
+	anything else to the grammar*/
+	BELLE_SIP_MESSAGE_PARSER_LAZY /**<the hand-written parser only splits the headers, each name is parsed when its
+	headers are first accessed. Headers nobody accessed are marshalled as received, and malformed ones are only dropped
+	once accessed*/
+}belle_sip_message_parser_t;
+
+/**
+ * Selects the parser for messages received from now on. They all build messages with identical headers.
+ */
+BELLESIP_EXPORT void belle_sip_message_set_parser(belle_sip_message_parser_t parser);
+
+BELLESIP_EXPORT belle_sip_message_parser_t belle_sip_message_get_parser(void);
+
 
 BELLESIP_EXPORT int belle_sip_message_is_request(belle_sip_message_t *msg);
 BELLESIP_EXPORT belle_sip_request_t* belle_sip_request_new(void);
@@ -65,6 +99,8 @@ BELLESIP_EXPORT belle_sip_uri_t* belle_sip_request_extract_origin(const belle_si
 
 /**
  * Clone all sip headers + body if any
+ * The clone shares the headers of the original until they are accessed through either message, see
+ * belle_sip_message_get_header().
  * @param  req message to be cloned
  * @return newly allocated request
  */
@@ -81,6 +117,12 @@ BELLESIP_EXPORT void belle_sip_request_set_absolute_uri(belle_sip_request_t* req
 
 BELLESIP_EXPORT int belle_sip_message_is_response(const belle_sip_message_t *msg);
 
+/**
+ * Returns the first header of the given name, or NULL.
+ * A message and its clones share their headers as long as they are not accessed. The headers returned by this function,
+ * belle_sip_message_get_header_by_type() or belle_sip_message_get_headers() may then be modified by the caller, so that
+ * getting them copies the headers of that name if they are still shared with a clone, even when they are only read.
+**/
 BELLESIP_EXPORT belle_sip_header_t *belle_sip_message_get_header(const belle_sip_message_t *msg, const char *header_name);
 BELLESIP_EXPORT int belle_sip_header_supported_contains_tag(const belle_sip_header_supported_t* supported, const char* tag);
 
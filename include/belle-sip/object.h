@@ -94,7 +94,7 @@ static BELLE_SIP_OBJECT_VPTR_TYPE(object_type) BELLE_SIP_OBJECT_VPTR_NAME(object
 	(belle_sip_object_on_first_ref_t)on_first_ref,\
 	(belle_sip_object_on_last_ref_t)on_last_ref,\
 	BELLE_SIP_DEFAULT_BUFSIZE_HINT,\
-	is_cpp, 0\
+	is_cpp, 0, NULL\
 	}; \
 	BELLE_SIP_OBJECT_VPTR_TYPE(object_type) * BELLE_SIP_OBJECT_GET_VPTR_FUNC(object_type)(void){\
 		return &BELLE_SIP_OBJECT_VPTR_NAME(object_type); \
@@ -172,6 +172,7 @@ struct _belle_sip_object_vptr{
 	int tostring_bufsize_hint; /*optimization: you can suggest here the typical size for a to_string() result.*/
 	int is_cpp; /*indicates whether this object kind is defined in c++*/
 	int cpp_offset; /*offset to apply to the belle_sip_object_t to find the pointer to the corresponding bellesip::Object, if any*/
+	struct belle_sip_type_info *type_info; /*ancestry and interface tables, computed on first use*/
 };
 
 typedef struct _belle_sip_object_vptr belle_sip_object_vptr_t;
@@ -179,11 +180,16 @@ typedef struct _belle_sip_object_vptr belle_sip_object_vptr_t;
 struct _belle_sip_object{
 	belle_sip_object_vptr_t *vptr;
 	int ref;
+	/*flags are kept in the padding that follows ref*/
+	unsigned char shared; /*the reference count is updated atomically, see belle_sip_object_set_shared()*/
+	unsigned char sampled; /*the object is tracked by the sampling leak detector*/
 	char* name;
 	struct weak_ref *weak_refs;
 	struct belle_sip_object_pool *pool;
-	belle_sip_list_t *pool_iterator;
-	belle_sip_list_t *data_store;
+	struct _belle_sip_object *pool_prev; /*links of the unowned objects of the pool*/
+	struct _belle_sip_object *pool_next;
+	struct belle_sip_object_data_store *data_store;
+	struct belle_sip_object_arena *arena; /*arena the object was allocated from, if any*/
 };
 
 BELLE_SIP_BEGIN_DECLS
@@ -230,6 +236,119 @@ BELLESIP_EXPORT void belle_sip_object_remove_from_leak_detector(belle_sip_object
 **/
 BELLESIP_EXPORT void belle_sip_object_inhibit_leak_detector(int yes);
 
+/**
+ * Activates the sampling leak detector, which tracks one object out of period created objects, with its type and
+ * creation time. Unlike belle_sip_object_enable_leak_detector(), it is thread safe and its cost is low enough to keep
+ * it enabled in production: objects that are not sampled only cost an atomic increment when created.
+ * Long lived samples are reported with belle_sip_object_foreach_leak_samples() or
+ * belle_sip_object_dump_leak_samples(); a type whose samples keep growing in number is likely to leak.
+ * @param period the sampling period, 0 to disable sampling and forget current samples.
+**/
+BELLESIP_EXPORT void belle_sip_object_enable_leak_sampling(unsigned int period);
+
+BELLESIP_EXPORT unsigned int belle_sip_object_get_leak_sampling_period(void);
+
+/**
+ * Samples of an object type still alive, see belle_sip_object_foreach_leak_samples().
+**/
+typedef struct belle_sip_object_leak_samples{
+	unsigned int count; /**<number of samples alive, the number of objects is about count times the sampling period*/
+	uint64_t oldest_age_ms; /**<time elapsed since the creation of the oldest of them*/
+	const char *oldest_name; /**<name of the oldest of them, if set with belle_sip_object_set_name(), valid until the callback returns*/
+}belle_sip_object_leak_samples_t;
+
+typedef void (*belle_sip_object_leak_samples_func_t)(const char *type_name, const belle_sip_object_leak_samples_t *samples, void *user_data);
+
+/**
+ * Calls func for each object type having samples alive for at least min_age_ms milliseconds.
+ * The object names are only valid during the call, func must not create nor destroy objects.
+**/
+BELLESIP_EXPORT void belle_sip_object_foreach_leak_samples(uint64_t min_age_ms, belle_sip_object_leak_samples_func_t func, void *user_data);
+
+/**
+ * Logs, per type, the samples alive for at least min_age_ms milliseconds.
+**/
+BELLESIP_EXPORT void belle_sip_object_dump_leak_samples(uint64_t min_age_ms);
+
+/**
+ * Counters of an object type, for the whole process. They are always maintained, unlike the leak detector.
+ * Objects of types defined in C++ are all accounted under belle_sip_cpp_object_t.
+**/
+typedef struct belle_sip_object_type_stats{
+	uint64_t allocations; /**<objects of this exact type created since the start of the process*/
+	size_t live; /**<objects of this exact type currently alive*/
+	size_t live_bytes; /**<memory used by these objects, not counting the memory they own*/
+}belle_sip_object_type_stats_t;
+
+typedef void (*belle_sip_object_type_stats_func_t)(const char *type_name, const belle_sip_object_type_stats_t *stats, void *user_data);
+
+/**
+ * Calls func for each object type of which at least one object was created. It can be called from any thread.
+**/
+BELLESIP_EXPORT void belle_sip_object_foreach_type_stats(belle_sip_object_type_stats_func_t func, void *user_data);
+
+/**
+ * Returns a table of the counters of all object types having live objects, one per line, to be freed with
+ * belle_sip_free().
+**/
+BELLESIP_EXPORT char *belle_sip_object_type_stats_to_string(void);
+
+/**
+ * Counters of the cache of an object type, for the calling thread.
+**/
+typedef struct belle_sip_object_cache_stats{
+	uint64_t allocations; /**<objects allocated while caches were enabled*/
+	uint64_t cache_hits; /**<allocations served from the cache*/
+	uint64_t releases; /**<objects destroyed while caches were enabled*/
+	unsigned int cached; /**<objects currently kept in the cache*/
+}belle_sip_object_cache_stats_t;
+
+typedef void (*belle_sip_object_cache_stats_func_t)(const char *type_name, const belle_sip_object_cache_stats_t *stats, void *user_data);
+
+/**
+ * Sets the maximum number of destroyed objects kept by each thread for each object type, in order to be reused by
+ * next allocations of the same type without going through malloc() and free().
+ * Parsing a message creates and destroys hundreds of small objects of a few types, which such caches serve well.
+ * 0 disables the caches, which is the default. Lowering the size does not release cached objects, see
+ * belle_sip_object_flush_caches().
+**/
+BELLESIP_EXPORT void belle_sip_object_set_cache_size(unsigned int max_objects);
+
+BELLESIP_EXPORT unsigned int belle_sip_object_get_cache_size(void);
+
+/**
+ * Calls func for each object type having a cache in the calling thread.
+**/
+BELLESIP_EXPORT void belle_sip_object_foreach_cache_stats(belle_sip_object_cache_stats_func_t func, void *user_data);
+
+/**
+ * Frees the objects cached by the calling thread and resets its counters. Caches of other threads are freed when
+ * these threads exit.
+**/
+BELLESIP_EXPORT void belle_sip_object_flush_caches(void);
+
+/**
+ * Makes the reference count of the object be updated atomically, so that the object can be ref'd and unref'd from
+ * several threads, and destroyed by whichever releases it last. It is intended to hand immutable objects, such as
+ * parsed messages or SDP session descriptions, to other threads without cloning them.
+ * Only the object's own reference count is made atomic: objects reachable from it (the headers of a message for
+ * example) can be read from any thread, but must not be ref'd or unref'd by other threads unless they are shared too.
+ * The object must be owned, i.e. not floating in a pool, and must no longer be modified once shared.
+**/
+BELLESIP_EXPORT void belle_sip_object_set_shared(void *obj);
+
+BELLESIP_EXPORT int belle_sip_object_is_shared(const void *obj);
+
+/**
+ * Makes all objects of the given type, or of types derived from it, be created shared. For example
+ * BELLE_SIP_TYPE_ID(belle_sip_header_t) makes all headers shared, so that they can also be ref'd from other threads.
+ * Atomic reference counting is slower than the default one, so that it should only be enabled for the types that
+ * really need it. This setting is global and shall be done at initialization time, before objects are created. It may
+ * be changed from any thread.
+ * @return 0
+**/
+BELLESIP_EXPORT int belle_sip_object_set_type_shared(belle_sip_type_id_t id, int yesno);
+
 int belle_sip_object_is_unowed(const belle_sip_object_t *obj);
 
 /**
@@ -415,7 +534,7 @@ BELLE_SIP_BEGIN_DECLS
 
 BELLESIP_EXPORT void *belle_sip_object_interface_cast(belle_sip_object_t *obj, belle_sip_interface_id_t id, const char *castname, const char *file, int fileno);
 
-int belle_sip_object_implements(belle_sip_object_t *obj, belle_sip_interface_id_t id);
+BELLESIP_EXPORT int belle_sip_object_implements(belle_sip_object_t *obj, belle_sip_interface_id_t id);
 
 BELLE_SIP_END_DECLS
 
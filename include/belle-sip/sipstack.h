@@ -29,6 +29,14 @@ struct belle_sip_timer_config{
 
 typedef struct belle_sip_timer_config belle_sip_timer_config_t;
 
+typedef struct belle_sip_sharded_stack belle_sip_sharded_stack_t;
+#define BELLE_SIP_SHARDED_STACK(obj) BELLE_SIP_CAST(obj,belle_sip_sharded_stack_t)
+
+/**
+ * Callback invoked from the thread of a shard, with the stack of the shard.
+**/
+typedef void (*belle_sip_shard_func_t)(belle_sip_stack_t *stack, int shard_index, void *user_data);
+
 BELLE_SIP_BEGIN_DECLS
 
 /**
@@ -122,6 +130,15 @@ BELLESIP_EXPORT int belle_sip_stack_get_inactive_transport_timeout(const belle_s
 **/
 BELLESIP_EXPORT void belle_sip_stack_set_inactive_transport_timeout(belle_sip_stack_t *stack, int seconds);
 
+/**
+ * Sets the maximum number of messages a channel parses each time it is notified by the main loop, 0 for no limit (the default).
+ * Data left in the channel's buffer is parsed at next main loop iteration, so that a peer flooding a connection
+ * does not delay the processing of other channels.
+**/
+BELLESIP_EXPORT void belle_sip_stack_set_max_messages_per_read(belle_sip_stack_t *stack, int max_messages);
+
+BELLESIP_EXPORT int belle_sip_stack_get_max_messages_per_read(const belle_sip_stack_t *stack);
+
 
 /**
  * Set the default dscp value to be used for all SIP sockets created and used in the stack.
@@ -178,6 +195,77 @@ BELLESIP_EXPORT void belle_sip_stack_enable_reconnect_to_primary_asap(belle_sip_
 **/
 BELLESIP_EXPORT int belle_sip_stack_reconnect_to_primary_asap_enabled(const belle_sip_stack_t *stack);
 
+/**
+ * Requests listening points created afterwards to open their socket with SO_REUSEPORT, so that several stacks can listen
+ * on the same address and port. The kernel then balances incoming datagrams and connections among them, keeping the
+ * packets of a given flow on the same socket.
+ * This has no effect on platforms that do not support SO_REUSEPORT.
+**/
+BELLESIP_EXPORT void belle_sip_stack_enable_reuse_port(belle_sip_stack_t *stack, int enabled);
+
+BELLESIP_EXPORT int belle_sip_stack_reuse_port_enabled(const belle_sip_stack_t *stack);
+
+/**
+ * Creates a sharded stack: a group of stacks, each one owning its main loop and running it in a dedicated thread.
+ * Stacks of the shards have SO_REUSEPORT enabled, so that their listening points can share the same address and port.
+ * Since the objects of a stack (channels, transactions, dialogs) must only be used from the thread of this stack, the
+ * application must use belle_sip_sharded_stack_post() to run code using a shard's objects.
+ * Datagrams received by a shard are processed by the shard owning their Call-ID, see
+ * belle_sip_sharded_stack_get_shard_for_call_id(): they are handed over, before being parsed, to the UDP listening point
+ * of this shard on the same port. Stream based connections (TCP, TLS) are not split this way, their messages are
+ * processed by the shard which accepted the connection, whatever their Call-ID. The shard owning the objects of a
+ * call is therefore given by belle_sip_sharded_stack_get_shard_for_transaction() or belle_sip_stack_get_shard_index(),
+ * which work for all transports.
+ * The sharded stack must be released from a thread which is not one of its shards, since its destruction waits for
+ * them to stop.
+ * @param nshards the number of shards, or 0 to create one shard per available processor.
+ * @param properties passed to belle_sip_stack_new() for every shard.
+ * @param on_start called from the thread of each shard, before its main loop starts. Shards are started one after the
+ * other, and this function returns once all of them are running. This is where listening points and providers are
+ * to be created.
+ * @param on_stop called from the thread of each shard once its main loop is stopped, to release the objects created in
+ * on_start. Can be NULL.
+ * @param user_data passed to on_start and on_stop.
+**/
+BELLESIP_EXPORT belle_sip_sharded_stack_t *belle_sip_sharded_stack_new(int nshards, const char *properties, belle_sip_shard_func_t on_start, belle_sip_shard_func_t on_stop, void *user_data);
+
+BELLESIP_EXPORT int belle_sip_sharded_stack_get_shard_count(const belle_sip_sharded_stack_t *obj);
+
+/**
+ * Returns the stack of a shard. It must only be used from the thread of this shard.
+**/
+BELLESIP_EXPORT belle_sip_stack_t *belle_sip_sharded_stack_get_stack(const belle_sip_sharded_stack_t *obj, int shard_index);
+
+/**
+ * Returns the index of the shard processing the datagrams of a call, computed from its Call-ID. It is stable for the
+ * life of the sharded stack. Calls whose messages come over a stream based connection are owned by the shard which
+ * accepted the connection instead: use belle_sip_sharded_stack_get_shard_for_transaction() for them.
+**/
+BELLESIP_EXPORT int belle_sip_sharded_stack_get_shard_for_call_id(const belle_sip_sharded_stack_t *obj, const char *call_id);
+
+/**
+ * Returns the index of the shard owning a transaction, and its dialog, whatever the transport of its messages.
+ * Can be called from any thread, as long as the transaction is referenced.
+**/
+BELLESIP_EXPORT int belle_sip_sharded_stack_get_shard_for_transaction(const belle_sip_sharded_stack_t *obj, const belle_sip_transaction_t *t);
+
+/**
+ * Returns the index of the shard running the stack, -1 if the stack is not part of a sharded stack.
+**/
+BELLESIP_EXPORT int belle_sip_stack_get_shard_index(const belle_sip_stack_t *stack);
+
+/**
+ * Schedules a function to be called from the thread of a shard, at next iteration of its main loop.
+ * Can be called from any thread.
+**/
+BELLESIP_EXPORT void belle_sip_sharded_stack_post(belle_sip_sharded_stack_t *obj, int shard_index, belle_sip_callback_t func, void *data);
+
+/**
+ * Same as belle_sip_sharded_stack_post(), the shard being the one processing the datagrams of the call. For calls over
+ * stream based connections, belle_sip_sharded_stack_post() must be given the shard owning their transactions.
+**/
+BELLESIP_EXPORT void belle_sip_sharded_stack_post_for_call_id(belle_sip_sharded_stack_t *obj, const char *call_id, belle_sip_callback_t func, void *data);
+
 
 /*
  * The following functions are for testing (non regression tests) ONLY
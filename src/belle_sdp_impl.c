@@ -22,6 +22,31 @@
 #include "grammars/belle_sdpLexer.h"
 #include "belle_sip_internal.h"
 
+static void belle_sdp_parser_context_create(belle_sip_parser_context_t *ctx){
+	pbelle_sdpLexer lex=belle_sdpLexerNew(ctx->input);
+	pbelle_sdpParser parser;
+
+	ctx->tokens=antlr3CommonTokenStreamSourceNew(ANTLR3_SIZE_HINT,TOKENSOURCE(lex));
+	parser=belle_sdpParserNew(ctx->tokens);
+	ctx->lexer=lex;
+	ctx->parser=parser;
+	ctx->base_lexer=lex->pLexer;
+	ctx->base_parser=parser->pParser;
+}
+
+static void belle_sdp_parser_context_destroy(belle_sip_parser_context_t *ctx){
+	pbelle_sdpParser parser=(pbelle_sdpParser)ctx->parser;
+	pbelle_sdpLexer lex=(pbelle_sdpLexer)ctx->lexer;
+	parser->free(parser);
+	ctx->tokens->free(ctx->tokens);
+	lex->free(lex);
+}
+
+const belle_sip_parser_grammar_t belle_sdp_grammar={
+	BELLE_SIP_PARSER_GRAMMAR_SDP,
+	belle_sdp_parser_context_create,
+	belle_sdp_parser_context_destroy
+};
 
 struct _belle_sdp_mime_parameter {
 	belle_sip_object_t base;
@@ -41,82 +41,178 @@ struct header_name_func_pair {
 	int protocol;
 	const char* name;
 	header_parse_func func;
+	belle_sip_type_id_t id; /*type of the headers created by func*/
+	header_parse_func create; /*builds simple valued headers from their value without the grammar, NULL for the others*/
 };
 
 static struct header_name_func_pair  header_table[] = {
-	 {PROTO_SIP, 			"m",							(header_parse_func)belle_sip_header_contact_parse}
-	,{PROTO_SIP, 			BELLE_SIP_CONTACT,				(header_parse_func)belle_sip_header_contact_parse}
-	,{PROTO_SIP, 			"f",							(header_parse_func)belle_sip_header_from_parse}
-	,{PROTO_SIP, 			BELLE_SIP_FROM,					(header_parse_func)belle_sip_header_from_parse}
-	,{PROTO_SIP, 			"t",							(header_parse_func)belle_sip_header_to_parse}
-	,{PROTO_SIP, 			BELLE_SIP_TO,					(header_parse_func)belle_sip_header_to_parse}
-	,{PROTO_SIP, 			"d",							(header_parse_func)belle_sip_header_diversion_parse}
-	,{PROTO_SIP, 			BELLE_SIP_DIVERSION,			(header_parse_func)belle_sip_header_diversion_parse}
-	,{PROTO_SIP, 			"i",							(header_parse_func)belle_sip_header_call_id_parse}
-	,{PROTO_SIP, 			BELLE_SIP_CALL_ID,				(header_parse_func)belle_sip_header_call_id_parse}
-	,{PROTO_SIP, 			"r",							(header_parse_func)belle_sip_header_retry_after_parse}
-	,{PROTO_SIP, 			BELLE_SIP_RETRY_AFTER,			(header_parse_func)belle_sip_header_retry_after_parse}
-	,{PROTO_SIP, 			"l",							(header_parse_func)belle_sip_header_content_length_parse}
-	,{PROTO_SIP|PROTO_HTTP, BELLE_SIP_CONTENT_LENGTH,		(header_parse_func)belle_sip_header_content_length_parse}
-	,{PROTO_SIP, 			"c",							(header_parse_func)belle_sip_header_content_type_parse}
-	,{PROTO_SIP|PROTO_HTTP, BELLE_SIP_CONTENT_TYPE,			(header_parse_func)belle_sip_header_content_type_parse}
-	,{PROTO_SIP, 			BELLE_SIP_CSEQ,					(header_parse_func)belle_sip_header_cseq_parse}
-	,{PROTO_SIP, 			BELLE_SIP_ROUTE,				(header_parse_func)belle_sip_header_route_parse}
-	,{PROTO_SIP, 			BELLE_SIP_RECORD_ROUTE,			(header_parse_func)belle_sip_header_record_route_parse}
-	,{PROTO_SIP, 			"v",							(header_parse_func)belle_sip_header_via_parse}
-	,{PROTO_SIP, 			BELLE_SIP_VIA,					(header_parse_func)belle_sip_header_via_parse}
-	,{PROTO_SIP, 			"x",							(header_parse_func)belle_sip_header_session_expires_parse}
-	,{PROTO_SIP, 			BELLE_SIP_SESSION_EXPIRES,		(header_parse_func)belle_sip_header_session_expires_parse}
-	,{PROTO_SIP, 			BELLE_SIP_AUTHORIZATION,		(header_parse_func)belle_sip_header_authorization_parse}
-	,{PROTO_SIP, 			BELLE_SIP_PROXY_AUTHORIZATION,	(header_parse_func)belle_sip_header_proxy_authorization_parse}
-	,{PROTO_SIP|PROTO_HTTP,	BELLE_SIP_WWW_AUTHENTICATE,		(header_parse_func)belle_sip_header_www_authenticate_parse}
-	,{PROTO_SIP|PROTO_HTTP,	BELLE_SIP_PROXY_AUTHENTICATE,	(header_parse_func)belle_sip_header_proxy_authenticate_parse}
-	,{PROTO_SIP, 			BELLE_SIP_MAX_FORWARDS,			(header_parse_func)belle_sip_header_max_forwards_parse}
-	,{PROTO_SIP|PROTO_HTTP, BELLE_SIP_USER_AGENT,			(header_parse_func)belle_sip_header_user_agent_parse}
-	,{PROTO_SIP, 			BELLE_SIP_EXPIRES,				(header_parse_func)belle_sip_header_expires_parse}
-	,{PROTO_SIP|PROTO_HTTP, BELLE_SIP_ALLOW,				(header_parse_func)belle_sip_header_allow_parse}
-	,{PROTO_SIP, 			BELLE_SIP_SUBSCRIPTION_STATE,	(header_parse_func)belle_sip_header_subscription_state_parse}
-	,{PROTO_SIP, 			BELLE_SIP_SERVICE_ROUTE,		(header_parse_func)belle_sip_header_service_route_parse}
-	,{PROTO_SIP, 			BELLE_SIP_REFER_TO,				(header_parse_func)belle_sip_header_refer_to_parse}
-	,{PROTO_SIP, 			BELLE_SIP_REFERRED_BY,			(header_parse_func)belle_sip_header_referred_by_parse}
-	,{PROTO_SIP, 			BELLE_SIP_REPLACES,				(header_parse_func)belle_sip_header_replaces_parse}
-	,{PROTO_SIP, 			BELLE_SIP_DATE,					(header_parse_func)belle_sip_header_date_parse}
-	,{PROTO_SIP, 			BELLE_SIP_P_PREFERRED_IDENTITY,	(header_parse_func)belle_sip_header_p_preferred_identity_parse}
-	,{PROTO_SIP, 			BELLE_SIP_PRIVACY,				(header_parse_func)belle_sip_header_privacy_parse}
-	,{PROTO_SIP, 			BELLE_SIP_EVENT,				(header_parse_func)belle_sip_header_event_parse}
-	,{PROTO_SIP, 			"o",							(header_parse_func)belle_sip_header_event_parse}
-	,{PROTO_SIP, 			BELLE_SIP_SUPPORTED,			(header_parse_func)belle_sip_header_supported_parse}
-	,{PROTO_SIP, 			"k",							(header_parse_func)belle_sip_header_supported_parse}
-	,{PROTO_SIP, 			BELLE_SIP_REQUIRE,				(header_parse_func)belle_sip_header_require_parse}
-	,{PROTO_SIP, 			BELLE_SIP_CONTENT_DISPOSITION,	(header_parse_func)belle_sip_header_content_disposition_parse}
-	,{PROTO_SIP, 			BELLE_SIP_ACCEPT,				(header_parse_func)belle_sip_header_accept_parse}
-	,{PROTO_SIP, 			BELLE_SIP_REASON,				(header_parse_func)belle_sip_header_reason_parse}
-	,{PROTO_SIP,			BELLE_SIP_AUTHENTICATION_INFO,	(header_parse_func)belle_sip_header_authentication_info_parse}
+	 {PROTO_SIP, 			"m",							(header_parse_func)belle_sip_header_contact_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_contact_t)}
+	,{PROTO_SIP, 			BELLE_SIP_CONTACT,				(header_parse_func)belle_sip_header_contact_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_contact_t)}
+	,{PROTO_SIP, 			"f",							(header_parse_func)belle_sip_header_from_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_from_t)}
+	,{PROTO_SIP, 			BELLE_SIP_FROM,					(header_parse_func)belle_sip_header_from_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_from_t)}
+	,{PROTO_SIP, 			"t",							(header_parse_func)belle_sip_header_to_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_to_t)}
+	,{PROTO_SIP, 			BELLE_SIP_TO,					(header_parse_func)belle_sip_header_to_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_to_t)}
+	,{PROTO_SIP, 			"d",							(header_parse_func)belle_sip_header_diversion_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_diversion_t)}
+	,{PROTO_SIP, 			BELLE_SIP_DIVERSION,			(header_parse_func)belle_sip_header_diversion_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_diversion_t)}
+	,{PROTO_SIP, 			"i",							(header_parse_func)belle_sip_header_call_id_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_call_id_t),	belle_sip_header_call_id_fast_parse}
+	,{PROTO_SIP, 			BELLE_SIP_CALL_ID,				(header_parse_func)belle_sip_header_call_id_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_call_id_t),	belle_sip_header_call_id_fast_parse}
+	,{PROTO_SIP, 			"r",							(header_parse_func)belle_sip_header_retry_after_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_retry_after_t)}
+	,{PROTO_SIP, 			BELLE_SIP_RETRY_AFTER,			(header_parse_func)belle_sip_header_retry_after_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_retry_after_t)}
+	,{PROTO_SIP, 			"l",							(header_parse_func)belle_sip_header_content_length_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_content_length_t),	belle_sip_header_content_length_fast_parse}
+	,{PROTO_SIP|PROTO_HTTP, BELLE_SIP_CONTENT_LENGTH,		(header_parse_func)belle_sip_header_content_length_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_content_length_t),	belle_sip_header_content_length_fast_parse}
+	,{PROTO_SIP, 			"c",							(header_parse_func)belle_sip_header_content_type_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_content_type_t)}
+	,{PROTO_SIP|PROTO_HTTP, BELLE_SIP_CONTENT_TYPE,			(header_parse_func)belle_sip_header_content_type_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_content_type_t)}
+	,{PROTO_SIP, 			BELLE_SIP_CSEQ,					(header_parse_func)belle_sip_header_cseq_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_cseq_t),	belle_sip_header_cseq_fast_parse}
+	,{PROTO_SIP, 			BELLE_SIP_ROUTE,				(header_parse_func)belle_sip_header_route_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_route_t)}
+	,{PROTO_SIP, 			BELLE_SIP_RECORD_ROUTE,			(header_parse_func)belle_sip_header_record_route_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_record_route_t)}
+	,{PROTO_SIP, 			"v",							(header_parse_func)belle_sip_header_via_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_via_t)}
+	,{PROTO_SIP, 			BELLE_SIP_VIA,					(header_parse_func)belle_sip_header_via_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_via_t)}
+	,{PROTO_SIP, 			"x",							(header_parse_func)belle_sip_header_session_expires_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_session_expires_t)}
+	,{PROTO_SIP, 			BELLE_SIP_SESSION_EXPIRES,		(header_parse_func)belle_sip_header_session_expires_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_session_expires_t)}
+	,{PROTO_SIP, 			BELLE_SIP_AUTHORIZATION,		(header_parse_func)belle_sip_header_authorization_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_authorization_t)}
+	,{PROTO_SIP, 			BELLE_SIP_PROXY_AUTHORIZATION,	(header_parse_func)belle_sip_header_proxy_authorization_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_proxy_authorization_t)}
+	,{PROTO_SIP|PROTO_HTTP,	BELLE_SIP_WWW_AUTHENTICATE,		(header_parse_func)belle_sip_header_www_authenticate_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_www_authenticate_t)}
+	,{PROTO_SIP|PROTO_HTTP,	BELLE_SIP_PROXY_AUTHENTICATE,	(header_parse_func)belle_sip_header_proxy_authenticate_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_proxy_authenticate_t)}
+	,{PROTO_SIP, 			BELLE_SIP_MAX_FORWARDS,			(header_parse_func)belle_sip_header_max_forwards_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_max_forwards_t),	belle_sip_header_max_forwards_fast_parse}
+	,{PROTO_SIP|PROTO_HTTP, BELLE_SIP_USER_AGENT,			(header_parse_func)belle_sip_header_user_agent_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_user_agent_t)}
+	,{PROTO_SIP, 			BELLE_SIP_EXPIRES,				(header_parse_func)belle_sip_header_expires_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_expires_t),	belle_sip_header_expires_fast_parse}
+	,{PROTO_SIP|PROTO_HTTP, BELLE_SIP_ALLOW,				(header_parse_func)belle_sip_header_allow_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_allow_t)}
+	,{PROTO_SIP, 			BELLE_SIP_SUBSCRIPTION_STATE,	(header_parse_func)belle_sip_header_subscription_state_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_subscription_state_t)}
+	,{PROTO_SIP, 			BELLE_SIP_SERVICE_ROUTE,		(header_parse_func)belle_sip_header_service_route_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_service_route_t)}
+	,{PROTO_SIP, 			BELLE_SIP_REFER_TO,				(header_parse_func)belle_sip_header_refer_to_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_refer_to_t)}
+	,{PROTO_SIP, 			BELLE_SIP_REFERRED_BY,			(header_parse_func)belle_sip_header_referred_by_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_referred_by_t)}
+	,{PROTO_SIP, 			BELLE_SIP_REPLACES,				(header_parse_func)belle_sip_header_replaces_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_replaces_t)}
+	,{PROTO_SIP, 			BELLE_SIP_DATE,					(header_parse_func)belle_sip_header_date_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_date_t)}
+	,{PROTO_SIP, 			BELLE_SIP_P_PREFERRED_IDENTITY,	(header_parse_func)belle_sip_header_p_preferred_identity_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_p_preferred_identity_t)}
+	,{PROTO_SIP, 			BELLE_SIP_PRIVACY,				(header_parse_func)belle_sip_header_privacy_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_privacy_t)}
+	,{PROTO_SIP, 			BELLE_SIP_EVENT,				(header_parse_func)belle_sip_header_event_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_event_t)}
+	,{PROTO_SIP, 			"o",							(header_parse_func)belle_sip_header_event_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_event_t)}
+	,{PROTO_SIP, 			BELLE_SIP_SUPPORTED,			(header_parse_func)belle_sip_header_supported_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_supported_t)}
+	,{PROTO_SIP, 			"k",							(header_parse_func)belle_sip_header_supported_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_supported_t)}
+	,{PROTO_SIP, 			BELLE_SIP_REQUIRE,				(header_parse_func)belle_sip_header_require_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_require_t)}
+	,{PROTO_SIP, 			BELLE_SIP_CONTENT_DISPOSITION,	(header_parse_func)belle_sip_header_content_disposition_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_content_disposition_t)}
+	,{PROTO_SIP, 			BELLE_SIP_ACCEPT,				(header_parse_func)belle_sip_header_accept_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_accept_t)}
+	,{PROTO_SIP, 			BELLE_SIP_REASON,				(header_parse_func)belle_sip_header_reason_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_reason_t)}
+	,{PROTO_SIP,			BELLE_SIP_AUTHENTICATION_INFO,	(header_parse_func)belle_sip_header_authentication_info_parse,	BELLE_SIP_TYPE_ID(belle_sip_header_authentication_info_t)}
 };
 
-static belle_sip_header_t* belle_header_create(const char* name,const char* value,int protocol) {
+/*
+ * Perfect hash of the names of header_table: with HEADER_HASH_SEED no two names hash to the same slot, so that a lookup
+ * compares the name with the only entry of its slot. Names must be unique. The seed has to be changed if names are
+ * added and the "Header table hash" test reports collisions: any small value passing this test is fine.
+ */
+#define HEADER_HASH_SIZE 512
+#define HEADER_HASH_SEED 5
+static unsigned char header_hash_slots[HEADER_HASH_SIZE]; /*index in header_table plus one, 0 if the slot is empty*/
+static belle_sip_once_t header_hash_once=BELLE_SIP_ONCE_INIT;
+
+static unsigned int header_name_hash(unsigned int seed, const char *name){
+	unsigned int h=2166136261u^seed;
+	for(;*name!='\0';++name){
+		unsigned char c=(unsigned char)*name;
+		if (c>='A' && c<='Z') c+='a'-'A';
+		h=(h^c)*16777619u;
+	}
+	return (h^(h>>16)) & (HEADER_HASH_SIZE-1);
+}
+
+/*fills the slots, returns the number of names that hash to a slot already taken*/
+static int fill_header_hash_slots(unsigned char slots[HEADER_HASH_SIZE]){
+	size_t elements =sizeof(header_table)/sizeof(struct header_name_func_pair);
 	size_t i;
+	int collisions=0;
+
+	for(i=0;i<elements;i++){
+		unsigned int slot=header_name_hash(HEADER_HASH_SEED,header_table[i].name);
+		if (slots[slot]!=0){
+			collisions++;
+			continue;
+		}
+		slots[slot]=(unsigned char)(i+1);
+	}
+	return collisions;
+}
+
+static void init_header_hash(void){
+	if (fill_header_hash_slots(header_hash_slots)!=0){
+		belle_sip_error("Header names collide in the header table hash, some headers will be created as extensions.");
+	}
+}
+
+int belle_sip_header_table_hash_collisions(void){
+	unsigned char slots[HEADER_HASH_SIZE]={0};
+	return fill_header_hash_slots(slots);
+}
+
+static const struct header_name_func_pair *find_header(const char *name, int protocol){
+	const struct header_name_func_pair *header;
+	int index;
+
+	belle_sip_once(&header_hash_once,init_header_hash);
+	index=header_hash_slots[header_name_hash(HEADER_HASH_SEED,name)];
+	if (index==0) return NULL;
+	header=&header_table[index-1];
+	if ((header->protocol & protocol) && strcasecmp(header->name,name)==0) return header;
+	return NULL;
+}
+
+static belle_sip_header_t* belle_header_create(const char* name,const char* value,int protocol) {
+	const struct header_name_func_pair *header;
 	belle_sip_header_t* ret;
-	size_t elements =sizeof(header_table)/sizeof(struct header_name_func_pair);
 
 	if (!name || name[0]=='\0') {
 		belle_sip_error("Cannot create header without name");
 		return NULL;
 	}
 
-	for(i=0;i<elements;i++) {
-		if ((header_table[i].protocol & protocol) && strcasecmp(header_table[i].name,name)==0) {
-			char* raw = belle_sip_strdup_printf("%s:%s",name,value);
-			ret=header_table[i].func(raw);
-			belle_sip_free(raw);
-			return ret;
-		}
+	if ((header=find_header(name,protocol))!=NULL) {
+		char* raw;
+		if (header->create && (ret=header->create(value))!=NULL) return ret;
+		raw = belle_sip_strdup_printf("%s:%s",name,value);
+		ret=header->func(raw);
+		belle_sip_free(raw);
+		return ret;
 	}
 	/*not a known header*/
 	return BELLE_SIP_HEADER(belle_sip_header_extension_create(name,value));
 
 }
 
+const char *belle_sip_header_get_typed_name(const char *name, belle_sip_type_id_t *id){
+	const struct header_name_func_pair *header=find_header(name,PROTO_SIP);
+	size_t elements =sizeof(header_table)/sizeof(struct header_name_func_pair);
+	size_t i;
+
+	if (header==NULL) return NULL;
+	*id=header->id;
+	/*compact forms share the type of their full name*/
+	if (header->name[1]=='\0'){
+		for(i=0;i<elements;i++){
+			if (header_table[i].id==header->id && header_table[i].name[1]!='\0') return header_table[i].name;
+		}
+	}
+	return header->name;
+}
+
+int belle_sip_header_type_is_address(belle_sip_type_id_t id){
+	switch(id){
+		case BELLE_SIP_TYPE_ID(belle_sip_header_address_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_contact_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_from_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_to_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_diversion_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_route_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_record_route_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_service_route_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_refer_to_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_referred_by_t):
+		case BELLE_SIP_TYPE_ID(belle_sip_header_p_preferred_identity_t):
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
 belle_sip_header_t* belle_sip_header_create(const char* name, const char* value) {
 	return belle_header_create(name,value,PROTO_SIP);
 }
@@ -149,12 +149,29 @@ void belle_sip_object_pool_remove(belle_sip_object_pool_t *pool, belle_sip_objec
 
 belle_sip_object_t * _belle_sip_object_init(belle_sip_object_t *obj, belle_sip_object_vptr_t *vptr);
 void belle_sip_cpp_object_delete(belle_sip_object_t *obj);
+
+/*
+ * Arena from which objects are allocated instead of being individually malloc'ed, while it is the current arena of the
+ * thread. The arena memory is freed at once when all the objects allocated from it, and the reference of its creator,
+ * are gone: an object kept beyond the others keeps the whole arena alive.
+ */
+typedef struct belle_sip_object_arena belle_sip_object_arena_t;
+BELLESIP_EXPORT belle_sip_object_arena_t *belle_sip_object_arena_new(size_t size);
+/*drops the reference of the creator of the arena*/
+BELLESIP_EXPORT void belle_sip_object_arena_release(belle_sip_object_arena_t *arena);
+/*makes objects created by the calling thread be allocated from arena, or normally if NULL. Returns the previous one.*/
+BELLESIP_EXPORT belle_sip_object_arena_t *belle_sip_object_arena_set_current(belle_sip_object_arena_t *arena);
+/*number of objects allocated from the arena and still alive*/
+BELLESIP_EXPORT int belle_sip_object_arena_get_object_count(const belle_sip_object_arena_t *arena);
+/*number of memory allocations made by the arena, including the one of the arena itself*/
+BELLESIP_EXPORT int belle_sip_object_arena_get_block_count(const belle_sip_object_arena_t *arena);
 void belle_sip_object_uninit(belle_sip_object_t *obj);
 #define belle_sip_object_init(obj)		/*nothing*/
 
 
 /*list of all vptrs (classes) used in belle-sip*/
 BELLE_SIP_DECLARE_VPTR(belle_sip_stack_t);
+BELLE_SIP_DECLARE_VPTR(belle_sip_sharded_stack_t);
 BELLE_SIP_DECLARE_VPTR(belle_sip_datagram_listening_point_t);
 BELLE_SIP_DECLARE_VPTR(belle_sip_provider_t);
 BELLE_SIP_DECLARE_VPTR(belle_sip_main_loop_t);
@@ -264,6 +281,8 @@ BELLE_SIP_DECLARE_CUSTOM_VPTR_END
 
 void belle_sip_resolver_context_notify(belle_sip_resolver_context_t *ctx);
 
+#include "timer_wheel.h"
+
 struct belle_sip_source{
 	belle_sip_object_t base;
 	belle_sip_list_t node;
@@ -278,6 +297,9 @@ struct belle_sip_source{
 	void *data;
 	uint64_t expire_ms;
 	int index; /* index in pollfd table */
+#ifdef HAVE_EPOLL
+	unsigned int epoll_events; /* events armed in the epoll set of the main loop*/
+#endif
 	belle_sip_source_func_t notify;
 	belle_sip_source_remove_callback_t on_remove;
 	belle_sip_socket_t sock;
@@ -285,8 +307,16 @@ struct belle_sip_source{
 	unsigned char expired;
 	unsigned char oneshot;
 	unsigned char notify_required; /*for testing purpose, use to ask for being scheduled*/
-	bctbx_iterator_t *it; /*for fast removal*/
+#ifdef HAVE_EPOLL
+	unsigned char epoll_registered;
+#endif
+	belle_sip_timer_wheel_entry_t timer; /*linked in the timer wheel of the main loop when the source has a timeout*/
 	belle_sip_main_loop_t *ml;
+	struct belle_sip_main_loop_source_stats *stats; /*where callback durations are recorded when the main loop is instrumented*/
+	belle_sip_source_t *id_next; /*next source in the same bucket of the main loop's index by id*/
+	belle_sip_source_t *ready_next; /*next source to be notified in the current main loop iteration*/
+	unsigned char indexed;
+	unsigned char ready; /*the source is in the list of sources to be notified*/
 };
 
 void belle_sip_socket_source_init(belle_sip_source_t *s, belle_sip_source_func_t func, void *data, belle_sip_socket_t fd, unsigned int events, unsigned int timeout_value_ms);
@@ -294,6 +324,8 @@ void belle_sip_fd_source_init(belle_sip_source_t *s, belle_sip_source_func_t fun
 belle_sip_source_t * belle_sip_fd_source_new(belle_sip_source_func_t func, void *data, belle_sip_fd_t fd, unsigned int events, unsigned int timeout_value_ms);
 void belle_sip_source_uninit(belle_sip_source_t *s);
 void belle_sip_source_set_notify(belle_sip_source_t *s, belle_sip_source_func_t func);
+/*for testing purpose, ask for the source to be notified with BELLE_SIP_EVENT_READ at next iteration*/
+void belle_sip_source_set_notify_required(belle_sip_source_t *s, int yesno);
 
 
 
@@ -426,25 +458,49 @@ struct belle_sip_dict {
 		belle_sip_parameters_set_parameter(BELLE_SIP_PARAMETERS(obj),#attribute,NULL);\
 	}
 
-#define ANTLR_STREAM_NEW(object_type, value,length) \
-antlr3StringStreamNew((pANTLR3_UINT8)value,ANTLR3_ENC_8BIT,(ANTLR3_UINT32)length,(pANTLR3_UINT8)#object_type)
+/*
+ * Input stream, lexer, token stream and parser of a grammar. They are kept by each thread and reset between parses
+ * instead of being created and freed for every parse.
+ */
+typedef struct belle_sip_parser_context belle_sip_parser_context_t;
+
+typedef struct belle_sip_parser_grammar{
+	int index; /*of the grammar in the caches of a thread*/
+	void (*create)(belle_sip_parser_context_t *ctx); /*creates the lexer, token stream and parser reading ctx->input*/
+	void (*destroy)(belle_sip_parser_context_t *ctx);
+}belle_sip_parser_grammar_t;
+
+struct belle_sip_parser_context{
+	const belle_sip_parser_grammar_t *grammar;
+	struct ANTLR3_INPUT_STREAM_struct *input;
+	struct ANTLR3_COMMON_TOKEN_STREAM_struct *tokens;
+	void *lexer; /*generated lexer*/
+	void *parser; /*generated parser*/
+	struct ANTLR3_LEXER_struct *base_lexer;
+	struct ANTLR3_PARSER_struct *base_parser;
+	belle_sip_parser_context_t *next;
+};
+
+#define BELLE_SIP_PARSER_GRAMMAR_MESSAGE 0
+#define BELLE_SIP_PARSER_GRAMMAR_SDP 1
+#define BELLE_SIP_PARSER_GRAMMARS 2
+
+extern const belle_sip_parser_grammar_t belle_sip_message_grammar;
+extern const belle_sip_parser_grammar_t belle_sdp_grammar;
+
+/*returns a context of the grammar ready to parse value, which may be a cached one*/
+belle_sip_parser_context_t *belle_sip_parser_context_acquire(const belle_sip_parser_grammar_t *grammar, const char *name, const char *value, size_t length);
+void belle_sip_parser_context_release(belle_sip_parser_context_t *ctx);
+/*contexts are cached by default, disabling it frees the contexts cached by the calling thread*/
+BELLESIP_EXPORT void belle_sip_parser_context_cache_enable(int enable);
 
 #define BELLE_PARSE(parser_name, object_type_prefix, object_type) \
 	object_type_prefix##object_type##_t* object_type_prefix##object_type##_parse (const char* value) { \
-	pANTLR3_INPUT_STREAM           input; \
-	pbelle_sip_messageLexer               lex; \
-	pANTLR3_COMMON_TOKEN_STREAM    tokens; \
-	p##parser_name              parser; \
+	belle_sip_parser_context_t *context; \
 	object_type_prefix##object_type##_t* l_parsed_object; \
-	input  = ANTLR_STREAM_NEW(object_type,value,strlen(value));\
-	lex    = belle_sip_messageLexerNew                (input);\
-	tokens = antlr3CommonTokenStreamSourceNew  (ANTLR3_SIZE_HINT, TOKENSOURCE(lex));\
-	parser = parser_name##New               (tokens);\
-	l_parsed_object = parser->object_type(parser);\
-	parser ->free(parser);\
-	tokens ->free(tokens);\
-	lex    ->free(lex);\
-	input  ->close(input);\
+	context = belle_sip_parser_context_acquire(&belle_sip_message_grammar,#object_type,value,strlen(value));\
+	l_parsed_object = ((p##parser_name)context->parser)->object_type((p##parser_name)context->parser);\
+	belle_sip_parser_context_release(context);\
 	if (l_parsed_object == NULL) belle_sip_error(#object_type" parser error for [%s]",value);\
 	return l_parsed_object;\
 }
@@ -550,6 +606,7 @@ struct belle_sip_stack{
 	int resolver_send_error;	/* used to simulate network error*/
 	int test_bind_port;
 	int dscp;
+	int max_messages_per_read; /*0 for unlimited*/
 	char *dns_user_hosts_file; /* used to load additional hosts file for tests */
 	char *dns_resolv_conf; /*used to load custom resolv.conf, for tests*/
 	belle_sip_list_t *dns_servers; /*used when dns servers are supplied by app layer*/
@@ -562,8 +619,18 @@ struct belle_sip_stack{
 	unsigned char dns_srv_enabled;
 	unsigned char dns_search_enabled;
 	unsigned char reconnect_to_primary_asap;
+	unsigned char reuse_port; /*listening points sockets are opened with SO_REUSEPORT*/
+	struct belle_sip_shard *shard; /*set when the stack is run by a sharded stack*/
+	belle_sip_list_t *providers; /*providers created on a sharded stack, not referenced*/
 };
 
+/*
+ * Hands a datagram peeked from the socket of a listening point over to the shard owning its Call-ID, reading it from the
+ * socket. Returns FALSE if it is to be processed by the shard which received it, in which case it is left in the socket.
+ */
+int belle_sip_stack_forward_datagram_to_shard(belle_sip_stack_t *stack, belle_sip_socket_t sock, int port, const char *peeked, size_t peeked_size,
+	int truncated, const struct sockaddr *addr, socklen_t addrlen);
+
 BELLESIP_EXPORT belle_sip_hop_t* belle_sip_hop_new(const char* transport, const char *cname, const char* host,int port);
 BELLESIP_EXPORT belle_sip_hop_t* belle_sip_hop_new_from_uri(const belle_sip_uri_t *uri);
 BELLESIP_EXPORT belle_sip_hop_t* belle_sip_hop_new_from_generic_uri(const belle_generic_uri_t *uri);
@@ -636,6 +703,31 @@ belle_http_provider_t *belle_http_provider_new(belle_sip_stack_t *s, const char
 #define BELLESIP_MULTIPART_BOUNDARY "---------------------------14737809831466499882746641449"
 
 void belle_sip_message_init(belle_sip_message_t *message);
+/*hand-written parser for the usual messages, returns NULL for anything the grammar must parse*/
+belle_sip_message_t *belle_sip_message_fast_parse_raw(const char *buff, size_t buff_length, size_t *message_length, int lazy);
+/*headers built from their value alone by the hand-written parser, NULL if the value must be parsed by the grammar*/
+belle_sip_header_t *belle_sip_header_call_id_fast_parse(const char *value);
+belle_sip_header_t *belle_sip_header_content_length_fast_parse(const char *value);
+belle_sip_header_t *belle_sip_header_cseq_fast_parse(const char *value);
+belle_sip_header_t *belle_sip_header_expires_fast_parse(const char *value);
+belle_sip_header_t *belle_sip_header_max_forwards_fast_parse(const char *value);
+/*adds a header line that is parsed only when the headers of its name are accessed, value is in line or NULL*/
+void belle_sip_message_add_raw_header(belle_sip_message_t *message, const char *name, size_t name_length, const char *line, size_t line_length, const char *value);
+/*name and type of the headers belle_sip_header_create() makes from this name, NULL for extension headers*/
+const char *belle_sip_header_get_typed_name(const char *name, belle_sip_type_id_t *id);
+/*tells whether headers of the type derive from belle_sip_header_address_t*/
+int belle_sip_header_type_is_address(belle_sip_type_id_t id);
+/*number of names of the header table that hash to the same slot as another one, must be 0*/
+int belle_sip_header_table_hash_collisions(void);
+/*
+ * Read only accessors for the stack itself (transaction matching, dialog lookup...). Unlike
+ * belle_sip_message_get_header() and belle_sip_message_get_header_by_type(), they do not copy headers shared with
+ * clones of the message. The returned headers must not be modified nor kept beyond the message.
+ */
+BELLESIP_EXPORT belle_sip_header_t *belle_sip_message_peek_header(const belle_sip_message_t *msg, const char *header_name);
+BELLESIP_EXPORT belle_sip_object_t *_belle_sip_message_peek_header_by_type_id(const belle_sip_message_t *msg, belle_sip_type_id_t id);
+#define belle_sip_message_peek_header_by_type(msg,header_type)\
+	(header_type*)_belle_sip_message_peek_header_by_type_id(BELLE_SIP_MESSAGE(msg),BELLE_SIP_TYPE_ID(header_type))
 
 struct _belle_sip_message {
 	belle_sip_object_t base;
@@ -643,6 +735,7 @@ struct _belle_sip_message {
 	belle_sip_body_handler_t *body_handler;
 
 	char *multipart_body_cache;
+	volatile intptr_t lock; /*bctbx_mutex_t serializing the accesses to the headers, created once the message is read shared*/
 };
 
 struct _belle_sip_request {
@@ -897,20 +990,11 @@ belle_sip_hop_t* belle_sip_response_get_return_hop(belle_sip_response_t *msg);
  */
 #define BELLE_SDP_PARSE(object_type) \
 belle_sdp_##object_type##_t* belle_sdp_##object_type##_parse (const char* value) { \
-	pANTLR3_INPUT_STREAM           input; \
-	pbelle_sdpLexer               lex; \
-	pANTLR3_COMMON_TOKEN_STREAM    tokens; \
-	pbelle_sdpParser              parser; \
+	belle_sip_parser_context_t *context; \
 	belle_sdp_##object_type##_t* l_parsed_object; \
-	input  = ANTLR_STREAM_NEW(object_type, value,strlen(value));\
-	lex    = belle_sdpLexerNew                (input);\
-	tokens = antlr3CommonTokenStreamSourceNew  (ANTLR3_SIZE_HINT, TOKENSOURCE(lex));\
-	parser = belle_sdpParserNew               (tokens);\
-	l_parsed_object = parser->object_type(parser).ret;\
-	parser ->free(parser);\
-	tokens ->free(tokens);\
-	lex    ->free(lex);\
-	input  ->close(input);\
+	context = belle_sip_parser_context_acquire(&belle_sdp_grammar,#object_type,value,strlen(value));\
+	l_parsed_object = ((pbelle_sdpParser)context->parser)->object_type((pbelle_sdpParser)context->parser).ret;\
+	belle_sip_parser_context_release(context);\
 	if (l_parsed_object == NULL) belle_sip_error(#object_type" parser error for [%s]",value);\
 	return l_parsed_object;\
 }
@@ -1115,6 +1199,17 @@ BELLESIP_EXPORT const char *belle_sip_authorization_get_algorithm(const belle_si
  * Generate a random unsigned int
  */
 uint32_t belle_sip_random(void);
+
+/**
+ * Monotonic time in microseconds, for measuring durations. Unlike belle_sip_time_ms(), it has no defined origin.
+ */
+uint64_t belle_sip_time_us(void);
+
+/**
+ * Same as belle_sip_time_ms(), with a resolution of a few milliseconds but cheaper, where the system provides a coarse
+ * clock.
+ */
+uint64_t belle_sip_time_ms_coarse(void);
 #ifdef __cplusplus
 }
 #endif
@@ -19,12 +19,14 @@
 
 #include "belle-sip/belle-sip.h"
 #include "belle_sip_internal.h"
-#include "bctoolbox/map.h"
 #include <limits.h>
 
 #ifndef _WIN32
 #include <unistd.h>
 #include <poll.h>
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 typedef struct pollfd belle_sip_pollfd_t;
 
 static int belle_sip_poll(belle_sip_pollfd_t *pfd, int count, int duration){
@@ -73,6 +75,41 @@ static unsigned int belle_sip_source_get_revents(belle_sip_source_t *s,belle_sip
 	return belle_sip_poll_to_event(&pfd[s->index]);
 }
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+
+/*
+ Epoll() based implementation of event loop.
+ Sources are registered in the epoll set when added to the main loop and updated when their events change,
+ so that an iteration only examines the sources that are ready.
+ Level-triggered mode is used on purpose: channels read at most one buffer per notification and rely on being
+ notified again as long as data is pending on the socket.
+ */
+
+static uint32_t belle_sip_event_to_epoll(unsigned int events){
+	uint32_t ret=0;
+	if (events & BELLE_SIP_EVENT_READ)
+		ret|=EPOLLIN;
+	if (events & BELLE_SIP_EVENT_WRITE)
+		ret|=EPOLLOUT;
+	if (events & BELLE_SIP_EVENT_ERROR)
+		ret|=EPOLLERR;
+	return ret;
+}
+
+static unsigned int belle_sip_epoll_to_event(uint32_t events){
+	unsigned int ret=0;
+	if (events & EPOLLIN)
+		ret|=BELLE_SIP_EVENT_READ;
+	if (events & EPOLLOUT)
+		ret|=BELLE_SIP_EVENT_WRITE;
+	if (events & EPOLLERR)
+		ret|=BELLE_SIP_EVENT_ERROR;
+	return ret;
+}
+
+#endif
+
 #else
 
 
@@ -159,15 +196,17 @@ static void belle_sip_source_destroy(belle_sip_source_t *obj){
 }
 
 static void belle_sip_source_init(belle_sip_source_t *s, belle_sip_source_func_t func, void *data, belle_sip_fd_t fd, unsigned int events, unsigned int timeout_value_ms){
-	static unsigned long global_id=1;
+	/*sources may be created from the threads of several main loops at once*/
+	static volatile intptr_t global_id=1;
 	s->node.data=s;
-	if (s->id==0) s->id=global_id++;
+	if (s->id==0) s->id=(unsigned long)belle_sip_atomic_fetch_add(&global_id,1);
 	s->fd=fd;
 	s->events=events;
 	s->timeout=timeout_value_ms;
 	s->data=data;
 	s->notify=func;
 	s->sock=(belle_sip_socket_t)-1;
+	s->timer.data=s;
 }
 
 void belle_sip_source_uninit(belle_sip_source_t *obj){
@@ -179,10 +218,6 @@ void belle_sip_source_uninit(belle_sip_source_t *obj){
 #endif
 	obj->fd=(belle_sip_fd_t)-1;
 	obj->sock=(belle_sip_socket_t)-1;
-/*	if (obj->it) {
-		bctbx_iterator_delete(obj->it);
-		obj->it=NULL;
-	}*/
 }
 
 void belle_sip_source_set_notify(belle_sip_source_t *s, belle_sip_source_func_t func) {
@@ -239,8 +274,16 @@ void * belle_sip_source_get_user_data(const belle_sip_source_t *s) {
 void belle_sip_source_set_user_data(belle_sip_source_t *s, void *user_data) {
 	s->data = user_data;
 }
+#ifdef HAVE_EPOLL
+static void belle_sip_main_loop_epoll_update(belle_sip_main_loop_t *ml, belle_sip_source_t *s);
+#endif
+
 int belle_sip_source_set_events(belle_sip_source_t* source, int event_mask) {
 	source->events = event_mask;
+#ifdef HAVE_EPOLL
+	if (source->epoll_registered)
+		belle_sip_main_loop_epoll_update(source->ml,source);
+#endif
 	return 0;
 }
 
@@ -249,44 +292,199 @@ belle_sip_socket_t belle_sip_source_get_socket(const belle_sip_source_t* source)
 }
 
 
+/*
+ * Tasks posted with belle_sip_main_loop_do_later() are stored in a bounded lock-free ring buffer, written by any thread
+ * and read by the main loop thread only. The sequence number of a cell tells whether it is free for the producer that
+ * claimed its position, or ready to be read.
+ * When the ring is full, tasks are appended to a mutex protected spill array instead, and keep going there until the
+ * main loop has run the whole ring and then the spill array, so that tasks are still run in the order they were posted.
+ */
+#define BELLE_SIP_MAIN_LOOP_TASK_QUEUE_SIZE 4096
+
+#define BELLE_SIP_MAIN_LOOP_DEFAULT_TIMER_BUDGET 256
+
+typedef struct belle_sip_main_loop_task{
+	volatile intptr_t sequence;
+	belle_sip_callback_t func;
+	void *data;
+}belle_sip_main_loop_task_t;
+
+typedef struct belle_sip_main_loop_source_stats{
+	char *name;
+	belle_sip_main_loop_histogram_t callback_duration;
+}belle_sip_main_loop_source_stats_t;
+
 struct belle_sip_main_loop{
 	belle_sip_object_t base;
 	belle_sip_list_t *fd_sources;
-	bctbx_map_t *timer_sources;
+	belle_sip_timer_wheel_t timers;
+	belle_sip_source_t **sources_by_id; /*hash table of the sources, protected by timer_sources_mutex*/
+	size_t sources_by_id_size; /*number of buckets, always a power of two*/
+	size_t sources_by_id_count;
 	belle_sip_object_pool_t *pool;
-	int nsources;
+	volatile intptr_t nsources; /*modified by belle_sip_main_loop_add_source() from any thread*/
+	belle_sip_main_loop_task_t *tasks;
+	volatile intptr_t tasks_enqueue_pos;
+	intptr_t tasks_dequeue_pos;
+	volatile intptr_t pending_tasks; /*number of posted tasks not yet run, the main loop is woken up when it leaves 0*/
+	belle_sip_main_loop_task_t *spilled_tasks; /*tasks posted while the ring was full, protected by spill_mutex*/
+	size_t spilled_count;
+	size_t spilled_size;
+	volatile intptr_t spilling; /*set while spilled_tasks is not empty*/
+	bctbx_mutex_t spill_mutex;
 	int run;
 	int in_loop;
 	bctbx_mutex_t timer_sources_mutex;
 #ifndef _WIN32
-	int control_fds[2];
+	int control_fds[2]; /*both ends are the same file descriptor when an eventfd is used*/
 	unsigned long thread_id;
 #endif
+	volatile intptr_t wakeup_pending; /*a wake up was written to the control fd and not yet read by the main loop*/
+	volatile intptr_t wakeup_requests;
+	volatile intptr_t wakeups;
+	uint64_t wakeups_received;
+	uint64_t spurious_wakeups;
+	uint64_t iterations;
+	uint64_t idle_iterations;
+	belle_sip_main_loop_histogram_t loop_lag;
+	belle_sip_main_loop_histogram_t poll_wait;
+	belle_sip_list_t *source_stats; /*belle_sip_main_loop_source_stats_t, one per kind of source*/
+	belle_sip_main_loop_source_stats_t *task_stats;
+	belle_sip_source_t *dump_timer;
+	int timer_budget; /*maximum number of timers notified per iteration, 0 for unlimited*/
+	uint64_t now_ms; /*time read after poll returned, valid for the thread running the iteration until it ends*/
+	unsigned long now_thread_id;
+	unsigned char now_valid;
+	unsigned char coarse_clock;
+	unsigned char instrumented;
+	belle_sip_main_loop_backend_t backend;
+	belle_sip_pollfd_t *pfd; /*pollfd table, grown as needed and kept from one iteration to the next*/
+	size_t pfd_size;
+#ifdef HAVE_EPOLL
+	int epoll_fd;
+	struct epoll_event *epoll_events;
+	int epoll_events_size;
+#endif
+	unsigned char woken_up; /*the current iteration was woken up through the control fd*/
+	unsigned char scan_required; /*some fd sources must be examined regardless of their readiness (cancelled, notify_required)*/
 };
 
-static void belle_sip_main_loop_remove_source_internal(
-	belle_sip_main_loop_t *ml,
-	belle_sip_source_t *source,
-	bool_t destroy_timer_sources
-) {
+#ifdef HAVE_EPOLL
+
+static void belle_sip_main_loop_epoll_register(belle_sip_main_loop_t *ml, belle_sip_source_t *s){
+	struct epoll_event ev={0};
+	ev.events=belle_sip_event_to_epoll(s->events);
+	ev.data.ptr=s;
+	if (epoll_ctl(ml->epoll_fd,EPOLL_CTL_ADD,s->fd,&ev)==-1){
+		belle_sip_error("epoll_ctl(EPOLL_CTL_ADD) failed for source [%p] fd [%i]: %s",s,s->fd,strerror(errno));
+		return;
+	}
+	s->epoll_events=ev.events;
+	s->epoll_registered=TRUE;
+}
+
+static void belle_sip_main_loop_epoll_unregister(belle_sip_main_loop_t *ml, belle_sip_source_t *s){
+	if (!s->epoll_registered) return;
+	s->epoll_registered=FALSE;
+	/*
+	 * Sources must be removed before their socket is closed: the set references the open file description, which
+	 * survives the close if the fd was duplicated, and would then keep reporting events for a freed source.
+	 */
+	if (epoll_ctl(ml->epoll_fd,EPOLL_CTL_DEL,s->fd,NULL)==-1){
+		if (errno==EBADF){
+			belle_sip_error("epoll_ctl(EPOLL_CTL_DEL): fd [%i] of source [%p] was closed before the source was removed",s->fd,s);
+		}else if (errno!=ENOENT){
+			belle_sip_error("epoll_ctl(EPOLL_CTL_DEL) failed for source [%p] fd [%i]: %s",s,s->fd,strerror(errno));
+		}
+	}
+}
+
+static void belle_sip_main_loop_epoll_update(belle_sip_main_loop_t *ml, belle_sip_source_t *s){
+	struct epoll_event ev={0};
+	ev.events=belle_sip_event_to_epoll(s->events);
+	if (ev.events==s->epoll_events) return;
+	ev.data.ptr=s;
+	if (epoll_ctl(ml->epoll_fd,EPOLL_CTL_MOD,s->fd,&ev)==-1){
+		belle_sip_error("epoll_ctl(EPOLL_CTL_MOD) failed for source [%p] fd [%i]: %s",s,s->fd,strerror(errno));
+		return;
+	}
+	s->epoll_events=ev.events;
+}
+
+#endif
+
+/*
+ * Index of sources by id. Ids are allocated sequentially, so that masking them spreads sources evenly in buckets.
+ * Must be called with timer_sources_mutex held.
+ */
+
+#define BELLE_SIP_MAIN_LOOP_INDEX_INITIAL_SIZE 64
+
+static void belle_sip_main_loop_index_grow(belle_sip_main_loop_t *ml){
+	size_t new_size=ml->sources_by_id_size ? ml->sources_by_id_size*2 : BELLE_SIP_MAIN_LOOP_INDEX_INITIAL_SIZE;
+	belle_sip_source_t **buckets=(belle_sip_source_t**)belle_sip_malloc0(new_size*sizeof(belle_sip_source_t*));
+	size_t i;
+
+	for(i=0;i<ml->sources_by_id_size;++i){
+		belle_sip_source_t *s,*next;
+		for(s=ml->sources_by_id[i];s!=NULL;s=next){
+			size_t bucket=s->id & (new_size-1);
+			next=s->id_next;
+			s->id_next=buckets[bucket];
+			buckets[bucket]=s;
+		}
+	}
+	if (ml->sources_by_id) belle_sip_free(ml->sources_by_id);
+	ml->sources_by_id=buckets;
+	ml->sources_by_id_size=new_size;
+}
+
+static void belle_sip_main_loop_index_add(belle_sip_main_loop_t *ml, belle_sip_source_t *source){
+	size_t bucket;
+	if (source->indexed) return;
+	if (ml->sources_by_id_count>=ml->sources_by_id_size) belle_sip_main_loop_index_grow(ml);
+	bucket=source->id & (ml->sources_by_id_size-1);
+	source->id_next=ml->sources_by_id[bucket];
+	ml->sources_by_id[bucket]=source;
+	source->indexed=TRUE;
+	ml->sources_by_id_count++;
+}
+
+static void belle_sip_main_loop_index_remove(belle_sip_main_loop_t *ml, belle_sip_source_t *source){
+	belle_sip_source_t **link;
+	if (!source->indexed) return;
+	for(link=&ml->sources_by_id[source->id & (ml->sources_by_id_size-1)];*link!=NULL;link=&(*link)->id_next){
+		if (*link==source){
+			*link=source->id_next;
+			break;
+		}
+	}
+	source->id_next=NULL;
+	source->indexed=FALSE;
+	ml->sources_by_id_count--;
+}
+
+void belle_sip_main_loop_remove_source(belle_sip_main_loop_t *ml, belle_sip_source_t *source){
 	int unrefs = 0;
 	if (source->node.next || source->node.prev || &source->node==ml->fd_sources)  {
 		ml->fd_sources=belle_sip_list_remove_link(ml->fd_sources,&source->node);
+#ifdef HAVE_EPOLL
+		belle_sip_main_loop_epoll_unregister(ml,source);
+#endif
 		unrefs++;
 	}
-	if (source->it) {
+	if (belle_sip_timer_wheel_entry_linked(&source->timer) || source->indexed) {
 		bctbx_mutex_lock(&ml->timer_sources_mutex);
-		if (destroy_timer_sources)
-			bctbx_map_erase(ml->timer_sources, source->it);
-		bctbx_iterator_delete(source->it);
+		if (belle_sip_timer_wheel_entry_linked(&source->timer)){
+			belle_sip_timer_wheel_remove(&ml->timers, &source->timer);
+			unrefs++;
+		}
+		belle_sip_main_loop_index_remove(ml, source);
 		bctbx_mutex_unlock(&ml->timer_sources_mutex);
-
-		source->it=NULL;
-		unrefs++;
 	}
 	if (unrefs) {
 		source->cancelled=TRUE;
-		ml->nsources--;
+		belle_sip_atomic_fetch_add(&ml->nsources,-1);
 		if (source->on_remove)
 			source->on_remove(source);
 
@@ -297,26 +495,22 @@ static void belle_sip_main_loop_remove_source_internal(
 	}
 }
 
-void belle_sip_main_loop_remove_source(belle_sip_main_loop_t *ml, belle_sip_source_t *source) {
-	belle_sip_main_loop_remove_source_internal(ml, source, TRUE);
+static void belle_sip_main_loop_source_stats_free(belle_sip_main_loop_source_stats_t *stats){
+	belle_sip_free(stats->name);
+	belle_sip_free(stats);
 }
 
 static void belle_sip_main_loop_destroy(belle_sip_main_loop_t *ml){
-	bctbx_iterator_t *it = bctbx_map_ullong_begin(ml->timer_sources);
-	bctbx_iterator_t *end = bctbx_map_ullong_end(ml->timer_sources);
+	belle_sip_timer_wheel_entry_t *entry;
 
-	while (!bctbx_iterator_ullong_equals(it, end)) {
-		belle_sip_main_loop_remove_source_internal(
-			ml,
-			(belle_sip_source_t *)bctbx_pair_ullong_get_second(bctbx_iterator_ullong_get_pair(it)),
-			FALSE
-		);
-		it = bctbx_iterator_ullong_get_next(it);
+	if (ml->dump_timer){
+		belle_sip_main_loop_remove_source(ml,ml->dump_timer);
+		belle_sip_object_unref(ml->dump_timer);
 	}
 
-	bctbx_iterator_ullong_delete(it);
-	bctbx_iterator_ullong_delete(end);
-
+	while ((entry=belle_sip_timer_wheel_get_first(&ml->timers))!=NULL){
+		belle_sip_main_loop_remove_source(ml,(belle_sip_source_t*)entry->data);
+	}
 	while (ml->fd_sources){
 		belle_sip_main_loop_remove_source(ml,(belle_sip_source_t*)ml->fd_sources->data);
 	}
@@ -324,37 +518,119 @@ static void belle_sip_main_loop_destroy(belle_sip_main_loop_t *ml){
 		belle_sip_object_unref(ml->pool);
 	}
 
-	bctbx_mmap_ullong_delete(ml->timer_sources);
 	bctbx_mutex_destroy(&ml->timer_sources_mutex);
+	/*tasks that were never run are dropped, like the sources that are still pending*/
+	belle_sip_free(ml->tasks);
+	if (ml->spilled_tasks) belle_sip_free(ml->spilled_tasks);
+	bctbx_mutex_destroy(&ml->spill_mutex);
+	belle_sip_list_free_with_data(ml->source_stats,(void (*)(void*))belle_sip_main_loop_source_stats_free);
+	if (ml->sources_by_id) belle_sip_free(ml->sources_by_id);
+	if (ml->pfd) belle_sip_free(ml->pfd);
 
 #ifndef _WIN32
 	close(ml->control_fds[0]);
-	close(ml->control_fds[1]);
+	if (ml->control_fds[1]!=ml->control_fds[0]) close(ml->control_fds[1]);
+#endif
+#ifdef HAVE_EPOLL
+	if (ml->epoll_fd!=-1) close(ml->epoll_fd);
+	if (ml->epoll_events) belle_sip_free(ml->epoll_events);
 #endif
 }
 
 BELLE_SIP_DECLARE_NO_IMPLEMENTED_INTERFACES(belle_sip_main_loop_t);
 BELLE_SIP_INSTANCIATE_VPTR(belle_sip_main_loop_t,belle_sip_object_t,belle_sip_main_loop_destroy,NULL,NULL,FALSE);
 
-belle_sip_main_loop_t *belle_sip_main_loop_new(void){
+static belle_sip_main_loop_backend_t belle_sip_main_loop_default_backend=BELLE_SIP_MAIN_LOOP_BACKEND_DEFAULT;
+
+void belle_sip_main_loop_set_default_backend(belle_sip_main_loop_backend_t backend){
+	belle_sip_main_loop_default_backend=backend;
+}
+
+static belle_sip_main_loop_backend_t belle_sip_main_loop_resolve_backend(belle_sip_main_loop_backend_t backend){
+	if (backend==BELLE_SIP_MAIN_LOOP_BACKEND_DEFAULT){
+#ifdef HAVE_EPOLL
+		return BELLE_SIP_MAIN_LOOP_BACKEND_EPOLL;
+#else
+		return BELLE_SIP_MAIN_LOOP_BACKEND_POLL;
+#endif
+	}
+#ifndef HAVE_EPOLL
+	if (backend==BELLE_SIP_MAIN_LOOP_BACKEND_EPOLL){
+		belle_sip_warning("epoll main loop backend is not available on this platform, using poll instead.");
+		return BELLE_SIP_MAIN_LOOP_BACKEND_POLL;
+	}
+#endif
+	return backend;
+}
+
+belle_sip_main_loop_t *belle_sip_main_loop_new_with_backend(belle_sip_main_loop_backend_t backend){
 	belle_sip_main_loop_t*m=belle_sip_object_new(belle_sip_main_loop_t);
+	int i;
+
 	m->pool=belle_sip_object_pool_push();
-	m->timer_sources = bctbx_mmap_ullong_new();
+	m->timer_budget=BELLE_SIP_MAIN_LOOP_DEFAULT_TIMER_BUDGET;
+	m->tasks=(belle_sip_main_loop_task_t*)belle_sip_malloc0(BELLE_SIP_MAIN_LOOP_TASK_QUEUE_SIZE*sizeof(belle_sip_main_loop_task_t));
+	for(i=0;i<BELLE_SIP_MAIN_LOOP_TASK_QUEUE_SIZE;++i){
+		m->tasks[i].sequence=i;
+	}
+	belle_sip_timer_wheel_init(&m->timers,belle_sip_time_ms());
 	bctbx_mutex_init(&m->timer_sources_mutex,NULL);
+	bctbx_mutex_init(&m->spill_mutex,NULL);
 
 #ifndef _WIN32
+#ifdef HAVE_EVENTFD
+	m->control_fds[0] = m->control_fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m->control_fds[0] == -1){
+		belle_sip_fatal("Cannot create control eventfd of main loop thread: %s", strerror(errno));
+	}
+#else
 	if (pipe(m->control_fds) == -1){
 		belle_sip_fatal("Cannot create control pipe of main loop thread: %s", strerror(errno));
 	}
+	/*the pipe is drained at once when the main loop is woken up*/
+	fcntl(m->control_fds[0], F_SETFL, fcntl(m->control_fds[0], F_GETFL) | O_NONBLOCK);
+#endif
 	m->thread_id = 0;
 #endif
-
+	m->backend=belle_sip_main_loop_resolve_backend(backend);
+#ifdef HAVE_EPOLL
+	m->epoll_fd=-1;
+	if (m->backend==BELLE_SIP_MAIN_LOOP_BACKEND_EPOLL){
+		m->epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+		if (m->epoll_fd==-1){
+			belle_sip_warning("epoll_create1() failed: %s, using poll main loop backend instead.",strerror(errno));
+			m->backend=BELLE_SIP_MAIN_LOOP_BACKEND_POLL;
+		}else{
+			struct epoll_event ev={0};
+			ev.events=EPOLLIN;
+			ev.data.ptr=NULL; /*a NULL source designates the control pipe*/
+			if (epoll_ctl(m->epoll_fd,EPOLL_CTL_ADD,m->control_fds[0],&ev)==-1){
+				belle_sip_fatal("Cannot register control pipe of main loop thread: %s", strerror(errno));
+			}
+		}
+	}
+#endif
 	return m;
 }
 
+belle_sip_main_loop_t *belle_sip_main_loop_new(void){
+	return belle_sip_main_loop_new_with_backend(belle_sip_main_loop_default_backend);
+}
+
+belle_sip_main_loop_backend_t belle_sip_main_loop_get_backend(const belle_sip_main_loop_t *ml){
+	return ml->backend;
+}
+
 void belle_sip_main_loop_wake_up(belle_sip_main_loop_t *ml);
+#ifndef _WIN32
+static void belle_sip_main_loop_ack_wake_up(belle_sip_main_loop_t *ml);
+#endif
 
-void belle_sip_main_loop_add_source(belle_sip_main_loop_t *ml, belle_sip_source_t *source){
+/*
+ * When give_ref is TRUE, the caller's reference on a timeout source is handed over to the main loop, which allows
+ * to add a source from another thread without touching its refcount once it is visible to the main loop.
+ */
+static void belle_sip_main_loop_add_source_internal(belle_sip_main_loop_t *ml, belle_sip_source_t *source, int give_ref){
 	if (source->node.next || source->node.prev){
 		belle_sip_fatal("Source is already linked somewhere else.");
 		return;
@@ -365,29 +641,40 @@ void belle_sip_main_loop_add_source(belle_sip_main_loop_t *ml, belle_sip_source_
 	}
 
 	source->ml=ml;
+	source->cancelled=FALSE;
+	source->stats=NULL;
 
-	if (source->timeout>=0){
-		belle_sip_object_ref(source);
-		source->expire_ms=belle_sip_time_ms()+source->timeout;
+	if (source->timeout>=0 || source->fd != (belle_sip_fd_t)-1){
 		bctbx_mutex_lock(&ml->timer_sources_mutex);
-		source->it = bctbx_map_insert_and_delete_with_returned_it(ml->timer_sources
-																	  , (bctbx_pair_t*)bctbx_pair_ullong_new(source->expire_ms, source));
+		belle_sip_main_loop_index_add(ml, source);
+		if (source->timeout>=0){
+			if (!give_ref) belle_sip_object_ref(source);
+			source->expire_ms=belle_sip_main_loop_get_time_ms(ml)+source->timeout;
+			belle_sip_timer_wheel_insert(&ml->timers, &source->timer, source->expire_ms);
+		}
 		bctbx_mutex_unlock(&ml->timer_sources_mutex);
-
 	}
-	source->cancelled=FALSE;
 	if (source->fd != (belle_sip_fd_t)-1 ) {
 		belle_sip_object_ref(source);
 		ml->fd_sources=belle_sip_list_prepend_link(ml->fd_sources,&source->node);
+		if (source->notify_required) ml->scan_required=TRUE;
+#ifdef HAVE_EPOLL
+		if (ml->backend==BELLE_SIP_MAIN_LOOP_BACKEND_EPOLL)
+			belle_sip_main_loop_epoll_register(ml,source);
+#endif
 	}
 
-	ml->nsources++;
+	belle_sip_atomic_fetch_add(&ml->nsources,1);
 #ifndef _WIN32
 	if (ml->thread_id != bctbx_thread_self())
 		belle_sip_main_loop_wake_up(ml);
 #endif
 }
 
+void belle_sip_main_loop_add_source(belle_sip_main_loop_t *ml, belle_sip_source_t *source){
+	belle_sip_main_loop_add_source_internal(ml,source,FALSE);
+}
+
 belle_sip_source_t* belle_sip_main_loop_create_timeout_with_remove_cb(  belle_sip_main_loop_t *ml
 																	  , belle_sip_source_func_t func
 																	  , void *data
@@ -417,35 +704,322 @@ unsigned long belle_sip_main_loop_add_timeout(belle_sip_main_loop_t *ml, belle_s
 	return s->id;
 }
 
-void belle_sip_main_loop_do_later(belle_sip_main_loop_t *ml, belle_sip_callback_t func, void *data){
-	/* FIXME: Temporary workaround for -Wcast-function-type. */
-	#if __GNUC__ >= 8
-		_Pragma("GCC diagnostic push")
-		_Pragma("GCC diagnostic ignored \"-Wcast-function-type\"")
-	#endif // if __GNUC__ >= 8
+/*
+ * Instrumentation
+ */
 
-	belle_sip_source_t * s=belle_sip_main_loop_create_timeout(ml,(belle_sip_source_func_t)func,data,0,"defered task");
+static void belle_sip_main_loop_histogram_add(belle_sip_main_loop_histogram_t *histogram, uint64_t value_us){
+	int bucket=0;
+	uint64_t v;
+	for(v=value_us;v!=0 && bucket<BELLE_SIP_MAIN_LOOP_HISTOGRAM_BUCKETS-1;v>>=1){
+		bucket++;
+	}
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->total_us+=value_us;
+	if (value_us>histogram->max_us) histogram->max_us=value_us;
+}
 
-	#if __GNUC__ >= 8
-		_Pragma("GCC diagnostic pop")
-	#endif // if __GNUC__ >= 8
+static belle_sip_main_loop_source_stats_t *belle_sip_main_loop_get_source_stats(belle_sip_main_loop_t *ml, const char *name){
+	belle_sip_list_t *elem;
+	belle_sip_main_loop_source_stats_t *stats;
+	for(elem=ml->source_stats;elem!=NULL;elem=elem->next){
+		stats=(belle_sip_main_loop_source_stats_t*)elem->data;
+		if (strcmp(stats->name,name)==0) return stats;
+	}
+	stats=belle_sip_new0(belle_sip_main_loop_source_stats_t);
+	stats->name=belle_sip_strdup(name);
+	ml->source_stats=belle_sip_list_append(ml->source_stats,stats);
+	return stats;
+}
 
-	s->oneshot=TRUE;
-	belle_sip_object_unref(s);
+/*
+ * Sources that are not plain timers are named after what they are for (resolver contexts are named after the
+ * resolved name for example), so only their type is meaningful.
+ */
+static const char *belle_sip_source_get_stats_name(const belle_sip_source_t *s){
+	const belle_sip_object_t *obj=(const belle_sip_object_t*)s;
+	if (obj->vptr==(belle_sip_object_vptr_t*)BELLE_SIP_OBJECT_GET_VPTR_FUNC(belle_sip_source_t)() && obj->name)
+		return obj->name;
+	return obj->vptr->type_name;
+}
+
+static uint64_t belle_sip_main_loop_read_clock(const belle_sip_main_loop_t *ml){
+	return ml->coarse_clock ? belle_sip_time_ms_coarse() : belle_sip_time_ms();
+}
+
+uint64_t belle_sip_main_loop_get_time_ms(belle_sip_main_loop_t *ml){
+	if (ml->now_valid && ml->now_thread_id==belle_sip_thread_self_id()) return ml->now_ms;
+	return belle_sip_main_loop_read_clock(ml);
+}
+
+void belle_sip_main_loop_enable_coarse_clock(belle_sip_main_loop_t *ml, int enabled){
+	ml->coarse_clock=(unsigned char)enabled;
+}
+
+int belle_sip_main_loop_coarse_clock_enabled(const belle_sip_main_loop_t *ml){
+	return ml->coarse_clock;
+}
+
+static int belle_sip_main_loop_notify_instrumented(belle_sip_main_loop_t *ml, belle_sip_source_t *s){
+	uint64_t start;
+	int ret;
+
+	if (s->revents & BELLE_SIP_EVENT_TIMEOUT){
+		uint64_t now=ml->now_ms;
+		belle_sip_main_loop_histogram_add(&ml->loop_lag,now>s->expire_ms ? (now-s->expire_ms)*1000 : 0);
+	}
+	if (!s->stats) s->stats=belle_sip_main_loop_get_source_stats(ml,belle_sip_source_get_stats_name(s));
+	start=belle_sip_time_us();
+	ret=s->notify(s->data,s->revents);
+	belle_sip_main_loop_histogram_add(&s->stats->callback_duration,belle_sip_time_us()-start);
+	return ret;
+}
+
+void belle_sip_main_loop_set_timer_budget(belle_sip_main_loop_t *ml, int max_timers){
+	ml->timer_budget=max_timers;
+}
+
+int belle_sip_main_loop_get_timer_budget(const belle_sip_main_loop_t *ml){
+	return ml->timer_budget;
+}
+
+void belle_sip_main_loop_enable_instrumentation(belle_sip_main_loop_t *ml, int enabled){
+	ml->instrumented=enabled ? TRUE : FALSE;
+}
+
+int belle_sip_main_loop_instrumentation_enabled(const belle_sip_main_loop_t *ml){
+	return ml->instrumented;
+}
+
+void belle_sip_main_loop_get_loop_lag(const belle_sip_main_loop_t *ml, belle_sip_main_loop_histogram_t *histogram){
+	*histogram=ml->loop_lag;
+}
+
+void belle_sip_main_loop_get_poll_wait(const belle_sip_main_loop_t *ml, belle_sip_main_loop_histogram_t *histogram){
+	*histogram=ml->poll_wait;
+}
+
+void belle_sip_main_loop_foreach_callback_duration(const belle_sip_main_loop_t *ml, belle_sip_main_loop_histogram_func_t func, void *user_data){
+	const belle_sip_list_t *elem;
+	for(elem=ml->source_stats;elem!=NULL;elem=elem->next){
+		const belle_sip_main_loop_source_stats_t *stats=(const belle_sip_main_loop_source_stats_t*)elem->data;
+		func(stats->name,&stats->callback_duration,user_data);
+	}
+}
+
+void belle_sip_main_loop_reset_instrumentation(belle_sip_main_loop_t *ml){
+	belle_sip_list_t *elem;
+	memset(&ml->loop_lag,0,sizeof(ml->loop_lag));
+	memset(&ml->poll_wait,0,sizeof(ml->poll_wait));
+	/*entries are kept since sources point to them*/
+	for(elem=ml->source_stats;elem!=NULL;elem=elem->next){
+		belle_sip_main_loop_source_stats_t *stats=(belle_sip_main_loop_source_stats_t*)elem->data;
+		memset(&stats->callback_duration,0,sizeof(stats->callback_duration));
+	}
+}
+
+/*upper bound of the bucket containing the given percentile*/
+static uint64_t belle_sip_main_loop_histogram_percentile(const belle_sip_main_loop_histogram_t *histogram, int percent){
+	uint64_t threshold=(histogram->count*percent+99)/100;
+	uint64_t cumulated=0;
+	int i;
+	for(i=0;i<BELLE_SIP_MAIN_LOOP_HISTOGRAM_BUCKETS-1;++i){
+		cumulated+=histogram->buckets[i];
+		if (cumulated>=threshold) return ((uint64_t)1)<<i;
+	}
+	return histogram->max_us;
+}
+
+static void belle_sip_main_loop_histogram_dump(const char *name, const belle_sip_main_loop_histogram_t *histogram, void *user_data){
+	const belle_sip_main_loop_t *ml=(const belle_sip_main_loop_t*)user_data;
+	if (histogram->count==0) return;
+	belle_sip_message("Main loop [%p] %s: count=%llu avg=%lluus p50<=%lluus p99<=%lluus max=%lluus", ml, name,
+		(unsigned long long)histogram->count,
+		(unsigned long long)(histogram->total_us/histogram->count),
+		(unsigned long long)belle_sip_main_loop_histogram_percentile(histogram,50),
+		(unsigned long long)belle_sip_main_loop_histogram_percentile(histogram,99),
+		(unsigned long long)histogram->max_us);
+}
+
+void belle_sip_main_loop_dump_instrumentation(const belle_sip_main_loop_t *ml){
+	if (!ml->instrumented){
+		belle_sip_message("Main loop [%p] is not instrumented",ml);
+		return;
+	}
+	belle_sip_main_loop_histogram_dump("loop lag",&ml->loop_lag,(void*)ml);
+	belle_sip_main_loop_histogram_dump("poll wait",&ml->poll_wait,(void*)ml);
+	belle_sip_main_loop_foreach_callback_duration(ml,belle_sip_main_loop_histogram_dump,(void*)ml);
+}
+
+static int belle_sip_main_loop_dump_timer_expired(void *data, unsigned int events){
+	belle_sip_main_loop_dump_instrumentation((belle_sip_main_loop_t*)data);
+	return BELLE_SIP_CONTINUE_WITHOUT_CATCHUP;
+}
+
+void belle_sip_main_loop_set_instrumentation_dump_interval(belle_sip_main_loop_t *ml, unsigned int interval_ms){
+	if (ml->dump_timer){
+		belle_sip_main_loop_remove_source(ml,ml->dump_timer);
+		belle_sip_object_unref(ml->dump_timer);
+		ml->dump_timer=NULL;
+	}
+	if (interval_ms>0){
+		ml->dump_timer=belle_sip_main_loop_create_timeout(ml,belle_sip_main_loop_dump_timer_expired,ml,interval_ms,"Main loop instrumentation dump timer");
+	}
+}
+
+/*
+ * Claims the next position of the task queue and fills it. Returns FALSE if the queue is full.
+ */
+static int belle_sip_main_loop_push_task(belle_sip_main_loop_t *ml, belle_sip_callback_t func, void *data){
+	belle_sip_main_loop_task_t *task;
+	intptr_t pos=belle_sip_atomic_load(&ml->tasks_enqueue_pos);
+
+	for(;;){
+		intptr_t diff;
+		task=&ml->tasks[pos & (BELLE_SIP_MAIN_LOOP_TASK_QUEUE_SIZE-1)];
+		diff=belle_sip_atomic_load(&task->sequence)-pos;
+		if (diff==0){
+			if (belle_sip_atomic_compare_exchange(&ml->tasks_enqueue_pos,&pos,pos+1)) break;
+			/*another thread took this position, pos now holds the current one*/
+		}else if (diff<0){
+			return FALSE;
+		}else{
+			pos=belle_sip_atomic_load(&ml->tasks_enqueue_pos);
+		}
+	}
+	task->func=func;
+	task->data=data;
+	belle_sip_atomic_store(&task->sequence,pos+1);
+	return TRUE;
+}
+
+/*
+ * Must be called by the main loop thread only.
+ */
+static int belle_sip_main_loop_pop_task(belle_sip_main_loop_t *ml, belle_sip_callback_t *func, void **data){
+	intptr_t pos=ml->tasks_dequeue_pos;
+	belle_sip_main_loop_task_t *task=&ml->tasks[pos & (BELLE_SIP_MAIN_LOOP_TASK_QUEUE_SIZE-1)];
+
+	if (belle_sip_atomic_load(&task->sequence)!=pos+1) return FALSE; /*empty, or the producer is still writing*/
+	*func=task->func;
+	*data=task->data;
+	ml->tasks_dequeue_pos=pos+1;
+	belle_sip_atomic_store(&task->sequence,pos+BELLE_SIP_MAIN_LOOP_TASK_QUEUE_SIZE);
+	return TRUE;
+}
+
+/*
+ * Appends a task to the spill array, unless the main loop drained it meanwhile and the ring can be used again.
+ * Returns FALSE in that case. The array is grown by doubling and kept between overflows.
+ */
+static int belle_sip_main_loop_spill_task(belle_sip_main_loop_t *ml, belle_sip_callback_t func, void *data, int ring_full){
+	bctbx_mutex_lock(&ml->spill_mutex);
+	if (!ring_full && ml->spilled_count==0){
+		bctbx_mutex_unlock(&ml->spill_mutex);
+		return FALSE;
+	}
+	if (ml->spilled_count==ml->spilled_size){
+		ml->spilled_size=ml->spilled_size ? ml->spilled_size*2 : BELLE_SIP_MAIN_LOOP_TASK_QUEUE_SIZE;
+		ml->spilled_tasks=(belle_sip_main_loop_task_t*)belle_sip_realloc(ml->spilled_tasks,ml->spilled_size*sizeof(belle_sip_main_loop_task_t));
+	}
+	ml->spilled_tasks[ml->spilled_count].func=func;
+	ml->spilled_tasks[ml->spilled_count].data=data;
+	ml->spilled_count++;
+	belle_sip_atomic_store(&ml->spilling,1);
+	bctbx_mutex_unlock(&ml->spill_mutex);
+	return TRUE;
+}
+
+static void belle_sip_main_loop_run_task(belle_sip_main_loop_t *ml, belle_sip_callback_t func, void *data){
+	if (ml->instrumented){
+		uint64_t start=belle_sip_time_us();
+		func(data);
+		if (!ml->task_stats) ml->task_stats=belle_sip_main_loop_get_source_stats(ml,"defered task");
+		belle_sip_main_loop_histogram_add(&ml->task_stats->callback_duration,belle_sip_time_us()-start);
+	}else{
+		func(data);
+	}
+}
+
+/*
+ * Runs the spilled tasks, once every task of the ring was run: they were all posted before the first spilled one.
+ * The array is taken out of the mutex while its tasks run, as they may post new ones.
+ */
+static intptr_t belle_sip_main_loop_run_spilled_tasks(belle_sip_main_loop_t *ml){
+	belle_sip_main_loop_task_t *tasks;
+	size_t count,size,i;
+
+	if (!belle_sip_atomic_load(&ml->spilling) || ml->tasks_dequeue_pos!=belle_sip_atomic_load(&ml->tasks_enqueue_pos)) return 0;
+	bctbx_mutex_lock(&ml->spill_mutex);
+	tasks=ml->spilled_tasks;
+	count=ml->spilled_count;
+	size=ml->spilled_size;
+	ml->spilled_tasks=NULL;
+	ml->spilled_count=ml->spilled_size=0;
+	belle_sip_atomic_store(&ml->spilling,0);
+	bctbx_mutex_unlock(&ml->spill_mutex);
+
+	for(i=0;i<count;++i){
+		belle_sip_main_loop_run_task(ml,tasks[i].func,tasks[i].data);
+	}
+
+	bctbx_mutex_lock(&ml->spill_mutex);
+	if (ml->spilled_tasks==NULL){
+		/*keep the array for the next overflow*/
+		ml->spilled_tasks=tasks;
+		ml->spilled_size=size;
+		tasks=NULL;
+	}
+	bctbx_mutex_unlock(&ml->spill_mutex);
+	if (tasks) belle_sip_free(tasks);
+	return (intptr_t)count;
+}
+
+/*
+ * Runs the tasks posted before this call. Tasks posted meanwhile, for example by the tasks themselves, are run at next
+ * iteration.
+ */
+static int belle_sip_main_loop_run_tasks(belle_sip_main_loop_t *ml){
+	intptr_t last=belle_sip_atomic_load(&ml->tasks_enqueue_pos);
+	intptr_t count=0;
+	belle_sip_callback_t func;
+	void *data;
+
+	while(ml->tasks_dequeue_pos<last && belle_sip_main_loop_pop_task(ml,&func,&data)){
+		belle_sip_main_loop_run_task(ml,func,data);
+		count++;
+	}
+	count+=belle_sip_main_loop_run_spilled_tasks(ml);
+	if (count) belle_sip_atomic_fetch_add(&ml->pending_tasks,-count);
+	return (int)count;
+}
+
+void belle_sip_main_loop_do_later(belle_sip_main_loop_t *ml, belle_sip_callback_t func, void *data){
+	/*once a task was spilled, the next ones must follow it until the main loop drains the spill array*/
+	if (!belle_sip_atomic_load(&ml->spilling) || !belle_sip_main_loop_spill_task(ml,func,data,FALSE)){
+		if (!belle_sip_main_loop_push_task(ml,func,data)){
+			belle_sip_main_loop_spill_task(ml,func,data,TRUE);
+		}
+	}
+	/*only the first task posted since the last run of the queue needs to wake the main loop up*/
+	if (belle_sip_atomic_fetch_add(&ml->pending_tasks,1)==0){
+#ifndef _WIN32
+		if (ml->thread_id != bctbx_thread_self())
+			belle_sip_main_loop_wake_up(ml);
+#endif
+	}
 }
 
 
 void belle_sip_source_set_timeout(belle_sip_source_t *s, unsigned int value_ms){
 	if (!s->expired){
 		belle_sip_main_loop_t *ml = s->ml;
-		s->expire_ms=belle_sip_time_ms()+value_ms;
-		if (s->it){
-			/*this timeout is already sorted in the timer_sources map, we need to move it to its new place*/
+		s->expire_ms=(ml ? belle_sip_main_loop_get_time_ms(ml) : belle_sip_time_ms())+value_ms;
+		if (belle_sip_timer_wheel_entry_linked(&s->timer)){
+			/*this timeout is already in the timer wheel, we need to move it to its new place*/
 			bctbx_mutex_lock(&ml->timer_sources_mutex);
-			bctbx_map_erase(ml->timer_sources, s->it);
-			bctbx_iterator_delete(s->it);
-			s->it = bctbx_map_insert_and_delete_with_returned_it(ml->timer_sources,
-				(bctbx_pair_t*)bctbx_pair_ullong_new(s->expire_ms, s));
+			belle_sip_timer_wheel_insert(&ml->timers, &s->timer, s->expire_ms);
 			bctbx_mutex_unlock(&ml->timer_sources_mutex);
 		}
 	}
@@ -460,40 +1034,34 @@ unsigned int belle_sip_source_get_timeout(const belle_sip_source_t *s){
 	return s->timeout;
 }
 
+void belle_sip_source_set_notify_required(belle_sip_source_t *s, int yesno){
+	s->notify_required=yesno ? TRUE : FALSE;
+	if (yesno && s->ml) s->ml->scan_required=TRUE;
+}
+
 void belle_sip_source_cancel(belle_sip_source_t *s){
 	s->cancelled=TRUE;
-	if (s->it) {
+	if (s->ml && s->node.data==s && (s->node.next || s->node.prev || &s->node==s->ml->fd_sources))
+		s->ml->scan_required=TRUE;
+	if (belle_sip_timer_wheel_entry_linked(&s->timer)) {
 		bctbx_mutex_lock(&s->ml->timer_sources_mutex);
-		bctbx_map_erase(s->ml->timer_sources, s->it);
-		bctbx_iterator_delete(s->it);
 		/*put on front*/
-		s->it = bctbx_map_insert_and_delete_with_returned_it(s->ml->timer_sources, (bctbx_pair_t*)bctbx_pair_ullong_new(0, s));
-
+		belle_sip_timer_wheel_insert_expired(&s->ml->timers, &s->timer);
 		bctbx_mutex_unlock(&s->ml->timer_sources_mutex);
 	}
 }
 
-static int match_source_id(const void *s, const void *pid){
-	if ( ((belle_sip_source_t*)s)->id==(unsigned long)(intptr_t)pid){
-		return 0;
-	}
-	return -1;
-}
-
 belle_sip_source_t *belle_sip_main_loop_find_source(belle_sip_main_loop_t *ml, unsigned long id){
-	bctbx_iterator_t *it;
 	belle_sip_source_t *ret=NULL;
-	belle_sip_list_t *elem=belle_sip_list_find_custom(ml->fd_sources,match_source_id,(const void*)(intptr_t)id);
-	if (elem!=NULL) {
-		ret = (belle_sip_source_t*)elem->data;
-	} else if ((it = bctbx_map_find_custom(ml->timer_sources, match_source_id, (const void*)(intptr_t)id))) {
-		ret = (belle_sip_source_t*)bctbx_pair_get_second(bctbx_iterator_get_pair(it));
-		bctbx_iterator_delete(it);
-	} /*else
-		ret = NULL;*/
 
+	bctbx_mutex_lock(&ml->timer_sources_mutex);
+	if (ml->sources_by_id_size>0){
+		for(ret=ml->sources_by_id[id & (ml->sources_by_id_size-1)];ret!=NULL;ret=ret->id_next){
+			if (ret->id==id) break;
+		}
+	}
+	bctbx_mutex_unlock(&ml->timer_sources_mutex);
 	return ret;
-
 }
 
 void belle_sip_main_loop_cancel_source(belle_sip_main_loop_t *ml, unsigned long id){
@@ -501,26 +1069,45 @@ void belle_sip_main_loop_cancel_source(belle_sip_main_loop_t *ml, unsigned long
 	if (s) belle_sip_source_cancel(s);
 }
 
-static void belle_sip_main_loop_iterate(belle_sip_main_loop_t *ml){
-	size_t pfd_size = (ml->nsources + 1) * sizeof(belle_sip_pollfd_t);
-	belle_sip_pollfd_t *pfd=(belle_sip_pollfd_t*)belle_sip_malloc0(pfd_size);
+/*
+ * List of the sources to be notified during an iteration, linked through the sources themselves so that building
+ * it does not allocate. A source is in at most one ready list at a time, and holds a reference while it is there.
+ */
+typedef struct belle_sip_ready_list{
+	belle_sip_source_t *head;
+	belle_sip_source_t *tail;
+}belle_sip_ready_list_t;
+
+static void belle_sip_ready_list_append(belle_sip_ready_list_t *rl, belle_sip_source_t *s){
+	if (s->ready) return;
+	s->ready=TRUE;
+	s->ready_next=NULL;
+	belle_sip_object_ref(s);
+	if (rl->tail) rl->tail->ready_next=s;
+	else rl->head=s;
+	rl->tail=s;
+}
+
+/*
+ * Waits for events on fd sources using poll(), and appends the sources to be notified to the ready list.
+ * Returns -1 in case of error.
+ */
+static int belle_sip_main_loop_poll(belle_sip_main_loop_t *ml, int duration, belle_sip_ready_list_t *ready){
+	size_t needed=(size_t)belle_sip_atomic_load(&ml->nsources) + 1;
+	belle_sip_pollfd_t *pfd;
 	int i=0;
 	belle_sip_source_t *s;
 	belle_sip_list_t *elem,*next;
-	int duration=-1;
 	int ret;
-	uint64_t cur;
-	belle_sip_list_t *to_be_notified=NULL;
-	int can_clean=belle_sip_object_pool_cleanable(ml->pool); /*iterate might not be called by the thread that created the main loop*/
-	belle_sip_object_pool_t *tmp_pool=NULL;
-	bctbx_iterator_t *it,*end;
 
-	if (!can_clean){
-		/*Push a temporary pool for the time of the iterate loop*/
-		tmp_pool=belle_sip_object_pool_push();
+	if (ml->pfd_size < needed){
+		/*grow only, so that the table is not reallocated at every iteration*/
+		ml->pfd_size = needed;
+		ml->pfd = (belle_sip_pollfd_t*)belle_sip_realloc(ml->pfd, ml->pfd_size * sizeof(belle_sip_pollfd_t));
 	}
+	pfd=ml->pfd;
 
-	/*Step 1: prepare the pollfd table and get the next timeout value */
+	/*prepare the pollfd table*/
 	for(elem=ml->fd_sources;elem!=NULL;elem=next) {
 		next=elem->next;
 		s=(belle_sip_source_t*)elem->data;
@@ -536,39 +1123,20 @@ static void belle_sip_main_loop_iterate(belle_sip_main_loop_t *ml){
 	pfd[i].events = POLLIN;
 	++i;
 #endif
-	/*all source with timeout are in ml->timer_sources*/
-	if (bctbx_map_size(ml->timer_sources) >0) {
-		int64_t diff;
-		uint64_t next_wakeup_time;
-		it = bctbx_map_begin(ml->timer_sources);
-		/*use first because in case of canceled timer, key ==0 , key != s->expire_ms */
-		next_wakeup_time = bctbx_pair_ullong_get_first((const bctbx_pair_ullong_t *)bctbx_iterator_get_pair(it));
-		/* compute the amount of time to wait for shortest timeout*/
-		cur=belle_sip_time_ms();
-		diff=next_wakeup_time-cur;
-		if (diff>0)
-			duration=MIN((unsigned int)diff,INT_MAX);
-		else
-			duration=0;
-		bctbx_iterator_delete(it);
-		it = NULL;
-	}
 
 	/* do the poll */
 	ret=belle_sip_poll(pfd,i,duration);
 	if (ret==-1){
-		goto end;
+		return ret;
 	}
 #ifndef _WIN32
 	if (pfd[i - 1].revents == POLLIN){
-		char c;
-		if (read(ml->control_fds[0], &c, 1) == -1)
-			belle_sip_fatal("Cannot read control pipe of main loop thread: %s", strerror(errno));
+		belle_sip_main_loop_ack_wake_up(ml);
 	}
 #endif
 
-	/* Step 2: examine poll results and determine the list of source to be notified */
-	cur=belle_sip_time_ms();
+	/*examine poll results and determine the list of source to be notified */
+	ml->scan_required=FALSE;
 	for(elem=ml->fd_sources;elem!=NULL;elem=elem->next){
 		unsigned revents=0;
 		s=(belle_sip_source_t*)elem->data;
@@ -585,64 +1153,173 @@ static void belle_sip_main_loop_iterate(belle_sip_main_loop_t *ml){
 				belle_sip_error("Source [%p] does not contains any fd !",s);
 			}
 			if (revents!=0){
-				to_be_notified=belle_sip_list_append(to_be_notified,belle_sip_object_ref(s));
+				belle_sip_ready_list_append(ready,s);
 			}
-		}else to_be_notified=belle_sip_list_append(to_be_notified,belle_sip_object_ref(s));
+		}else belle_sip_ready_list_append(ready,s);
 	}
+	return ret;
+}
 
-	/* Step 3: find timeouted sources */
-
-	bctbx_mutex_lock(&ml->timer_sources_mutex); /*iterator chain might be alterated by element insertion*/
-	it = bctbx_map_begin(ml->timer_sources);
-	end = bctbx_map_end(ml->timer_sources);
-	while (!bctbx_iterator_equals(it,end)) {
-		/*use first because in case of canceled timer, key != s->expire_ms*/
-		uint64_t expire = bctbx_pair_ullong_get_first((const bctbx_pair_ullong_t *)bctbx_iterator_get_pair(it));
-		s = (belle_sip_source_t*)bctbx_pair_get_second(bctbx_iterator_get_pair(it));
-		if (expire > cur) {
-			/* no need to continue looping because map is ordered*/
-			break;
-		} else {
-			if (s->revents==0) {
-				s->expired=TRUE;
-				to_be_notified=belle_sip_list_append(to_be_notified,belle_sip_object_ref(s));
-			} /*else already in to_be_notified by Step 2*/
+#ifdef HAVE_EPOLL
+/*
+ * Same as belle_sip_main_loop_poll(), using epoll_wait().
+ * Only ready sources are examined, except when some sources were cancelled or require notification, in which
+ * case the list of fd sources is walked once.
+ */
+static int belle_sip_main_loop_epoll(belle_sip_main_loop_t *ml, int duration, belle_sip_ready_list_t *ready){
+	belle_sip_source_t *s;
+	belle_sip_list_t *elem;
+	int ret,i;
+	int nsources=(int)belle_sip_atomic_load(&ml->nsources);
 
-			s->revents|=BELLE_SIP_EVENT_TIMEOUT;
-			it=bctbx_iterator_get_next(it);
+	if (ml->epoll_events_size < nsources + 1){
+		ml->epoll_events_size = nsources + 1;
+		ml->epoll_events = (struct epoll_event*)belle_sip_realloc(ml->epoll_events, ml->epoll_events_size * sizeof(struct epoll_event));
+	}
+	ret=epoll_wait(ml->epoll_fd,ml->epoll_events,ml->epoll_events_size,duration);
+	if (ret==-1){
+		if (errno!=EINTR)
+			belle_sip_error("epoll_wait() error: %s",strerror(errno));
+		return -1;
+	}
+	for(i=0;i<ret;++i){
+		s=(belle_sip_source_t*)ml->epoll_events[i].data.ptr;
+		if (s==NULL){
+			belle_sip_main_loop_ack_wake_up(ml);
+			continue;
+		}
+		if (s->cancelled) continue; /*will be collected below*/
+		s->revents=belle_sip_epoll_to_event(ml->epoll_events[i].events);
+		if (s->revents!=0){
+			belle_sip_ready_list_append(ready,s);
+		}
+	}
+	if (ml->scan_required){
+		ml->scan_required=FALSE;
+		for(elem=ml->fd_sources;elem!=NULL;elem=elem->next){
+			s=(belle_sip_source_t*)elem->data;
+			if (s->cancelled){
+				belle_sip_ready_list_append(ready,s);
+			}else if (s->notify_required){ /*for testing purpose to force channel to read*/
+				s->notify_required=0; /*reset*/
+				if (s->revents==0)
+					belle_sip_ready_list_append(ready,s);
+				s->revents|=BELLE_SIP_EVENT_READ;
+			}
 		}
 	}
-	bctbx_iterator_delete(it);
-	bctbx_iterator_delete(end);
+	return ret;
+}
+#endif
+
+static void belle_sip_main_loop_iterate(belle_sip_main_loop_t *ml){
+	belle_sip_source_t *s,*next;
+	int duration=-1;
+	int ret;
+	uint64_t cur;
+	belle_sip_ready_list_t ready={NULL,NULL};
+	int can_clean=belle_sip_object_pool_cleanable(ml->pool); /*iterate might not be called by the thread that created the main loop*/
+	belle_sip_object_pool_t *tmp_pool=NULL;
+	belle_sip_timer_wheel_entry_t *entry;
+	uint64_t next_wakeup_time;
+	int has_work;
+	int fired_timers=0;
+	uint64_t poll_start=0;
+
+	ml->iterations++;
+	ml->woken_up=FALSE;
+	if (!can_clean){
+		/*Push a temporary pool for the time of the iterate loop*/
+		tmp_pool=belle_sip_object_pool_push();
+	}
+
+	/*Step 1: get the next timeout value */
+	/*all source with timeout are in ml->timers*/
+	bctbx_mutex_lock(&ml->timer_sources_mutex);
+	if (belle_sip_timer_wheel_get_next_expiry(&ml->timers, &next_wakeup_time)) {
+		int64_t diff;
+		/* compute the amount of time to wait for shortest timeout*/
+		cur=belle_sip_main_loop_read_clock(ml);
+		diff=next_wakeup_time-cur;
+		if (diff>0)
+			duration=(int)MIN((uint64_t)diff,INT_MAX);
+		else
+			duration=0;
+	}
+	bctbx_mutex_unlock(&ml->timer_sources_mutex);
+	if (belle_sip_atomic_load(&ml->pending_tasks)>0){
+		/*some tasks were posted after the queue was last run*/
+		duration=0;
+	}
+	if (ml->scan_required){
+		/*some sources must be notified without waiting for their fd, for example a channel with messages left in its buffer*/
+		duration=0;
+	}
+
+	/* Step 2: wait for events and determine the list of fd sources to be notified */
+	if (ml->instrumented) poll_start=belle_sip_time_us();
+#ifdef HAVE_EPOLL
+	if (ml->backend==BELLE_SIP_MAIN_LOOP_BACKEND_EPOLL)
+		ret=belle_sip_main_loop_epoll(ml,duration,&ready);
+	else
+#endif
+		ret=belle_sip_main_loop_poll(ml,duration,&ready);
+	if (ret==-1){
+		goto end;
+	}
+	if (ml->instrumented) belle_sip_main_loop_histogram_add(&ml->poll_wait,belle_sip_time_us()-poll_start);
+	/*the time is read once per iteration, and given to whoever asks for it until the end of the iteration*/
+	cur=ml->now_ms=belle_sip_main_loop_read_clock(ml);
+	ml->now_thread_id=belle_sip_thread_self_id();
+	ml->now_valid=TRUE;
+
+	/* Step 3: find timeouted sources */
+
+	bctbx_mutex_lock(&ml->timer_sources_mutex); /*the wheel might be altered by insertions from other threads*/
+	belle_sip_timer_wheel_advance(&ml->timers, cur);
+	/*timers beyond the budget stay in the expired list, and are notified at next iteration without waiting*/
+	for (entry = belle_sip_timer_wheel_get_expired(&ml->timers); entry != NULL && (ml->timer_budget == 0 || fired_timers < ml->timer_budget); entry = entry->next) {
+		fired_timers++;
+		s = (belle_sip_source_t*)entry->data;
+		if (s->revents==0) {
+			s->expired=TRUE;
+			belle_sip_ready_list_append(&ready,s);
+		} /*else already in the ready list by Step 2*/
+
+		s->revents|=BELLE_SIP_EVENT_TIMEOUT;
+	}
 	bctbx_mutex_unlock(&ml->timer_sources_mutex);
 
+	has_work=(ready.head!=NULL);
+
 	/* Step 4: notify those to be notified */
-	for(elem=to_be_notified;elem!=NULL;){
-		s=(belle_sip_source_t*)elem->data;
-		next=elem->next;
+	for(s=ready.head;s!=NULL;s=next){
+		next=s->ready_next;
+		/*unlink before notifying, the callback may let the source be added to a ready list again*/
+		s->ready_next=NULL;
+		s->ready=FALSE;
 		if (!s->cancelled){
 
 			if (s->timeout > 0 && belle_sip_log_level_enabled(BELLE_SIP_LOG_DEBUG)) {
 				/*to avoid too many traces*/
 				char *objdesc=belle_sip_object_to_string((belle_sip_object_t*)s);
-				belle_sip_debug("source %s notified revents=%u, timeout=%i",objdesc,revents,s->timeout);
+				belle_sip_debug("source %s notified revents=%u, timeout=%i",objdesc,s->revents,s->timeout);
 				belle_sip_free(objdesc);
 			}
 
-			ret=s->notify(s->data,s->revents);
+			if (ml->instrumented) ret=belle_sip_main_loop_notify_instrumented(ml,s);
+			else ret=s->notify(s->data,s->revents);
 			if (ret==BELLE_SIP_STOP || s->oneshot){
 				/*this source needs to be removed*/
 				belle_sip_main_loop_remove_source(ml,s);
 			} else  {
-				if (s->expired && s->it) {
+				if (s->expired && belle_sip_timer_wheel_entry_linked(&s->timer)) {
 					bctbx_mutex_lock(&ml->timer_sources_mutex);
-					bctbx_map_erase(ml->timer_sources, s->it);
-					bctbx_iterator_delete(s->it);
+					belle_sip_timer_wheel_remove(&ml->timers, &s->timer);
 					bctbx_mutex_unlock(&ml->timer_sources_mutex);
-					s->it=NULL;
 					belle_sip_object_unref(s);
 				}
-				if (!s->it && s->timeout >= 0){
+				if (!belle_sip_timer_wheel_entry_linked(&s->timer) && s->timeout >= 0){
 					/*timeout needs to be started again */
 					if (ret==BELLE_SIP_CONTINUE_WITHOUT_CATCHUP){
 						s->expire_ms=cur+s->timeout;
@@ -651,8 +1328,7 @@ static void belle_sip_main_loop_iterate(belle_sip_main_loop_t *ml){
 					}
 					s->expired=FALSE;
 					bctbx_mutex_lock(&ml->timer_sources_mutex);
-					s->it = bctbx_map_insert_and_delete_with_returned_it(ml->timer_sources,
-							(bctbx_pair_t*)bctbx_pair_ullong_new(s->expire_ms, s));
+					belle_sip_timer_wheel_insert(&ml->timers, &s->timer, s->expire_ms);
 					bctbx_mutex_unlock(&ml->timer_sources_mutex);
 					belle_sip_object_ref(s);
 				}
@@ -662,18 +1338,25 @@ static void belle_sip_main_loop_iterate(belle_sip_main_loop_t *ml){
 		}
 		s->revents=0;
 		belle_sip_object_unref(s);
-		belle_sip_free(elem); /*free just the element*/
-		elem=next;
 	}
 
+	/* Step 5: run tasks posted with belle_sip_main_loop_do_later() */
+	if (belle_sip_main_loop_run_tasks(ml)>0) has_work=TRUE;
+
+	if (!has_work){
+		ml->idle_iterations++;
+		if (ml->woken_up) ml->spurious_wakeups++;
+	}
+
+	ml->now_valid=FALSE;
 	if (can_clean) belle_sip_object_pool_clean(ml->pool);
 	else if (tmp_pool) {
 		belle_sip_object_unref(tmp_pool);
 		tmp_pool=NULL;
 	}
+	return;
 end:
-
-	belle_sip_free(pfd);
+	if (tmp_pool) belle_sip_object_unref(tmp_pool);
 }
 
 void belle_sip_main_loop_run(belle_sip_main_loop_t *ml){
@@ -692,6 +1375,25 @@ void belle_sip_main_loop_run(belle_sip_main_loop_t *ml){
 	ml->in_loop = FALSE;
 }
 
+void belle_sip_main_loop_get_stats(const belle_sip_main_loop_t *ml, belle_sip_main_loop_stats_t *stats){
+	belle_sip_main_loop_t *obj=(belle_sip_main_loop_t*)ml;
+	stats->iterations=obj->iterations;
+	stats->idle_iterations=obj->idle_iterations;
+	stats->wakeup_requests=(uint64_t)belle_sip_atomic_load(&obj->wakeup_requests);
+	stats->wakeups=(uint64_t)belle_sip_atomic_load(&obj->wakeups);
+	stats->wakeups_received=obj->wakeups_received;
+	stats->spurious_wakeups=obj->spurious_wakeups;
+}
+
+void belle_sip_main_loop_reset_stats(belle_sip_main_loop_t *ml){
+	ml->iterations=0;
+	ml->idle_iterations=0;
+	belle_sip_atomic_store(&ml->wakeup_requests,0);
+	belle_sip_atomic_store(&ml->wakeups,0);
+	ml->wakeups_received=0;
+	ml->spurious_wakeups=0;
+}
+
 int belle_sip_main_loop_quit(belle_sip_main_loop_t *ml){
 	ml->run=0;
 	return BELLE_SIP_STOP;
@@ -717,8 +1419,39 @@ void belle_sip_main_loop_sleep(belle_sip_main_loop_t *ml, int milliseconds){
 
 #ifndef _WIN32
 void belle_sip_main_loop_wake_up(belle_sip_main_loop_t *ml) {
+	belle_sip_atomic_fetch_add(&ml->wakeup_requests,1);
+	/*a single write is needed until the main loop reads it, whatever the number of requests*/
+	if (belle_sip_atomic_exchange(&ml->wakeup_pending,TRUE)) return;
+	belle_sip_atomic_fetch_add(&ml->wakeups,1);
+#ifdef HAVE_EVENTFD
+	{
+		uint64_t one = 1;
+		if (write(ml->control_fds[1], &one, sizeof(one)) == -1) {
+			belle_sip_fatal("Cannot write to control eventfd of main loop thread: %s", strerror(errno));
+		}
+	}
+#else
 	if (write(ml->control_fds[1], "wake up!", 1) == -1) {
 		belle_sip_fatal("Cannot write to control pipe of main loop thread: %s", strerror(errno));
 	}
+#endif
+}
+
+static void belle_sip_main_loop_ack_wake_up(belle_sip_main_loop_t *ml) {
+#ifdef HAVE_EVENTFD
+	uint64_t value;
+	if (read(ml->control_fds[0], &value, sizeof(value)) == -1 && errno != EAGAIN)
+		belle_sip_fatal("Cannot read control eventfd of main loop thread: %s", strerror(errno));
+#else
+	char buf[32];
+	ssize_t ret;
+	while ((ret = read(ml->control_fds[0], buf, sizeof(buf))) > 0);
+	if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+		belle_sip_fatal("Cannot read control pipe of main loop thread: %s", strerror(errno));
+#endif
+	/*cleared after reading: requests made meanwhile were published before and are handled by this iteration*/
+	belle_sip_atomic_store(&ml->wakeup_pending,FALSE);
+	ml->wakeups_received++;
+	ml->woken_up=TRUE;
 }
 #endif
@@ -23,16 +23,162 @@ static void _belle_sip_object_pool_remove_from_stack(belle_sip_object_pool_t *po
 
 static int _belle_sip_object_marshal_check_enabled = FALSE;
 
-static int has_type(belle_sip_object_t *obj, belle_sip_type_id_t id){
-	belle_sip_object_vptr_t *vptr=obj->vptr;
+/*
+ * Type information flattened from the vptr chain, so that type checks and interface lookups neither walk the chain
+ * nor call get_parent(). Ancestor ids and interface ids are looked up in bitsets and tables indexed by id when the
+ * ids are close enough to each other, which is the case unless types of several namespaces are mixed, and in a
+ * contiguous array otherwise.
+ * Type information is computed once per type and lives as long as the vptr, i.e. forever.
+ */
+typedef struct belle_sip_type_info{
+	int depth; /*number of types in the chain, including the type itself*/
+	belle_sip_type_id_t *ancestors; /*ids of the type and of its parents, most derived first*/
+	belle_sip_type_id_t min_id;
+	unsigned int id_span; /*number of bits of ancestor_bits, 0 when it is not used*/
+	uint64_t *ancestor_bits;
+	int interface_count;
+	belle_sip_interface_desc_t **interfaces; /*interfaces of the type and of its parents, most derived first*/
+	belle_sip_interface_id_t min_interface_id;
+	unsigned int interface_span; /*number of entries of interfaces_by_id, 0 when it is not used*/
+	belle_sip_interface_desc_t **interfaces_by_id;
+	belle_sip_object_vptr_t *vptr;
+	volatile intptr_t allocations;
+	volatile intptr_t live;
+	struct belle_sip_type_info *next; /*in the list of all types*/
+}belle_sip_type_info_t;
 
-	while(vptr!=NULL){
-		if (vptr->id==id) return TRUE;
-		vptr=vptr->get_parent();
+static volatile intptr_t all_type_infos=0;
+
+#define BELLE_SIP_TYPE_INFO_MAX_ID_SPAN 256
+#define BELLE_SIP_TYPE_INFO_MAX_INTERFACE_SPAN 64
+
+static belle_sip_type_info_t *belle_sip_type_info_new(belle_sip_object_vptr_t *vptr){
+	belle_sip_type_info_t *info=belle_sip_new0(belle_sip_type_info_t);
+	belle_sip_object_vptr_t *it;
+	belle_sip_type_id_t max_id=0;
+	belle_sip_interface_id_t max_interface_id=0;
+	int i;
+
+	info->vptr=vptr;
+
+	for(it=vptr;it!=NULL;it=it->get_parent()){
+		belle_sip_interface_desc_t **ifaces;
+		info->depth++;
+		for(ifaces=it->interfaces;ifaces!=NULL && *ifaces!=NULL;++ifaces) info->interface_count++;
+	}
+	info->ancestors=belle_sip_malloc(sizeof(belle_sip_type_id_t)*info->depth);
+	info->interfaces=belle_sip_malloc(sizeof(belle_sip_interface_desc_t*)*(info->interface_count+1));
+	info->interface_count=0;
+	info->min_id=(belle_sip_type_id_t)-1;
+	info->min_interface_id=(belle_sip_interface_id_t)-1;
+	for(it=vptr,i=0;it!=NULL;it=it->get_parent(),++i){
+		belle_sip_interface_desc_t **ifaces;
+		info->ancestors[i]=it->id;
+		if (it->id<info->min_id) info->min_id=it->id;
+		if (it->id>max_id) max_id=it->id;
+		for(ifaces=it->interfaces;ifaces!=NULL && *ifaces!=NULL;++ifaces){
+			info->interfaces[info->interface_count++]=*ifaces;
+			if ((*ifaces)->id<info->min_interface_id) info->min_interface_id=(*ifaces)->id;
+			if ((*ifaces)->id>max_interface_id) max_interface_id=(*ifaces)->id;
+		}
+	}
+	info->interfaces[info->interface_count]=NULL;
+
+	if (max_id-info->min_id<BELLE_SIP_TYPE_INFO_MAX_ID_SPAN){
+		info->id_span=max_id-info->min_id+1;
+		info->ancestor_bits=belle_sip_malloc0(sizeof(uint64_t)*((info->id_span+63)/64));
+		for(i=0;i<info->depth;++i){
+			unsigned int bit=info->ancestors[i]-info->min_id;
+			info->ancestor_bits[bit/64]|=((uint64_t)1)<<(bit%64);
+		}
+	}
+	if (info->interface_count>0 && max_interface_id-info->min_interface_id<BELLE_SIP_TYPE_INFO_MAX_INTERFACE_SPAN){
+		info->interface_span=max_interface_id-info->min_interface_id+1;
+		info->interfaces_by_id=belle_sip_malloc0(sizeof(belle_sip_interface_desc_t*)*info->interface_span);
+		/*the most derived declaration of an interface wins, as when walking the chain*/
+		for(i=info->interface_count-1;i>=0;--i){
+			info->interfaces_by_id[info->interfaces[i]->id-info->min_interface_id]=info->interfaces[i];
+		}
+	}
+	return info;
+}
+
+static void belle_sip_type_info_destroy(belle_sip_type_info_t *info){
+	belle_sip_free(info->ancestors);
+	belle_sip_free(info->ancestor_bits);
+	belle_sip_free(info->interfaces);
+	belle_sip_free(info->interfaces_by_id);
+	belle_sip_free(info);
+}
+
+static belle_sip_type_info_t *belle_sip_object_get_type_info(belle_sip_object_vptr_t *vptr){
+	belle_sip_type_info_t *info=(belle_sip_type_info_t*)belle_sip_atomic_load((volatile intptr_t*)&vptr->type_info);
+	if (info==NULL){
+		intptr_t expected=0;
+		info=belle_sip_type_info_new(vptr);
+		/*another thread may have computed it meanwhile, in which case its result is kept*/
+		if (!belle_sip_atomic_compare_exchange((volatile intptr_t*)&vptr->type_info,&expected,(intptr_t)info)){
+			belle_sip_type_info_destroy(info);
+			info=(belle_sip_type_info_t*)expected;
+		}else{
+			intptr_t head=belle_sip_atomic_load(&all_type_infos);
+			do{
+				info->next=(belle_sip_type_info_t*)head;
+			}while(!belle_sip_atomic_compare_exchange(&all_type_infos,&head,(intptr_t)info));
+		}
+	}
+	return info;
+}
+
+static void belle_sip_type_info_count_new(belle_sip_object_vptr_t *vptr){
+	belle_sip_type_info_t *info=belle_sip_object_get_type_info(vptr);
+	belle_sip_atomic_fetch_add(&info->allocations,1);
+	belle_sip_atomic_fetch_add(&info->live,1);
+}
+
+void belle_sip_object_foreach_type_stats(belle_sip_object_type_stats_func_t func, void *user_data){
+	belle_sip_type_info_t *info;
+	for(info=(belle_sip_type_info_t*)belle_sip_atomic_load(&all_type_infos);info!=NULL;info=info->next){
+		belle_sip_object_type_stats_t stats;
+		intptr_t allocations=belle_sip_atomic_load(&info->allocations);
+		if (allocations==0) continue; /*type only used in casts*/
+		stats.allocations=(uint64_t)allocations;
+		stats.live=(size_t)belle_sip_atomic_load(&info->live);
+		stats.live_bytes=stats.live*info->vptr->size;
+		func(info->vptr->type_name,&stats,user_data);
+	}
+}
+
+static void append_type_stats(const char *type_name, const belle_sip_object_type_stats_t *stats, void *user_data){
+	char **str=(char**)user_data;
+	if (stats->live==0) return;
+	*str=belle_sip_strcat_printf(*str,"%-48s %10lu %12lu %14llu\n",type_name,(unsigned long)stats->live,
+		(unsigned long)stats->live_bytes,(unsigned long long)stats->allocations);
+}
+
+char *belle_sip_object_type_stats_to_string(void){
+	char *str=belle_sip_strdup_printf("%-48s %10s %12s %14s\n","type","live","live bytes","allocations");
+	belle_sip_object_foreach_type_stats(append_type_stats,&str);
+	return str;
+}
+
+static int belle_sip_type_info_has_type(const belle_sip_type_info_t *info, belle_sip_type_id_t id){
+	int i;
+
+	if (info->id_span>0){
+		unsigned int bit=id-info->min_id;
+		return bit<info->id_span && (info->ancestor_bits[bit/64] & (((uint64_t)1)<<(bit%64)))!=0;
+	}
+	for(i=0;i<info->depth;++i){
+		if (info->ancestors[i]==id) return TRUE;
 	}
 	return FALSE;
 }
 
+static int has_type(belle_sip_object_t *obj, belle_sip_type_id_t id){
+	return belle_sip_type_info_has_type(belle_sip_object_get_type_info(obj->vptr),id);
+}
+
 int _belle_sip_object_is_instance_of(belle_sip_object_t * obj,belle_sip_type_id_t id) {
 	return has_type(obj,id);
 }
@@ -46,7 +192,186 @@ static belle_sip_list_t *all_objects=NULL;
 static int belle_sip_leak_detector_enabled=FALSE;
 static int belle_sip_leak_detector_inhibited=FALSE;
 
+/*
+ * Sampling leak detector. Samples are kept in an open addressing hash table indexed by object address, with linear
+ * probing and backward shift deletion, protected by a mutex since objects are created and destroyed by any thread.
+ */
+typedef struct belle_sip_leak_sample{
+	belle_sip_object_t *obj;
+	belle_sip_object_vptr_t *vptr;
+	uint64_t creation_ms;
+	char *name; /*copy of the name of the object, which may be changed or freed by another thread*/
+}belle_sip_leak_sample_t;
+
+#define BELLE_SIP_LEAK_SAMPLES_INITIAL_SIZE 256
+
+static volatile intptr_t leak_sampling_period=0;
+static volatile intptr_t leak_sampling_counter=0;
+static bctbx_mutex_t leak_samples_mutex;
+static belle_sip_once_t leak_samples_once=BELLE_SIP_ONCE_INIT;
+static belle_sip_leak_sample_t *leak_samples=NULL;
+static size_t leak_samples_size=0; /*always a power of two*/
+static size_t leak_samples_count=0;
+
+static size_t leak_samples_hash(const belle_sip_object_t *obj, size_t size){
+	return (size_t)((((uintptr_t)obj)>>4)*2654435761u) & (size-1);
+}
+
+static belle_sip_leak_sample_t *leak_samples_slot(belle_sip_leak_sample_t *table, size_t size, const belle_sip_object_t *obj){
+	size_t i;
+	for(i=leak_samples_hash(obj,size);table[i].obj!=NULL && table[i].obj!=obj;i=(i+1) & (size-1));
+	return &table[i];
+}
+
+static void init_leak_samples_mutex(void){
+	bctbx_mutex_init(&leak_samples_mutex,NULL);
+}
+
+static void leak_samples_grow(void){
+	size_t new_size=leak_samples_size ? leak_samples_size*2 : BELLE_SIP_LEAK_SAMPLES_INITIAL_SIZE;
+	belle_sip_leak_sample_t *table=(belle_sip_leak_sample_t*)belle_sip_malloc0(new_size*sizeof(belle_sip_leak_sample_t));
+	size_t i;
+
+	for(i=0;i<leak_samples_size;++i){
+		if (leak_samples[i].obj) *leak_samples_slot(table,new_size,leak_samples[i].obj)=leak_samples[i];
+	}
+	if (leak_samples) belle_sip_free(leak_samples);
+	leak_samples=table;
+	leak_samples_size=new_size;
+}
+
+static void leak_samples_add(belle_sip_object_t *obj){
+	belle_sip_leak_sample_t *sample;
+
+	bctbx_mutex_lock(&leak_samples_mutex);
+	/*keep the table at most half full*/
+	if ((leak_samples_count+1)*2>leak_samples_size) leak_samples_grow();
+	sample=leak_samples_slot(leak_samples,leak_samples_size,obj);
+	if (sample->obj==NULL) leak_samples_count++;
+	sample->obj=obj;
+	sample->vptr=obj->vptr;
+	sample->creation_ms=belle_sip_time_ms();
+	sample->name=obj->name ? belle_sip_strdup(obj->name) : NULL;
+	obj->sampled=TRUE;
+	bctbx_mutex_unlock(&leak_samples_mutex);
+}
+
+static void leak_samples_remove(belle_sip_object_t *obj){
+	size_t i,j;
+
+	bctbx_mutex_lock(&leak_samples_mutex);
+	obj->sampled=FALSE;
+	if (leak_samples_size==0 || leak_samples_slot(leak_samples,leak_samples_size,obj)->obj==NULL){
+		/*samples were forgotten since the object was created*/
+		bctbx_mutex_unlock(&leak_samples_mutex);
+		return;
+	}
+	i=(size_t)(leak_samples_slot(leak_samples,leak_samples_size,obj)-leak_samples);
+	if (leak_samples[i].name) belle_sip_free(leak_samples[i].name);
+	leak_samples[i].obj=NULL;
+	leak_samples[i].name=NULL;
+	leak_samples_count--;
+	/*move back the following entries that would no longer be found*/
+	for(j=(i+1) & (leak_samples_size-1);leak_samples[j].obj!=NULL;j=(j+1) & (leak_samples_size-1)){
+		size_t home=leak_samples_hash(leak_samples[j].obj,leak_samples_size);
+		if (((j-home) & (leak_samples_size-1)) >= ((j-i) & (leak_samples_size-1))){
+			leak_samples[i]=leak_samples[j];
+			leak_samples[j].obj=NULL;
+			leak_samples[j].name=NULL;
+			i=j;
+		}
+	}
+	bctbx_mutex_unlock(&leak_samples_mutex);
+}
+
+static void leak_samples_set_name(belle_sip_object_t *obj, const char *name){
+	belle_sip_leak_sample_t *sample;
+
+	bctbx_mutex_lock(&leak_samples_mutex);
+	if (leak_samples_size>0 && (sample=leak_samples_slot(leak_samples,leak_samples_size,obj))->obj!=NULL){
+		if (sample->name) belle_sip_free(sample->name);
+		sample->name=name ? belle_sip_strdup(name) : NULL;
+	}
+	bctbx_mutex_unlock(&leak_samples_mutex);
+}
+
+void belle_sip_object_enable_leak_sampling(unsigned int period){
+	belle_sip_once(&leak_samples_once,init_leak_samples_mutex);
+	belle_sip_atomic_store(&leak_sampling_period,(intptr_t)period);
+	if (period==0){
+		size_t i;
+		bctbx_mutex_lock(&leak_samples_mutex);
+		for(i=0;i<leak_samples_size;++i){
+			if (leak_samples[i].name) belle_sip_free(leak_samples[i].name);
+		}
+		if (leak_samples) belle_sip_free(leak_samples);
+		leak_samples=NULL;
+		leak_samples_size=leak_samples_count=0;
+		bctbx_mutex_unlock(&leak_samples_mutex);
+	}
+}
+
+unsigned int belle_sip_object_get_leak_sampling_period(void){
+	return (unsigned int)belle_sip_atomic_load(&leak_sampling_period);
+}
+
+void belle_sip_object_foreach_leak_samples(uint64_t min_age_ms, belle_sip_object_leak_samples_func_t func, void *user_data){
+	typedef struct{
+		belle_sip_object_vptr_t *vptr;
+		belle_sip_object_leak_samples_t samples;
+	}type_samples_t;
+	type_samples_t *types=NULL;
+	size_t type_count=0;
+	uint64_t now=belle_sip_time_ms();
+	size_t i,j;
+
+	belle_sip_once(&leak_samples_once,init_leak_samples_mutex);
+	bctbx_mutex_lock(&leak_samples_mutex);
+	for(i=0;i<leak_samples_size;++i){
+		belle_sip_leak_sample_t *sample=&leak_samples[i];
+		uint64_t age;
+		if (sample->obj==NULL) continue;
+		age=now>sample->creation_ms ? now-sample->creation_ms : 0;
+		if (age<min_age_ms) continue;
+		/*there are few types, a linear search is enough*/
+		for(j=0;j<type_count && types[j].vptr!=sample->vptr;++j);
+		if (j==type_count){
+			types=(type_samples_t*)belle_sip_realloc(types,(type_count+1)*sizeof(type_samples_t));
+			memset(&types[j],0,sizeof(type_samples_t));
+			types[j].vptr=sample->vptr;
+			type_count++;
+		}
+		types[j].samples.count++;
+		if (age>=types[j].samples.oldest_age_ms){
+			types[j].samples.oldest_age_ms=age;
+			types[j].samples.oldest_name=sample->name;
+		}
+	}
+	for(j=0;j<type_count;++j){
+		func(types[j].vptr->type_name,&types[j].samples,user_data);
+	}
+	bctbx_mutex_unlock(&leak_samples_mutex);
+	if (types) belle_sip_free(types);
+}
+
+static void log_leak_samples(const char *type_name, const belle_sip_object_leak_samples_t *samples, void *user_data){
+	unsigned int period=*(unsigned int*)user_data;
+	belle_sip_warning("%u sample(s) of %s alive (about %u objects), oldest [%s] created %llu ms ago",
+		samples->count,type_name,samples->count*period,samples->oldest_name ? samples->oldest_name : "",
+		(unsigned long long)samples->oldest_age_ms);
+}
+
+void belle_sip_object_dump_leak_samples(uint64_t min_age_ms){
+	unsigned int period=belle_sip_object_get_leak_sampling_period();
+	belle_sip_warning("Leak samples older than %llu ms, one object out of %u is sampled:",(unsigned long long)min_age_ms,period);
+	belle_sip_object_foreach_leak_samples(min_age_ms,log_leak_samples,&period);
+}
+
 static void add_new_object(belle_sip_object_t *obj){
+	intptr_t period=leak_sampling_period;
+	if (period>0 && belle_sip_atomic_fetch_add(&leak_sampling_counter,1)%period==0){
+		leak_samples_add(obj);
+	}
 	if (belle_sip_leak_detector_enabled && !belle_sip_leak_detector_inhibited){
 		all_objects=belle_sip_list_prepend(all_objects,obj);
 	}
@@ -92,8 +417,338 @@ void belle_sip_object_dump_active_objects(void){
 	}else belle_sip_warning("No objects leaked.");
 }
 
+/*
+ * Per thread caches of destroyed objects, one per object type, so that objects are reused without going through
+ * malloc() and free(). Cached objects are linked through their first bytes. The caches of a thread are found with
+ * an open addressing hash table indexed by vptr.
+ */
+typedef struct belle_sip_object_cache{
+	belle_sip_object_vptr_t *vptr;
+	void *free_list;
+	belle_sip_object_cache_stats_t stats;
+}belle_sip_object_cache_t;
+
+typedef struct belle_sip_object_caches{
+	belle_sip_object_cache_t *table;
+	size_t size; /*always a power of two*/
+	size_t count;
+}belle_sip_object_caches_t;
+
+#define BELLE_SIP_OBJECT_CACHES_INITIAL_SIZE 64
+
+static unsigned int belle_sip_object_cache_size=0;
+static belle_sip_thread_key_t caches_key;
+static belle_sip_once_t caches_key_once=BELLE_SIP_ONCE_INIT;
+static int caches_key_created=0;
+
+static void object_caches_release(belle_sip_object_caches_t *caches){
+	size_t i;
+	for(i=0;i<caches->size;++i){
+		void *obj,*next;
+		for(obj=caches->table[i].free_list;obj!=NULL;obj=next){
+			next=*(void**)obj;
+			belle_sip_free(obj);
+		}
+	}
+	if (caches->table) belle_sip_free(caches->table);
+	caches->table=NULL;
+	caches->size=caches->count=0;
+}
+
+static void cleanup_object_caches(void *data){
+	belle_sip_object_caches_t *caches=(belle_sip_object_caches_t*)data;
+	object_caches_release(caches);
+	belle_sip_free(caches);
+}
+
+static void create_caches_key(void){
+	if (belle_sip_thread_key_create(&caches_key, cleanup_object_caches)==0) caches_key_created=1;
+}
+
+static belle_sip_object_caches_t *get_object_caches(int create){
+	belle_sip_object_caches_t *caches;
+
+	belle_sip_once(&caches_key_once,create_caches_key);
+	if (!caches_key_created) return NULL;
+	caches=(belle_sip_object_caches_t*)belle_sip_thread_getspecific(caches_key);
+	if (caches==NULL && create){
+		caches=belle_sip_new0(belle_sip_object_caches_t);
+		belle_sip_thread_setspecific(caches_key,caches);
+	}
+	return caches;
+}
+
+static size_t object_caches_hash(const belle_sip_object_vptr_t *vptr, size_t size){
+	return (size_t)((((uintptr_t)vptr)>>4)*2654435761u) & (size-1);
+}
+
+static belle_sip_object_cache_t *object_caches_slot(belle_sip_object_cache_t *table, size_t size, const belle_sip_object_vptr_t *vptr){
+	size_t i;
+	for(i=object_caches_hash(vptr,size);table[i].vptr!=NULL && table[i].vptr!=vptr;i=(i+1) & (size-1));
+	return &table[i];
+}
+
+static void object_caches_grow(belle_sip_object_caches_t *caches){
+	size_t new_size=caches->size ? caches->size*2 : BELLE_SIP_OBJECT_CACHES_INITIAL_SIZE;
+	belle_sip_object_cache_t *table=(belle_sip_object_cache_t*)belle_sip_malloc0(new_size*sizeof(belle_sip_object_cache_t));
+	size_t i;
+
+	for(i=0;i<caches->size;++i){
+		if (caches->table[i].vptr)
+			*object_caches_slot(table,new_size,caches->table[i].vptr)=caches->table[i];
+	}
+	if (caches->table) belle_sip_free(caches->table);
+	caches->table=table;
+	caches->size=new_size;
+}
+
+static belle_sip_object_cache_t *get_object_cache(belle_sip_object_vptr_t *vptr){
+	belle_sip_object_caches_t *caches=get_object_caches(TRUE);
+	belle_sip_object_cache_t *cache;
+
+	if (caches==NULL) return NULL;
+	/*keep the table at most 3/4 full*/
+	if ((caches->count+1)*4>caches->size*3) object_caches_grow(caches);
+	cache=object_caches_slot(caches->table,caches->size,vptr);
+	if (cache->vptr==NULL){
+		cache->vptr=vptr;
+		caches->count++;
+	}
+	return cache;
+}
+
+/*
+ * Arenas. The first block is allocated with the arena itself, further blocks are linked through their first bytes.
+ * The arena counts the objects allocated from it plus one for its creator, objects can be released from any thread.
+ */
+struct belle_sip_object_arena{
+	volatile intptr_t refs;
+	char *pos;
+	char *end;
+	void *blocks;
+	size_t size;
+};
+
+#define BELLE_SIP_OBJECT_ARENA_ALIGNMENT 16
+#define BELLE_SIP_OBJECT_ARENA_ALIGN(size) (((size)+BELLE_SIP_OBJECT_ARENA_ALIGNMENT-1) & ~((size_t)BELLE_SIP_OBJECT_ARENA_ALIGNMENT-1))
+#define BELLE_SIP_OBJECT_ARENA_HEADER_SIZE BELLE_SIP_OBJECT_ARENA_ALIGN(sizeof(belle_sip_object_arena_t))
+
+static volatile intptr_t current_arenas=0; /*number of threads having a current arena*/
+static belle_sip_thread_key_t arena_key;
+static belle_sip_once_t arena_key_once=BELLE_SIP_ONCE_INIT;
+static int arena_key_created=0;
+
+static void create_arena_key(void){
+	if (belle_sip_thread_key_create(&arena_key, NULL)==0) arena_key_created=1;
+}
+
+belle_sip_object_arena_t *belle_sip_object_arena_new(size_t size){
+	belle_sip_object_arena_t *arena;
+
+	size=BELLE_SIP_OBJECT_ARENA_ALIGN(size);
+	arena=(belle_sip_object_arena_t*)belle_sip_malloc(BELLE_SIP_OBJECT_ARENA_HEADER_SIZE+size);
+	arena->refs=1;
+	arena->pos=(char*)arena+BELLE_SIP_OBJECT_ARENA_HEADER_SIZE;
+	arena->end=arena->pos+size;
+	arena->blocks=NULL;
+	arena->size=size;
+	return arena;
+}
+
+static void belle_sip_object_arena_unref(belle_sip_object_arena_t *arena){
+	void *block,*next;
+	if (belle_sip_atomic_fetch_add(&arena->refs,-1)!=1) return;
+	for(block=arena->blocks;block!=NULL;block=next){
+		next=*(void**)block;
+		belle_sip_free(block);
+	}
+	belle_sip_free(arena);
+}
+
+void belle_sip_object_arena_release(belle_sip_object_arena_t *arena){
+	belle_sip_object_arena_unref(arena);
+}
+
+int belle_sip_object_arena_get_object_count(const belle_sip_object_arena_t *arena){
+	return (int)belle_sip_atomic_load((volatile intptr_t*)&arena->refs)-1;
+}
+
+int belle_sip_object_arena_get_block_count(const belle_sip_object_arena_t *arena){
+	const void *block;
+	int count=1;
+	for(block=arena->blocks;block!=NULL;block=*(void* const*)block) count++;
+	return count;
+}
+
+belle_sip_object_arena_t *belle_sip_object_arena_set_current(belle_sip_object_arena_t *arena){
+	belle_sip_object_arena_t *previous;
+
+	belle_sip_once(&arena_key_once,create_arena_key);
+	if (!arena_key_created) return NULL;
+	previous=(belle_sip_object_arena_t*)belle_sip_thread_getspecific(arena_key);
+	belle_sip_thread_setspecific(arena_key,arena);
+	if (previous==NULL && arena!=NULL) belle_sip_atomic_fetch_add(&current_arenas,1);
+	else if (previous!=NULL && arena==NULL) belle_sip_atomic_fetch_add(&current_arenas,-1);
+	return previous;
+}
+
+/*the arena allocates from a new block when the current one is exhausted, so objects are never moved*/
+static belle_sip_object_t *belle_sip_object_arena_alloc(belle_sip_object_arena_t *arena, size_t size){
+	belle_sip_object_t *obj;
+
+	size=BELLE_SIP_OBJECT_ARENA_ALIGN(size);
+	if ((size_t)(arena->end-arena->pos)<size){
+		size_t block_size=MAX(size,arena->size);
+		void *block=belle_sip_malloc(BELLE_SIP_OBJECT_ARENA_ALIGNMENT+block_size);
+		*(void**)block=arena->blocks;
+		arena->blocks=block;
+		arena->pos=(char*)block+BELLE_SIP_OBJECT_ARENA_ALIGNMENT;
+		arena->end=arena->pos+block_size;
+	}
+	obj=(belle_sip_object_t*)arena->pos;
+	arena->pos+=size;
+	memset(obj,0,size);
+	obj->arena=arena;
+	belle_sip_atomic_fetch_add(&arena->refs,1);
+	return obj;
+}
+
+static belle_sip_object_t *belle_sip_object_alloc(belle_sip_object_vptr_t *vptr){
+	if (belle_sip_atomic_load(&current_arenas)>0){
+		belle_sip_object_arena_t *arena=(belle_sip_object_arena_t*)belle_sip_thread_getspecific(arena_key);
+		if (arena) return belle_sip_object_arena_alloc(arena,vptr->size);
+	}
+	if (belle_sip_object_cache_size>0){
+		belle_sip_object_cache_t *cache=get_object_cache(vptr);
+		if (cache){
+			void *obj=cache->free_list;
+			cache->stats.allocations++;
+			if (obj){
+				cache->free_list=*(void**)obj;
+				cache->stats.cached--;
+				cache->stats.cache_hits++;
+				memset(obj,0,vptr->size);
+				return (belle_sip_object_t*)obj;
+			}
+		}
+	}
+	return (belle_sip_object_t *)belle_sip_malloc0(vptr->size);
+}
+
+static void belle_sip_object_free(belle_sip_object_t *obj, belle_sip_object_vptr_t *vptr){
+	if (obj->arena){
+		belle_sip_object_arena_unref(obj->arena);
+		return;
+	}
+	if (belle_sip_object_cache_size>0){
+		belle_sip_object_cache_t *cache=get_object_cache(vptr);
+		if (cache){
+			cache->stats.releases++;
+			if (cache->stats.cached<belle_sip_object_cache_size){
+				*(void**)obj=cache->free_list;
+				cache->free_list=obj;
+				cache->stats.cached++;
+				return;
+			}
+		}
+	}
+	belle_sip_free(obj);
+}
+
+void belle_sip_object_set_cache_size(unsigned int max_objects){
+	belle_sip_object_cache_size=max_objects;
+}
+
+unsigned int belle_sip_object_get_cache_size(void){
+	return belle_sip_object_cache_size;
+}
+
+void belle_sip_object_foreach_cache_stats(belle_sip_object_cache_stats_func_t func, void *user_data){
+	belle_sip_object_caches_t *caches=get_object_caches(FALSE);
+	size_t i;
+
+	if (caches==NULL) return;
+	for(i=0;i<caches->size;++i){
+		if (caches->table[i].vptr)
+			func(caches->table[i].vptr->type_name,&caches->table[i].stats,user_data);
+	}
+}
+
+void belle_sip_object_flush_caches(void){
+	belle_sip_object_caches_t *caches=get_object_caches(FALSE);
+	if (caches) object_caches_release(caches);
+}
+
+/*
+ * Set of the types made shared by belle_sip_object_set_type_shared(), read by every object creation. It is never
+ * modified in place: a new set is published atomically instead. Replaced sets are not freed, as other threads may still
+ * be reading them, which is acceptable since the setting is only changed at initialization time.
+ */
+typedef struct belle_sip_shared_types{
+	int count;
+	belle_sip_type_id_t ids[1];
+}belle_sip_shared_types_t;
+
+static volatile intptr_t shared_types=0; /*NULL when no type is shared*/
+
+int belle_sip_object_set_type_shared(belle_sip_type_id_t id, int yesno){
+	intptr_t current=belle_sip_atomic_load(&shared_types);
+	belle_sip_shared_types_t *set;
+
+	for(;;){
+		const belle_sip_shared_types_t *cur=(const belle_sip_shared_types_t*)current;
+		int count=cur ? cur->count : 0;
+		int i,found=-1;
+
+		for(i=0;i<count;++i){
+			if (cur->ids[i]==id) found=i;
+		}
+		if ((yesno && found!=-1) || (!yesno && found==-1)) return 0;
+		if (!yesno && count==1){
+			set=NULL;
+		}else{
+			set=(belle_sip_shared_types_t*)belle_sip_malloc(sizeof(belle_sip_shared_types_t)+sizeof(belle_sip_type_id_t)*count);
+			set->count=0;
+			for(i=0;i<count;++i){
+				if (i!=found) set->ids[set->count++]=cur->ids[i];
+			}
+			if (yesno) set->ids[set->count++]=id;
+		}
+		if (belle_sip_atomic_compare_exchange(&shared_types,&current,(intptr_t)set)) break;
+		/*another thread changed the set meanwhile, current now holds it*/
+		if (set) belle_sip_free(set);
+	}
+	return 0;
+}
+
+static int belle_sip_object_type_is_shared(belle_sip_object_vptr_t *vptr){
+	const belle_sip_shared_types_t *set=(const belle_sip_shared_types_t*)belle_sip_atomic_load(&shared_types);
+	const belle_sip_type_info_t *info;
+	int i;
+
+	if (set==NULL) return FALSE;
+	info=belle_sip_object_get_type_info(vptr);
+	for(i=0;i<set->count;++i){
+		if (belle_sip_type_info_has_type(info,set->ids[i])) return TRUE;
+	}
+	return FALSE;
+}
+
+void belle_sip_object_set_shared(void *ptr){
+	belle_sip_object_t *obj=BELLE_SIP_OBJECT(ptr);
+	if (obj->ref==0){
+		belle_sip_warning("belle_sip_object_set_shared(): %s(%p) is floating, it should be ref'd before being shared.",obj->vptr->type_name,obj);
+	}
+	obj->shared=TRUE;
+}
+
+int belle_sip_object_is_shared(const void *ptr){
+	return BELLE_SIP_OBJECT(ptr)->shared;
+}
+
 belle_sip_object_t * _belle_sip_object_init(belle_sip_object_t *obj, belle_sip_object_vptr_t *vptr){
 	obj->vptr = vptr;
+	obj->shared = (unsigned char)belle_sip_object_type_is_shared(vptr);
 
 	obj->ref = vptr->initially_unowned ? 0 : 1;
 	if (obj->ref == 0) {
@@ -101,12 +756,13 @@ belle_sip_object_t * _belle_sip_object_init(belle_sip_object_t *obj, belle_sip_o
 		if (pool) belle_sip_object_pool_add(pool,obj);
 	}
 
+	belle_sip_type_info_count_new(vptr);
 	add_new_object(obj);
 	return obj;
 }
 
 belle_sip_object_t * _belle_sip_object_new(size_t objsize, belle_sip_object_vptr_t *vptr){
-	belle_sip_object_t *obj=(belle_sip_object_t *)belle_sip_malloc0(vptr->size);
+	belle_sip_object_t *obj=belle_sip_object_alloc(vptr);
 	return _belle_sip_object_init(obj, vptr);
 }
 
@@ -123,7 +779,8 @@ belle_sip_object_t * belle_sip_object_ref(void *obj){
 
 	if (o->vptr->on_first_ref && (o->ref == 0 || (!o->vptr->initially_unowned && o->ref == 1)))
 		o->vptr->on_first_ref(o);
-	o->ref++;
+	if (o->shared) belle_sip_atomic_int_fetch_add(&o->ref,1);
+	else o->ref++;
 
 	return obj;
 }
@@ -134,8 +791,10 @@ void belle_sip_object_unref(void *ptr) {
 
 int belle_sip_object_unref_2(void *ptr) {
 	belle_sip_object_t *obj=BELLE_SIP_OBJECT(ptr);
+	/*the count of a shared object may be updated by other threads meanwhile*/
+	int ref=obj->shared ? belle_sip_atomic_int_load(&obj->ref) : obj->ref;
 
-	if (obj->ref <= -1) {
+	if (ref <= -1) {
 		belle_sip_error("Object [%p] freed twice or corrupted !",obj);
 		if (obj->vptr && obj->vptr->type_name) belle_sip_error("Object type might be [%s]",obj->vptr->type_name);
 		if (obj->name) belle_sip_error("Object name might be [%s]",obj->name);
@@ -143,7 +802,7 @@ int belle_sip_object_unref_2(void *ptr) {
 		return 1;
 	}
 
-	if (obj->vptr->initially_unowned && obj->ref==0){
+	if (obj->vptr->initially_unowned && ref==0){
 		if (obj->pool)
 			belle_sip_object_pool_remove(obj->pool,obj);
 		obj->ref=-1;
@@ -154,15 +813,14 @@ int belle_sip_object_unref_2(void *ptr) {
 
 
 	if (obj->vptr->on_last_ref){
-		if ((obj->vptr->initially_unowned && obj->ref==1)
-			|| (!obj->vptr->initially_unowned && obj->ref == 2)){
+		if ((obj->vptr->initially_unowned && ref==1)
+			|| (!obj->vptr->initially_unowned && ref == 2)){
 			obj->vptr->on_last_ref(obj);
 		}
 	}
 
-	obj->ref--; /* keep the ref until here to make sure obj is not deleted by obj->vptr->on_last_ref*/
-
-	if (obj->ref == 0){
+	/* keep the ref until here to make sure obj is not deleted by obj->vptr->on_last_ref*/
+	if (obj->shared ? belle_sip_atomic_int_fetch_add(&obj->ref,-1)==1 : --obj->ref == 0){
 		obj->ref = -1;
 		belle_sip_object_delete(obj);
 		return 1;
@@ -256,6 +914,7 @@ void belle_sip_object_uninit(belle_sip_object_t *obj){
 
 	belle_sip_object_loose_weak_refs(obj);
 	belle_sip_object_remove_from_leak_detector(obj);
+	if (obj->sampled) leak_samples_remove(obj);
 	vptr = obj->vptr;
 	while(vptr!=NULL){
 		if (vptr->destroy) vptr->destroy(obj);
@@ -266,7 +925,9 @@ void belle_sip_object_uninit(belle_sip_object_t *obj){
 
 void belle_sip_object_delete(void *ptr){
 	belle_sip_object_t *obj=BELLE_SIP_OBJECT(ptr);
+	belle_sip_object_vptr_t *vptr=obj->vptr;
 
+	belle_sip_atomic_fetch_add(&belle_sip_object_get_type_info(vptr)->live,-1);
 	if (obj->vptr->is_cpp){
 		/*This will call delete which calls the destructor chain*/
 		belle_sip_cpp_object_delete(obj);
@@ -274,7 +935,7 @@ void belle_sip_object_delete(void *ptr){
 	}
 	/*otherwise we're in C, call the destructor chain and free the memory*/
 	belle_sip_object_uninit(obj);
-	belle_sip_free(obj);
+	belle_sip_object_free(obj,vptr);
 }
 
 static belle_sip_object_vptr_t *find_common_floor(belle_sip_object_vptr_t *vptr1, belle_sip_object_vptr_t *vptr2){
@@ -309,14 +970,16 @@ void _belle_sip_object_copy(belle_sip_object_t *newobj, const belle_sip_object_t
 belle_sip_object_t *belle_sip_object_clone(const belle_sip_object_t *obj){
 	belle_sip_object_t *newobj;
 
-	newobj=belle_sip_malloc0(obj->vptr->size);
+	newobj=belle_sip_object_alloc(obj->vptr);
 	newobj->ref=obj->vptr->initially_unowned ? 0 : 1;
 	newobj->vptr=obj->vptr;
+	newobj->shared=(unsigned char)belle_sip_object_type_is_shared(obj->vptr);
 	_belle_sip_object_copy(newobj,obj);
 	if (newobj->ref==0){
 		belle_sip_object_pool_t *pool=belle_sip_object_pool_get_current();
 		if (pool) belle_sip_object_pool_add(pool,newobj);
 	}
+	belle_sip_type_info_count_new(newobj->vptr);
 	add_new_object(newobj);
 	return newobj;
 }
@@ -326,100 +989,171 @@ belle_sip_object_t *belle_sip_object_clone_and_ref(const belle_sip_object_t *obj
 }
 
 
+/*
+ * The data store keeps its entries in an array, in insertion order, and indexes them with an open addressing hash
+ * table of power of two size, kept less than half full. Removals, which are rare, rebuild the index.
+ */
 struct belle_sip_object_data{
 	char* name;
 	void* data;
 	belle_sip_data_destroy destroy_func;
+	unsigned int hash;
 };
 
-static int belle_sip_object_data_find(const void* a, const void* b)
-{
-	struct belle_sip_object_data* da = (struct belle_sip_object_data*)a;
-	return strcmp(da->name, (const char*)b);
+struct belle_sip_object_data_store{
+	struct belle_sip_object_data *entries;
+	int count;
+	int capacity;
+	int *index; /*entry position + 1, 0 for empty slots*/
+	int index_size;
+};
+
+#define BELLE_SIP_OBJECT_DATA_STORE_MIN_CAPACITY 4
+
+static unsigned int belle_sip_object_data_hash(const char *name){
+	/*FNV-1a*/
+	unsigned int hash=2166136261U;
+	for(;*name!='\0';++name){
+		hash^=(unsigned char)*name;
+		hash*=16777619U;
+	}
+	return hash;
 }
 
-static void belle_sip_object_data_destroy(void* data)
-{
-	struct belle_sip_object_data* da = (struct belle_sip_object_data*)data;
-	if (da->destroy_func) da->destroy_func(da->data);
-	belle_sip_free(da->name);
-	belle_sip_free(da);
+static void belle_sip_object_data_store_reindex(struct belle_sip_object_data_store *store){
+	int mask=store->index_size-1;
+	int i;
+	memset(store->index,0,sizeof(int)*store->index_size);
+	for(i=0;i<store->count;++i){
+		int slot=(int)(store->entries[i].hash & (unsigned int)mask);
+		while(store->index[slot]!=0) slot=(slot+1) & mask;
+		store->index[slot]=i+1;
+	}
 }
 
-int belle_sip_object_data_set( belle_sip_object_t *obj, const char* name, void* data, belle_sip_data_destroy destroy_func )
-{
-	int ret = 0;
-	belle_sip_list_t*  list_entry = belle_sip_list_find_custom(obj->data_store, belle_sip_object_data_find, name);
-	struct belle_sip_object_data* entry = (list_entry)? list_entry->data : NULL;
+/*returns the position of the entry, or -1*/
+static int belle_sip_object_data_store_find(const struct belle_sip_object_data_store *store, const char *name){
+	unsigned int hash;
+	int mask;
+	int slot;
+	if (store==NULL) return -1;
+	hash=belle_sip_object_data_hash(name);
+	mask=store->index_size-1;
+	for(slot=(int)(hash & (unsigned int)mask);store->index[slot]!=0;slot=(slot+1) & mask){
+		const struct belle_sip_object_data *entry=&store->entries[store->index[slot]-1];
+		if (entry->hash==hash && strcmp(entry->name,name)==0) return store->index[slot]-1;
+	}
+	return -1;
+}
+
+static struct belle_sip_object_data *belle_sip_object_data_store_append(belle_sip_object_t *obj, const char *name){
+	struct belle_sip_object_data_store *store=obj->data_store;
+	struct belle_sip_object_data *entry;
 
-	if( entry == NULL){
-		entry = belle_sip_malloc0(sizeof( struct belle_sip_object_data));
-		obj->data_store = belle_sip_list_append(obj->data_store, entry);
+	if (store==NULL){
+		store=obj->data_store=belle_sip_new0(struct belle_sip_object_data_store);
 	}
-	else {
-		// clean previous data
-		if( entry->destroy_func ) entry->destroy_func(entry->data);
-		belle_sip_free(entry->name);
-		ret = 1;
+	if (store->count==store->capacity){
+		store->capacity=store->capacity ? store->capacity*2 : BELLE_SIP_OBJECT_DATA_STORE_MIN_CAPACITY;
+		store->entries=belle_sip_realloc(store->entries,sizeof(struct belle_sip_object_data)*store->capacity);
+		store->index_size=store->capacity*2;
+		store->index=belle_sip_realloc(store->index,sizeof(int)*store->index_size);
+		belle_sip_object_data_store_reindex(store);
 	}
+	entry=&store->entries[store->count++];
+	entry->name=belle_sip_strdup(name);
+	entry->hash=belle_sip_object_data_hash(name);
+	{
+		int mask=store->index_size-1;
+		int slot=(int)(entry->hash & (unsigned int)mask);
+		while(store->index[slot]!=0) slot=(slot+1) & mask;
+		store->index[slot]=store->count;
+	}
+	return entry;
+}
 
-	if( entry ){
-		entry->data = data;
-		entry->name = belle_sip_strdup(name);
-		entry->destroy_func = destroy_func;
+/*takes the entry out of the store, the caller is responsible for its name and data*/
+static struct belle_sip_object_data belle_sip_object_data_store_take(belle_sip_object_t *obj, int pos){
+	struct belle_sip_object_data_store *store=obj->data_store;
+	struct belle_sip_object_data entry=store->entries[pos];
+
+	store->count--;
+	memmove(&store->entries[pos],&store->entries[pos+1],sizeof(struct belle_sip_object_data)*(store->count-pos));
+	belle_sip_object_data_store_reindex(store);
+	return entry;
+}
+
+int belle_sip_object_data_set( belle_sip_object_t *obj, const char* name, void* data, belle_sip_data_destroy destroy_func )
+{
+	int pos = belle_sip_object_data_store_find(obj->data_store, name);
+	struct belle_sip_object_data* entry;
+	void *old_data = NULL;
+	belle_sip_data_destroy old_destroy_func = NULL;
+
+	if( pos == -1 ){
+		entry = belle_sip_object_data_store_append(obj, name);
 	} else {
-		ret = -1;
+		entry = &obj->data_store->entries[pos];
+		old_data = entry->data;
+		old_destroy_func = entry->destroy_func;
 	}
-	return ret;
+	entry->data = data;
+	entry->destroy_func = destroy_func;
+	// clean previous data, once the store is consistent since the destroy function may use it
+	if( old_destroy_func ) old_destroy_func(old_data);
+	return pos == -1 ? 0 : 1;
 }
 
 void* belle_sip_object_data_get( belle_sip_object_t *obj, const char* name )
 {
-	belle_sip_list_t  *list_entry = belle_sip_list_find_custom(obj->data_store, belle_sip_object_data_find, name);
-	struct belle_sip_object_data* entry = (list_entry)? list_entry->data : NULL;
-
-	return entry? entry->data : NULL;
+	int pos = belle_sip_object_data_store_find(obj->data_store, name);
+	return pos != -1 ? obj->data_store->entries[pos].data : NULL;
 }
 
 int belle_sip_object_data_remove( belle_sip_object_t *obj, const char* name)
 {
-	belle_sip_list_t  *list_entry = belle_sip_list_find_custom(obj->data_store, belle_sip_object_data_find, name);
-	struct belle_sip_object_data* entry = (list_entry)? list_entry->data : NULL;
-	if( entry ){
-		belle_sip_free(entry->name);
-		if( entry->destroy_func ) entry->destroy_func(entry->data);
-		belle_sip_free(entry);
-	}
-	if( list_entry ) obj->data_store = belle_sip_list_remove_link(obj->data_store, list_entry);
-	return !(list_entry!= NULL);
+	int pos = belle_sip_object_data_store_find(obj->data_store, name);
+	struct belle_sip_object_data entry;
+
+	if( pos == -1 ) return 1;
+	entry = belle_sip_object_data_store_take(obj, pos);
+	belle_sip_free(entry.name);
+	if( entry.destroy_func ) entry.destroy_func(entry.data);
+	return 0;
 }
 
 int belle_sip_object_data_exists( const belle_sip_object_t *obj, const char* name )
 {
-	return (belle_sip_list_find_custom(obj->data_store, belle_sip_object_data_find, name) != NULL);
+	return belle_sip_object_data_store_find(obj->data_store, name) != -1;
 }
 
 
 void* belle_sip_object_data_grab( belle_sip_object_t* obj, const char* name)
 {
-	belle_sip_list_t  *list_entry = belle_sip_list_find_custom(obj->data_store, belle_sip_object_data_find, name);
-	struct belle_sip_object_data* entry = (list_entry)? list_entry->data : NULL;
-	void* data =NULL;
-
-	if( entry ){
-		belle_sip_free(entry->name);
-		data = entry->data;
-	}
-	obj->data_store = belle_sip_list_remove_link(obj->data_store, list_entry);
-	belle_sip_free(entry);
+	int pos = belle_sip_object_data_store_find(obj->data_store, name);
+	struct belle_sip_object_data entry;
 
-	return data;
+	if( pos == -1 ) return NULL;
+	entry = belle_sip_object_data_store_take(obj, pos);
+	belle_sip_free(entry.name);
+	return entry.data;
 }
 
 void belle_sip_object_data_clear( belle_sip_object_t* obj )
 {
-	belle_sip_list_for_each(obj->data_store, belle_sip_object_data_destroy);
-	obj->data_store = belle_sip_list_free(obj->data_store);
+	struct belle_sip_object_data_store *store = obj->data_store;
+	int i;
+
+	if( store == NULL ) return;
+	obj->data_store = NULL;
+	for( i = 0; i < store->count; ++i ){
+		struct belle_sip_object_data* entry = &store->entries[i];
+		if( entry->destroy_func ) entry->destroy_func(entry->data);
+		belle_sip_free(entry->name);
+	}
+	belle_sip_free(store->entries);
+	belle_sip_free(store->index);
+	belle_sip_free(store);
 }
 
 void belle_sip_object_data_clone( const belle_sip_object_t* src, belle_sip_object_t* dst, belle_sip_data_clone clone_func)
@@ -430,40 +1164,24 @@ void belle_sip_object_data_clone( const belle_sip_object_t* src, belle_sip_objec
 
 void belle_sip_object_data_merge( const belle_sip_object_t* src, belle_sip_object_t* dst, belle_sip_data_clone clone_func)
 {
-	belle_sip_list_t *list = src->data_store;
-	struct belle_sip_object_data* it = NULL;
-	void* cloned_data = NULL;
-
-	while( list ){
-		it = list->data;
-		if( it ){
-			cloned_data = (clone_func)? clone_func( it->name, it->data ) : it->data;
-			belle_sip_object_data_set(dst, it->name, cloned_data, it->destroy_func);
-		}
-		list = list->next;
-	}
-}
+	int i;
 
-
-struct belle_sip_object_foreach_data {
-	void (*apply_func)(const char*, void*, void*);
-	void* userdata;
-};
-
-static void belle_sip_object_for_each_cb(void* data, void* pvdata)
-{
-	struct belle_sip_object_data*         it = (struct belle_sip_object_data*)data;
-	struct belle_sip_object_foreach_data* fd = (struct belle_sip_object_foreach_data*)pvdata;
-
-	if( it && fd->apply_func ){
-		fd->apply_func(it->name, it->data, fd->userdata);
+	for( i = 0; src->data_store && i < src->data_store->count; ++i ){
+		struct belle_sip_object_data* it = &src->data_store->entries[i];
+		void* cloned_data = (clone_func)? clone_func( it->name, it->data ) : it->data;
+		belle_sip_object_data_set(dst, it->name, cloned_data, it->destroy_func);
 	}
 }
 
 void belle_sip_object_data_foreach( const belle_sip_object_t* obj, void (*apply_func)(const char* key, void* data, void* userdata), void* userdata)
 {
-	struct belle_sip_object_foreach_data fd = { apply_func, userdata };
-	belle_sip_list_for_each2(obj->data_store, belle_sip_object_for_each_cb, &fd);
+	int i;
+
+	if( apply_func == NULL ) return;
+	for( i = 0; obj->data_store && i < obj->data_store->count; ++i ){
+		struct belle_sip_object_data* it = &obj->data_store->entries[i];
+		apply_func(it->name, it->data, userdata);
+	}
 }
 
 
@@ -479,15 +1197,16 @@ void *belle_sip_object_cast(belle_sip_object_t *obj, belle_sip_type_id_t id, con
 
 void *belle_sip_object_get_interface_methods(belle_sip_object_t *obj, belle_sip_interface_id_t ifid){
 	if (obj!=NULL){
-		belle_sip_object_vptr_t *vptr;
-		for (vptr=obj->vptr;vptr!=NULL;vptr=vptr->get_parent()){
-			belle_sip_interface_desc_t **ifaces=vptr->interfaces;
-			if (ifaces!=NULL){
-				for(;*ifaces!=0;++ifaces){
-					if ((*ifaces)->id==ifid){
-						return *ifaces;
-					}
-				}
+		belle_sip_type_info_t *info=belle_sip_object_get_type_info(obj->vptr);
+		belle_sip_interface_desc_t **ifaces;
+
+		if (info->interface_span>0){
+			unsigned int index=ifid-info->min_interface_id;
+			return index<info->interface_span ? info->interfaces_by_id[index] : NULL;
+		}
+		for(ifaces=info->interfaces;*ifaces!=NULL;++ifaces){
+			if ((*ifaces)->id==ifid){
+				return *ifaces;
 			}
 		}
 	}
@@ -515,6 +1234,7 @@ void belle_sip_object_set_name(belle_sip_object_t* object,const char* name) {
 	}
 	if (name)
 		object->name=belle_sip_strdup(name);
+	if (object->sampled) leak_samples_set_name(object,name);
 }
 
 const char* belle_sip_object_get_name(belle_sip_object_t* object) {
@@ -683,7 +1403,7 @@ char *belle_sip_object_describe_type_from_name(const char *name){
 
 struct belle_sip_object_pool{
 	belle_sip_object_t base;
-	belle_sip_list_t *objects;
+	belle_sip_object_t *objects; /*unowned objects, linked through their pool_prev and pool_next fields*/
 	unsigned long thread_id;
 };
 
@@ -705,11 +1425,21 @@ void belle_sip_object_pool_add(belle_sip_object_pool_t *pool, belle_sip_object_t
 	if (obj->pool!=NULL){
 		belle_sip_fatal("It is not possible to add an object to multiple pools.");
 	}
-	pool->objects=belle_sip_list_prepend(pool->objects,obj);
-	obj->pool_iterator=pool->objects;
+	obj->pool_prev=NULL;
+	obj->pool_next=pool->objects;
+	if (pool->objects) pool->objects->pool_prev=obj;
+	pool->objects=obj;
 	obj->pool=pool;
 }
 
+static void belle_sip_object_pool_unlink(belle_sip_object_pool_t *pool, belle_sip_object_t *obj){
+	if (obj->pool_prev) obj->pool_prev->pool_next=obj->pool_next;
+	else pool->objects=obj->pool_next;
+	if (obj->pool_next) obj->pool_next->pool_prev=obj->pool_prev;
+	obj->pool_prev=obj->pool_next=NULL;
+	obj->pool=NULL;
+}
+
 void belle_sip_object_pool_remove(belle_sip_object_pool_t *pool, belle_sip_object_t *obj){
 	unsigned long tid=belle_sip_thread_self_id();
 	if (obj->pool!=pool){
@@ -720,9 +1450,7 @@ void belle_sip_object_pool_remove(belle_sip_object_pool_t *pool, belle_sip_objec
 		belle_sip_fatal("It is forbidden (and unsafe()) to ref()/unref() an unowned object outside of the thread that created it.");
 		return;
 	}
-	pool->objects=belle_sip_list_delete_link(pool->objects,obj->pool_iterator);
-	obj->pool_iterator=NULL;
-	obj->pool=NULL;
+	belle_sip_object_pool_unlink(pool,obj);
 }
 
 int belle_sip_object_pool_cleanable(belle_sip_object_pool_t *pool){
@@ -730,28 +1458,30 @@ int belle_sip_object_pool_cleanable(belle_sip_object_pool_t *pool){
 }
 
 void belle_sip_object_pool_clean(belle_sip_object_pool_t *pool){
-	belle_sip_list_t *elem,*next;
+	belle_sip_object_t *obj;
+	int log_enabled;
 
+	if (pool->objects==NULL) return;
 	if (!belle_sip_object_pool_cleanable(pool)){
 		belle_sip_warning("Thread pool [%p] cannot be cleaned from thread [%lu] because it was created for thread [%lu]",
 				 pool,belle_sip_thread_self_id(),(unsigned long)pool->thread_id);
 		return;
 	}
 
-	for(elem=pool->objects;elem!=NULL;elem=next){
-		belle_sip_object_t *obj=(belle_sip_object_t*)elem->data;
+	log_enabled=belle_sip_log_level_enabled(BELLE_SIP_LOG_DEBUG);
+	/*objects created by destructors go to the head of the list, and are collected as well*/
+	while((obj=pool->objects)!=NULL){
+		belle_sip_object_pool_unlink(pool,obj);
 		if (obj->ref==0){
-			belle_sip_message("Garbage collecting unowned object of type %s",obj->vptr->type_name);
+			if (log_enabled){
+				belle_sip_debug("Garbage collecting unowned object of type %s",obj->vptr->type_name);
+			}
 			obj->ref=-1;
 			belle_sip_object_delete(obj);
-			next=elem->next;
-			belle_sip_free(elem);
 		}else {
 			belle_sip_fatal("Object %p is in unowned list but with ref count %i, bug.",obj,obj->ref);
-			next=elem->next;
 		}
 	}
-	pool->objects=NULL;
 }
 
 static void belle_sip_object_pool_detach_from_thread(belle_sip_object_pool_t *pool){
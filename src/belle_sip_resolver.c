@@ -633,7 +633,7 @@ static int resolver_process_data(belle_sip_simple_resolver_context_t *ctx, unsig
 		simulated_timeout=1;
 	}
 
-	if (simulated_timeout || ((revents & BELLE_SIP_EVENT_TIMEOUT) && ((int)(belle_sip_time_ms()-ctx->start_time)>=timeout))) {
+	if (simulated_timeout || ((revents & BELLE_SIP_EVENT_TIMEOUT) && ((int)(belle_sip_main_loop_get_time_ms(ctx->base.stack->ml)-ctx->start_time)>=timeout))) {
 		belle_sip_error("%s timed-out", __FUNCTION__);
 		belle_sip_resolver_context_notify(BELLE_SIP_RESOLVER_CONTEXT(ctx));
 		return BELLE_SIP_STOP;
@@ -829,7 +829,7 @@ static int _resolver_send_query(belle_sip_simple_resolver_context_t *ctx) {
 	}
 
 	if (resolver_process_data(ctx, 0) == BELLE_SIP_CONTINUE) {
-		ctx->start_time=belle_sip_time_ms();
+		ctx->start_time=belle_sip_main_loop_get_time_ms(ctx->base.stack->ml);
 		belle_sip_message("DNS resolution awaiting response, queued to main loop");
 		/*only init source if res inprogress*/
 		/*the timeout set to the source is 1 s, this is to allow dns.c to send request retransmissions*/
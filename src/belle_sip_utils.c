@@ -135,6 +135,34 @@ uint64_t belle_sip_time_ms(void){
 	}
 	return (ts.tv_sec*1000LL) + (ts.tv_nsec/1000000LL);
 }
+
+uint64_t belle_sip_time_ms_coarse(void){
+#if defined(CLOCK_REALTIME_COARSE) && !defined(__APPLE__)
+	/*same origin as belle_sip_time_ms(), read without entering the kernel but only updated at each tick*/
+	struct timespec ts;
+	if (clock_gettime(CLOCK_REALTIME_COARSE,&ts)==-1){
+		return belle_sip_time_ms();
+	}
+	return (ts.tv_sec*1000LL) + (ts.tv_nsec/1000000LL);
+#else
+	return belle_sip_time_ms();
+#endif
+}
+
+uint64_t belle_sip_time_us(void){
+	/*only used to measure durations, which must not follow the wall clock adjustments unlike belle_sip_time_ms()*/
+#ifdef __APPLE__
+	const int clock_id=BC_CLOCK_MONOTONIC;
+#else
+	const int clock_id=CLOCK_MONOTONIC;
+#endif
+	struct timespec ts;
+	if (clock_gettime(clock_id,&ts)==-1){
+		belle_sip_error("clock_gettime() error for clock_id=%i: %s",clock_id,strerror(errno));
+		return 0;
+	}
+	return (ts.tv_sec*1000000LL) + (ts.tv_nsec/1000LL);
+}
 #else
 uint64_t belle_sip_time_ms(void){
 #ifdef BELLE_SIP_WINDOWS_DESKTOP
@@ -143,6 +171,17 @@ uint64_t belle_sip_time_ms(void){
 	return GetTickCount64();
 #endif
 }
+
+uint64_t belle_sip_time_ms_coarse(void){
+	return belle_sip_time_ms();
+}
+
+uint64_t belle_sip_time_us(void){
+	LARGE_INTEGER frequency,counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)((counter.QuadPart/frequency.QuadPart)*1000000LL + ((counter.QuadPart%frequency.QuadPart)*1000000LL)/frequency.QuadPart);
+}
 #endif
 
 /**
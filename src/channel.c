@@ -22,6 +22,17 @@
 #include <ctype.h>
 #include <wchar.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BELLE_SIP_SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BELLE_SIP_SCAN_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define BELLE_SIP_SCAN_NEON
+#endif
+
 #ifdef __ANDROID__
 #include "wakelock_internal.h"
 #endif
@@ -98,6 +109,7 @@ static void belle_sip_channel_input_stream_rewind(belle_sip_channel_input_stream
 static void belle_sip_channel_input_stream_reset(belle_sip_channel_input_stream_t* input_stream) {
 	belle_sip_channel_input_stream_rewind(input_stream);
 	input_stream->state=WAITING_MESSAGE_START;
+	input_stream->scanned=0;
 	if (input_stream->msg != NULL) belle_sip_object_unref(input_stream->msg);
 	input_stream->msg=NULL;
 	input_stream->chuncked_mode=FALSE;
@@ -108,6 +120,97 @@ static size_t belle_sip_channel_input_stream_get_buff_length(belle_sip_channel_i
 	return sizeof(input_stream->buff) - (input_stream->write_ptr-input_stream->buff);
 }
 
+#if defined(BELLE_SIP_SCAN_AVX2) || defined(BELLE_SIP_SCAN_SSE2)
+static int first_set_bit(unsigned int v){
+#if defined(__GNUC__)
+	return __builtin_ctz(v);
+#else
+	int n=0;
+	while ((v & 1)==0){
+		v>>=1;
+		n++;
+	}
+	return n;
+#endif
+}
+#endif
+
+/*returns the first \r\n\r\n of [p,end[, comparing a block of bytes with '\r' and the same block shifted by 3 with '\n'
+ at once, and checking the candidates one by one*/
+static const char *find_end_of_headers(const char *p, const char *end){
+#if defined(BELLE_SIP_SCAN_AVX2)
+	const __m256i cr=_mm256_set1_epi8('\r');
+	const __m256i lf=_mm256_set1_epi8('\n');
+	for(;end-p>=32+3;p+=32){
+		__m256i first=_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p),cr);
+		__m256i last=_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p+3)),lf);
+		unsigned int candidates=(unsigned int)_mm256_movemask_epi8(_mm256_and_si256(first,last));
+		for(;candidates!=0;candidates&=candidates-1){
+			int i=first_set_bit(candidates);
+			if (p[i+1]=='\n' && p[i+2]=='\r') return p+i;
+		}
+	}
+#elif defined(BELLE_SIP_SCAN_SSE2)
+	const __m128i cr=_mm_set1_epi8('\r');
+	const __m128i lf=_mm_set1_epi8('\n');
+	for(;end-p>=16+3;p+=16){
+		__m128i first=_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p),cr);
+		__m128i last=_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p+3)),lf);
+		unsigned int candidates=(unsigned int)_mm_movemask_epi8(_mm_and_si128(first,last));
+		for(;candidates!=0;candidates&=candidates-1){
+			int i=first_set_bit(candidates);
+			if (p[i+1]=='\n' && p[i+2]=='\r') return p+i;
+		}
+	}
+#elif defined(BELLE_SIP_SCAN_NEON)
+	const uint8x16_t cr=vdupq_n_u8('\r');
+	const uint8x16_t lf=vdupq_n_u8('\n');
+	for(;end-p>=16+3;p+=16){
+		uint8x16_t first=vceqq_u8(vld1q_u8((const uint8_t*)p),cr);
+		uint8x16_t last=vceqq_u8(vld1q_u8((const uint8_t*)(p+3)),lf);
+		if (vmaxvq_u8(vandq_u8(first,last))!=0){
+			int i;
+			for(i=0;i<16;i++){
+				if (memcmp(p+i,"\r\n\r\n",4)==0) return p+i;
+			}
+		}
+	}
+#endif
+	/*scalar version, also used for the last bytes*/
+	while (end-p>=4 && (p=memchr(p,'\r',(size_t)(end-p-3)))!=NULL){
+		if (p[1]=='\n' && p[2]=='\r' && p[3]=='\n') return p;
+		p++;
+	}
+	return NULL;
+}
+
+/*
+ * Bytes are only appended after read_ptr until it moves, so searches resume where the previous one stopped instead of
+ * rescanning the whole pending message at every recv().
+ */
+static char *belle_sip_channel_input_stream_find_end_of_headers(belle_sip_channel_input_stream_t* input_stream) {
+	size_t length=(size_t)(input_stream->write_ptr-input_stream->read_ptr);
+	const char *found=find_end_of_headers(input_stream->read_ptr+input_stream->scanned,input_stream->write_ptr);
+
+	if (found) return (char*)found;
+	/*the last 3 bytes may be the beginning of a \r\n\r\n*/
+	if (length>3 && length-3>input_stream->scanned) input_stream->scanned=length-3;
+	return NULL;
+}
+
+static int belle_sip_channel_input_stream_has_line(belle_sip_channel_input_stream_t* input_stream) {
+	size_t length=(size_t)(input_stream->write_ptr-input_stream->read_ptr);
+	const char *p=input_stream->read_ptr+input_stream->scanned;
+	const char *end=input_stream->write_ptr;
+
+	while (end-p>=2 && (p=memchr(p,'\r',(size_t)(end-p-1)))!=NULL){
+		if (p[1]=='\n') return TRUE;
+		p++;
+	}
+	if (length>1 && length-1>input_stream->scanned) input_stream->scanned=length-1;
+	return FALSE;
+}
+
 static void belle_sip_channel_destroy(belle_sip_channel_t *obj){
 	belle_sip_channel_input_stream_reset(&obj->input_stream);
 	if (obj->peer_cname) belle_sip_free(obj->peer_cname);
@@ -543,34 +646,40 @@ void belle_sip_channel_parse_stream(belle_sip_channel_t *obj, int end_of_stream)
 	int offset;
 	size_t read_size=0;
 	int num;
+	/*datagrams are not read by the channel itself, only stream channels can defer parsing*/
+	int max_messages=(end_of_stream || !belle_sip_channel_is_reliable(obj)) ? 0 : obj->stack->max_messages_per_read;
+	int started_messages=0; /*messages whose start was found by this call*/
 
+	obj->parse_pending=FALSE;
 	while ((num=(int)(obj->input_stream.write_ptr-obj->input_stream.read_ptr))>0){
-
 		if (obj->input_stream.state == WAITING_MESSAGE_START) {
-			int i;
+			if (max_messages>0 && started_messages>=max_messages){
+				/*leave the remaining data for next main loop iteration, so that other sources are not starved*/
+				belle_sip_debug("channel [%p]: [%i] messages parsed, deferring the remaining [%i] bytes",obj,started_messages,num);
+				obj->parse_pending=TRUE;
+				belle_sip_source_set_notify_required((belle_sip_source_t*)obj,TRUE);
+				break;
+			}
 			/*first, make sure there is \r\n in the buffer, otherwise, micro parser cannot conclude, because we need a complete request or response line somewhere*/
-			for (i=0;i<num-1;i++) {
-				if ((obj->input_stream.read_ptr[i]=='\r' && obj->input_stream.read_ptr[i+1]=='\n')
-						|| belle_sip_channel_input_stream_get_buff_length(&obj->input_stream) <= 1 /*1 because null terminated*/  /*if buffer full try to parse in any case*/) {
-					/*good, now we can start searching  for request/response*/
-					if ((offset=get_message_start_pos(obj->input_stream.read_ptr,num)) >=0 ) {
-						/*message found !*/
-						if (offset>0) {
-							belle_sip_warning("trashing [%i] bytes in front of sip message on channel [%p]",offset,obj);
-							obj->input_stream.read_ptr+=offset;
-						}
-						obj->input_stream.state=MESSAGE_AQUISITION;
-					} else {
-						belle_sip_debug("Unexpected [%s] received on channel [%p], trashing",obj->input_stream.read_ptr,obj);
-						obj->input_stream.read_ptr=obj->input_stream.write_ptr;
-						belle_sip_channel_input_stream_reset(&obj->input_stream);
-						continue;
+			if (num>1 && (belle_sip_channel_input_stream_has_line(&obj->input_stream)
+					|| belle_sip_channel_input_stream_get_buff_length(&obj->input_stream) <= 1 /*1 because null terminated*/  /*if buffer full try to parse in any case*/)) {
+				/*good, now we can start searching  for request/response*/
+				if ((offset=get_message_start_pos(obj->input_stream.read_ptr,num)) >=0 ) {
+					/*message found !*/
+					if (offset>0) {
+						belle_sip_warning("trashing [%i] bytes in front of sip message on channel [%p]",offset,obj);
+						obj->input_stream.read_ptr+=offset;
 					}
-				break;
+					obj->input_stream.state=MESSAGE_AQUISITION;
+					obj->input_stream.scanned=0;
+					started_messages++;
+				} else {
+					belle_sip_debug("Unexpected [%s] received on channel [%p], trashing",obj->input_stream.read_ptr,obj);
+					obj->input_stream.read_ptr=obj->input_stream.write_ptr;
+					belle_sip_channel_input_stream_reset(&obj->input_stream);
+					continue;
 				}
-			}
-
-			if (i >= num-1) {
+			} else {
 				belle_sip_debug("[%s] received on channel [%p], cannot determine if expected or not, waiting for new data",obj->input_stream.read_ptr,obj);
 				break;
 			}
@@ -579,10 +688,11 @@ void belle_sip_channel_parse_stream(belle_sip_channel_t *obj, int end_of_stream)
 		if (obj->input_stream.state==MESSAGE_AQUISITION) {
 			/*search for \r\n\r\n*/
 			char* end_of_message=NULL;
-			if ((end_of_message=strstr(obj->input_stream.read_ptr,"\r\n\r\n"))){
+			if ((end_of_message=belle_sip_channel_input_stream_find_end_of_headers(&obj->input_stream))){
 				int bytes_to_parse;
 				char tmp;
 				/*end of message found*/
+				obj->input_stream.scanned=0;
 				end_of_message+=4;/*add \r\n\r\n*/
 				bytes_to_parse=(int)(end_of_message-obj->input_stream.read_ptr);
 				tmp=*end_of_message;
@@ -612,6 +722,7 @@ void belle_sip_channel_parse_stream(belle_sip_channel_t *obj, int end_of_stream)
 														,end_of_message);
 					obj->input_stream.read_ptr=end_of_message;
 					obj->input_stream.state=WAITING_MESSAGE_START;
+					obj->input_stream.scanned=0;
 					continue;
 				}
 			}else break; /*The message isn't finished to be receive, we need more data*/
@@ -642,10 +753,44 @@ static void belle_sip_channel_process_stream(belle_sip_channel_t *obj, int eos){
 	}
 }
 
+/*processes the bytes just written at the end of the input stream*/
+static void belle_sip_channel_process_received_bytes(belle_sip_channel_t *obj, int num){
+	char *begin=obj->input_stream.write_ptr;
+	obj->input_stream.write_ptr+=num;
+	/*first null terminate the read buff*/
+	*obj->input_stream.write_ptr='\0';
+	if (num>20 || obj->input_stream.state != WAITING_MESSAGE_START ) /*to avoid tracing server based keep alives*/ {
+		char *logbuf = make_logbuf(obj, BELLE_SIP_LOG_MESSAGE ,begin,num);
+		if (logbuf) {
+			belle_sip_message("channel [%p]: received [%i] new bytes from [%s://%s:%i]:\n%s",
+					obj,
+					num,
+					belle_sip_channel_get_transport_name(obj),
+					obj->peer_name,
+					obj->peer_port,
+					logbuf);
+			belle_sip_free(logbuf);
+		}
+	}
+	belle_sip_channel_process_stream(obj,FALSE);
+	if (obj->input_stream.state == WAITING_MESSAGE_START && !obj->parse_pending){
+		channel_end_recv_background_task(obj);
+	}/*if still in message acquisition state, keep the backgroud task*/
+}
+
 static int belle_sip_channel_process_read_data(belle_sip_channel_t *obj){
 	int num;
 	int ret=BELLE_SIP_CONTINUE;
 
+	if (obj->parse_pending){
+		/*first parse what is already in the buffer, the socket will be read at next iteration*/
+		belle_sip_channel_process_stream(obj,FALSE);
+		if (!obj->parse_pending && obj->input_stream.state == WAITING_MESSAGE_START){
+			channel_end_recv_background_task(obj);
+		}
+		return ret;
+	}
+
 	/*prevent system to suspend the process until we have finish reading everything from the socket and notified the upper layer*/
 	if (obj->input_stream.state == WAITING_MESSAGE_START) {
 		channel_begin_recv_background_task(obj);
@@ -658,27 +803,7 @@ static int belle_sip_channel_process_read_data(belle_sip_channel_t *obj){
 		num=obj->simulated_recv_return;
 	}
 	if (num>0){
-		char *begin=obj->input_stream.write_ptr;
-		obj->input_stream.write_ptr+=num;
-		/*first null terminate the read buff*/
-		*obj->input_stream.write_ptr='\0';
-		if (num>20 || obj->input_stream.state != WAITING_MESSAGE_START ) /*to avoid tracing server based keep alives*/ {
-			char *logbuf = make_logbuf(obj, BELLE_SIP_LOG_MESSAGE ,begin,num);
-			if (logbuf) {
-				belle_sip_message("channel [%p]: received [%i] new bytes from [%s://%s:%i]:\n%s",
-						obj,
-						num,
-						belle_sip_channel_get_transport_name(obj),
-						obj->peer_name,
-						obj->peer_port,
-						logbuf);
-				belle_sip_free(logbuf);
-			}
-		}
-		belle_sip_channel_process_stream(obj,FALSE);
-		if (obj->input_stream.state == WAITING_MESSAGE_START){
-			channel_end_recv_background_task(obj);
-		}/*if still in message acquisition state, keep the backgroud task*/
+		belle_sip_channel_process_received_bytes(obj,num);
 	} else if (num == 0) {
 		/*before closing the channel, check if there was a pending message to receive, whose body acquisition is to be finished.*/
 		belle_sip_channel_process_stream(obj,TRUE);
@@ -696,6 +821,22 @@ static int belle_sip_channel_process_read_data(belle_sip_channel_t *obj){
 	return ret;
 }
 
+void belle_sip_channel_process_datagram(belle_sip_channel_t *obj, const char *data, size_t size){
+	size_t room=belle_sip_channel_input_stream_get_buff_length(&obj->input_stream)-1;
+	if (size==0) return;
+	if (size>room){
+		belle_sip_error("channel [%p]: datagram of [%i] bytes truncated to [%i]",obj,(int)size,(int)room);
+		size=room;
+	}
+	belle_sip_object_ref(obj);
+	if (obj->input_stream.state == WAITING_MESSAGE_START) {
+		channel_begin_recv_background_task(obj);
+	}
+	memcpy(obj->input_stream.write_ptr,data,size);
+	belle_sip_channel_process_received_bytes(obj,(int)size);
+	belle_sip_object_unref(obj);
+}
+
 int belle_sip_channel_process_data(belle_sip_channel_t *obj,unsigned int revents){
 	int ret=BELLE_SIP_CONTINUE;
 	belle_sip_object_ref(obj);
@@ -739,7 +880,7 @@ static void update_inactivity_timer(belle_sip_channel_t *obj, int from_recv){
 		}
 	}
 	if (from_recv)
-		obj->last_recv_time=belle_sip_time_ms();
+		obj->last_recv_time=belle_sip_main_loop_get_time_ms(obj->stack->ml);
 }
 
 /*constructor for channels creating an outgoing connection
@@ -922,10 +1063,11 @@ int belle_sip_channel_recv(belle_sip_channel_t *obj, void *buf, size_t buflen){
 }
 
 void belle_sip_channel_close(belle_sip_channel_t *obj){
+	/*removing the source (our base class) will decrement the ref count, this why this code needs to be protected by ref/unref.
+	 The source is removed before the socket is closed, so that it is unregistered from the main loop's poll set.*/
+	belle_sip_main_loop_remove_source(obj->stack->ml,(belle_sip_source_t*)obj);
 	if (BELLE_SIP_OBJECT_VPTR(obj,belle_sip_channel_t)->close)
 		BELLE_SIP_OBJECT_VPTR(obj,belle_sip_channel_t)->close(obj); /*udp channel doesn't have close function*/
-	/*removing the source (our base class) will decrement the ref count, this why this code needs to be protected by ref/unref.*/
-	belle_sip_main_loop_remove_source(obj->stack->ml,(belle_sip_source_t*)obj);
 	belle_sip_source_uninit((belle_sip_source_t*)obj);
 }
 
@@ -1055,7 +1197,7 @@ int belle_sip_channel_notify_timeout(belle_sip_channel_t *obj){
 		return FALSE;
 	}
 
-	if ((int)(belle_sip_time_ms() - obj->last_recv_time) >= (too_long * 1000)){
+	if ((int)(belle_sip_main_loop_get_time_ms(obj->stack->ml) - obj->last_recv_time) >= (too_long * 1000)){
 		belle_sip_message("A timeout related to this channel occured and no message received during last %i seconds. This channel is suspect, moving to error state",too_long);
 		channel_set_state(obj,BELLE_SIP_CHANNEL_ERROR);
 		return TRUE;
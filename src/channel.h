@@ -29,6 +29,7 @@
 
 #define belle_sip_network_buffer_size 65535
 #define belle_sip_send_network_buffer_size 16384
+#define belle_sip_default_max_messages_per_read 0 /*no limit*/
 
 typedef enum belle_sip_channel_state{
 	BELLE_SIP_CHANNEL_INIT,
@@ -77,6 +78,7 @@ typedef struct belle_sip_channel_input_stream{
 	char buff[belle_sip_network_buffer_size];
 	char* read_ptr;
 	char* write_ptr;
+	size_t scanned; /*bytes after read_ptr already searched for the end of the start line or of the headers*/
 	belle_sip_message_t *msg;
 	size_t content_length;
 	int chuncked_mode;
@@ -128,6 +130,7 @@ struct belle_sip_channel{
 	unsigned char about_to_be_closed;
 	unsigned char srv_overrides_port; /*set when this channel was connected to destination port provided by SRV resolution*/
 	unsigned char soft_error; /*set when this channel enters ERROR state because of error detected in upper layer */
+	unsigned char parse_pending; /*the input buffer still contains messages that could not be parsed because of max_messages_per_read*/
 	int stop_logging_buffer; /*log buffer content only if this is non binary data, and stop it at the first occurence*/
 	bool_t closed_by_remote; /*If the channel has been remotely closed*/
 	bool_t dns_ttl_timedout;
@@ -201,6 +204,8 @@ void channel_set_state(belle_sip_channel_t *obj, belle_sip_channel_state_t state
  * in return from this function.
  */
 int belle_sip_channel_process_data(belle_sip_channel_t *obj,unsigned int revents);
+/*processes a datagram received for the channel by other means than its socket*/
+void belle_sip_channel_process_datagram(belle_sip_channel_t *obj, const char *data, size_t size);
 
 /*this function is to be used only in belle_sip_listening_point_clean_channels()*/
 void belle_sip_channel_force_close(belle_sip_channel_t *obj);
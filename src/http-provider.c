@@ -575,11 +575,11 @@ void belle_http_provider_set_recv_error(belle_http_provider_t *obj, int recv_err
 	for(it=obj->tcp_channels;it!=NULL;it=it->next){
 		belle_sip_channel_t *chan = (belle_sip_channel_t*)it->data;
 		chan->simulated_recv_return=recv_error;
-		chan->base.notify_required=(recv_error<=0);
+		belle_sip_source_set_notify_required((belle_sip_source_t*)chan,recv_error<=0);
 	}
 	for(it=obj->tls_channels;it!=NULL;it=it->next){
 		belle_sip_channel_t *chan = (belle_sip_channel_t*)it->data;
 		chan->simulated_recv_return=recv_error;
-		chan->base.notify_required=(recv_error<=0);
+		belle_sip_source_set_notify_required((belle_sip_source_t*)chan,recv_error<=0);
 	}
 }
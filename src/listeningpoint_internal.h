@@ -61,6 +61,8 @@ typedef struct belle_sip_udp_listening_point belle_sip_udp_listening_point_t;
 belle_sip_channel_t * belle_sip_channel_new_udp(belle_sip_stack_t *stack, int sock, const char *bindip, int localport, const char *peername, int peerport);
 belle_sip_channel_t * belle_sip_channel_new_udp_with_addr(belle_sip_stack_t *stack, int sock, const char *bindip, int localport, const struct addrinfo *ai);
 belle_sip_listening_point_t * belle_sip_udp_listening_point_new(belle_sip_stack_t *s, const char *ipaddress, int port);
+/*processes a datagram read by another stack sharing the address and port of the listening point, see sharded stacks*/
+void belle_sip_udp_listening_point_process_datagram(belle_sip_listening_point_t *lp, const char *data, size_t size, const struct sockaddr *addr, socklen_t addrlen);
 BELLE_SIP_DECLARE_CUSTOM_VPTR_BEGIN(belle_sip_udp_listening_point_t,belle_sip_listening_point_t)
 BELLE_SIP_DECLARE_CUSTOM_VPTR_END
 
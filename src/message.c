@@ -22,11 +22,47 @@
 
 #include "belle_sip_internal.h"
 
+/*
+ * Header line kept as received until the headers of its container are accessed, see
+ * belle_sip_message_add_raw_header().
+ */
+typedef struct _raw_header {
+	char *line; /*whole line, without the final CRLF*/
+	char *name;
+	const char *value; /*in line, NULL if the header has no value*/
+} raw_header_t;
+
+/*
+ * Containers are shared between a message and its clones until one of them accesses the headers of the container,
+ * see belle_sip_message_clone(). Clones may be given to other threads, so the count of messages sharing a container
+ * is updated atomically; everything else is only modified once the container is private to a message.
+ */
 typedef struct _headers_container {
 	char* name;
 	belle_sip_list_t* header_list;
+	belle_sip_list_t* raw_list; /*raw_header_t not parsed yet, in which case header_list is empty*/
+	belle_sip_type_id_t raw_type; /*type the raw headers will have once parsed*/
+	volatile intptr_t refs; /*number of messages sharing the container*/
+	int exposed; /*headers were given to or by the user of the message, who may still reference them. Only set on private containers*/
 } headers_container_t;
 
+static raw_header_t *raw_header_new(const char *name, size_t name_length, const char *line, size_t line_length, const char *value){
+	/*a single block holds the structure, the line and the name*/
+	raw_header_t *raw=belle_sip_malloc(sizeof(raw_header_t)+line_length+1+name_length+1);
+	raw->line=(char*)(raw+1);
+	memcpy(raw->line,line,line_length);
+	raw->line[line_length]='\0';
+	raw->name=raw->line+line_length+1;
+	memcpy(raw->name,name,name_length);
+	raw->name[name_length]='\0';
+	raw->value=value ? raw->line+(value-line) : NULL;
+	return raw;
+}
+
+static raw_header_t *raw_header_copy(const raw_header_t *orig){
+	return raw_header_new(orig->name,strlen(orig->name),orig->line,strlen(orig->line),orig->value);
+}
+
 /*reference is
  * http://www.iana.org/assignments/sip-parameters/sip-parameters.xhtml#sip-parameters-2
  */
@@ -83,35 +119,147 @@ static const char * expand_name(const char *name){
 static headers_container_t* belle_sip_message_headers_container_new(const char* name) {
 	headers_container_t* headers_container = belle_sip_new0(headers_container_t);
 	headers_container->name = belle_sip_strdup(expand_name(name));
+	headers_container->refs = 1;
 	return headers_container;
 }
 
 static void belle_sip_headers_container_delete(headers_container_t *obj){
 	belle_sip_free(obj->name);
 	belle_sip_list_free_with_data(obj->header_list,(void (*)(void*))belle_sip_object_unref);
+	belle_sip_list_free_with_data(obj->raw_list,belle_sip_free);
 	belle_sip_free(obj);
 }
 
+static headers_container_t *belle_sip_headers_container_copy(const headers_container_t *obj){
+	headers_container_t *copy=belle_sip_message_headers_container_new(obj->name);
+	copy->header_list=belle_sip_list_copy_with_data(obj->header_list,(void *(*)(void*))belle_sip_object_clone_and_ref);
+	copy->raw_list=belle_sip_list_copy_with_data(obj->raw_list,(void *(*)(void*))raw_header_copy);
+	copy->raw_type=obj->raw_type;
+	return copy;
+}
+
+static void belle_sip_headers_container_release(headers_container_t *obj){
+	if (belle_sip_atomic_fetch_add(&obj->refs,-1)==1) belle_sip_headers_container_delete(obj);
+}
+
+/*
+ * Messages shared between threads (see belle_sip_object_set_shared()) may be read concurrently, and reading headers
+ * makes their containers private and parses them: this is serialized per message, with a mutex created by the first
+ * thread reading the message once it is shared.
+ */
+static bctbx_mutex_t *belle_sip_message_get_lock(const belle_sip_message_t *msg){
+	volatile intptr_t *lock=(volatile intptr_t*)&msg->lock;
+	bctbx_mutex_t *mutex=(bctbx_mutex_t*)belle_sip_atomic_load(lock);
+	if (mutex==NULL){
+		intptr_t expected=0;
+		mutex=belle_sip_new(bctbx_mutex_t);
+		bctbx_mutex_init(mutex,NULL);
+		/*another thread may have created it meanwhile, in which case its mutex is kept*/
+		if (!belle_sip_atomic_compare_exchange(lock,&expected,(intptr_t)mutex)){
+			bctbx_mutex_destroy(mutex);
+			belle_sip_free(mutex);
+			mutex=(bctbx_mutex_t*)expected;
+		}
+	}
+	return mutex;
+}
+
+static void belle_sip_message_lock_if_shared(const belle_sip_message_t *msg){
+	if (belle_sip_object_is_shared(msg)) bctbx_mutex_lock(belle_sip_message_get_lock(msg));
+}
+
+static void belle_sip_message_unlock_if_shared(const belle_sip_message_t *msg){
+	if (belle_sip_object_is_shared(msg)) bctbx_mutex_unlock((bctbx_mutex_t*)belle_sip_atomic_load((volatile intptr_t*)&msg->lock));
+}
+
+/*creates the headers of the raw lines, the same way the message grammar does*/
+static void belle_sip_headers_container_parse(headers_container_t *c){
+	belle_sip_list_t *elem;
+	for(elem=c->raw_list;elem!=NULL;elem=elem->next){
+		raw_header_t *raw=(raw_header_t*)elem->data;
+		belle_sip_header_t *h;
+		for(h=belle_sip_header_create(raw->name,raw->value);h!=NULL;h=belle_sip_header_get_next(h)){
+			c->header_list=belle_sip_list_append(c->header_list,belle_sip_object_ref(h));
+		}
+	}
+	c->raw_list=belle_sip_list_free_with_data(c->raw_list,belle_sip_free);
+}
+
+/*makes the container of the list element private to the message, parsing its raw lines*/
+static headers_container_t *belle_sip_headers_container_make_private(belle_sip_list_t *elem){
+	headers_container_t *c=(headers_container_t*)elem->data;
+	if (belle_sip_atomic_load(&c->refs)>1){
+		/*copied before being released, so that the other messages never see it private while it is read*/
+		headers_container_t *copy=belle_sip_headers_container_copy(c);
+		belle_sip_headers_container_release(c);
+		elem->data=c=copy;
+	}
+	if (c->raw_list) belle_sip_headers_container_parse(c);
+	return c;
+}
+
+/*
+ * Makes the container of the list element private to the message before its headers are given to the user of the
+ * message, who may modify them. Raw headers are parsed at this time.
+ */
+static headers_container_t *belle_sip_headers_container_own(const belle_sip_message_t *msg, belle_sip_list_t *elem){
+	headers_container_t *c;
+	belle_sip_message_lock_if_shared(msg);
+	c=belle_sip_headers_container_make_private(elem);
+	c->exposed=TRUE;
+	belle_sip_message_unlock_if_shared(msg);
+	return c;
+}
+
+/*
+ * Gives the headers of a container for reading only, without making it private to the message nor marking them as
+ * given to the user, so that clones can keep sharing it. Raw lines still have to be parsed, which requires a private
+ * container. The caller holds the lock of shared messages.
+ */
+static const belle_sip_list_t *belle_sip_headers_container_peek(belle_sip_list_t *elem){
+	headers_container_t *c=(headers_container_t*)elem->data;
+	if (c->raw_list) c=belle_sip_headers_container_make_private(elem);
+	return c->header_list;
+}
+
 static void belle_sip_message_destroy(belle_sip_message_t *msg){
-	belle_sip_list_free_with_data(msg->header_list,(void (*)(void*))belle_sip_headers_container_delete);
+	belle_sip_list_t *elem;
+	for(elem=msg->header_list;elem!=NULL;elem=elem->next){
+		belle_sip_headers_container_release((headers_container_t*)elem->data);
+	}
+	msg->header_list=belle_sip_list_free(msg->header_list);
 	if (msg->body_handler)
 		belle_sip_object_unref(msg->body_handler);
 	if (msg->multipart_body_cache)
 		bctbx_free(msg->multipart_body_cache);
+	if (msg->lock){
+		bctbx_mutex_destroy((bctbx_mutex_t*)msg->lock);
+		belle_sip_free((void*)msg->lock);
+	}
 }
 
-/*very sub-optimal clone method */
+/*
+ * Clones are copy on write: they share the header containers of the original message, and headers are only copied
+ * when one of the messages gives them to its user. Marshalling does not copy.
+ * Headers the user of the original may still reference and modify are copied immediately, as well as all headers of a
+ * message shared between threads (see belle_sip_object_set_shared()), containers not being thread safe.
+ */
 static void belle_sip_message_clone(belle_sip_message_t *obj, const belle_sip_message_t *orig){
 	headers_container_t *c;
 	const belle_sip_list_t *l;
+	int shared=belle_sip_object_is_shared(orig);
+	belle_sip_message_lock_if_shared(orig);
 	for(l=orig->header_list;l!=NULL;l=l->next){
 		c=(headers_container_t*)l->data;
-		if (c->header_list){
-			belle_sip_list_t * ll=belle_sip_list_copy_with_data(c->header_list,(void *(*)(void*))belle_sip_object_clone);
-			belle_sip_message_add_headers(obj,ll);
-			belle_sip_list_free(ll);
+		if (!c->header_list && !c->raw_list) continue;
+		if (shared || c->exposed){
+			c=belle_sip_headers_container_copy(c);
+		}else{
+			belle_sip_atomic_fetch_add(&c->refs,1);
 		}
+		obj->header_list=belle_sip_list_append(obj->header_list,c);
 	}
+	belle_sip_message_unlock_if_shared(orig);
 }
 
 BELLE_SIP_DECLARE_NO_IMPLEMENTED_INTERFACES(belle_sip_message_t);
@@ -123,16 +271,59 @@ belle_sip_message_t* belle_sip_message_parse (const char* value) {
 	return belle_sip_message_parse_raw(value,strlen(value),&message_length);
 }
 
-belle_sip_message_t* belle_sip_message_parse_raw (const char* buff, size_t buff_length,size_t* message_length ) { \
-	pANTLR3_INPUT_STREAM           input;
-	pbelle_sip_messageLexer               lex;
-	pANTLR3_COMMON_TOKEN_STREAM    tokens;
-	pbelle_sip_messageParser              parser;
+static size_t parse_arena_size=0;
+
+void belle_sip_message_set_parse_arena_size(size_t size){
+	parse_arena_size=size;
+}
+
+size_t belle_sip_message_get_parse_arena_size(void){
+	return parse_arena_size;
+}
+
+static belle_sip_message_parser_t message_parser=BELLE_SIP_MESSAGE_PARSER_ANTLR;
+
+void belle_sip_message_set_parser(belle_sip_message_parser_t parser){
+	message_parser=parser;
+}
+
+belle_sip_message_parser_t belle_sip_message_get_parser(void){
+	return message_parser;
+}
+
+static void belle_sip_message_parser_context_create(belle_sip_parser_context_t *ctx){
+	pbelle_sip_messageLexer lex=belle_sip_messageLexerNew(ctx->input);
+	pbelle_sip_messageParser parser;
+
+	ctx->tokens=antlr3CommonTokenStreamSourceNew(ANTLR3_SIZE_HINT,TOKENSOURCE(lex));
+	parser=belle_sip_messageParserNew(ctx->tokens);
+	ctx->lexer=lex;
+	ctx->parser=parser;
+	ctx->base_lexer=lex->pLexer;
+	ctx->base_parser=parser->pParser;
+}
+
+static void belle_sip_message_parser_context_destroy(belle_sip_parser_context_t *ctx){
+	pbelle_sip_messageParser parser=(pbelle_sip_messageParser)ctx->parser;
+	pbelle_sip_messageLexer lex=(pbelle_sip_messageLexer)ctx->lexer;
+	parser->free(parser);
+	ctx->tokens->free(ctx->tokens);
+	lex->free(lex);
+}
+
+const belle_sip_parser_grammar_t belle_sip_message_grammar={
+	BELLE_SIP_PARSER_GRAMMAR_MESSAGE,
+	belle_sip_message_parser_context_create,
+	belle_sip_message_parser_context_destroy
+};
+
+static belle_sip_message_t *belle_sip_message_antlr_parse_raw(const char* buff, size_t buff_length,size_t* message_length){
+	belle_sip_parser_context_t *context;
+	pbelle_sip_messageParser parser;
 	belle_sip_message_t* l_parsed_object;
-	input  = ANTLR_STREAM_NEW("message",buff,buff_length);
-	lex    = belle_sip_messageLexerNew                (input);
-	tokens = antlr3CommonTokenStreamSourceNew  (1025, lex->pLexer->rec->state->tokSource);
-	parser = belle_sip_messageParserNew               (tokens);
+
+	context = belle_sip_parser_context_acquire(&belle_sip_message_grammar,"message",buff,buff_length);
+	parser = (pbelle_sip_messageParser)context->parser;
 	l_parsed_object = parser->message_raw(parser,message_length);
 /*	if (*message_length < buff_length) {*/
 		/*there is a body*/
@@ -141,10 +332,38 @@ belle_sip_message_t* belle_sip_message_parse_raw (const char* buff, size_t buff_
 		memcpy(l_parsed_object->body,buff+*message_length,l_parsed_object->body_length);
 		l_parsed_object->body[l_parsed_object->body_length]='\0';
 	}*/
-	parser ->free(parser);
-	tokens ->free(tokens);
-	lex    ->free(lex);
-	input  ->close(input);
+	belle_sip_parser_context_release(context);
+	return l_parsed_object;
+}
+
+belle_sip_message_t* belle_sip_message_parse_raw (const char* buff, size_t buff_length,size_t* message_length ) { \
+	belle_sip_message_t* l_parsed_object=NULL;
+	belle_sip_object_arena_t *arena=NULL;
+	belle_sip_object_arena_t *previous_arena=NULL;
+
+	if (parse_arena_size>0){
+		/*objects of the message are carved from the arena, which lives until the last of them is released*/
+		arena=belle_sip_object_arena_new(parse_arena_size);
+		previous_arena=belle_sip_object_arena_set_current(arena);
+	}
+	if (message_parser!=BELLE_SIP_MESSAGE_PARSER_ANTLR){
+		l_parsed_object=belle_sip_message_fast_parse_raw(buff,buff_length,message_length,message_parser==BELLE_SIP_MESSAGE_PARSER_LAZY);
+	}
+	if (l_parsed_object==NULL){
+		/*the fast parser gives up on anything it does not handle exactly like the grammar*/
+		l_parsed_object=belle_sip_message_antlr_parse_raw(buff,buff_length,message_length);
+	}
+	if (l_parsed_object){
+		/*nobody references the parsed headers yet, so that clones can share them*/
+		belle_sip_list_t *elem;
+		for(elem=l_parsed_object->header_list;elem!=NULL;elem=elem->next){
+			((headers_container_t*)elem->data)->exposed=FALSE;
+		}
+	}
+	if (arena){
+		belle_sip_object_arena_set_current(previous_arena);
+		belle_sip_object_arena_release(arena);
+	}
 	return l_parsed_object;
 }
 
@@ -156,11 +375,54 @@ void belle_sip_message_init(belle_sip_message_t *message){
 
 }
 
+static belle_sip_list_t *belle_sip_headers_container_find(const belle_sip_message_t* message,const char* header_name) {
+	return belle_sip_list_find_custom(	message->header_list
+										, (belle_sip_compare_func)belle_sip_headers_container_comp_func
+										, header_name);
+}
+
 headers_container_t* belle_sip_headers_container_get(const belle_sip_message_t* message,const char* header_name) {
-	belle_sip_list_t *  result = belle_sip_list_find_custom(	message->header_list
-															, (belle_sip_compare_func)belle_sip_headers_container_comp_func
-															, header_name);
-	return result?(headers_container_t*)(result->data):NULL;
+	belle_sip_list_t *result;
+	headers_container_t *c=NULL;
+	belle_sip_message_lock_if_shared(message);
+	result=belle_sip_headers_container_find(message,header_name);
+	if (result){
+		/*the returned headers may be modified*/
+		c=belle_sip_headers_container_make_private(result);
+		c->exposed=TRUE;
+	}
+	belle_sip_message_unlock_if_shared(message);
+	return c;
+}
+
+void belle_sip_message_add_raw_header(belle_sip_message_t *message, const char *name, size_t name_length, const char *line, size_t line_length, const char *value){
+	belle_sip_type_id_t type=BELLE_SIP_TYPE_ID(belle_sip_header_extension_t);
+	const char *container_name;
+	belle_sip_list_t *elem;
+	headers_container_t *headers_container;
+	raw_header_t *raw=raw_header_new(name,name_length,line,line_length,value);
+
+	/*same container as the one the parsed headers would go to*/
+	container_name=belle_sip_header_get_typed_name(raw->name,&type);
+	if (container_name==NULL) container_name=expand_name(raw->name);
+	elem=belle_sip_headers_container_find(message,container_name);
+	if (elem){
+		headers_container=(headers_container_t*)elem->data;
+	}else{
+		headers_container=belle_sip_message_headers_container_new(container_name);
+		headers_container->raw_type=type;
+		message->header_list=belle_sip_list_append(message->header_list,headers_container);
+	}
+	if (headers_container->raw_list==NULL && headers_container->header_list!=NULL){
+		/*already parsed, keep the order of the headers*/
+		belle_sip_header_t *h;
+		for(h=belle_sip_header_create(raw->name,raw->value);h!=NULL;h=belle_sip_header_get_next(h)){
+			headers_container->header_list=belle_sip_list_append(headers_container->header_list,belle_sip_object_ref(h));
+		}
+		belle_sip_free(raw);
+		return;
+	}
+	headers_container->raw_list=belle_sip_list_append(headers_container->raw_list,raw);
 }
 
 headers_container_t * get_or_create_container(belle_sip_message_t *message, const char *header_name){
@@ -168,6 +430,7 @@ headers_container_t * get_or_create_container(belle_sip_message_t *message, cons
 	headers_container_t* headers_container = belle_sip_headers_container_get(message,header_name);
 	if (headers_container == NULL) {
 		headers_container = belle_sip_message_headers_container_new(header_name);
+		headers_container->exposed = TRUE;
 		message->header_list=belle_sip_list_append(message->header_list,headers_container);
 	}
 	return headers_container;
@@ -215,15 +478,46 @@ const belle_sip_list_t* belle_sip_message_get_headers(const belle_sip_message_t
 }
 
 belle_sip_object_t *_belle_sip_message_get_header_by_type_id(const belle_sip_message_t *message, belle_sip_type_id_t id){
-	const belle_sip_list_t *e1;
-	for(e1=message->header_list;e1!=NULL;e1=e1->next){
+	belle_sip_list_t *e1;
+	belle_sip_object_t *ret=NULL;
+	belle_sip_message_lock_if_shared(message);
+	for(e1=message->header_list;e1!=NULL && ret==NULL;e1=e1->next){
 		headers_container_t* headers_container=(headers_container_t*)e1->data;
-		if (headers_container->header_list){
-			belle_sip_object_t *ret=headers_container->header_list->data;
-			if (ret->vptr->id==id) return ret;
+		if (headers_container->raw_list ? headers_container->raw_type==id
+			: headers_container->header_list && ((belle_sip_object_t*)headers_container->header_list->data)->vptr->id==id){
+			headers_container=belle_sip_headers_container_make_private(e1);
+			headers_container->exposed=TRUE;
+			if (headers_container->header_list) ret=headers_container->header_list->data;
 		}
 	}
-	return NULL;
+	belle_sip_message_unlock_if_shared(message);
+	return ret;
+}
+
+belle_sip_object_t *_belle_sip_message_peek_header_by_type_id(const belle_sip_message_t *message, belle_sip_type_id_t id){
+	belle_sip_list_t *e1;
+	belle_sip_object_t *ret=NULL;
+	belle_sip_message_lock_if_shared(message);
+	for(e1=message->header_list;e1!=NULL && ret==NULL;e1=e1->next){
+		headers_container_t* headers_container=(headers_container_t*)e1->data;
+		if (headers_container->raw_list ? headers_container->raw_type==id
+			: headers_container->header_list && ((belle_sip_object_t*)headers_container->header_list->data)->vptr->id==id){
+			const belle_sip_list_t *headers=belle_sip_headers_container_peek(e1);
+			if (headers) ret=headers->data;
+		}
+	}
+	belle_sip_message_unlock_if_shared(message);
+	return ret;
+}
+
+belle_sip_header_t *belle_sip_message_peek_header(const belle_sip_message_t *msg, const char *header_name){
+	belle_sip_list_t *elem;
+	const belle_sip_list_t *headers=NULL;
+	belle_sip_message_lock_if_shared(msg);
+	elem=belle_sip_headers_container_find(msg,header_name);
+	if (elem) headers=belle_sip_headers_container_peek(elem);
+	belle_sip_message_unlock_if_shared(msg);
+	return headers ? (belle_sip_header_t*)headers->data : NULL;
 }
 
 void belle_sip_message_remove_first(belle_sip_message_t *msg, const char *header_name){
@@ -245,10 +539,12 @@ void belle_sip_message_remove_last(belle_sip_message_t *msg, const char *header_
 }
 
 void belle_sip_message_remove_header(belle_sip_message_t *msg, const char *header_name){
-	headers_container_t* headers_container = belle_sip_headers_container_get(msg,header_name);
-	if (headers_container){
-		msg->header_list = belle_sip_list_remove(msg->header_list,headers_container);
-		belle_sip_headers_container_delete(headers_container);
+	belle_sip_list_t *elem = belle_sip_headers_container_find(msg,header_name);
+	if (elem){
+		/*no need to copy a shared container just to drop it*/
+		headers_container_t* headers_container = (headers_container_t*)elem->data;
+		msg->header_list = belle_sip_list_delete_link(msg->header_list,elem);
+		belle_sip_headers_container_release(headers_container);
 	}
 }
 void belle_sip_message_remove_header_from_ptr(belle_sip_message_t *msg, belle_sip_header_t* header) {
@@ -296,7 +592,7 @@ static void belle_sip_message_for_each_header(const belle_sip_message_t *message
 	belle_sip_list_t* headers_list;
 	belle_sip_list_t* header_list;
 	for(headers_list=message->header_list;headers_list!=NULL;headers_list=headers_list->next){
-		for(header_list=((headers_container_t*)(headers_list->data))->header_list
+		for(header_list=belle_sip_headers_container_own(message,headers_list)->header_list
 				;header_list!=NULL
 				;header_list=header_list->next)	{
 			cb(BELLE_SIP_HEADER(header_list->data),user_data);
@@ -314,16 +610,31 @@ belle_sip_list_t* belle_sip_message_get_all_headers(const belle_sip_message_t *m
 	return headers;
 }
 
-belle_sip_error_code belle_sip_headers_marshal(belle_sip_message_t *message, char* buff, size_t buff_size, size_t *offset) {
+static belle_sip_error_code _belle_sip_headers_marshal(belle_sip_message_t *message, char* buff, size_t buff_size, size_t *offset) {
 	/*FIXME, replace this code by belle_sip_message_for_each_header*/
 	belle_sip_list_t* headers_list;
 	belle_sip_list_t* header_list;
 	belle_sip_error_code error=BELLE_SIP_OK;
 #ifdef BELLE_SIP_WORKAROUND_TECHNICOLOR_SIP_ALG_ROUTER_BUG
 	belle_sip_header_t *content_length=NULL;
+	headers_container_t *raw_content_length=NULL;
 #endif
 
 	for(headers_list=message->header_list;headers_list!=NULL;headers_list=headers_list->next){
+		/*headers nobody accessed are sent as received*/
+#ifdef BELLE_SIP_WORKAROUND_TECHNICOLOR_SIP_ALG_ROUTER_BUG
+		if (((headers_container_t*)(headers_list->data))->raw_list
+			&& ((headers_container_t*)(headers_list->data))->raw_type==BELLE_SIP_TYPE_ID(belle_sip_header_content_length_t)){
+			raw_content_length=(headers_container_t*)(headers_list->data);
+			continue;
+		}
+#endif
+		for(header_list=((headers_container_t*)(headers_list->data))->raw_list
+				;header_list!=NULL
+				;header_list=header_list->next)	{
+			error=belle_sip_snprintf(buff,buff_size,offset,"%s\r\n",((raw_header_t*)header_list->data)->line);
+			if (error!=BELLE_SIP_OK) return error;
+		}
 		for(header_list=((headers_container_t*)(headers_list->data))->header_list
 				;header_list!=NULL
 				;header_list=header_list->next)	{
@@ -351,12 +662,27 @@ belle_sip_error_code belle_sip_headers_marshal(belle_sip_message_t *message, cha
 		error=belle_sip_snprintf(buff,buff_size,offset,"%s","\r\n");
 		if (error!=BELLE_SIP_OK) return error;
 	}
+	if (raw_content_length){
+		for(header_list=raw_content_length->raw_list;header_list!=NULL;header_list=header_list->next){
+			error=belle_sip_snprintf(buff,buff_size,offset,"%s\r\n",((raw_header_t*)header_list->data)->line);
+			if (error!=BELLE_SIP_OK) return error;
+		}
+	}
 #endif
 	error=belle_sip_snprintf(buff,buff_size,offset,"%s","\r\n");
 	if (error!=BELLE_SIP_OK) return error;
 	return error;
 }
 
+belle_sip_error_code belle_sip_headers_marshal(belle_sip_message_t *message, char* buff, size_t buff_size, size_t *offset) {
+	belle_sip_error_code error;
+	/*raw lines of shared messages may be parsed by another thread meanwhile*/
+	belle_sip_message_lock_if_shared(message);
+	error=_belle_sip_headers_marshal(message,buff,buff_size,offset);
+	belle_sip_message_unlock_if_shared(message);
+	return error;
+}
+
 static void belle_sip_request_destroy(belle_sip_request_t* request) {
 	if (request->method) belle_sip_free(request->method);
 	if (request->uri) belle_sip_object_unref(request->uri);
@@ -1045,10 +1371,23 @@ static message_header_list_t mandatory_headers[] = {
 	return 0;
 }
 */
+/*checks whether the message has a header, without parsing nor copying it*/
+static int belle_sip_message_has_header(const belle_sip_message_t *message, const char *header_name){
+	belle_sip_list_t *elem;
+	int ret=FALSE;
+	belle_sip_message_lock_if_shared(message);
+	elem=belle_sip_headers_container_find(message,header_name);
+	/*raw lines are parsed first, malformed ones being dropped*/
+	if (elem) ret=belle_sip_headers_container_peek(elem)!=NULL;
+	belle_sip_message_unlock_if_shared(message);
+	return ret;
+}
+
 int belle_sip_message_check_headers(const belle_sip_message_t* message) {
 	if (BELLE_SIP_OBJECT_IS_INSTANCE_OF(message,belle_sip_request_t)) {
 		int i;
-		belle_sip_header_via_t *via;
+		belle_sip_header_via_t *via=NULL;
+		belle_sip_list_t *elem;
 		const char * method = belle_sip_request_get_method(BELLE_SIP_REQUEST(message));
 
 		for (i=0;mandatory_headers[i].method!=NULL;i++) {
@@ -1056,7 +1395,7 @@ int belle_sip_message_check_headers(const belle_sip_message_t* message) {
 				 (mandatory_headers[i].method[0] == '*') ){
 				int j;
 				for(j=0;mandatory_headers[i].headers[j]!=NULL;j++) {
-					if (belle_sip_message_get_header(message,mandatory_headers[i].headers[j])==NULL) {
+					if (!belle_sip_message_has_header(message,mandatory_headers[i].headers[j])) {
 						belle_sip_error("Missing mandatory header [%s] for message [%s]",mandatory_headers[i].headers[j],method);
 						return 0;
 					}
@@ -1064,7 +1403,13 @@ int belle_sip_message_check_headers(const belle_sip_message_t* message) {
 				return 1;
 			}
 		}
-		via=belle_sip_message_get_header_by_type(message,belle_sip_header_via_t);
+		belle_sip_message_lock_if_shared(message);
+		elem=belle_sip_headers_container_find(message,BELLE_SIP_VIA);
+		if (elem){
+			const belle_sip_list_t *vias=belle_sip_headers_container_peek(elem);
+			if (vias) via=BELLE_SIP_HEADER_VIA(vias->data);
+		}
+		belle_sip_message_unlock_if_shared(message);
 		if (!via || belle_sip_header_via_get_branch(via)==NULL) return 0;
 	}
 	/*else fixme should also check responses*/
@@ -1073,23 +1418,32 @@ int belle_sip_message_check_headers(const belle_sip_message_t* message) {
 }
 
 int belle_sip_request_check_uris_components(const belle_sip_request_t* request) {
-	belle_sip_list_t* new_list = belle_sip_message_get_all_headers(BELLE_SIP_MESSAGE(request));
-	belle_sip_list_t* iterator = new_list;
-
-	for (;iterator!=NULL;iterator=iterator->next) {
-		belle_sip_header_t* header=(belle_sip_header_t*)iterator->data;
-		if (BELLE_SIP_IS_INSTANCE_OF(header,belle_sip_header_address_t)) {
-			belle_sip_uri_t* uri=belle_sip_header_address_get_uri(BELLE_SIP_HEADER_ADDRESS(header));
-			if (uri && !belle_sip_uri_check_components_from_context(uri,belle_sip_request_get_method(request),belle_sip_header_get_name(header))) {
-				char* header_string=belle_sip_object_to_string(header);
-				belle_sip_error("Malformed header [%s] for request [%p]",header_string,request);
-				belle_sip_free(header_string);
-				belle_sip_list_free(new_list);
-				return FALSE;
+	const belle_sip_message_t *message=BELLE_SIP_MESSAGE(request);
+	belle_sip_list_t *elem;
+	int ret=TRUE;
+
+	/*headers are only read: containers shared with clones are not copied, and only address headers are parsed*/
+	belle_sip_message_lock_if_shared(message);
+	for (elem=message->header_list;elem!=NULL && ret;elem=elem->next) {
+		const headers_container_t *c=(const headers_container_t*)elem->data;
+		const belle_sip_list_t *iterator;
+		if (c->raw_list && !belle_sip_header_type_is_address(c->raw_type)) continue;
+		for (iterator=belle_sip_headers_container_peek(elem);iterator!=NULL;iterator=iterator->next) {
+			belle_sip_header_t* header=(belle_sip_header_t*)iterator->data;
+			if (BELLE_SIP_IS_INSTANCE_OF(header,belle_sip_header_address_t)) {
+				belle_sip_uri_t* uri=belle_sip_header_address_get_uri(BELLE_SIP_HEADER_ADDRESS(header));
+				if (uri && !belle_sip_uri_check_components_from_context(uri,belle_sip_request_get_method(request),belle_sip_header_get_name(header))) {
+					char* header_string=belle_sip_object_to_string(header);
+					belle_sip_error("Malformed header [%s] for request [%p]",header_string,request);
+					belle_sip_free(header_string);
+					ret=FALSE;
+					break;
+				}
 			}
 		}
 	}
+	belle_sip_message_unlock_if_shared(message);
+	if (!ret) return FALSE;
 
-	belle_sip_list_free(new_list);
 	return belle_sip_uri_check_components_from_request_uri(belle_sip_request_get_uri((const belle_sip_request_t*)request));
 }
@@ -0,0 +1,763 @@
+/*
+ * Copyright (c) 2012-2019 Belledonne Communications SARL.
+ *
+ * This file is part of belle-sip.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "belle_sip_internal.h"
+#include <ctype.h>
+
+/*
+ * Hand-written single pass parser for SIP requests and responses, see belle_sip_message_set_parser().
+ * The start line and the header lines are framed directly in the input buffer, and the most common headers are built
+ * without going through the grammar. Fields are only copied to be given to the setters of the objects.
+ * The parser only accepts what it builds exactly like the grammar does: headers it does not know or whose value it
+ * does not fully understand are created by belle_sip_header_create() from the same name and value as the grammar
+ * would, and messages it cannot frame (HTTP, non sip request uri, unusual start line...) are left to the grammar.
+ */
+
+#define FP_ALNUM	(1<<0)
+#define FP_TOKEN	(1<<1) /*alphanum mark % + `*/
+#define FP_USER		(1<<2) /*unreserved and user-unreserved, but escaped chars*/
+#define FP_PARAM	(1<<3) /*unreserved and param-unreserved, but escaped chars*/
+#define FP_WORD		(1<<4) /*word of Call-ID*/
+#define FP_HOST		(1<<5) /*alphanum - .*/
+#define FP_IPV6		(1<<6) /*hexdigit : .*/
+#define FP_DIGIT	(1<<7)
+#define FP_HEX		(1<<8)
+
+/*
+ * Classes of the ASCII characters, other characters belong to none. Alphanumeric characters belong to FP_TOKEN,
+ * FP_USER, FP_PARAM, FP_WORD and FP_HOST, hexadecimal digits to FP_IPV6 too, and the marks of each class are:
+ * FP_TOKEN -_.!~*'()%+`
+ * FP_USER -_.!~*'()&=+$,;?/
+ * FP_PARAM -_.!~*'()[]/:&+$
+ * FP_WORD -_.!~*'()%+`<>:\"/[]?{}
+ * FP_HOST -.
+ * FP_IPV6 :.
+ */
+static const unsigned short char_classes[256]={
+	/*0x00*/ 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000,
+	/*0x10*/ 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000,
+	/*0x20*/ 0x000, 0x01e, 0x010, 0x000, 0x00c, 0x012, 0x00c, 0x01e, 0x01e, 0x01e, 0x01e, 0x01e, 0x004, 0x03e, 0x07e, 0x01c,
+	/*0x30*/ 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x058, 0x004, 0x010, 0x004, 0x010, 0x014,
+	/*0x40*/ 0x000, 0x17f, 0x17f, 0x17f, 0x17f, 0x17f, 0x17f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f,
+	/*0x50*/ 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x018, 0x010, 0x018, 0x000, 0x01e,
+	/*0x60*/ 0x012, 0x17f, 0x17f, 0x17f, 0x17f, 0x17f, 0x17f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f,
+	/*0x70*/ 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x03f, 0x010, 0x000, 0x010, 0x01e, 0x000,
+};
+
+#define IS(c,cls) (char_classes[(unsigned char)(c)] & (cls))
+
+typedef struct fast_parser{
+	char local[1024];
+	char *scratch; /*NUL terminated copies of the fields of the current line*/
+	size_t scratch_pos;
+	size_t scratch_size;
+}fast_parser_t;
+
+/*a line copied field by field, separators included, needs at most twice its length*/
+static void fp_reset(fast_parser_t *p, size_t line_length){
+	size_t needed=2*line_length+2;
+	if (needed>p->scratch_size){
+		if (p->scratch!=p->local) belle_sip_free(p->scratch);
+		p->scratch=belle_sip_malloc(needed);
+		p->scratch_size=needed;
+	}
+	p->scratch_pos=0;
+}
+
+static const char *fp_copy(fast_parser_t *p, const char *s, const char *end){
+	char *ret=p->scratch+p->scratch_pos;
+	size_t len=(size_t)(end-s);
+	memcpy(ret,s,len);
+	ret[len]='\0';
+	p->scratch_pos+=len+1;
+	return ret;
+}
+
+static const char *fp_span(const char *s, const char *end, unsigned short cls){
+	while(s<end && IS(*s,cls)) ++s;
+	return s;
+}
+
+static const char *fp_skip_sp(const char *s, const char *end){
+	while(s<end && *s==' ') ++s;
+	return s;
+}
+
+/*quoted-string, returns a pointer after the closing quote or NULL*/
+static const char *fp_quoted_string(const char *s, const char *end){
+	if (s>=end || *s!='"') return NULL;
+	for(++s;s<end;++s){
+		if (*s=='\\'){
+			if (++s==end) return NULL;
+		}else if (*s=='"') return s+1;
+	}
+	return NULL;
+}
+
+static int fp_is_ipv4(const char *s, const char *end){
+	int groups=0;
+	while(groups<4){
+		const char *digits=fp_span(s,end,FP_DIGIT);
+		if (digits==s || digits-s>3) return FALSE;
+		groups++;
+		s=digits;
+		if (groups<4){
+			if (s==end || *s!='.') return FALSE;
+			s++;
+		}
+	}
+	return s==end;
+}
+
+/*IPv6 address, restricted to the forms the grammar surely accepts*/
+static int fp_is_ipv6(const char *s, const char *end){
+	const char *last_colon=NULL;
+	const char *p;
+	int double_colon=FALSE;
+
+	for(p=s;p<end;++p){
+		if (*p==':') last_colon=p;
+	}
+	if (last_colon==NULL) return FALSE;
+	if (memchr(s,'.',(size_t)(end-s))!=NULL){
+		/*hexpart ":" IPv4address*/
+		if (last_colon==s || !IS(last_colon[-1],FP_HEX) || !fp_is_ipv4(last_colon+1,end)) return FALSE;
+		end=last_colon;
+	}
+	/*groups of hex digits separated by single colons, with at most one double colon*/
+	for(p=s;p<end;){
+		if (*p==':'){
+			if (p+1<end && p[1]==':'){
+				if (double_colon) return FALSE;
+				double_colon=TRUE;
+				p+=2;
+				continue;
+			}
+			if (p==s || p+1==end || p[-1]==':') return FALSE;
+		}else if (!IS(*p,FP_HEX)) return FALSE;
+		++p;
+	}
+	return TRUE;
+}
+
+/*hostname or IPv4 address, as accepted by the grammar*/
+static int fp_is_host(const char *s, const char *end){
+	const char *label=s;
+	const char *p;
+	if (fp_is_ipv4(s,end)) return TRUE;
+	for(p=s;p<=end;++p){
+		if (p==end || *p=='.'){
+			if (p==label || *label=='-' || p[-1]=='-') return FALSE;
+			if (p==end){
+				/*top label has at least two characters and no double dash*/
+				const char *q;
+				if (p-label<2) return FALSE;
+				for(q=label;q<p-1;++q){
+					if (q[0]=='-' && q[1]=='-') return FALSE;
+				}
+				return TRUE;
+			}
+			label=p+1;
+		}else if (!IS(*p,FP_HOST)) return FALSE;
+	}
+	return FALSE;
+}
+
+/*host of an uri or of a Via, IPv6 references are returned without brackets*/
+static const char *fp_host(fast_parser_t *p, const char **s, const char *end){
+	const char *start=*s;
+	const char *host_end;
+	if (start<end && *start=='['){
+		host_end=fp_span(start+1,end,FP_IPV6);
+		if (host_end==end || *host_end!=']' || !fp_is_ipv6(start+1,host_end)) return NULL;
+		*s=host_end+1;
+		return fp_copy(p,start+1,host_end);
+	}
+	host_end=fp_span(start,end,FP_HOST);
+	if (!fp_is_host(start,host_end)) return NULL;
+	*s=host_end;
+	return fp_copy(p,start,host_end);
+}
+
+/*the buffer is not NUL terminated*/
+static int fp_atoi(const char *s, const char *end){
+	int value=0;
+	for(;s<end;++s) value=10*value+(*s-'0');
+	return value;
+}
+
+static int fp_port(const char **s, const char *end, int *port){
+	const char *digits=*s;
+	const char *digits_end=fp_span(digits,end,FP_DIGIT);
+	if (digits_end==digits || digits_end-digits>5) return FALSE;
+	*port=fp_atoi(digits,digits_end);
+	*s=digits_end;
+	return TRUE;
+}
+
+/*
+ * Parses a sip or sips uri, with its parameters if with_params is set. The caller checks the character that follows.
+ * Escaped characters, passwords and uri headers are left to the grammar.
+ */
+static belle_sip_uri_t *fp_uri(fast_parser_t *p, const char **s, const char *end, int with_params){
+	const char *cur=*s;
+	const char *run;
+	const char *host;
+	belle_sip_uri_t *uri;
+	int secure;
+	int port;
+
+	if (end-cur>4 && strncasecmp(cur,"sip:",4)==0){
+		secure=FALSE;
+		cur+=4;
+	}else if (end-cur>5 && strncasecmp(cur,"sips:",5)==0){
+		secure=TRUE;
+		cur+=5;
+	}else return NULL;
+
+	uri=belle_sip_uri_new();
+	if (secure) belle_sip_uri_set_secure(uri,TRUE);
+	/*userinfo is only known once its @ is found*/
+	run=cur;
+	while(run<end && (IS(*run,FP_USER) || *run==':' || *run=='%')) ++run;
+	if (run<end && *run=='@'){
+		const char *user_end=fp_span(cur,run,FP_USER);
+		if (user_end!=run || run==cur) goto error;
+		belle_sip_uri_set_user(uri,fp_copy(p,cur,run));
+		cur=run+1;
+	}
+	if ((host=fp_host(p,&cur,end))==NULL) goto error;
+	belle_sip_uri_set_host(uri,host);
+	if (cur<end && *cur==':'){
+		cur++;
+		if (!fp_port(&cur,end,&port)) goto error;
+		belle_sip_uri_set_port(uri,port);
+	}
+	while(with_params && cur<end && *cur==';'){
+		const char *name_end=fp_span(cur+1,end,FP_PARAM);
+		const char *name;
+		const char *value=NULL;
+		if (name_end==cur+1) goto error;
+		name=fp_copy(p,cur+1,name_end);
+		cur=name_end;
+		if (cur<end && *cur=='='){
+			const char *value_end=fp_span(cur+1,end,FP_PARAM);
+			if (value_end==cur+1) goto error;
+			value=fp_copy(p,cur+1,value_end);
+			cur=value_end;
+		}
+		belle_sip_parameters_set_parameter(BELLE_SIP_PARAMETERS(uri),name,value);
+	}
+	if (cur<end && (*cur=='?' || *cur=='%')) goto error;
+	*s=cur;
+	return uri;
+error:
+	belle_sip_object_unref(uri);
+	return NULL;
+}
+
+/*generic parameter following a header value: SEMI token [EQUAL (token | quoted-string)], *s being on the semicolon*/
+static int fp_param(fast_parser_t *p, belle_sip_parameters_t *params, const char **s, const char *end){
+	const char *cur=fp_skip_sp(*s+1,end);
+	const char *name_end=fp_span(cur,end,FP_TOKEN);
+	const char *name;
+	const char *value=NULL;
+
+	if (name_end==cur) return FALSE;
+	name=fp_copy(p,cur,name_end);
+	cur=fp_skip_sp(name_end,end);
+	if (cur<end && *cur=='='){
+		const char *value_end;
+		cur=fp_skip_sp(cur+1,end);
+		if (cur<end && *cur=='"') value_end=fp_quoted_string(cur,end);
+		else value_end=fp_span(cur,end,FP_TOKEN);
+		if (value_end==NULL || value_end==cur) return FALSE;
+		value=fp_copy(p,cur,value_end);
+		cur=fp_skip_sp(value_end,end);
+	}
+	belle_sip_parameters_set_parameter(params,name,value);
+	*s=cur;
+	return TRUE;
+}
+
+static int fp_params(fast_parser_t *p, belle_sip_parameters_t *params, const char **s, const char *end){
+	const char *cur=fp_skip_sp(*s,end);
+	while(cur<end && *cur==';'){
+		if (!fp_param(p,params,&cur,end)) return FALSE;
+	}
+	*s=cur;
+	return TRUE;
+}
+
+/*
+ * name-addr, or addr-spec without uri parameters if name_addr_only is not set, with sip uris only.
+ */
+static int fp_address(fast_parser_t *p, belle_sip_header_address_t *address, const char **s, const char *end, int name_addr_only){
+	const char *cur=fp_skip_sp(*s,end);
+	belle_sip_uri_t *uri;
+
+	if (cur<end && *cur=='"'){
+		const char *quoted_end=fp_quoted_string(cur,end);
+		char *unescaped;
+		if (quoted_end==NULL) return FALSE;
+		unescaped=belle_sip_string_to_backslash_less_unescaped_string(fp_copy(p,cur,quoted_end));
+		belle_sip_header_address_set_quoted_displayname(address,unescaped);
+		belle_sip_free(unescaped);
+		cur=fp_skip_sp(quoted_end,end);
+		if (cur==end || *cur!='<') return FALSE;
+	}else if (cur<end && *cur!='<'){
+		/*display name made of tokens, or the beginning of an addr-spec*/
+		const char *tokens_end=fp_span(cur,end,FP_TOKEN);
+		const char *next=fp_skip_sp(tokens_end,end);
+		while(next>tokens_end && next<end && IS(*next,FP_TOKEN)){
+			tokens_end=fp_span(next,end,FP_TOKEN);
+			next=fp_skip_sp(tokens_end,end);
+		}
+		if (tokens_end>cur && next<end && *next=='<'){
+			belle_sip_header_address_set_displayname(address,fp_copy(p,cur,tokens_end));
+			cur=next;
+		}else{
+			if (name_addr_only) return FALSE;
+			if ((uri=fp_uri(p,&cur,end,FALSE))==NULL) return FALSE;
+			belle_sip_header_address_set_uri(address,uri);
+			*s=fp_skip_sp(cur,end);
+			return TRUE;
+		}
+	}
+	if (cur==end) return FALSE;
+	/*cur is on the <*/
+	cur=fp_skip_sp(cur+1,end);
+	if ((uri=fp_uri(p,&cur,end,TRUE))==NULL) return FALSE;
+	belle_sip_header_address_set_uri(address,uri);
+	cur=fp_skip_sp(cur,end);
+	if (cur==end || *cur!='>') return FALSE;
+	*s=fp_skip_sp(cur+1,end);
+	return TRUE;
+}
+
+/*comma separated list of addresses with parameters, chained like the grammar does*/
+static belle_sip_header_t *fp_address_list(fast_parser_t *p, const char *s, const char *end, belle_sip_header_address_t *(*new_header)(void), int name_addr_only){
+	belle_sip_header_t *first=NULL;
+	belle_sip_header_t *last=NULL;
+	for(;;){
+		belle_sip_header_address_t *address=new_header();
+		if (last) belle_sip_header_set_next(last,BELLE_SIP_HEADER(address));
+		else first=BELLE_SIP_HEADER(address);
+		last=BELLE_SIP_HEADER(address);
+		if (!fp_address(p,address,&s,end,name_addr_only)) goto error;
+		if (!fp_params(p,BELLE_SIP_PARAMETERS(address),&s,end)) goto error;
+		if (s==end) return first;
+		if (*s!=',') goto error;
+		s=fp_skip_sp(s+1,end);
+	}
+error:
+	belle_sip_object_unref(first);
+	return NULL;
+}
+
+static belle_sip_header_t *fp_single_address(fast_parser_t *p, const char *s, const char *end, belle_sip_header_address_t *address){
+	if (fp_address(p,address,&s,end,FALSE) && fp_params(p,BELLE_SIP_PARAMETERS(address),&s,end) && s==end){
+		return BELLE_SIP_HEADER(address);
+	}
+	belle_sip_object_unref(address);
+	return NULL;
+}
+
+static belle_sip_header_t *fp_from(fast_parser_t *p, const char *s, const char *end){
+	return fp_single_address(p,s,end,BELLE_SIP_HEADER_ADDRESS(belle_sip_header_from_new()));
+}
+
+static belle_sip_header_t *fp_to(fast_parser_t *p, const char *s, const char *end){
+	return fp_single_address(p,s,end,BELLE_SIP_HEADER_ADDRESS(belle_sip_header_to_new()));
+}
+
+static belle_sip_header_address_t *new_contact(void){
+	return BELLE_SIP_HEADER_ADDRESS(belle_sip_header_contact_new());
+}
+
+static belle_sip_header_address_t *new_route(void){
+	return BELLE_SIP_HEADER_ADDRESS(belle_sip_header_route_new());
+}
+
+static belle_sip_header_address_t *new_record_route(void){
+	return BELLE_SIP_HEADER_ADDRESS(belle_sip_header_record_route_new());
+}
+
+static belle_sip_header_t *fp_contact(fast_parser_t *p, const char *s, const char *end){
+	if (s<end && *s=='*'){
+		belle_sip_header_contact_t *contact;
+		if (s+1!=end) return NULL;
+		contact=belle_sip_header_contact_new();
+		belle_sip_header_contact_set_wildcard(contact,1);
+		return BELLE_SIP_HEADER(contact);
+	}
+	return fp_address_list(p,s,end,new_contact,FALSE);
+}
+
+static belle_sip_header_t *fp_route(fast_parser_t *p, const char *s, const char *end){
+	return fp_address_list(p,s,end,new_route,TRUE);
+}
+
+static belle_sip_header_t *fp_record_route(fast_parser_t *p, const char *s, const char *end){
+	return fp_address_list(p,s,end,new_record_route,TRUE);
+}
+
+static int fp_via_parm(fast_parser_t *p, belle_sip_header_via_t *via, const char **s, const char *end){
+	const char *cur=*s;
+	const char *name_end;
+	const char *version_end;
+	const char *host;
+	int port;
+
+	/*sent-protocol*/
+	name_end=fp_span(cur,end,FP_TOKEN);
+	if (name_end==cur || name_end==end || *name_end!='/') return FALSE;
+	version_end=fp_span(name_end+1,end,FP_TOKEN);
+	if (version_end==name_end+1 || version_end==end || *version_end!='/') return FALSE;
+	belle_sip_header_via_set_protocol(via,fp_copy(p,cur,version_end));
+	cur=version_end+1;
+	name_end=fp_span(cur,end,FP_TOKEN);
+	if (name_end==cur) return FALSE;
+	belle_sip_header_via_set_transport(via,fp_copy(p,cur,name_end));
+	/*sent-by*/
+	cur=fp_skip_sp(name_end,end);
+	if (cur==name_end) return FALSE;
+	if ((host=fp_host(p,&cur,end))==NULL) return FALSE;
+	belle_sip_header_via_set_host(via,host);
+	if (cur<end && *cur==':'){
+		cur++;
+		if (!fp_port(&cur,end,&port)) return FALSE;
+		belle_sip_header_via_set_port(via,port);
+	}
+	for(cur=fp_skip_sp(cur,end);cur<end && *cur==';';cur=fp_skip_sp(cur,end)){
+		const char *param=fp_skip_sp(cur+1,end);
+		name_end=fp_span(param,end,FP_TOKEN);
+		if (name_end-param>=8 && strncasecmp(param,"received",8)==0){
+			/*the grammar sets received itself, provided it is an address*/
+			const char *value_end;
+			if (name_end-param!=8 || name_end==end || *name_end!='=') return FALSE;
+			value_end=fp_span(name_end+1,end,FP_IPV6);
+			if (!fp_is_ipv4(name_end+1,value_end) && !fp_is_ipv6(name_end+1,value_end)) return FALSE;
+			belle_sip_header_via_set_received(via,fp_copy(p,name_end+1,value_end));
+			cur=value_end;
+		}else if (!fp_param(p,BELLE_SIP_PARAMETERS(via),&cur,end)) return FALSE;
+	}
+	*s=cur;
+	return TRUE;
+}
+
+static belle_sip_header_t *fp_via(fast_parser_t *p, const char *s, const char *end){
+	belle_sip_header_t *first=NULL;
+	belle_sip_header_t *last=NULL;
+	for(;;){
+		belle_sip_header_via_t *via=belle_sip_header_via_new();
+		if (last) belle_sip_header_set_next(last,BELLE_SIP_HEADER(via));
+		else first=BELLE_SIP_HEADER(via);
+		last=BELLE_SIP_HEADER(via);
+		if (!fp_via_parm(p,via,&s,end)) goto error;
+		if (s==end) return first;
+		if (*s!=',') goto error;
+		s=fp_skip_sp(s+1,end);
+	}
+error:
+	belle_sip_object_unref(first);
+	return NULL;
+}
+
+static int fp_number(const char *s, const char *end, int *value){
+	const char *digits_end=fp_span(s,end,FP_DIGIT);
+	if (digits_end==s || digits_end!=end || end-s>9) return FALSE;
+	*value=fp_atoi(s,end);
+	return TRUE;
+}
+
+static belle_sip_header_t *fp_content_length(fast_parser_t *p, const char *s, const char *end){
+	int value;
+	belle_sip_header_content_length_t *header;
+	if (!fp_number(s,end,&value)) return NULL;
+	header=belle_sip_header_content_length_new();
+	belle_sip_header_content_length_set_content_length(header,value);
+	return BELLE_SIP_HEADER(header);
+}
+
+static belle_sip_header_t *fp_max_forwards(fast_parser_t *p, const char *s, const char *end){
+	int value;
+	belle_sip_header_max_forwards_t *header;
+	if (!fp_number(s,end,&value)) return NULL;
+	header=belle_sip_header_max_forwards_new();
+	belle_sip_header_max_forwards_set_max_forwards(header,value);
+	return BELLE_SIP_HEADER(header);
+}
+
+static belle_sip_header_t *fp_expires(fast_parser_t *p, const char *s, const char *end){
+	int value;
+	belle_sip_header_expires_t *header;
+	if (!fp_number(s,end,&value)) return NULL;
+	header=belle_sip_header_expires_new();
+	belle_sip_header_expires_set_expires(header,value);
+	return BELLE_SIP_HEADER(header);
+}
+
+static belle_sip_header_t *fp_cseq(fast_parser_t *p, const char *s, const char *end){
+	const char *digits_end=fp_span(s,end,FP_DIGIT);
+	const char *method=fp_skip_sp(digits_end,end);
+	belle_sip_header_cseq_t *header;
+	int value;
+	if (method==digits_end || fp_span(method,end,FP_TOKEN)!=end || method==end) return NULL;
+	if (!fp_number(s,digits_end,&value)) return NULL;
+	header=belle_sip_header_cseq_new();
+	belle_sip_header_cseq_set_seq_number(header,value);
+	belle_sip_header_cseq_set_method(header,fp_copy(p,method,end));
+	return BELLE_SIP_HEADER(header);
+}
+
+static belle_sip_header_t *fp_call_id(fast_parser_t *p, const char *s, const char *end){
+	const char *word_end=fp_span(s,end,FP_WORD);
+	belle_sip_header_call_id_t *header;
+	if (word_end==s) return NULL;
+	if (word_end<end && *word_end=='@'){
+		const char *host_end=fp_span(word_end+1,end,FP_WORD);
+		if (host_end==word_end+1) return NULL;
+		word_end=host_end;
+	}
+	if (word_end!=end) return NULL;
+	header=belle_sip_header_call_id_new();
+	belle_sip_header_call_id_set_call_id(header,fp_copy(p,s,end));
+	return BELLE_SIP_HEADER(header);
+}
+
+static belle_sip_header_t *fp_content_type(fast_parser_t *p, const char *s, const char *end){
+	const char *type_end=fp_span(s,end,FP_TOKEN);
+	const char *subtype_end;
+	const char *cur;
+	belle_sip_header_content_type_t *header;
+	if (type_end==s || type_end==end || *type_end!='/') return NULL;
+	subtype_end=fp_span(type_end+1,end,FP_TOKEN);
+	if (subtype_end==type_end+1) return NULL;
+	/*the grammar handles the type parameter in its own way*/
+	for(cur=subtype_end;(cur=memchr(cur,';',(size_t)(end-cur)))!=NULL;++cur){
+		const char *name=fp_skip_sp(cur+1,end);
+		if (end-name>=4 && strncasecmp(name,"type",4)==0) return NULL;
+	}
+	header=belle_sip_header_content_type_new();
+	belle_sip_header_content_type_set_type(header,fp_copy(p,s,type_end));
+	belle_sip_header_content_type_set_subtype(header,fp_copy(p,type_end+1,subtype_end));
+	cur=subtype_end;
+	if (!fp_params(p,BELLE_SIP_PARAMETERS(header),&cur,end) || cur!=end){
+		belle_sip_object_unref(header);
+		return NULL;
+	}
+	return BELLE_SIP_HEADER(header);
+}
+
+typedef belle_sip_header_t *(*fast_header_parse_func)(fast_parser_t *p, const char *value, const char *end);
+
+/*builds a header from a value given to belle_sip_header_create(), surrounded by white spaces like after the colon*/
+static belle_sip_header_t *fp_header_value(fast_header_parse_func func, const char *value){
+	fast_parser_t p;
+	const char *end;
+	belle_sip_header_t *header;
+
+	if (value==NULL) return NULL;
+	end=value+strlen(value);
+	value=fp_skip_sp(value,end);
+	while(end>value && (end[-1]==' ' || end[-1]=='\t')) --end;
+	if (value==end || memchr(value,'\r',(size_t)(end-value))!=NULL || memchr(value,'\n',(size_t)(end-value))!=NULL) return NULL;
+	p.scratch=p.local;
+	p.scratch_size=sizeof(p.local);
+	fp_reset(&p,(size_t)(end-value));
+	header=func(&p,value,end);
+	if (p.scratch!=p.local) belle_sip_free(p.scratch);
+	return header;
+}
+
+belle_sip_header_t *belle_sip_header_call_id_fast_parse(const char *value){
+	return fp_header_value(fp_call_id,value);
+}
+
+belle_sip_header_t *belle_sip_header_content_length_fast_parse(const char *value){
+	return fp_header_value(fp_content_length,value);
+}
+
+belle_sip_header_t *belle_sip_header_cseq_fast_parse(const char *value){
+	return fp_header_value(fp_cseq,value);
+}
+
+belle_sip_header_t *belle_sip_header_expires_fast_parse(const char *value){
+	return fp_header_value(fp_expires,value);
+}
+
+belle_sip_header_t *belle_sip_header_max_forwards_fast_parse(const char *value){
+	return fp_header_value(fp_max_forwards,value);
+}
+
+static const struct fast_header_parser{
+	const char *name;
+	char compact_name;
+	fast_header_parse_func func;
+}fast_header_parsers[]={
+	{BELLE_SIP_VIA,				'v',	fp_via},
+	{BELLE_SIP_FROM,			'f',	fp_from},
+	{BELLE_SIP_TO,				't',	fp_to},
+	{BELLE_SIP_CALL_ID,			'i',	fp_call_id},
+	{BELLE_SIP_CSEQ,			'\0',	fp_cseq},
+	{BELLE_SIP_CONTACT,			'm',	fp_contact},
+	{BELLE_SIP_MAX_FORWARDS,	'\0',	fp_max_forwards},
+	{BELLE_SIP_CONTENT_LENGTH,	'l',	fp_content_length},
+	{BELLE_SIP_CONTENT_TYPE,	'c',	fp_content_type},
+	{BELLE_SIP_ROUTE,			'\0',	fp_route},
+	{BELLE_SIP_RECORD_ROUTE,	'\0',	fp_record_route},
+	{BELLE_SIP_EXPIRES,			'\0',	fp_expires}
+};
+
+static fast_header_parse_func fp_find_header_parser(const char *name, size_t len){
+	size_t i;
+	for(i=0;i<sizeof(fast_header_parsers)/sizeof(fast_header_parsers[0]);++i){
+		const struct fast_header_parser *hp=&fast_header_parsers[i];
+		if (len==1){
+			if (hp->compact_name!='\0' && tolower((unsigned char)name[0])==hp->compact_name) return hp->func;
+		}else if (strlen(hp->name)==len && strncasecmp(hp->name,name,len)==0) return hp->func;
+	}
+	return NULL;
+}
+
+/*
+ * Adds the header of the line [s,end) to the message, returns FALSE if the line is not a header line.
+ * In lazy mode, the line is kept as is and parsed when the header is accessed.
+ */
+static int fp_header(fast_parser_t *p, belle_sip_message_t *msg, const char *s, const char *end, int lazy){
+	const char *name_end=fp_span(s,end,FP_TOKEN);
+	const char *value=name_end;
+	const char *value_end=end;
+	const char *name;
+	fast_header_parse_func func;
+	belle_sip_header_t *header=NULL;
+
+	if (name_end==s) return FALSE;
+	while(value<end && (*value==' ' || *value=='\t')) ++value;
+	if (value==end || *value!=':') return FALSE;
+	value=fp_skip_sp(value+1,end);
+	if (end-value>=3 && value[0]=='\r' && value[1]=='\n' && value[2]==' '){
+		value=fp_skip_sp(value+2,end);
+	}
+	if (lazy){
+		belle_sip_message_add_raw_header(msg,s,(size_t)(name_end-s),s,(size_t)(end-s),value<end ? value : NULL);
+		return TRUE;
+	}
+	fp_reset(p,(size_t)(end-s));
+	if (value<end && memchr(value,'\r',(size_t)(end-value))==NULL && (func=fp_find_header_parser(s,(size_t)(name_end-s)))!=NULL){
+		/*like the grammar, ignore trailing white spaces*/
+		while(value_end>value && (value_end[-1]==' ' || value_end[-1]=='\t')) --value_end;
+		header=func(p,value,value_end);
+		p->scratch_pos=0;
+	}
+	if (header==NULL){
+		name=fp_copy(p,s,name_end);
+		header=belle_sip_header_create(name,value<end ? fp_copy(p,value,end) : NULL);
+	}
+	for(;header!=NULL;header=belle_sip_header_get_next(header)){
+		belle_sip_message_add_header(msg,header);
+	}
+	return TRUE;
+}
+
+static belle_sip_message_t *fp_request_line(fast_parser_t *p, const char *s, const char *end){
+	const char *method_end=fp_span(s,end,FP_TOKEN);
+	const char *cur;
+	belle_sip_request_t *req;
+	belle_sip_uri_t *uri;
+
+	if (method_end==s || method_end==end || *method_end!=' ') return NULL;
+	cur=method_end+1;
+	if ((uri=fp_uri(p,&cur,end,TRUE))==NULL) return NULL;
+	if (end-cur!=8 || cur[0]!=' ' || strncasecmp(cur+1,"SIP/",4)!=0 || !IS(cur[5],FP_DIGIT) || cur[6]!='.' || !IS(cur[7],FP_DIGIT)){
+		belle_sip_object_unref(uri);
+		return NULL;
+	}
+	req=belle_sip_request_new();
+	belle_sip_request_set_method(req,fp_copy(p,s,method_end));
+	belle_sip_request_set_uri(req,uri);
+	return BELLE_SIP_MESSAGE(req);
+}
+
+static belle_sip_message_t *fp_status_line(fast_parser_t *p, const char *s, const char *end){
+	belle_sip_response_t *resp;
+	/*SIP/2.0 SP 3DIGIT SP reason-phrase, with a non empty reason phrase*/
+	if (end-s<13 || s[7]!=' ' || !IS(s[8],FP_DIGIT) || !IS(s[9],FP_DIGIT) || !IS(s[10],FP_DIGIT) || s[11]!=' '
+		|| !IS(s[4],FP_DIGIT) || s[5]!='.' || !IS(s[6],FP_DIGIT)) return NULL;
+	resp=belle_sip_response_new();
+	belle_sip_response_set_status_code(resp,fp_atoi(s+8,s+11));
+	belle_sip_response_set_reason_phrase(resp,fp_copy(p,s+12,end));
+	return BELLE_SIP_MESSAGE(resp);
+}
+
+static const char *fp_find_crlf(const char *s, const char *end){
+	while(s<end-1){
+		const char *cr=memchr(s,'\r',(size_t)(end-1-s));
+		if (cr==NULL) return NULL;
+		if (cr[1]=='\n') return cr;
+		s=cr+1;
+	}
+	return NULL;
+}
+
+belle_sip_message_t *belle_sip_message_fast_parse_raw(const char *buff, size_t buff_length, size_t *message_length, int lazy){
+	fast_parser_t p;
+	const char *end=buff+buff_length;
+	const char *line_end;
+	const char *cur;
+	belle_sip_message_t *msg;
+	int headers=0;
+
+	p.scratch=p.local;
+	p.scratch_size=sizeof(p.local);
+	p.scratch_pos=0;
+
+	if ((line_end=fp_find_crlf(buff,end))==NULL) return NULL;
+	fp_reset(&p,(size_t)(line_end-buff));
+	if (line_end-buff>4 && strncasecmp(buff,"SIP/",4)==0){
+		msg=fp_status_line(&p,buff,line_end);
+	}else{
+		msg=fp_request_line(&p,buff,line_end);
+	}
+	if (msg==NULL) goto end;
+
+	for(cur=line_end+2;;cur=line_end+2){
+		if (end-cur>=2 && cur[0]=='\r' && cur[1]=='\n'){
+			cur+=2;
+			break;
+		}
+		/*a header ends at the first CRLF that is not followed by a space*/
+		line_end=fp_find_crlf(cur,end);
+		while(line_end!=NULL && end-line_end>2 && line_end[2]==' '){
+			line_end=fp_find_crlf(line_end+2,end);
+		}
+		if (line_end==NULL || !fp_header(&p,msg,cur,line_end,lazy)) goto error;
+		headers++;
+	}
+	if (headers==0) goto error;
+	*message_length=(size_t)(cur-buff);
+	goto end;
+error:
+	belle_sip_object_unref(msg);
+	msg=NULL;
+end:
+	if (p.scratch!=p.local) belle_sip_free(p.scratch);
+	return msg;
+}
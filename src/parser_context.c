@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2012-2019 Belledonne Communications SARL.
+ *
+ * This file is part of belle-sip.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <antlr3.h>
+
+#include "belle_sip_internal.h"
+
+/*parses are nested (a message parse creates headers, which parse their values), so a thread may use a few contexts
+ of a grammar at the same time*/
+#define BELLE_SIP_PARSER_CONTEXT_CACHE_SIZE 4
+
+typedef struct belle_sip_parser_contexts{
+	belle_sip_parser_context_t *free_list[BELLE_SIP_PARSER_GRAMMARS];
+	int count[BELLE_SIP_PARSER_GRAMMARS];
+}belle_sip_parser_contexts_t;
+
+static int parser_context_cache_enabled=TRUE;
+static belle_sip_thread_key_t contexts_key;
+static belle_sip_once_t contexts_key_once=BELLE_SIP_ONCE_INIT;
+static int contexts_key_created=0;
+
+static belle_sip_parser_context_t *parser_context_new(const belle_sip_parser_grammar_t *grammar, const char *name, const char *value, size_t length){
+	belle_sip_parser_context_t *ctx=belle_sip_new0(belle_sip_parser_context_t);
+	ctx->grammar=grammar;
+	ctx->input=antlr3StringStreamNew((pANTLR3_UINT8)value,ANTLR3_ENC_8BIT,(ANTLR3_UINT32)length,(pANTLR3_UINT8)name);
+	grammar->create(ctx);
+	return ctx;
+}
+
+static void parser_context_destroy(belle_sip_parser_context_t *ctx){
+	ctx->grammar->destroy(ctx);
+	ctx->input->close(ctx->input);
+	belle_sip_free(ctx);
+}
+
+static void cleanup_parser_contexts(void *data){
+	belle_sip_parser_contexts_t *contexts=(belle_sip_parser_contexts_t*)data;
+	int i;
+	for(i=0;i<BELLE_SIP_PARSER_GRAMMARS;++i){
+		belle_sip_parser_context_t *ctx,*next;
+		for(ctx=contexts->free_list[i];ctx!=NULL;ctx=next){
+			next=ctx->next;
+			parser_context_destroy(ctx);
+		}
+	}
+	belle_sip_free(contexts);
+}
+
+static void create_contexts_key(void){
+	if (belle_sip_thread_key_create(&contexts_key, cleanup_parser_contexts)==0) contexts_key_created=1;
+}
+
+static belle_sip_parser_contexts_t *get_parser_contexts(int create){
+	belle_sip_parser_contexts_t *contexts;
+
+	belle_sip_once(&contexts_key_once,create_contexts_key);
+	if (!contexts_key_created) return NULL;
+	contexts=(belle_sip_parser_contexts_t*)belle_sip_thread_getspecific(contexts_key);
+	if (contexts==NULL && create){
+		contexts=belle_sip_new0(belle_sip_parser_contexts_t);
+		belle_sip_thread_setspecific(contexts_key,contexts);
+	}
+	return contexts;
+}
+
+/*exceptions are chained and kept by the recognizer until it is freed*/
+static void recognizer_clear_errors(pANTLR3_BASE_RECOGNIZER rec){
+	if (rec->state->exception){
+		rec->state->exception->freeEx(rec->state->exception);
+		rec->state->exception=NULL;
+	}
+	rec->state->error=ANTLR3_FALSE;
+}
+
+/*frees what the last parse left, none of the parsed objects reference it*/
+static void parser_context_clean(belle_sip_parser_context_t *ctx){
+	pANTLR3_STRING_FACTORY strings=ctx->input->strFactory;
+
+	/*the name of the stream is one of the strings*/
+	strings->strings->clear(strings->strings);
+	strings->index=0;
+	ctx->input->istream->streamName=NULL;
+	ctx->input->fileName=NULL;
+	ctx->tokens->reset(ctx->tokens);
+	recognizer_clear_errors(ctx->base_lexer->rec);
+	recognizer_clear_errors(ctx->base_parser->rec);
+}
+
+static void parser_context_reuse(belle_sip_parser_context_t *ctx, const char *name, const char *value, size_t length){
+	ctx->input->reuse(ctx->input,(pANTLR3_UINT8)value,(ANTLR3_UINT32)length,(pANTLR3_UINT8)name);
+	/*gives the new stream name to the token factory and token source*/
+	ctx->base_lexer->setCharStream(ctx->base_lexer,ctx->input);
+	ctx->base_lexer->rec->reset(ctx->base_lexer->rec);
+	ctx->base_parser->rec->reset(ctx->base_parser->rec);
+}
+
+belle_sip_parser_context_t *belle_sip_parser_context_acquire(const belle_sip_parser_grammar_t *grammar, const char *name, const char *value, size_t length){
+	belle_sip_parser_contexts_t *contexts=parser_context_cache_enabled ? get_parser_contexts(TRUE) : NULL;
+	belle_sip_parser_context_t *ctx;
+
+	if (contexts==NULL || contexts->free_list[grammar->index]==NULL){
+		return parser_context_new(grammar,name,value,length);
+	}
+	ctx=contexts->free_list[grammar->index];
+	contexts->free_list[grammar->index]=ctx->next;
+	contexts->count[grammar->index]--;
+	ctx->next=NULL;
+	parser_context_reuse(ctx,name,value,length);
+	return ctx;
+}
+
+void belle_sip_parser_context_release(belle_sip_parser_context_t *ctx){
+	belle_sip_parser_contexts_t *contexts=parser_context_cache_enabled ? get_parser_contexts(TRUE) : NULL;
+	int index=ctx->grammar->index;
+
+	if (contexts==NULL || contexts->count[index]>=BELLE_SIP_PARSER_CONTEXT_CACHE_SIZE){
+		parser_context_destroy(ctx);
+		return;
+	}
+	parser_context_clean(ctx);
+	ctx->next=contexts->free_list[index];
+	contexts->free_list[index]=ctx;
+	contexts->count[index]++;
+}
+
+void belle_sip_parser_context_cache_enable(int enable){
+	belle_sip_parser_contexts_t *contexts;
+
+	parser_context_cache_enabled=enable;
+	if (!enable && (contexts=get_parser_contexts(FALSE))!=NULL){
+		belle_sip_thread_setspecific(contexts_key,NULL);
+		cleanup_parser_contexts(contexts);
+	}
+}
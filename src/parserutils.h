@@ -56,5 +56,6 @@ remove any \
  * */
 BELLESIP_EXPORT char* belle_sip_string_to_backslash_less_unescaped_string(const char* buff);
 BELLESIP_EXPORT char* belle_sip_display_name_to_backslashed_escaped_string(const char* buff);
+BELLESIP_EXPORT void belle_sip_header_address_set_quoted_displayname(belle_sip_header_address_t* address,const char* value);
 
 #endif
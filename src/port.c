@@ -196,6 +196,18 @@ int belle_sip_thread_key_delete(belle_sip_thread_key_t key){
 #endif
 }
 
+void belle_sip_once(belle_sip_once_t *once, void (*func)(void)){
+	intptr_t expected=0;
+	/*0: not run, 1: running, 2: done*/
+	if (belle_sip_atomic_load(once)==2) return;
+	if (belle_sip_atomic_compare_exchange(once,&expected,1)){
+		func();
+		belle_sip_atomic_store(once,2);
+		return;
+	}
+	while(belle_sip_atomic_load(once)!=2) Sleep(0);
+}
+
 #ifndef BELLE_SIP_WINDOWS_DESKTOP
 void belle_sip_sleep(unsigned int ms) {
 	HANDLE sleepEvent = CreateEventEx(NULL, NULL, CREATE_EVENT_MANUAL_RESET, EVENT_ALL_ACCESS);
@@ -254,6 +266,20 @@ int belle_sip_socket_set_dscp(belle_sip_socket_t sock, int ai_family, int dscp){
 #endif
 
 
+int belle_sip_socket_enable_reuse_port(belle_sip_socket_t sock){
+#ifdef SO_REUSEPORT
+	int value=1;
+	int err=bctbx_setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&value, sizeof(value));
+	if (err==-1){
+		belle_sip_warning("belle_sip_socket_enable_reuse_port: bctbx_setsockopt(SO_REUSEPORT) failed: %s",belle_sip_get_socket_error_string());
+	}
+	return err;
+#else
+	belle_sip_warning("belle_sip_socket_enable_reuse_port: SO_REUSEPORT is not supported on this platform.");
+	return -1;
+#endif
+}
+
 int belle_sip_socket_enable_dual_stack(belle_sip_socket_t sock){
 	int value=0;
 	int err=bctbx_setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&value, sizeof(value));
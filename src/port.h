@@ -94,6 +94,8 @@ BELLESIP_EXPORT void belle_sip_uninit_sockets(void);
 int belle_sip_socket_set_nonblocking (belle_sip_socket_t sock);
 int belle_sip_socket_set_dscp(belle_sip_socket_t sock, int ai_family, int dscp);
 int belle_sip_socket_enable_dual_stack(belle_sip_socket_t sock);
+/*allows several sockets to be bound on the same address and port, the kernel balancing incoming traffic among them*/
+int belle_sip_socket_enable_reuse_port(belle_sip_socket_t sock);
 
 #if defined(_WIN32)
 
@@ -108,6 +110,10 @@ int belle_sip_thread_setspecific(belle_sip_thread_key_t key,const void *value);
 const void* belle_sip_thread_getspecific(belle_sip_thread_key_t key);
 int belle_sip_thread_key_delete(belle_sip_thread_key_t key);
 
+typedef volatile intptr_t belle_sip_once_t;
+#define BELLE_SIP_ONCE_INIT 0
+void belle_sip_once(belle_sip_once_t *once, void (*func)(void));
+
 
 static BELLESIP_INLINE void belle_sip_close_socket(belle_sip_socket_t s){
 	closesocket(s);
@@ -180,6 +186,10 @@ typedef pthread_key_t belle_sip_thread_key_t;
 #define belle_sip_thread_getspecific(key)			pthread_getspecific(key)
 #define belle_sip_thread_key_delete(key)				pthread_key_delete(key)
 
+typedef pthread_once_t belle_sip_once_t;
+#define BELLE_SIP_ONCE_INIT PTHREAD_ONCE_INIT
+#define belle_sip_once(once,func)					pthread_once(once,func)
+
 static BELLESIP_INLINE void belle_sip_close_socket(belle_sip_socket_t s){
 	close(s);
 }
@@ -196,4 +206,87 @@ static BELLESIP_INLINE int get_socket_error(void){
 #define BELLESIP_EINPROGRESS BCTBX_EINPROGRESS
 #define belle_sip_error_code_is_would_block(err) ((err)==BELLESIP_EWOULDBLOCK || (err)==BELLESIP_EINPROGRESS)
 
+/*
+ * Atomic operations on intptr_t, and on int for reference counts, with sequentially consistent ordering.
+ */
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#ifdef _WIN64
+#define belle_sip_interlocked_add InterlockedExchangeAdd64
+#define belle_sip_interlocked_exchange InterlockedExchange64
+#define belle_sip_interlocked_compare_exchange InterlockedCompareExchange64
+typedef volatile LONG64 *belle_sip_interlocked_ptr_t;
+#else
+#define belle_sip_interlocked_add InterlockedExchangeAdd
+#define belle_sip_interlocked_exchange InterlockedExchange
+#define belle_sip_interlocked_compare_exchange InterlockedCompareExchange
+typedef volatile LONG *belle_sip_interlocked_ptr_t;
+#endif
+
+static BELLESIP_INLINE intptr_t belle_sip_atomic_load(volatile intptr_t *p){
+	return (intptr_t)belle_sip_interlocked_add((belle_sip_interlocked_ptr_t)p,0);
+}
+
+static BELLESIP_INLINE void belle_sip_atomic_store(volatile intptr_t *p, intptr_t value){
+	belle_sip_interlocked_exchange((belle_sip_interlocked_ptr_t)p,value);
+}
+
+static BELLESIP_INLINE intptr_t belle_sip_atomic_fetch_add(volatile intptr_t *p, intptr_t value){
+	return (intptr_t)belle_sip_interlocked_add((belle_sip_interlocked_ptr_t)p,value);
+}
+
+static BELLESIP_INLINE intptr_t belle_sip_atomic_exchange(volatile intptr_t *p, intptr_t value){
+	return (intptr_t)belle_sip_interlocked_exchange((belle_sip_interlocked_ptr_t)p,value);
+}
+
+/*returns TRUE if *p was equal to *expected and is now desired, otherwise sets *expected to the current value*/
+static BELLESIP_INLINE int belle_sip_atomic_compare_exchange(volatile intptr_t *p, intptr_t *expected, intptr_t desired){
+	intptr_t prev=(intptr_t)belle_sip_interlocked_compare_exchange((belle_sip_interlocked_ptr_t)p,desired,*expected);
+	if (prev==*expected) return 1;
+	*expected=prev;
+	return 0;
+}
+
+static BELLESIP_INLINE int belle_sip_atomic_int_load(volatile int *p){
+	return (int)InterlockedExchangeAdd((volatile LONG*)p,0);
+}
+
+static BELLESIP_INLINE int belle_sip_atomic_int_fetch_add(volatile int *p, int value){
+	return (int)InterlockedExchangeAdd((volatile LONG*)p,value);
+}
+
+#else
+
+static BELLESIP_INLINE intptr_t belle_sip_atomic_load(volatile intptr_t *p){
+	return __atomic_load_n(p,__ATOMIC_SEQ_CST);
+}
+
+static BELLESIP_INLINE void belle_sip_atomic_store(volatile intptr_t *p, intptr_t value){
+	__atomic_store_n(p,value,__ATOMIC_SEQ_CST);
+}
+
+static BELLESIP_INLINE intptr_t belle_sip_atomic_fetch_add(volatile intptr_t *p, intptr_t value){
+	return __atomic_fetch_add(p,value,__ATOMIC_SEQ_CST);
+}
+
+static BELLESIP_INLINE intptr_t belle_sip_atomic_exchange(volatile intptr_t *p, intptr_t value){
+	return __atomic_exchange_n(p,value,__ATOMIC_SEQ_CST);
+}
+
+/*returns TRUE if *p was equal to *expected and is now desired, otherwise sets *expected to the current value*/
+static BELLESIP_INLINE int belle_sip_atomic_compare_exchange(volatile intptr_t *p, intptr_t *expected, intptr_t desired){
+	return __atomic_compare_exchange_n(p,expected,desired,0,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST);
+}
+
+static BELLESIP_INLINE int belle_sip_atomic_int_load(volatile int *p){
+	return __atomic_load_n(p,__ATOMIC_SEQ_CST);
+}
+
+static BELLESIP_INLINE int belle_sip_atomic_int_fetch_add(volatile int *p, int value){
+	return __atomic_fetch_add(p,value,__ATOMIC_SEQ_CST);
+}
+
+#endif
+
 #endif
@@ -93,6 +93,7 @@ static void belle_sip_provider_uninit(belle_sip_provider_t *p){
 	p->auth_contexts=belle_sip_list_free_with_data(p->auth_contexts,(void(*)(void*))belle_sip_authorization_destroy);
 	p->dialogs=belle_sip_list_free_with_data(p->dialogs,belle_sip_object_unref);
 	p->lps=belle_sip_list_free_with_data(p->lps,belle_sip_object_unref);
+	if (p->stack->shard) p->stack->providers=belle_sip_list_remove(p->stack->providers,p);
 }
 
 static void channel_state_changed(belle_sip_channel_listener_t *obj, belle_sip_channel_t *chan, belle_sip_channel_state_t state){
@@ -387,14 +388,14 @@ static void compute_hash_from_invariants(belle_sip_message_t *msg, char *branchi
 
 static char *compute_rfc2543_branch(belle_sip_request_t *req, char *branchid, size_t branchid_size){
 	md5_state_t ctx;
-	unsigned int cseq=belle_sip_header_cseq_get_seq_number(belle_sip_message_get_header_by_type(req,belle_sip_header_cseq_t));
+	unsigned int cseq=belle_sip_header_cseq_get_seq_number(belle_sip_message_peek_header_by_type(req,belle_sip_header_cseq_t));
 	uint8_t digest[16];
-	const char* callid=belle_sip_header_call_id_get_call_id(belle_sip_message_get_header_by_type(req,belle_sip_header_call_id_t));
-	belle_sip_header_via_t *via=belle_sip_message_get_header_by_type(req,belle_sip_header_via_t);
+	const char* callid=belle_sip_header_call_id_get_call_id(belle_sip_message_peek_header_by_type(req,belle_sip_header_call_id_t));
+	belle_sip_header_via_t *via=belle_sip_message_peek_header_by_type(req,belle_sip_header_via_t);
 	const char *v_branch=belle_sip_header_via_get_branch(via);
-	belle_sip_header_from_t *from=belle_sip_message_get_header_by_type(req,belle_sip_header_from_t);
+	belle_sip_header_from_t *from=belle_sip_message_peek_header_by_type(req,belle_sip_header_from_t);
 	char *from_str=belle_sip_object_to_string(from);
-	belle_sip_header_to_t *to=belle_sip_message_get_header_by_type(req,belle_sip_header_to_t);
+	belle_sip_header_to_t *to=belle_sip_message_peek_header_by_type(req,belle_sip_header_to_t);
 	char *to_str=belle_sip_object_to_string(belle_sip_header_address_get_uri((belle_sip_header_address_t*)to));
 
 	belle_sip_md5_init(&ctx);
@@ -439,8 +440,9 @@ static void channel_on_message_headers(belle_sip_channel_listener_t *obj, belle_
 }
 
 static void channel_on_message(belle_sip_channel_listener_t *obj, belle_sip_channel_t *chan, belle_sip_message_t *msg){
+	belle_sip_provider_t *prov=BELLE_SIP_PROVIDER(obj);
 	belle_sip_object_ref(msg);
-	belle_sip_provider_dispatch_message(BELLE_SIP_PROVIDER(obj),msg);
+	belle_sip_provider_dispatch_message(prov,msg);
 }
 
 static int channel_on_auth_requested(belle_sip_channel_listener_t *obj, belle_sip_channel_t *chan, const char* distinguished_name){
@@ -567,6 +569,8 @@ belle_sip_provider_t *belle_sip_provider_new(belle_sip_stack_t *s, belle_sip_lis
 	p->stack=s;
 	p->rport_enabled=1;
 	p->unconditional_answer = 480;
+	/*shards look up the listening point receiving the datagrams forwarded by the other shards*/
+	if (s->shard) s->providers=belle_sip_list_append(s->providers,p);
 	if (lp) belle_sip_provider_add_listening_point(p,lp);
 	return p;
 }
@@ -740,15 +744,15 @@ belle_sip_dialog_t *belle_sip_provider_find_dialog_from_message(belle_sip_provid
 			return req->dialog;
 	}
 
-	to=belle_sip_message_get_header_by_type(msg,belle_sip_header_to_t);
+	to=belle_sip_message_peek_header_by_type(msg,belle_sip_header_to_t);
 
 	if (to==NULL || (to_tag=belle_sip_header_to_get_tag(to))==NULL){
 		/* a request without to tag cannot be part of a dialog */
 		return NULL;
 	}
 
-	call_id=belle_sip_message_get_header_by_type(msg,belle_sip_header_call_id_t);
-	from=belle_sip_message_get_header_by_type(msg,belle_sip_header_from_t);
+	call_id=belle_sip_message_peek_header_by_type(msg,belle_sip_header_call_id_t);
+	from=belle_sip_message_peek_header_by_type(msg,belle_sip_header_from_t);
 
 	if (call_id==NULL || from==NULL || (from_tag=belle_sip_header_from_get_tag(from))==NULL) return NULL;
 
@@ -946,8 +950,8 @@ static int client_transaction_match(const void *p_tr, const void *p_matcher){
 belle_sip_client_transaction_t * belle_sip_provider_find_matching_client_transaction(belle_sip_provider_t *prov,
 																				   belle_sip_response_t *resp){
 	struct client_transaction_matcher matcher;
-	belle_sip_header_via_t *via=(belle_sip_header_via_t*)belle_sip_message_get_header((belle_sip_message_t*)resp,"via");
-	belle_sip_header_cseq_t *cseq=(belle_sip_header_cseq_t*)belle_sip_message_get_header((belle_sip_message_t*)resp,"cseq");
+	belle_sip_header_via_t *via=(belle_sip_header_via_t*)belle_sip_message_peek_header((belle_sip_message_t*)resp,"via");
+	belle_sip_header_cseq_t *cseq=(belle_sip_header_cseq_t*)belle_sip_message_peek_header((belle_sip_message_t*)resp,"cseq");
 	belle_sip_client_transaction_t *ret=NULL;
 	belle_sip_list_t *elem;
 	if (via==NULL){
@@ -1012,7 +1016,7 @@ static int transaction_match(const void *p_tr, const void *p_matcher){
 
 belle_sip_transaction_t * belle_sip_provider_find_matching_transaction(belle_sip_list_t *transactions, belle_sip_request_t *req){
 	struct transaction_matcher matcher;
-	belle_sip_header_via_t *via=(belle_sip_header_via_t*)belle_sip_message_get_header((belle_sip_message_t*)req,"via");
+	belle_sip_header_via_t *via=(belle_sip_header_via_t*)belle_sip_message_peek_header((belle_sip_message_t*)req,"via");
 	belle_sip_transaction_t *ret=NULL;
 	belle_sip_list_t *elem=NULL;
 	const char *branch;
@@ -1356,7 +1360,7 @@ void belle_sip_provider_set_recv_error(belle_sip_provider_t *prov, int recv_erro
 	for(lps=prov->lps;lps!=NULL;lps=lps->next){
 		for(channels=((belle_sip_listening_point_t*)lps->data)->channels;channels!=NULL;channels=channels->next){
 			((belle_sip_channel_t*)channels->data)->simulated_recv_return=recv_error;
-			((belle_sip_source_t*)channels->data)->notify_required=(recv_error<=0);
+			belle_sip_source_set_notify_required((belle_sip_source_t*)channels->data,recv_error<=0);
 		}
 	}
 }
@@ -157,6 +157,7 @@ belle_sip_stack_t * belle_sip_stack_new(const char *properties){
 	stack->dns_srv_enabled=TRUE;
 	stack->dns_search_enabled=TRUE;
 	stack->inactive_transport_timeout=3600; /*one hour*/
+	stack->max_messages_per_read=belle_sip_default_max_messages_per_read;
 	return stack;
 }
 
@@ -321,6 +322,14 @@ void belle_sip_stack_set_inactive_transport_timeout(belle_sip_stack_t *stack, in
 	stack->inactive_transport_timeout=seconds;
 }
 
+void belle_sip_stack_set_max_messages_per_read(belle_sip_stack_t *stack, int max_messages){
+	stack->max_messages_per_read=max_messages;
+}
+
+int belle_sip_stack_get_max_messages_per_read(const belle_sip_stack_t *stack){
+	return stack->max_messages_per_read;
+}
+
 void belle_sip_stack_set_default_dscp(belle_sip_stack_t *stack, int dscp){
 	stack->dscp=dscp;
 }
@@ -358,3 +367,328 @@ int belle_sip_stack_reconnect_to_primary_asap_enabled(const belle_sip_stack_t *s
 void belle_sip_stack_set_client_bind_port(belle_sip_stack_t *stack, int port){
 	stack->test_bind_port = port;
 }
+
+void belle_sip_stack_enable_reuse_port(belle_sip_stack_t *stack, int enabled){
+	stack->reuse_port=(unsigned char)enabled;
+}
+
+int belle_sip_stack_reuse_port_enabled(const belle_sip_stack_t *stack){
+	return stack->reuse_port;
+}
+
+/*
+ * Sharded stack
+ */
+
+typedef struct belle_sip_forwarded_datagram{
+	struct belle_sip_forwarded_datagram *next;
+	int port; /*of the listening point that received the datagram*/
+	struct sockaddr_storage addr; /*of the sender*/
+	socklen_t addrlen;
+	char *data; /*allocated with the structure*/
+	size_t size;
+}belle_sip_forwarded_datagram_t;
+
+typedef struct belle_sip_shard{
+	belle_sip_sharded_stack_t *parent;
+	int index;
+	bctbx_thread_t thread;
+	belle_sip_stack_t *stack;
+	int running;
+	bctbx_mutex_t forwarded_mutex;
+	belle_sip_forwarded_datagram_t *forwarded_first; /*datagrams handed over by the other shards, protected by forwarded_mutex*/
+	belle_sip_forwarded_datagram_t *forwarded_last;
+	int accepting; /*datagrams are handed over between the end of the start and the beginning of the stop, protected by forwarded_mutex*/
+}belle_sip_shard_t;
+
+struct belle_sip_sharded_stack{
+	belle_sip_object_t base;
+	belle_sip_shard_t *shards;
+	int nshards;
+	char *properties;
+	belle_sip_shard_func_t on_start;
+	belle_sip_shard_func_t on_stop;
+	void *user_data;
+	bctbx_mutex_t mutex;
+	bctbx_cond_t started_cond;
+};
+
+/*takes the datagrams handed over to the shard*/
+static belle_sip_forwarded_datagram_t *belle_sip_shard_take_forwarded(belle_sip_shard_t *shard){
+	belle_sip_forwarded_datagram_t *first;
+	bctbx_mutex_lock(&shard->forwarded_mutex);
+	first=shard->forwarded_first;
+	shard->forwarded_first=shard->forwarded_last=NULL;
+	bctbx_mutex_unlock(&shard->forwarded_mutex);
+	return first;
+}
+
+static void *belle_sip_shard_thread(void *data){
+	belle_sip_shard_t *shard=(belle_sip_shard_t*)data;
+	belle_sip_sharded_stack_t *obj=shard->parent;
+	belle_sip_stack_t *stack;
+	belle_sip_forwarded_datagram_t *fwd,*next;
+
+	/*the stack is created from the thread of the shard, so that its main loop owns the object pool of this thread*/
+	stack=belle_sip_stack_new(obj->properties);
+	belle_sip_stack_enable_reuse_port(stack,TRUE);
+	stack->shard=shard;
+	if (obj->on_start) obj->on_start(stack,shard->index,obj->user_data);
+
+	bctbx_mutex_lock(&obj->mutex);
+	shard->stack=stack;
+	shard->running=TRUE;
+	bctbx_cond_signal(&obj->started_cond);
+	bctbx_mutex_unlock(&obj->mutex);
+
+	belle_sip_stack_main(stack);
+
+	/*no datagram is handed over anymore, the ones that were not dispatched are dropped*/
+	for(fwd=belle_sip_shard_take_forwarded(shard);fwd!=NULL;fwd=next){
+		next=fwd->next;
+		belle_sip_free(fwd);
+	}
+	if (obj->on_stop) obj->on_stop(stack,shard->index,obj->user_data);
+	belle_sip_object_unref(stack);
+	return NULL;
+}
+
+static void belle_sip_shard_quit(void *data){
+	belle_sip_main_loop_quit((belle_sip_main_loop_t*)data);
+}
+
+static void belle_sip_sharded_stack_destroy(belle_sip_sharded_stack_t *obj){
+	int i;
+	for(i=0;i<obj->nshards;++i){
+		if (obj->shards[i].running && bctbx_thread_self()==obj->shards[i].thread){
+			belle_sip_fatal("Sharded stack [%p] released from the thread of its shard [%i], it cannot be stopped from there",obj,i);
+		}
+	}
+	/*once cleared, no shard posts to the main loop of another one, which may be stopped below*/
+	for(i=0;i<obj->nshards;++i){
+		belle_sip_shard_t *shard=&obj->shards[i];
+		bctbx_mutex_lock(&shard->forwarded_mutex);
+		shard->accepting=FALSE;
+		bctbx_mutex_unlock(&shard->forwarded_mutex);
+	}
+	for(i=0;i<obj->nshards;++i){
+		belle_sip_shard_t *shard=&obj->shards[i];
+		if (shard->running){
+			belle_sip_main_loop_do_later(shard->stack->ml,belle_sip_shard_quit,shard->stack->ml);
+			bctbx_thread_join(shard->thread,NULL);
+		}
+		bctbx_mutex_destroy(&shard->forwarded_mutex);
+	}
+	bctbx_cond_destroy(&obj->started_cond);
+	bctbx_mutex_destroy(&obj->mutex);
+	belle_sip_free(obj->shards);
+	if (obj->properties) belle_sip_free(obj->properties);
+}
+
+BELLE_SIP_DECLARE_NO_IMPLEMENTED_INTERFACES(belle_sip_sharded_stack_t);
+BELLE_SIP_INSTANCIATE_VPTR(belle_sip_sharded_stack_t,belle_sip_object_t,belle_sip_sharded_stack_destroy,NULL,NULL,FALSE);
+
+static int belle_sip_get_processor_count(void){
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long count=sysconf(_SC_NPROCESSORS_ONLN);
+	return count>0 ? (int)count : 1;
+#else
+	return 1;
+#endif
+}
+
+belle_sip_sharded_stack_t *belle_sip_sharded_stack_new(int nshards, const char *properties, belle_sip_shard_func_t on_start, belle_sip_shard_func_t on_stop, void *user_data){
+	belle_sip_sharded_stack_t *obj=belle_sip_object_new(belle_sip_sharded_stack_t);
+	int i;
+
+	if (nshards<=0) nshards=belle_sip_get_processor_count();
+	obj->nshards=nshards;
+	obj->shards=belle_sip_malloc0(nshards*sizeof(belle_sip_shard_t));
+	obj->properties=properties ? belle_sip_strdup(properties) : NULL;
+	obj->on_start=on_start;
+	obj->on_stop=on_stop;
+	obj->user_data=user_data;
+	bctbx_mutex_init(&obj->mutex,NULL);
+	bctbx_cond_init(&obj->started_cond,NULL);
+
+	for(i=0;i<nshards;++i){
+		belle_sip_shard_t *shard=&obj->shards[i];
+
+		shard->parent=obj;
+		shard->index=i;
+		bctbx_mutex_init(&shard->forwarded_mutex,NULL);
+		if (bctbx_thread_create(&shard->thread,NULL,belle_sip_shard_thread,shard)!=0){
+			belle_sip_fatal("Cannot create thread for shard [%i] of sharded stack [%p]",i,obj);
+		}
+		/*shards are started one after the other, so that on_start() callbacks are never run concurrently*/
+		bctbx_mutex_lock(&obj->mutex);
+		while(!shard->running) bctbx_cond_wait(&obj->started_cond,&obj->mutex);
+		bctbx_mutex_unlock(&obj->mutex);
+	}
+	for(i=0;i<nshards;++i){
+		belle_sip_shard_t *shard=&obj->shards[i];
+		bctbx_mutex_lock(&shard->forwarded_mutex);
+		shard->accepting=TRUE;
+		bctbx_mutex_unlock(&shard->forwarded_mutex);
+	}
+	belle_sip_message("Sharded stack [%p] started with [%i] shards",obj,nshards);
+	return obj;
+}
+
+int belle_sip_sharded_stack_get_shard_count(const belle_sip_sharded_stack_t *obj){
+	return obj->nshards;
+}
+
+belle_sip_stack_t *belle_sip_sharded_stack_get_stack(const belle_sip_sharded_stack_t *obj, int shard_index){
+	if (shard_index<0 || shard_index>=obj->nshards){
+		belle_sip_error("belle_sip_sharded_stack_get_stack(): invalid shard index [%i]",shard_index);
+		return NULL;
+	}
+	return obj->shards[shard_index].stack;
+}
+
+static int belle_sip_sharded_stack_hash_call_id(const belle_sip_sharded_stack_t *obj, const char *call_id, size_t length){
+	/*FNV-1a*/
+	uint32_t hash=2166136261u;
+	size_t i;
+	for(i=0;i<length;++i){
+		hash^=(unsigned char)call_id[i];
+		hash*=16777619u;
+	}
+	return (int)(hash % (uint32_t)obj->nshards);
+}
+
+int belle_sip_sharded_stack_get_shard_for_call_id(const belle_sip_sharded_stack_t *obj, const char *call_id){
+	return belle_sip_sharded_stack_hash_call_id(obj,call_id,strlen(call_id));
+}
+
+int belle_sip_stack_get_shard_index(const belle_sip_stack_t *stack){
+	return stack->shard ? stack->shard->index : -1;
+}
+
+int belle_sip_sharded_stack_get_shard_for_transaction(const belle_sip_sharded_stack_t *obj, const belle_sip_transaction_t *t){
+	return belle_sip_stack_get_shard_index(t->provider->stack);
+}
+
+void belle_sip_sharded_stack_post(belle_sip_sharded_stack_t *obj, int shard_index, belle_sip_callback_t func, void *data){
+	belle_sip_stack_t *stack=belle_sip_sharded_stack_get_stack(obj,shard_index);
+	if (stack) belle_sip_main_loop_do_later(stack->ml,func,data);
+}
+
+void belle_sip_sharded_stack_post_for_call_id(belle_sip_sharded_stack_t *obj, const char *call_id, belle_sip_callback_t func, void *data){
+	belle_sip_sharded_stack_post(obj,belle_sip_sharded_stack_get_shard_for_call_id(obj,call_id),func,data);
+}
+
+static int is_header_name(const char *name, size_t length, const char *expected){
+	return strlen(expected)==length && strncasecmp(name,expected,length)==0;
+}
+
+/*finds the value of the Call-ID header in the raw text of a message, without parsing it*/
+static const char *belle_sip_find_raw_call_id(const char *data, size_t size, size_t *length){
+	const char *end=data+size;
+	const char *line=memchr(data,'\n',size); /*the start line is skipped*/
+
+	while(line!=NULL && ++line<end){
+		const char *eol=memchr(line,'\n',(size_t)(end-line));
+		const char *colon,*name_end,*value,*value_end;
+
+		if (eol==NULL) return NULL; /*truncated*/
+		if (line[0]=='\r' || line[0]=='\n') return NULL; /*end of headers*/
+		colon=memchr(line,':',(size_t)(eol-line));
+		if (colon!=NULL){
+			name_end=colon;
+			while(name_end>line && (name_end[-1]==' ' || name_end[-1]=='\t')) --name_end;
+			if (is_header_name(line,(size_t)(name_end-line),BELLE_SIP_CALL_ID) || is_header_name(line,(size_t)(name_end-line),"i")){
+				value=colon+1;
+				value_end=eol;
+				while(value<value_end && (*value==' ' || *value=='\t')) ++value;
+				while(value_end>value && (value_end[-1]=='\r' || value_end[-1]==' ' || value_end[-1]=='\t')) --value_end;
+				if (value==value_end) return NULL;
+				*length=(size_t)(value_end-value);
+				return value;
+			}
+		}
+		line=eol;
+	}
+	return NULL;
+}
+
+static belle_sip_listening_point_t *belle_sip_stack_find_udp_listening_point(belle_sip_stack_t *stack, int port){
+	belle_sip_list_t *elem;
+	for(elem=stack->providers;elem!=NULL;elem=elem->next){
+		belle_sip_listening_point_t *lp=belle_sip_provider_get_listening_point((belle_sip_provider_t*)elem->data,"UDP");
+		if (lp && belle_sip_listening_point_get_port(lp)==port) return lp;
+	}
+	return NULL;
+}
+
+/*runs in the thread of the shard the datagrams were handed over to*/
+static void belle_sip_shard_dispatch_forwarded(void *data){
+	belle_sip_shard_t *shard=(belle_sip_shard_t*)data;
+	belle_sip_forwarded_datagram_t *fwd,*next;
+
+	for(fwd=belle_sip_shard_take_forwarded(shard);fwd!=NULL;fwd=next){
+		belle_sip_listening_point_t *lp=belle_sip_stack_find_udp_listening_point(shard->stack,fwd->port);
+		next=fwd->next;
+		if (lp){
+			/*received as if it had come to the socket of this shard, the message is only parsed here*/
+			belle_sip_udp_listening_point_process_datagram(lp,fwd->data,fwd->size,(struct sockaddr*)&fwd->addr,fwd->addrlen);
+		}else{
+			belle_sip_warning("Shard [%i] has no UDP listening point on port [%i], dropping forwarded datagram",shard->index,fwd->port);
+		}
+		belle_sip_free(fwd);
+	}
+}
+
+int belle_sip_stack_forward_datagram_to_shard(belle_sip_stack_t *stack, belle_sip_socket_t sock, int port, const char *peeked, size_t peeked_size,
+	int truncated, const struct sockaddr *addr, socklen_t addrlen){
+	belle_sip_sharded_stack_t *obj=stack->shard->parent;
+	belle_sip_shard_t *target;
+	belle_sip_forwarded_datagram_t *fwd;
+	const char *call_id;
+	size_t call_id_length=0;
+	size_t size;
+	int received;
+	int was_empty;
+
+	call_id=belle_sip_find_raw_call_id(peeked,peeked_size,&call_id_length);
+	if (call_id==NULL || addrlen>(socklen_t)sizeof(fwd->addr)) return FALSE; /*processed by the shard which received it*/
+	target=&obj->shards[belle_sip_sharded_stack_hash_call_id(obj,call_id,call_id_length)];
+	if (target==stack->shard) return FALSE;
+
+	/*the peeked bytes are the whole datagram unless they filled the buffer*/
+	size=truncated ? belle_sip_network_buffer_size : peeked_size;
+	fwd=(belle_sip_forwarded_datagram_t*)belle_sip_malloc(sizeof(belle_sip_forwarded_datagram_t)+size);
+	fwd->data=(char*)(fwd+1);
+	received=(int)bctbx_recvfrom(sock,fwd->data,size,0,NULL,NULL);
+	if (received<=0){
+		/*the datagram is gone, nothing to hand over*/
+		belle_sip_free(fwd);
+		return TRUE;
+	}
+	fwd->next=NULL;
+	fwd->size=(size_t)received;
+	fwd->port=port;
+	memcpy(&fwd->addr,addr,addrlen);
+	fwd->addrlen=addrlen;
+
+	bctbx_mutex_lock(&target->forwarded_mutex);
+	if (!target->accepting){
+		bctbx_mutex_unlock(&target->forwarded_mutex);
+		belle_sip_free(fwd);
+		return TRUE;
+	}
+	was_empty=target->forwarded_first==NULL;
+	if (was_empty) target->forwarded_first=fwd;
+	else target->forwarded_last->next=fwd;
+	target->forwarded_last=fwd;
+	/*only the first datagram queued since the last dispatch needs a task, posted under the lock so that the target main
+	 loop cannot be stopped meanwhile*/
+	if (was_empty) belle_sip_main_loop_do_later(target->stack->ml,belle_sip_shard_dispatch_forwarded,target);
+	bctbx_mutex_unlock(&target->forwarded_mutex);
+	return TRUE;
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2012-2019 Belledonne Communications SARL.
+ *
+ * This file is part of belle-sip.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "belle_sip_internal.h"
+
+#define LEVEL0_SIZE (1<<BELLE_SIP_TIMER_WHEEL_LEVEL0_BITS)
+#define LEVELN_SIZE (1<<BELLE_SIP_TIMER_WHEEL_LEVELN_BITS)
+#define EXPIRED_SLOT BELLE_SIP_TIMER_WHEEL_SLOTS
+/*entries further than this are parked in the last level and re-inserted when cascaded*/
+#define MAX_DELTA ((((uint64_t)1)<<(BELLE_SIP_TIMER_WHEEL_LEVEL0_BITS+(BELLE_SIP_TIMER_WHEEL_LEVELS-1)*BELLE_SIP_TIMER_WHEEL_LEVELN_BITS))-1)
+
+static int level_shift(int level){
+	return level==0 ? 0 : BELLE_SIP_TIMER_WHEEL_LEVEL0_BITS+(level-1)*BELLE_SIP_TIMER_WHEEL_LEVELN_BITS;
+}
+
+static int level_size(int level){
+	return level==0 ? LEVEL0_SIZE : LEVELN_SIZE;
+}
+
+/*number of the first slot of a level*/
+static int level_base(int level){
+	return level==0 ? 0 : LEVEL0_SIZE+(level-1)*LEVELN_SIZE;
+}
+
+static int level_index(int level, uint64_t time_ms){
+	return (int)((time_ms>>level_shift(level)) & (uint64_t)(level_size(level)-1));
+}
+
+static int count_trailing_zeros(uint64_t v){
+#if defined(__GNUC__)
+	return __builtin_ctzll(v);
+#else
+	int n=0;
+	while ((v & 1)==0){
+		v>>=1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * Returns the offset from 'from' of the first occupied slot of the level, searching circularly, or -1 if the level
+ * is empty.
+ */
+static int find_next_occupied(const belle_sip_timer_wheel_t *tw, int level, int from){
+	int size=level_size(level);
+	const uint64_t *bits=tw->occupancy+level_base(level)/64;
+	int offset=0;
+
+	/*levels are made of whole 64 bits words*/
+	while (offset<size){
+		int index=(from+offset) & (size-1);
+		uint64_t word=bits[index/64]>>(index%64);
+		if (word!=0){
+			return offset+count_trailing_zeros(word);
+		}
+		/*skip to the beginning of next word*/
+		offset+=64-(index%64);
+	}
+	return -1;
+}
+
+static void slot_append(belle_sip_timer_wheel_slot_t *slot, belle_sip_timer_wheel_entry_t *entry){
+	entry->next=NULL;
+	entry->prev=slot->tail;
+	if (slot->tail) slot->tail->next=entry;
+	else slot->head=entry;
+	slot->tail=entry;
+}
+
+static void slot_prepend(belle_sip_timer_wheel_slot_t *slot, belle_sip_timer_wheel_entry_t *entry){
+	entry->prev=NULL;
+	entry->next=slot->head;
+	if (slot->head) slot->head->prev=entry;
+	else slot->tail=entry;
+	slot->head=entry;
+}
+
+static void slot_unlink(belle_sip_timer_wheel_slot_t *slot, belle_sip_timer_wheel_entry_t *entry){
+	if (entry->prev) entry->prev->next=entry->next;
+	else slot->head=entry->next;
+	if (entry->next) entry->next->prev=entry->prev;
+	else slot->tail=entry->prev;
+	entry->prev=entry->next=NULL;
+}
+
+static void set_occupied(belle_sip_timer_wheel_t *tw, int slot, int yesno){
+	uint64_t mask=((uint64_t)1)<<(slot%64);
+	if (yesno) tw->occupancy[slot/64]|=mask;
+	else tw->occupancy[slot/64]&=~mask;
+}
+
+void belle_sip_timer_wheel_init(belle_sip_timer_wheel_t *tw, uint64_t now_ms){
+	memset(tw,0,sizeof(*tw));
+	tw->current_ms=now_ms;
+}
+
+/*put the entry in the slot matching its expiration time, without changing the count*/
+static void timer_wheel_place(belle_sip_timer_wheel_t *tw, belle_sip_timer_wheel_entry_t *entry){
+	uint64_t delta;
+	uint64_t slot_time=entry->expire_ms;
+	int level;
+	int slot;
+
+	if (entry->expire_ms<=tw->current_ms){
+		slot_append(&tw->expired,entry);
+		entry->slot=EXPIRED_SLOT+1;
+		return;
+	}
+	delta=entry->expire_ms-tw->current_ms;
+	if (delta>MAX_DELTA){
+		delta=MAX_DELTA;
+		slot_time=tw->current_ms+MAX_DELTA;
+	}
+	for(level=0;level<BELLE_SIP_TIMER_WHEEL_LEVELS-1;++level){
+		if (delta < (((uint64_t)1)<<level_shift(level+1))) break;
+	}
+	slot=level_base(level)+level_index(level,slot_time);
+	slot_append(&tw->slots[slot],entry);
+	set_occupied(tw,slot,TRUE);
+	entry->slot=(unsigned short)(slot+1);
+}
+
+void belle_sip_timer_wheel_insert(belle_sip_timer_wheel_t *tw, belle_sip_timer_wheel_entry_t *entry, uint64_t expire_ms){
+	if (belle_sip_timer_wheel_entry_linked(entry)){
+		belle_sip_timer_wheel_remove(tw,entry);
+	}
+	entry->expire_ms=expire_ms;
+	timer_wheel_place(tw,entry);
+	tw->count++;
+}
+
+void belle_sip_timer_wheel_insert_expired(belle_sip_timer_wheel_t *tw, belle_sip_timer_wheel_entry_t *entry){
+	if (belle_sip_timer_wheel_entry_linked(entry)){
+		belle_sip_timer_wheel_remove(tw,entry);
+	}
+	entry->expire_ms=0;
+	slot_prepend(&tw->expired,entry);
+	entry->slot=EXPIRED_SLOT+1;
+	tw->count++;
+}
+
+void belle_sip_timer_wheel_remove(belle_sip_timer_wheel_t *tw, belle_sip_timer_wheel_entry_t *entry){
+	int slot;
+	if (!belle_sip_timer_wheel_entry_linked(entry)) return;
+	slot=entry->slot-1;
+	if (slot==EXPIRED_SLOT){
+		slot_unlink(&tw->expired,entry);
+	}else{
+		slot_unlink(&tw->slots[slot],entry);
+		if (tw->slots[slot].head==NULL) set_occupied(tw,slot,FALSE);
+	}
+	entry->slot=0;
+	tw->count--;
+}
+
+/*detach all entries of a slot, returning them as a list*/
+static belle_sip_timer_wheel_entry_t *slot_take(belle_sip_timer_wheel_t *tw, int slot){
+	belle_sip_timer_wheel_entry_t *head=tw->slots[slot].head;
+	tw->slots[slot].head=tw->slots[slot].tail=NULL;
+	set_occupied(tw,slot,FALSE);
+	return head;
+}
+
+static void slot_expire(belle_sip_timer_wheel_t *tw, int slot){
+	belle_sip_timer_wheel_entry_t *entry,*next;
+	for(entry=slot_take(tw,slot);entry!=NULL;entry=next){
+		next=entry->next;
+		slot_append(&tw->expired,entry);
+		entry->slot=EXPIRED_SLOT+1;
+	}
+}
+
+/*called when current_ms reaches the beginning of a level 0 turn*/
+static void timer_wheel_cascade(belle_sip_timer_wheel_t *tw){
+	int level;
+	for(level=1;level<BELLE_SIP_TIMER_WHEEL_LEVELS;++level){
+		int index=level_index(level,tw->current_ms);
+		belle_sip_timer_wheel_entry_t *entry,*next;
+		for(entry=slot_take(tw,level_base(level)+index);entry!=NULL;entry=next){
+			next=entry->next;
+			timer_wheel_place(tw,entry);
+		}
+		/*upper level only moves when this one completes a turn*/
+		if (index!=0) break;
+	}
+}
+
+/*time at which next slot expires or is cascaded, (uint64_t)-1 if the wheel has no pending entry*/
+static uint64_t timer_wheel_next_event(const belle_sip_timer_wheel_t *tw){
+	uint64_t next=(uint64_t)-1;
+	int level;
+	int offset;
+
+	offset=find_next_occupied(tw,0,level_index(0,tw->current_ms+1));
+	if (offset>=0){
+		next=tw->current_ms+1+offset;
+	}
+	for(level=1;level<BELLE_SIP_TIMER_WHEEL_LEVELS;++level){
+		int shift=level_shift(level);
+		offset=find_next_occupied(tw,level,(level_index(level,tw->current_ms)+1) & (LEVELN_SIZE-1));
+		if (offset>=0){
+			uint64_t cascade_ms=((tw->current_ms>>shift)+offset+1)<<shift;
+			if (cascade_ms<next) next=cascade_ms;
+		}
+	}
+	return next;
+}
+
+void belle_sip_timer_wheel_advance(belle_sip_timer_wheel_t *tw, uint64_t now_ms){
+	while (tw->current_ms<now_ms){
+		uint64_t next=timer_wheel_next_event(tw);
+		int index;
+
+		if (next>now_ms){
+			/*nothing happens in between, jump directly*/
+			tw->current_ms=now_ms;
+			break;
+		}
+		tw->current_ms=next;
+		index=level_index(0,next);
+		if (index==0){
+			/*beginning of a new turn: bring entries of upper levels down before expiring the first slot*/
+			timer_wheel_cascade(tw);
+		}
+		if (tw->slots[index].head) slot_expire(tw,index);
+	}
+}
+
+int belle_sip_timer_wheel_get_next_expiry(const belle_sip_timer_wheel_t *tw, uint64_t *next_ms){
+	if (tw->count==0) return FALSE;
+	if (tw->expired.head){
+		*next_ms=tw->current_ms;
+	}else{
+		*next_ms=timer_wheel_next_event(tw);
+	}
+	return TRUE;
+}
+
+belle_sip_timer_wheel_entry_t *belle_sip_timer_wheel_get_expired(const belle_sip_timer_wheel_t *tw){
+	return tw->expired.head;
+}
+
+belle_sip_timer_wheel_entry_t *belle_sip_timer_wheel_find_custom(const belle_sip_timer_wheel_t *tw, belle_sip_timer_wheel_match_func_t func, const void *user_data){
+	belle_sip_timer_wheel_entry_t *entry;
+	int slot;
+
+	for(entry=tw->expired.head;entry!=NULL;entry=entry->next){
+		if (func(entry,user_data)==0) return entry;
+	}
+	for(slot=0;slot<BELLE_SIP_TIMER_WHEEL_SLOTS;++slot){
+		if (tw->occupancy[slot/64]==0){
+			slot+=63; /*whole word is empty*/
+			continue;
+		}
+		for(entry=tw->slots[slot].head;entry!=NULL;entry=entry->next){
+			if (func(entry,user_data)==0) return entry;
+		}
+	}
+	return NULL;
+}
+
+static int match_any(const belle_sip_timer_wheel_entry_t *entry, const void *user_data){
+	(void)entry;
+	(void)user_data;
+	return 0;
+}
+
+belle_sip_timer_wheel_entry_t *belle_sip_timer_wheel_get_first(const belle_sip_timer_wheel_t *tw){
+	if (tw->count==0) return NULL;
+	return belle_sip_timer_wheel_find_custom(tw,match_any,NULL);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2012-2019 Belledonne Communications SARL.
+ *
+ * This file is part of belle-sip.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BELLE_SIP_TIMER_WHEEL_H
+#define BELLE_SIP_TIMER_WHEEL_H
+
+/*
+ * Hierarchical timing wheel with millisecond resolution, used by the main loop to store its timer sources.
+ * Level 0 has one slot per millisecond for the next 256 ms, each upper level has 64 slots each covering a
+ * whole turn of the level below. Entries are cascaded to lower levels as time advances, and an occupancy bitmap
+ * allows to find the next non-empty slot without walking empty ones.
+ * Insertion and removal are O(1) and allocation free, the entry being embedded in the timed object.
+ * The wheel is not thread safe: the caller is responsible for locking.
+ */
+
+#define BELLE_SIP_TIMER_WHEEL_LEVELS 5
+#define BELLE_SIP_TIMER_WHEEL_LEVEL0_BITS 8
+#define BELLE_SIP_TIMER_WHEEL_LEVELN_BITS 6
+#define BELLE_SIP_TIMER_WHEEL_SLOTS ((1<<BELLE_SIP_TIMER_WHEEL_LEVEL0_BITS) + (BELLE_SIP_TIMER_WHEEL_LEVELS-1)*(1<<BELLE_SIP_TIMER_WHEEL_LEVELN_BITS))
+
+typedef struct belle_sip_timer_wheel_entry belle_sip_timer_wheel_entry_t;
+
+struct belle_sip_timer_wheel_entry{
+	belle_sip_timer_wheel_entry_t *prev;
+	belle_sip_timer_wheel_entry_t *next;
+	void *data;
+	uint64_t expire_ms; /*key of the entry in the wheel, 0 for entries put in front of the expired list*/
+	unsigned short slot; /*slot number + 1, 0 when not in a wheel*/
+};
+
+typedef struct belle_sip_timer_wheel_slot{
+	belle_sip_timer_wheel_entry_t *head;
+	belle_sip_timer_wheel_entry_t *tail;
+}belle_sip_timer_wheel_slot_t;
+
+typedef struct belle_sip_timer_wheel{
+	uint64_t current_ms; /*time up to which the wheel has been advanced*/
+	size_t count;
+	belle_sip_timer_wheel_slot_t expired; /*entries whose expiration time is reached*/
+	belle_sip_timer_wheel_slot_t slots[BELLE_SIP_TIMER_WHEEL_SLOTS];
+	uint64_t occupancy[BELLE_SIP_TIMER_WHEEL_SLOTS/64];
+}belle_sip_timer_wheel_t;
+
+typedef int (*belle_sip_timer_wheel_match_func_t)(const belle_sip_timer_wheel_entry_t *entry, const void *user_data);
+
+BELLE_SIP_BEGIN_DECLS
+
+void belle_sip_timer_wheel_init(belle_sip_timer_wheel_t *tw, uint64_t now_ms);
+
+/*
+ * Inserts the entry so that it expires at expire_ms. An entry whose expiration time is already reached goes directly
+ * to the end of the expired list.
+ */
+void belle_sip_timer_wheel_insert(belle_sip_timer_wheel_t *tw, belle_sip_timer_wheel_entry_t *entry, uint64_t expire_ms);
+
+/*
+ * Puts the entry in front of the expired list, so that it is reported at next advance.
+ */
+void belle_sip_timer_wheel_insert_expired(belle_sip_timer_wheel_t *tw, belle_sip_timer_wheel_entry_t *entry);
+
+void belle_sip_timer_wheel_remove(belle_sip_timer_wheel_t *tw, belle_sip_timer_wheel_entry_t *entry);
+
+/*
+ * Moves all entries expiring before or at now_ms to the expired list, in expiration order.
+ * Entries stay in the expired list until they are removed or re-inserted.
+ */
+void belle_sip_timer_wheel_advance(belle_sip_timer_wheel_t *tw, uint64_t now_ms);
+
+/*
+ * Returns TRUE and sets next_ms to the time at which the wheel needs to be advanced, or FALSE if it is empty.
+ * The returned time is never later than the first expiration, but may be earlier when entries need to be cascaded.
+ */
+int belle_sip_timer_wheel_get_next_expiry(const belle_sip_timer_wheel_t *tw, uint64_t *next_ms);
+
+belle_sip_timer_wheel_entry_t *belle_sip_timer_wheel_get_expired(const belle_sip_timer_wheel_t *tw);
+
+/*
+ * Returns any entry of the wheel, or NULL if it is empty.
+ */
+belle_sip_timer_wheel_entry_t *belle_sip_timer_wheel_get_first(const belle_sip_timer_wheel_t *tw);
+
+belle_sip_timer_wheel_entry_t *belle_sip_timer_wheel_find_custom(const belle_sip_timer_wheel_t *tw, belle_sip_timer_wheel_match_func_t func, const void *user_data);
+
+#define belle_sip_timer_wheel_size(tw) ((tw)->count)
+#define belle_sip_timer_wheel_entry_linked(entry) ((entry)->slot!=0)
+
+BELLE_SIP_END_DECLS
+
+#endif
@@ -345,7 +345,7 @@ BELLE_SIP_INSTANCIATE_CUSTOM_VPTR_END
 
 void belle_sip_server_transaction_init(belle_sip_server_transaction_t *t, belle_sip_provider_t *prov,belle_sip_request_t *req){
 	const char *branch;
-	belle_sip_header_via_t *via=BELLE_SIP_HEADER_VIA(belle_sip_message_get_header((belle_sip_message_t*)req,"via"));
+	belle_sip_header_via_t *via=BELLE_SIP_HEADER_VIA(belle_sip_message_peek_header((belle_sip_message_t*)req,"via"));
 	branch=belle_sip_header_via_get_branch(via);
 	if (branch==NULL || strncmp(branch,BELLE_SIP_BRANCH_MAGIC_COOKIE,strlen(BELLE_SIP_BRANCH_MAGIC_COOKIE))!=0){
 		branch=req->rfc2543_branch;
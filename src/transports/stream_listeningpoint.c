@@ -23,15 +23,16 @@ static int on_new_connection(void *userdata, unsigned int events);
 
 
 void belle_sip_stream_listening_point_destroy_server_socket(belle_sip_stream_listening_point_t *lp){
-	if (lp->server_sock!=(belle_sip_socket_t)-1){
-		belle_sip_close_socket(lp->server_sock);
-		lp->server_sock=-1;
-	}
+	/*the source is removed before the socket is closed*/
 	if (lp->source){
 		belle_sip_main_loop_remove_source(lp->base.stack->ml,lp->source);
 		belle_sip_object_unref(lp->source);
 		lp->source=NULL;
 	}
+	if (lp->server_sock!=(belle_sip_socket_t)-1){
+		belle_sip_close_socket(lp->server_sock);
+		lp->server_sock=-1;
+	}
 }
 
 static void belle_sip_stream_listening_point_uninit(belle_sip_stream_listening_point_t *lp){
@@ -62,7 +63,7 @@ BELLE_SIP_INSTANCIATE_CUSTOM_VPTR_BEGIN(belle_sip_stream_listening_point_t)
 BELLE_SIP_INSTANCIATE_CUSTOM_VPTR_END
 
 
-static belle_sip_socket_t create_server_socket(const char *addr, int * port, int *family){
+static belle_sip_socket_t create_server_socket(const char *addr, int * port, int *family, int reuse_port){
 	struct addrinfo hints={0};
 	struct addrinfo *res=NULL;
 	int err;
@@ -96,6 +97,9 @@ static belle_sip_socket_t create_server_socket(const char *addr, int * port, int
 	if (err == -1){
 		belle_sip_warning ("Fail to set SIP/TCP address reusable: %s.", belle_sip_get_socket_error_string());
 	}
+	if (reuse_port){
+		belle_sip_socket_enable_reuse_port(sock);
+	}
 	if (res->ai_family==AF_INET6){
 		belle_sip_socket_enable_dual_stack(sock);
 	}
@@ -135,7 +139,7 @@ void belle_sip_stream_listening_point_setup_server_socket(belle_sip_stream_liste
 	int port=belle_sip_uri_get_port(obj->base.listening_uri);
 
 	obj->server_sock=create_server_socket(belle_sip_uri_get_host(obj->base.listening_uri),
-		&port, &obj->base.ai_family);
+		&port, &obj->base.ai_family, obj->base.stack->reuse_port);
 	if (obj->server_sock==(belle_sip_socket_t)-1) return;
 	belle_sip_uri_set_port(((belle_sip_listening_point_t*)obj)->listening_uri,port);
 	if (obj->base.stack->dscp)
@@ -64,7 +64,7 @@ BELLE_SIP_INSTANCIATE_CUSTOM_VPTR_BEGIN(belle_sip_udp_listening_point_t)
 BELLE_SIP_INSTANCIATE_CUSTOM_VPTR_END
 
 
-static belle_sip_socket_t create_udp_socket(const char *addr, int *port, int *family){
+static belle_sip_socket_t create_udp_socket(const char *addr, int *port, int *family, int reuse_port){
 	struct addrinfo hints={0};
 	struct addrinfo *res=NULL;
 	int err;
@@ -99,6 +99,9 @@ static belle_sip_socket_t create_udp_socket(const char *addr, int *port, int *fa
 	if (err == -1){
 		belle_sip_warning ("Fail to set SIP/UDP address reusable: %s.", belle_sip_get_socket_error_string());
 	}
+	if (reuse_port){
+		belle_sip_socket_enable_reuse_port(sock);
+	}
 	if (res->ai_family==AF_INET6){
 		belle_sip_socket_enable_dual_stack(sock);
 	}
@@ -131,7 +134,7 @@ static int on_udp_data(belle_sip_udp_listening_point_t *lp, unsigned int events)
 static int belle_sip_udp_listening_point_init_socket(belle_sip_udp_listening_point_t *lp){
 	int port=belle_sip_uri_get_listening_port(((belle_sip_listening_point_t*)lp)->listening_uri);
 	lp->sock=create_udp_socket(belle_sip_uri_get_host(((belle_sip_listening_point_t*)lp)->listening_uri)
-					,&port,&lp->base.ai_family);
+					,&port,&lp->base.ai_family,lp->base.stack->reuse_port);
 	if (lp->sock==(belle_sip_socket_t)-1){
 		return -1;
 	}
@@ -148,6 +151,30 @@ static void belle_sip_udp_listening_point_init(belle_sip_udp_listening_point_t *
 	belle_sip_udp_listening_point_init_socket(lp);
 }
 
+/*finds the channel of the peer, creating it if it does not exist*/
+static belle_sip_channel_t *get_channel_for_peer(belle_sip_udp_listening_point_t *lp, const struct sockaddr *addr, socklen_t addrlen){
+	belle_sip_channel_t *chan;
+	struct addrinfo ai={0};
+	/*preserve the V4 mapping*/
+	ai.ai_family=addr->sa_family;
+	ai.ai_addr=(struct sockaddr*)addr;
+	ai.ai_addrlen=addrlen;
+	chan=_belle_sip_listening_point_get_channel((belle_sip_listening_point_t*)lp,NULL,&ai);
+	if (chan==NULL){
+		/*TODO: should rather create the channel with real local ip and port and not just 0.0.0.0"*/
+		chan=belle_sip_channel_new_udp_with_addr(lp->base.stack
+												,(int)lp->sock
+												,belle_sip_uri_get_host(lp->base.listening_uri)
+												,belle_sip_uri_get_port(lp->base.listening_uri)
+												,&ai);
+		if (chan!=NULL){
+			belle_sip_message("udp_listening_point: new channel created to %s:%i",chan->peer_name,chan->peer_port);
+			belle_sip_listening_point_add_channel((belle_sip_listening_point_t*)lp,chan);
+		}
+	}
+	return chan;
+}
+
 /*peek data from the master socket to see where it comes from, and dispatch to matching channel.
  * If the channel does not exist, create it */
 static int on_udp_data(belle_sip_udp_listening_point_t *lp, unsigned int events){
@@ -171,24 +198,13 @@ static int on_udp_data(belle_sip_udp_listening_point_t *lp, unsigned int events)
 			belle_sip_udp_listening_point_init_socket(lp);
 		}else{
 			belle_sip_channel_t *chan;
-			struct addrinfo ai={0};
-			/*preserve the V4 mapping*/
-			ai.ai_family=addr.ss_family;
-			ai.ai_addr=(struct sockaddr*)&addr;
-			ai.ai_addrlen=addrlen;
-			chan=_belle_sip_listening_point_get_channel((belle_sip_listening_point_t*)lp,NULL,&ai);
-			if (chan==NULL){
-				/*TODO: should rather create the channel with real local ip and port and not just 0.0.0.0"*/
-				chan=belle_sip_channel_new_udp_with_addr(lp->base.stack
-														,(int)lp->sock
-														,belle_sip_uri_get_host(lp->base.listening_uri)
-														,belle_sip_uri_get_port(lp->base.listening_uri)
-														,&ai);
-				if (chan!=NULL){
-					belle_sip_message("udp_listening_point: new channel created to %s:%i",chan->peer_name,chan->peer_port);
-					belle_sip_listening_point_add_channel((belle_sip_listening_point_t*)lp,chan);
-				}
+			/*datagrams of the calls owned by another shard are handed over before being parsed*/
+			if (lp->base.stack->shard && belle_sip_stack_forward_datagram_to_shard(lp->base.stack,lp->sock
+					,belle_sip_uri_get_port(lp->base.listening_uri),(const char*)buf,(size_t)err,err==(int)sizeof(buf)
+					,(struct sockaddr*)&addr,addrlen)){
+				return BELLE_SIP_CONTINUE;
 			}
+			chan=get_channel_for_peer(lp,(struct sockaddr*)&addr,addrlen);
 			if (chan){
 				/*notify the channel*/
 				belle_sip_debug("Notifying udp channel, local [%s:%i]  remote [%s:%i]"
@@ -203,6 +219,11 @@ static int on_udp_data(belle_sip_udp_listening_point_t *lp, unsigned int events)
 	return BELLE_SIP_CONTINUE;
 }
 
+void belle_sip_udp_listening_point_process_datagram(belle_sip_listening_point_t *lp, const char *data, size_t size, const struct sockaddr *addr, socklen_t addrlen){
+	belle_sip_channel_t *chan=get_channel_for_peer((belle_sip_udp_listening_point_t*)lp,addr,addrlen);
+	if (chan) belle_sip_channel_process_datagram(chan,data,size);
+}
+
 belle_sip_listening_point_t * belle_sip_udp_listening_point_new(belle_sip_stack_t *s, const char *ipaddress, int port){
 	belle_sip_udp_listening_point_t *lp=belle_sip_object_new(belle_sip_udp_listening_point_t);
 	belle_sip_udp_listening_point_init(lp,s,ipaddress, port);
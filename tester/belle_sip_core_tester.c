@@ -149,6 +149,52 @@ static void test_object_data(void)
 
 }
 
+#define DATA_STORE_KEYS 200
+
+typedef struct data_store_order{
+	int next;
+	int mismatches;
+}data_store_order_t;
+
+static void check_data_store_order(const char *name, void *data, void *udata){
+	data_store_order_t *order=(data_store_order_t*)udata;
+	/*removed keys are skipped, the others are visited in insertion order*/
+	if (order->next%3==0) order->next++;
+	if (VOIDPTR_TO_INT(data)!=order->next) order->mismatches++;
+	order->next++;
+}
+
+static void test_object_data_many_keys(void){
+	belle_sip_object_t *obj=belle_sip_object_new(belle_sip_object_t);
+	data_store_order_t order={0};
+	char key[32];
+	int i;
+
+	for(i=0;i<DATA_STORE_KEYS;++i){
+		snprintf(key,sizeof(key),"key-%i",i);
+		BC_ASSERT_EQUAL(belle_sip_object_data_set(obj,key,INT_TO_VOIDPTR(i),NULL),0,int,"%d");
+	}
+	for(i=0;i<DATA_STORE_KEYS;++i){
+		snprintf(key,sizeof(key),"key-%i",i);
+		BC_ASSERT_EQUAL(VOIDPTR_TO_INT(belle_sip_object_data_get(obj,key)),i,int,"%d");
+	}
+	for(i=0;i<DATA_STORE_KEYS;i+=3){
+		snprintf(key,sizeof(key),"key-%i",i);
+		if (i%2) BC_ASSERT_EQUAL(belle_sip_object_data_remove(obj,key),0,int,"%d");
+		else BC_ASSERT_EQUAL(VOIDPTR_TO_INT(belle_sip_object_data_grab(obj,key)),i,int,"%d");
+	}
+	for(i=0;i<DATA_STORE_KEYS;++i){
+		snprintf(key,sizeof(key),"key-%i",i);
+		BC_ASSERT_EQUAL(belle_sip_object_data_exists(obj,key),i%3!=0,int,"%d");
+		if (i%3!=0) BC_ASSERT_EQUAL(VOIDPTR_TO_INT(belle_sip_object_data_get(obj,key)),i,int,"%d");
+	}
+	BC_ASSERT_EQUAL(belle_sip_object_data_remove(obj,"key-0"),1,int,"%d");
+	BC_ASSERT_PTR_NULL(belle_sip_object_data_grab(obj,"key-0"));
+	belle_sip_object_data_foreach(obj,check_data_store_order,&order);
+	BC_ASSERT_EQUAL(order.mismatches,0,int,"%d");
+	belle_sip_object_unref(obj);
+}
+
 static void test_dictionary(void)
 {
 	belle_sip_dict_t* obj = belle_sip_object_new(belle_sip_dict_t);
@@ -338,13 +384,382 @@ static void test_truncated_compressed_body(void) {
 	belle_sip_object_unref(mbh);
 }
 
+static const char *cached_invite="INVITE sip:bob@sip.example.org;transport=tcp SIP/2.0\r\n"
+	"Via: SIP/2.0/TCP 192.168.1.10:5060;branch=z9hG4bK.a1b2c3d4;rport\r\n"
+	"Via: SIP/2.0/UDP 10.0.0.2:5062;branch=z9hG4bK.e5f6a7b8;received=192.168.1.2\r\n"
+	"Max-Forwards: 70\r\n"
+	"Record-Route: <sip:proxy.example.org;transport=tcp;lr>\r\n"
+	"From: \"Alice\" <sip:alice@sip.example.org>;tag=9fxced76sl\r\n"
+	"To: <sip:bob@sip.example.org>\r\n"
+	"Call-ID: 3848276298220188511@192.168.1.10\r\n"
+	"CSeq: 20 INVITE\r\n"
+	"Contact: <sip:alice@192.168.1.10:5060;transport=tcp>;+sip.instance=\"<urn:uuid:f81d4fae-7dec-11d0-a765-00a0c91e6bf6>\"\r\n"
+	"Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO, UPDATE\r\n"
+	"Supported: replaces, outbound, gruu\r\n"
+	"User-Agent: belle-sip tester\r\n"
+	"Content-Type: application/sdp\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+
+#define CACHED_INVITE_PARSINGS 2000
+
+static uint64_t parse_invites(void){
+	uint64_t start=bctbx_get_cur_time_ms();
+	int i;
+	for(i=0;i<CACHED_INVITE_PARSINGS;++i){
+		belle_sip_message_t *msg=belle_sip_message_parse(cached_invite);
+		if (!BC_ASSERT_PTR_NOT_NULL(msg)) break;
+		belle_sip_object_unref(msg);
+	}
+	return bctbx_get_cur_time_ms()-start;
+}
+
+static void check_cache_stats(const char *type_name, const belle_sip_object_cache_stats_t *stats, void *user_data){
+	int *via_hits=(int*)user_data;
+	BC_ASSERT_TRUE(stats->cached<=belle_sip_object_get_cache_size());
+	BC_ASSERT_TRUE(stats->cache_hits<=stats->allocations);
+	if (strcmp(type_name,"belle_sip_header_via_t")==0) *via_hits=(int)stats->cache_hits;
+}
+
+static void test_object_caches(void){
+	uint64_t without_cache,with_cache;
+	int via_hits=0;
+
+	BC_ASSERT_EQUAL(belle_sip_object_get_cache_size(),0,int,"%i");
+	without_cache=parse_invites();
+	belle_sip_object_set_cache_size(256);
+	with_cache=parse_invites();
+	belle_sip_message("%i INVITE parsed and destroyed in %" PRIu64 " ms without object caches, %" PRIu64 " ms with object caches",
+		CACHED_INVITE_PARSINGS,without_cache,with_cache);
+	belle_sip_object_foreach_cache_stats(check_cache_stats,&via_hits);
+	/*once the first message is destroyed, its Via headers are reused by the next ones*/
+	BC_ASSERT_GREATER(via_hits,CACHED_INVITE_PARSINGS,int,"%i");
+	belle_sip_object_set_cache_size(0);
+	belle_sip_object_flush_caches();
+	via_hits=-1;
+	belle_sip_object_foreach_cache_stats(check_cache_stats,&via_hits);
+	BC_ASSERT_EQUAL(via_hits,-1,int,"%i");
+}
+
+/*
+ * Returns the number of allocations done to parse and destroy one INVITE, and when it is parsed in an arena, the number
+ * of objects and blocks of the arena.
+ */
+static int count_invite_allocations(int *arena_objects, int *arena_blocks){
+	belle_sip_message_t *msg;
+	*arena_objects=*arena_blocks=0;
+	belle_sip_tester_start_counting_allocations();
+	msg=belle_sip_message_parse(cached_invite);
+	if (msg){
+		belle_sip_object_arena_t *arena=BELLE_SIP_OBJECT(msg)->arena;
+		if (arena){
+			*arena_objects=belle_sip_object_arena_get_object_count(arena);
+			*arena_blocks=belle_sip_object_arena_get_block_count(arena);
+		}
+		belle_sip_object_unref(msg);
+	}
+	return belle_sip_tester_stop_counting_allocations();
+}
+
+static void test_message_arena(void){
+	belle_sip_message_t *msg;
+	belle_sip_header_via_t *via;
+	belle_sip_object_arena_t *arena;
+	uint64_t without_arena,with_arena;
+	int allocs_without_arena,allocs_with_arena,arena_objects,arena_blocks;
+
+	BC_ASSERT_EQUAL((int)belle_sip_message_get_parse_arena_size(),0,int,"%i");
+	without_arena=parse_invites();
+	allocs_without_arena=count_invite_allocations(&arena_objects,&arena_blocks);
+	BC_ASSERT_EQUAL(arena_objects,0,int,"%i");
+	belle_sip_message_set_parse_arena_size(4096);
+	with_arena=parse_invites();
+	allocs_with_arena=count_invite_allocations(&arena_objects,&arena_blocks);
+	belle_sip_message("%i INVITE parsed and destroyed in %" PRIu64 " ms without arena, %" PRIu64 " ms with arena",
+		CACHED_INVITE_PARSINGS,without_arena,with_arena);
+	belle_sip_message("An INVITE is parsed with %i allocations without arena, %i with arena (%i%%): %i objects taken from %i arena blocks",
+		allocs_without_arena,allocs_with_arena,allocs_without_arena ? allocs_with_arena*100/allocs_without_arena : 0,arena_objects,arena_blocks);
+	/*
+	 * Only the objects come from the arena, their strings, lists and parameters remain allocated separately: each
+	 * object of the message saves an allocation, less the blocks of the arena.
+	 */
+	BC_ASSERT_GREATER(arena_objects,10,int,"%i");
+	BC_ASSERT_LOWER(allocs_with_arena,allocs_without_arena-arena_objects+arena_blocks,int,"%i");
+
+	msg=belle_sip_message_parse(cached_invite);
+	if (!BC_ASSERT_PTR_NOT_NULL(msg)) goto end;
+	arena=BELLE_SIP_OBJECT(msg)->arena;
+	if (!BC_ASSERT_PTR_NOT_NULL(arena)) goto end;
+	via=belle_sip_message_get_header_by_type(msg,belle_sip_header_via_t);
+	BC_ASSERT_PTR_EQUAL(BELLE_SIP_OBJECT(via)->arena,arena);
+	BC_ASSERT_GREATER(belle_sip_object_arena_get_object_count(arena),10,int,"%i");
+	/*a header kept beyond its message keeps the arena alive*/
+	belle_sip_object_ref(via);
+	belle_sip_object_unref(msg);
+	BC_ASSERT_EQUAL(belle_sip_object_arena_get_object_count(arena),1,int,"%i");
+	BC_ASSERT_STRING_EQUAL(belle_sip_header_via_get_host(via),"192.168.1.10");
+	belle_sip_object_unref(via);
+
+	/*objects created outside of parsing are not taken from the arena*/
+	via=belle_sip_header_via_new();
+	BC_ASSERT_PTR_NULL(BELLE_SIP_OBJECT(via)->arena);
+	belle_sip_object_unref(via);
+end:
+	belle_sip_message_set_parse_arena_size(0);
+}
+
+#define SHARING_THREADS 4
+#define SHARED_REFS 100000
+
+typedef struct shared_message_ctx{
+	belle_sip_message_t *msg;
+	belle_sip_header_call_id_t *call_id;
+	bctbx_thread_t thread;
+	int call_id_mismatches;
+}shared_message_ctx_t;
+
+static void *ref_shared_message(void *data){
+	shared_message_ctx_t *ctx=(shared_message_ctx_t*)data;
+	int i;
+	for(i=0;i<SHARED_REFS;++i){
+		belle_sip_object_ref(ctx->msg);
+		if (strcmp(belle_sip_header_call_id_get_call_id(ctx->call_id),"3848276298220188511@192.168.1.10")!=0)
+			ctx->call_id_mismatches++;
+		belle_sip_object_unref(ctx->msg);
+	}
+	return NULL;
+}
+
+static void on_shared_message_destroyed(void *data, belle_sip_object_t *obj){
+	(*(int*)data)++;
+}
+
+static void test_shared_objects(void){
+	shared_message_ctx_t ctx[SHARING_THREADS];
+	belle_sip_message_t *msg;
+	belle_sip_header_call_id_t *call_id;
+	int destroyed=0;
+	int i;
+
+	msg=belle_sip_message_parse(cached_invite);
+	if (!BC_ASSERT_PTR_NOT_NULL(msg)) return;
+	/*getters may parse or copy headers on first access: the threads only read what is fetched here*/
+	call_id=belle_sip_message_get_header_by_type(msg,belle_sip_header_call_id_t);
+	if (!BC_ASSERT_PTR_NOT_NULL(call_id)){
+		belle_sip_object_unref(msg);
+		return;
+	}
+	BC_ASSERT_FALSE(belle_sip_object_is_shared(msg));
+	belle_sip_object_set_shared(msg);
+	BC_ASSERT_TRUE(belle_sip_object_is_shared(msg));
+	belle_sip_object_weak_ref(msg,on_shared_message_destroyed,&destroyed);
+	for(i=0;i<SHARING_THREADS;++i){
+		ctx[i].msg=msg;
+		ctx[i].call_id=call_id;
+		ctx[i].call_id_mismatches=0;
+		bctbx_thread_create(&ctx[i].thread,NULL,ref_shared_message,&ctx[i]);
+	}
+	for(i=0;i<SHARING_THREADS;++i){
+		bctbx_thread_join(ctx[i].thread,NULL);
+		BC_ASSERT_EQUAL(ctx[i].call_id_mismatches,0,int,"%i");
+	}
+	/*no reference was lost nor added by concurrent updates*/
+	BC_ASSERT_EQUAL(destroyed,0,int,"%i");
+	BC_ASSERT_EQUAL(BELLE_SIP_OBJECT(msg)->ref,1,int,"%i");
+	belle_sip_object_unref(msg);
+	BC_ASSERT_EQUAL(destroyed,1,int,"%i");
+
+	/*sharing a base type shares the types derived from it*/
+	BC_ASSERT_EQUAL(belle_sip_object_set_type_shared(BELLE_SIP_TYPE_ID(belle_sip_message_t),TRUE),0,int,"%i");
+	msg=belle_sip_message_parse(cached_invite);
+	if (BC_ASSERT_PTR_NOT_NULL(msg)){
+		BC_ASSERT_TRUE(belle_sip_object_is_shared(msg));
+		BC_ASSERT_FALSE(belle_sip_object_is_shared(belle_sip_message_get_header(msg,"Via")));
+		belle_sip_object_unref(msg);
+	}
+	belle_sip_object_set_type_shared(BELLE_SIP_TYPE_ID(belle_sip_message_t),FALSE);
+	msg=belle_sip_message_parse(cached_invite);
+	if (BC_ASSERT_PTR_NOT_NULL(msg)){
+		BC_ASSERT_FALSE(belle_sip_object_is_shared(msg));
+		belle_sip_object_unref(msg);
+	}
+
+	/*any number of types can be shared*/
+	BC_ASSERT_EQUAL(belle_sip_object_set_type_shared(BELLE_SIP_TYPE_ID(belle_sip_header_t),TRUE),0,int,"%i");
+	for(i=0;i<32;++i){
+		BC_ASSERT_EQUAL(belle_sip_object_set_type_shared((belle_sip_type_id_t)(BELLE_SIP_TYPE_ID(belle_sip_message_t)+1000+i),TRUE),0,int,"%i");
+	}
+	msg=belle_sip_message_parse(cached_invite);
+	if (BC_ASSERT_PTR_NOT_NULL(msg)){
+		BC_ASSERT_FALSE(belle_sip_object_is_shared(msg));
+		BC_ASSERT_TRUE(belle_sip_object_is_shared(belle_sip_message_get_header(msg,"Via")));
+		belle_sip_object_unref(msg);
+	}
+	for(i=0;i<32;++i){
+		belle_sip_object_set_type_shared((belle_sip_type_id_t)(BELLE_SIP_TYPE_ID(belle_sip_message_t)+1000+i),FALSE);
+	}
+	belle_sip_object_set_type_shared(BELLE_SIP_TYPE_ID(belle_sip_header_t),FALSE);
+}
+
+#define POOLED_OBJECTS 10000
+
+static void on_pooled_object_destroyed(void *data, belle_sip_object_t *obj){
+	(*(int*)data)++;
+}
+
+static void test_object_pool(void){
+	belle_sip_object_pool_t *pool=belle_sip_object_pool_push();
+	belle_sip_header_via_t **vias=belle_sip_malloc0(sizeof(belle_sip_header_via_t*)*POOLED_OBJECTS);
+	belle_sip_header_via_t *floating;
+	uint64_t start=bctbx_get_cur_time_ms();
+	int destroyed=0;
+	int i;
+
+	for(i=0;i<POOLED_OBJECTS;++i){
+		vias[i]=belle_sip_header_via_new();
+		belle_sip_object_weak_ref(vias[i],on_pooled_object_destroyed,&destroyed);
+		BC_ASSERT_PTR_EQUAL(BELLE_SIP_OBJECT(vias[i])->pool,pool);
+	}
+	/*owning objects takes them out of the pool, wherever they are in it*/
+	for(i=0;i<POOLED_OBJECTS;i+=2){
+		belle_sip_object_ref(vias[i]);
+		BC_ASSERT_PTR_NULL(BELLE_SIP_OBJECT(vias[i])->pool);
+	}
+	/*an unowned object can also be destroyed before the pool is cleaned*/
+	floating=belle_sip_header_via_new();
+	belle_sip_object_unref(floating);
+
+	belle_sip_object_unref(pool);
+	belle_sip_message("%i objects pooled and collected in %" PRIu64 " ms",POOLED_OBJECTS,bctbx_get_cur_time_ms()-start);
+	BC_ASSERT_EQUAL(destroyed,POOLED_OBJECTS/2,int,"%i");
+	for(i=0;i<POOLED_OBJECTS;i+=2){
+		BC_ASSERT_EQUAL(BELLE_SIP_OBJECT(vias[i])->ref,1,int,"%i");
+		belle_sip_object_unref(vias[i]);
+	}
+	BC_ASSERT_EQUAL(destroyed,POOLED_OBJECTS,int,"%i");
+	belle_sip_free(vias);
+}
+
+typedef struct type_stats_lookup{
+	const char *type_name;
+	belle_sip_object_type_stats_t stats;
+	int found;
+}type_stats_lookup_t;
+
+static void find_type_stats(const char *type_name, const belle_sip_object_type_stats_t *stats, void *user_data){
+	type_stats_lookup_t *lookup=(type_stats_lookup_t*)user_data;
+	if (strcmp(type_name,lookup->type_name)==0){
+		lookup->stats=*stats;
+		lookup->found++;
+	}
+}
+
+static void get_type_stats(const char *type_name, type_stats_lookup_t *lookup){
+	memset(lookup,0,sizeof(*lookup));
+	lookup->type_name=type_name;
+	belle_sip_object_foreach_type_stats(find_type_stats,lookup);
+}
+
+#define COUNTED_OBJECTS 100
+
+static void test_type_stats(void){
+	belle_sip_header_call_id_t *call_ids[COUNTED_OBJECTS];
+	belle_sip_header_call_id_t *clone;
+	type_stats_lookup_t before,after;
+	char *table;
+	int i;
+
+	call_ids[0]=BELLE_SIP_HEADER_CALL_ID(belle_sip_object_ref(belle_sip_header_call_id_new()));
+	get_type_stats("belle_sip_header_call_id_t",&before);
+	BC_ASSERT_EQUAL(before.found,1,int,"%d");
+	for(i=1;i<COUNTED_OBJECTS;++i){
+		call_ids[i]=BELLE_SIP_HEADER_CALL_ID(belle_sip_object_ref(belle_sip_header_call_id_new()));
+	}
+	clone=BELLE_SIP_HEADER_CALL_ID(belle_sip_object_clone_and_ref(BELLE_SIP_OBJECT(call_ids[0])));
+	get_type_stats("belle_sip_header_call_id_t",&after);
+	BC_ASSERT_EQUAL((int)(after.stats.live-before.stats.live),COUNTED_OBJECTS,int,"%d");
+	BC_ASSERT_EQUAL((int)(after.stats.allocations-before.stats.allocations),COUNTED_OBJECTS,int,"%d");
+	BC_ASSERT_EQUAL((int)(after.stats.live_bytes/after.stats.live),(int)(before.stats.live_bytes/before.stats.live),int,"%d");
+
+	table=belle_sip_object_type_stats_to_string();
+	BC_ASSERT_PTR_NOT_NULL(strstr(table,"belle_sip_header_call_id_t"));
+	belle_sip_message("Live objects:\n%s",table);
+	belle_sip_free(table);
+
+	for(i=0;i<COUNTED_OBJECTS;++i){
+		belle_sip_object_unref(call_ids[i]);
+	}
+	belle_sip_object_unref(clone);
+	get_type_stats("belle_sip_header_call_id_t",&after);
+	BC_ASSERT_EQUAL((int)after.stats.live,(int)before.stats.live-1,int,"%d");
+}
+
+typedef struct leak_samples_lookup{
+	const char *type_name;
+	unsigned int count;
+	int calls;
+	char oldest_name[32];
+}leak_samples_lookup_t;
+
+static void find_leak_samples(const char *type_name, const belle_sip_object_leak_samples_t *samples, void *user_data){
+	leak_samples_lookup_t *lookup=(leak_samples_lookup_t*)user_data;
+	lookup->calls++;
+	if (strcmp(type_name,lookup->type_name)==0){
+		lookup->count=samples->count;
+		if (samples->oldest_name) snprintf(lookup->oldest_name,sizeof(lookup->oldest_name),"%s",samples->oldest_name);
+	}
+}
+
+#define LEAK_SAMPLING_PERIOD 10
+
+static void test_leak_sampling(void){
+	belle_sip_header_call_id_t *call_ids[COUNTED_OBJECTS];
+	leak_samples_lookup_t lookup;
+	int i;
+
+	belle_sip_object_enable_leak_sampling(LEAK_SAMPLING_PERIOD);
+	BC_ASSERT_EQUAL(belle_sip_object_get_leak_sampling_period(),LEAK_SAMPLING_PERIOD,unsigned int,"%u");
+	for(i=0;i<COUNTED_OBJECTS;++i){
+		call_ids[i]=BELLE_SIP_HEADER_CALL_ID(belle_sip_object_ref(belle_sip_header_call_id_new()));
+		/*names set after the creation are reported too*/
+		belle_sip_object_set_name(BELLE_SIP_OBJECT(call_ids[i]),"sampled call-id");
+	}
+	memset(&lookup,0,sizeof(lookup));
+	lookup.type_name="belle_sip_header_call_id_t";
+	belle_sip_object_foreach_leak_samples(0,find_leak_samples,&lookup);
+	BC_ASSERT_EQUAL(lookup.count,COUNTED_OBJECTS/LEAK_SAMPLING_PERIOD,unsigned int,"%u");
+	BC_ASSERT_STRING_EQUAL(lookup.oldest_name,"sampled call-id");
+	belle_sip_object_dump_leak_samples(0);
+
+	/*samples are not old enough*/
+	memset(&lookup,0,sizeof(lookup));
+	lookup.type_name="belle_sip_header_call_id_t";
+	belle_sip_object_foreach_leak_samples(3600000,find_leak_samples,&lookup);
+	BC_ASSERT_EQUAL(lookup.calls,0,int,"%d");
+
+	for(i=0;i<COUNTED_OBJECTS;++i){
+		belle_sip_object_unref(call_ids[i]);
+	}
+	memset(&lookup,0,sizeof(lookup));
+	lookup.type_name="belle_sip_header_call_id_t";
+	belle_sip_object_foreach_leak_samples(0,find_leak_samples,&lookup);
+	BC_ASSERT_EQUAL(lookup.count,0,unsigned int,"%u");
+	belle_sip_object_enable_leak_sampling(0);
+}
 
 test_t core_tests[] = {
 	TEST_NO_TAG("Object Data", test_object_data),
+	TEST_NO_TAG("Object Data with many keys", test_object_data_many_keys),
 	TEST_NO_TAG("Dictionary", test_dictionary),
 	TEST_NO_TAG("Presence marshal", test_presence_marshal),
 	TEST_NO_TAG("Compressed body", test_compressed_body),
-	TEST_NO_TAG("Truncated compressed body", test_truncated_compressed_body)
+	TEST_NO_TAG("Truncated compressed body", test_truncated_compressed_body),
+	TEST_NO_TAG("Object caches", test_object_caches),
+	TEST_NO_TAG("Message arena", test_message_arena),
+	TEST_NO_TAG("Shared objects", test_shared_objects),
+	TEST_NO_TAG("Object pool", test_object_pool),
+	TEST_NO_TAG("Type statistics", test_type_stats),
+	TEST_NO_TAG("Leak sampling", test_leak_sampling)
 };
 
 test_suite_t core_test_suite = {"Core", NULL, NULL, belle_sip_tester_before_each, belle_sip_tester_after_each,
@@ -22,6 +22,8 @@
 #include "belle_sip_internal.h"
 #include "belle_sip_tester.h"
 
+#include <inttypes.h>
+
 
 static void test_simple_contact_header(void) {
 	belle_sip_header_contact_t* L_tmp;
@@ -1406,6 +1408,159 @@ static void test_authentication_info_header(void) {
 	BC_ASSERT_PTR_NULL(belle_sip_header_authentication_info_parse("nimportequoi"));
 }
 
+static void test_parser_context_reuse(void){
+	belle_sip_header_via_t *via;
+	belle_sip_header_t *header;
+
+	/*a context that met a syntax error must parse next value as a new one*/
+	header=belle_sip_header_create("Via","SIP/2.0/UDP [::1;;");
+	if (header) belle_sip_object_unref(header);
+	via=belle_sip_header_via_parse("Via: SIP/2.0/UDP 192.168.0.19:5062;rport;received=192.169.0.4;branch=z9hG4bK368560724");
+	if (!BC_ASSERT_PTR_NOT_NULL(via)) return;
+	BC_ASSERT_STRING_EQUAL(belle_sip_header_via_get_host(via),"192.168.0.19");
+	BC_ASSERT_EQUAL(belle_sip_header_via_get_port(via),5062,int,"%d");
+	belle_sip_object_unref(via);
+}
+
+typedef belle_sip_header_t *(*header_parse_func)(const char *);
+
+static const struct{
+	const char *name;
+	const char *value;
+	header_parse_func parse;
+}simple_headers[]={
+	{"Content-Length", "12", (header_parse_func)belle_sip_header_content_length_parse},
+	{"content-length", "  0 ", (header_parse_func)belle_sip_header_content_length_parse},
+	{"l", "1500", (header_parse_func)belle_sip_header_content_length_parse},
+	{"Content-Length", "twelve", (header_parse_func)belle_sip_header_content_length_parse},
+	{"Max-Forwards", "70", (header_parse_func)belle_sip_header_max_forwards_parse},
+	{"Expires", "3600", (header_parse_func)belle_sip_header_expires_parse},
+	{"EXPIRES", "\t3600", (header_parse_func)belle_sip_header_expires_parse},
+	{"CSeq", "21 INVITE", (header_parse_func)belle_sip_header_cseq_parse},
+	{"CSeq", "1  REGISTER  ", (header_parse_func)belle_sip_header_cseq_parse},
+	{"CSeq", "INVITE", (header_parse_func)belle_sip_header_cseq_parse},
+	{"Call-ID", "977107319@192.168.1.12", (header_parse_func)belle_sip_header_call_id_parse},
+	{"i", "a84b4c76e66710", (header_parse_func)belle_sip_header_call_id_parse},
+	{"Call-ID", "f81d4fae-7dec-11d0-a765-00a0c91e6bf6@[2a01:e35:1387:1020::1]", (header_parse_func)belle_sip_header_call_id_parse}
+};
+
+/*simple valued headers are built without the grammar, they must be the same as the ones it builds*/
+static void test_simple_header_create(void){
+	int i;
+
+	for(i=0;i<(int)(sizeof(simple_headers)/sizeof(simple_headers[0]));++i){
+		char *raw=belle_sip_strdup_printf("%s: %s",simple_headers[i].name,simple_headers[i].value);
+		belle_sip_header_t *created=belle_sip_header_create(simple_headers[i].name,simple_headers[i].value);
+		belle_sip_header_t *parsed=simple_headers[i].parse(raw);
+
+		if (parsed==NULL){
+			BC_ASSERT_PTR_NULL(created);
+		}else if (BC_ASSERT_PTR_NOT_NULL(created)){
+			char *created_str=belle_sip_object_to_string(created);
+			char *parsed_str=belle_sip_object_to_string(parsed);
+			BC_ASSERT_EQUAL(BELLE_SIP_OBJECT(created)->vptr->id,BELLE_SIP_OBJECT(parsed)->vptr->id,int,"%d");
+			BC_ASSERT_STRING_EQUAL(created_str,parsed_str);
+			belle_sip_free(created_str);
+			belle_sip_free(parsed_str);
+		}
+		if (created) belle_sip_object_unref(created);
+		if (parsed) belle_sip_object_unref(parsed);
+		belle_sip_free(raw);
+	}
+}
+
+static void test_header_name_lookup(void){
+	belle_sip_header_t *header;
+
+	header=belle_sip_header_create("sUbScRiPtIoN-sTaTe","active;expires=60");
+	BC_ASSERT_TRUE(BELLE_SIP_OBJECT_IS_INSTANCE_OF(header,belle_sip_header_subscription_state_t));
+	belle_sip_object_unref(header);
+	header=belle_sip_header_create("x","1800");
+	BC_ASSERT_TRUE(BELLE_SIP_OBJECT_IS_INSTANCE_OF(header,belle_sip_header_session_expires_t));
+	belle_sip_object_unref(header);
+	header=belle_sip_header_create("X-Expires","3600");
+	BC_ASSERT_TRUE(BELLE_SIP_OBJECT_IS_INSTANCE_OF(header,belle_sip_header_extension_t));
+	belle_sip_object_unref(header);
+	header=belle_sip_header_create("Expire","3600");
+	BC_ASSERT_TRUE(BELLE_SIP_OBJECT_IS_INSTANCE_OF(header,belle_sip_header_extension_t));
+	belle_sip_object_unref(header);
+	/*known to sip only*/
+	header=belle_http_header_create("Expires","3600");
+	BC_ASSERT_TRUE(BELLE_SIP_OBJECT_IS_INSTANCE_OF(header,belle_sip_header_extension_t));
+	belle_sip_object_unref(header);
+	header=belle_http_header_create("Content-Length","12");
+	BC_ASSERT_TRUE(BELLE_SIP_OBJECT_IS_INSTANCE_OF(header,belle_sip_header_content_length_t));
+	belle_sip_object_unref(header);
+}
+
+static void test_header_table_hash(void){
+	/*the seed of the header name hash is hard-coded, it must not make two known names collide*/
+	BC_ASSERT_EQUAL(belle_sip_header_table_hash_collisions(),0,int,"%d");
+}
+
+static void check_header_type_is_address(const char *name, const char *value){
+	belle_sip_type_id_t id=BELLE_SIP_TYPE_ID(belle_sip_header_extension_t);
+	belle_sip_header_t *header=belle_sip_header_create(name,value);
+	BC_ASSERT_PTR_NOT_NULL(belle_sip_header_get_typed_name(name,&id));
+	BC_ASSERT_EQUAL(belle_sip_header_type_is_address(id),BELLE_SIP_OBJECT_IS_INSTANCE_OF(header,belle_sip_header_address_t),int,"%d");
+	belle_sip_object_unref(header);
+}
+
+static void test_header_type_is_address(void){
+	check_header_type_is_address("m","<sip:bob@example.org>");
+	check_header_type_is_address("Record-Route","<sip:proxy.example.org;lr>");
+	check_header_type_is_address("Service-Route","<sip:proxy.example.org;lr>");
+	check_header_type_is_address("Diversion","<sip:carol@example.org>;reason=unconditional");
+	check_header_type_is_address("Referred-By","<sip:dave@example.org>");
+	check_header_type_is_address("P-Preferred-Identity","<sip:alice@example.org>");
+	check_header_type_is_address("Via","SIP/2.0/UDP 192.168.1.1;branch=z9hG4bKabc");
+	check_header_type_is_address("Call-ID","abc@example.org");
+	check_header_type_is_address("Subscription-State","active");
+}
+
+#define HEADER_PARSE_ITERATIONS 20000
+
+static uint64_t header_parse_benchmark(void){
+	uint64_t start=bctbx_get_cur_time_ms();
+	int i;
+
+	for(i=0;i<HEADER_PARSE_ITERATIONS;++i){
+		belle_sip_header_t *header=belle_sip_header_create("Contact","<sip:alice@192.168.1.12:5060;transport=tcp>;expires=3600");
+		belle_sip_object_unref(header);
+	}
+	return bctbx_get_cur_time_ms()-start;
+}
+
+static void test_header_parse_benchmark(void){
+	uint64_t uncached_time,cached_time;
+
+	belle_sip_parser_context_cache_enable(FALSE);
+	uncached_time=header_parse_benchmark();
+	belle_sip_parser_context_cache_enable(TRUE);
+	cached_time=header_parse_benchmark();
+	belle_sip_message("%i Contact headers parsed in %" PRIu64 " ms with new parser contexts, %" PRIu64 " ms with cached ones",
+		HEADER_PARSE_ITERATIONS,uncached_time,cached_time);
+}
+
+static void test_simple_header_create_benchmark(void){
+	uint64_t start=bctbx_get_cur_time_ms();
+	uint64_t created_time;
+	int i;
+
+	for(i=0;i<HEADER_PARSE_ITERATIONS;++i){
+		belle_sip_object_unref(belle_sip_header_create("Content-Length","1234"));
+		belle_sip_object_unref(belle_sip_header_create("Call-ID","977107319@192.168.1.12"));
+	}
+	created_time=bctbx_get_cur_time_ms()-start;
+	start=bctbx_get_cur_time_ms();
+	for(i=0;i<HEADER_PARSE_ITERATIONS;++i){
+		belle_sip_object_unref(belle_sip_header_content_length_parse("Content-Length:1234"));
+		belle_sip_object_unref(belle_sip_header_call_id_parse("Call-ID:977107319@192.168.1.12"));
+	}
+	belle_sip_message("%i Content-Length and Call-ID headers created in %" PRIu64 " ms, parsed by the grammar in %" PRIu64 " ms",
+		HEADER_PARSE_ITERATIONS,created_time,bctbx_get_cur_time_ms()-start);
+}
+
 test_t headers_tests[] = {
 	TEST_NO_TAG("Address", test_address_header),
 	TEST_NO_TAG("Address with params",test_address_header_with_params),
@@ -1456,7 +1611,14 @@ test_t headers_tests[] = {
 	TEST_NO_TAG("Content-Disposition", test_content_disposition_header),
 	TEST_NO_TAG("Accept", test_accept_header),
 	TEST_NO_TAG("Reason", test_reason_header),
-	TEST_NO_TAG("Authentication-Info", test_authentication_info_header)
+	TEST_NO_TAG("Authentication-Info", test_authentication_info_header),
+	TEST_NO_TAG("Parser context reuse", test_parser_context_reuse),
+	TEST_NO_TAG("Simple header create", test_simple_header_create),
+	TEST_NO_TAG("Header name lookup", test_header_name_lookup),
+	TEST_NO_TAG("Header table hash", test_header_table_hash),
+	TEST_NO_TAG("Header type is address", test_header_type_is_address),
+	TEST_NO_TAG("Header parse benchmark", test_header_parse_benchmark),
+	TEST_NO_TAG("Simple header create benchmark", test_simple_header_create_benchmark)
 };
 
 test_suite_t headers_test_suite = {"Headers", NULL, NULL, belle_sip_tester_before_each, belle_sip_tester_after_each,
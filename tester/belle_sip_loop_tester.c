@@ -0,0 +1,1040 @@
+/*
+ * Copyright (c) 2012-2019 Belledonne Communications SARL.
+ *
+ * This file is part of belle-sip.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "belle-sip/belle-sip.h"
+#include "belle_sip_tester.h"
+#include "belle_sip_internal.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+typedef struct loop_test_ctx{
+	int fd;
+	int read_count;
+	int timer_count;
+	int removed;
+	void *user_data;
+}loop_test_ctx_t;
+
+static int on_fd_readable(void *user_data, unsigned int events){
+	loop_test_ctx_t *ctx=(loop_test_ctx_t*)user_data;
+	char c;
+	if (events & BELLE_SIP_EVENT_READ){
+		if (read(ctx->fd,&c,1)==1) ctx->read_count++;
+	}
+	return BELLE_SIP_CONTINUE;
+}
+
+static int on_timer(void *user_data, unsigned int events){
+	loop_test_ctx_t *ctx=(loop_test_ctx_t*)user_data;
+	(void)events;
+	ctx->timer_count++;
+	return BELLE_SIP_STOP;
+}
+
+static void on_source_removed(belle_sip_source_t *s){
+	loop_test_ctx_t *ctx=(loop_test_ctx_t*)belle_sip_source_get_user_data(s);
+	ctx->removed++;
+}
+
+static void check_backend(belle_sip_main_loop_backend_t backend){
+	belle_sip_main_loop_t *ml=belle_sip_main_loop_new_with_backend(backend);
+	belle_sip_main_loop_backend_t used=belle_sip_main_loop_get_backend(ml);
+
+	BC_ASSERT_NOT_EQUAL(used,BELLE_SIP_MAIN_LOOP_BACKEND_DEFAULT,int,"%i");
+	if (backend==BELLE_SIP_MAIN_LOOP_BACKEND_POLL){
+		BC_ASSERT_EQUAL(used,BELLE_SIP_MAIN_LOOP_BACKEND_POLL,int,"%i");
+	}
+	belle_sip_object_unref(ml);
+}
+
+static void main_loop_backend_selection(void){
+	check_backend(BELLE_SIP_MAIN_LOOP_BACKEND_DEFAULT);
+	check_backend(BELLE_SIP_MAIN_LOOP_BACKEND_POLL);
+	check_backend(BELLE_SIP_MAIN_LOOP_BACKEND_EPOLL);
+}
+
+#ifndef _WIN32
+
+static void fd_and_timer_sources(belle_sip_main_loop_backend_t backend){
+	belle_sip_main_loop_t *ml=belle_sip_main_loop_new_with_backend(backend);
+	loop_test_ctx_t ctx={0};
+	belle_sip_source_t *fd_source;
+	belle_sip_source_t *timer;
+	int fds[2];
+
+	if (!BC_ASSERT_EQUAL(pipe(fds),0,int,"%i")){
+		belle_sip_object_unref(ml);
+		return;
+	}
+	ctx.fd=fds[0];
+	fd_source=belle_sip_socket_source_new(on_fd_readable,&ctx,fds[0],BELLE_SIP_EVENT_READ,-1);
+	belle_sip_source_set_remove_cb(fd_source,on_source_removed);
+	belle_sip_main_loop_add_source(ml,fd_source);
+	timer=belle_sip_main_loop_create_timeout(ml,on_timer,&ctx,20,"loop tester timer");
+
+	/*nothing to read, only the timer must fire*/
+	belle_sip_main_loop_sleep(ml,100);
+	BC_ASSERT_EQUAL(ctx.timer_count,1,int,"%i");
+	BC_ASSERT_EQUAL(ctx.read_count,0,int,"%i");
+
+	BC_ASSERT_EQUAL((int)write(fds[1],"a",1),1,int,"%i");
+	belle_sip_main_loop_sleep(ml,50);
+	BC_ASSERT_EQUAL(ctx.read_count,1,int,"%i");
+
+	/*source no longer interested in read events: data must stay in the pipe*/
+	belle_sip_source_set_events(fd_source,0);
+	BC_ASSERT_EQUAL((int)write(fds[1],"b",1),1,int,"%i");
+	belle_sip_main_loop_sleep(ml,50);
+	BC_ASSERT_EQUAL(ctx.read_count,1,int,"%i");
+
+	belle_sip_source_set_events(fd_source,BELLE_SIP_EVENT_READ);
+	belle_sip_main_loop_sleep(ml,50);
+	BC_ASSERT_EQUAL(ctx.read_count,2,int,"%i");
+
+	/*a cancelled source must be removed at next iteration even if not ready*/
+	belle_sip_source_cancel(fd_source);
+	belle_sip_main_loop_sleep(ml,50);
+	BC_ASSERT_EQUAL(ctx.removed,1,int,"%i");
+
+	belle_sip_object_unref(timer);
+	belle_sip_object_unref(fd_source);
+	belle_sip_object_unref(ml);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void poll_fd_and_timer_sources(void){
+	fd_and_timer_sources(BELLE_SIP_MAIN_LOOP_BACKEND_POLL);
+}
+
+static void epoll_fd_and_timer_sources(void){
+	fd_and_timer_sources(BELLE_SIP_MAIN_LOOP_BACKEND_EPOLL);
+}
+
+#define ALLOC_FREE_ITERATIONS 10000
+
+typedef struct iteration_test_ctx{
+	belle_sip_main_loop_t *ml;
+	uint64_t stop_at;
+}iteration_test_ctx_t;
+
+static int on_iteration(void *user_data, unsigned int events){
+	iteration_test_ctx_t *ctx=(iteration_test_ctx_t*)user_data;
+	belle_sip_main_loop_stats_t stats;
+	(void)events;
+	belle_sip_main_loop_get_stats(ctx->ml,&stats);
+	if (stats.iterations>=ctx->stop_at) belle_sip_main_loop_quit(ctx->ml);
+	return BELLE_SIP_CONTINUE;
+}
+
+/*runs the main loop for the given number of iterations and returns the number of allocations done meanwhile*/
+static int count_iteration_allocations(iteration_test_ctx_t *ctx, int iterations){
+	belle_sip_main_loop_stats_t stats;
+
+	belle_sip_main_loop_get_stats(ctx->ml,&stats);
+	ctx->stop_at=stats.iterations+iterations;
+	belle_sip_tester_start_counting_allocations();
+	belle_sip_main_loop_run(ctx->ml);
+	return belle_sip_tester_stop_counting_allocations();
+}
+
+static void allocation_free_iterations(belle_sip_main_loop_backend_t backend){
+	iteration_test_ctx_t ctx;
+	loop_test_ctx_t idle_ctx={0};
+	belle_sip_source_t *idle_source;
+	belle_sip_source_t *ready_source;
+	belle_sip_source_t *timer;
+	int idle_fds[2];
+	int ready_fds[2];
+
+	if (!BC_ASSERT_EQUAL(pipe(idle_fds),0,int,"%i")) return;
+	if (!BC_ASSERT_EQUAL(pipe(ready_fds),0,int,"%i")){
+		close(idle_fds[0]);
+		close(idle_fds[1]);
+		return;
+	}
+	ctx.ml=belle_sip_main_loop_new_with_backend(backend);
+	idle_ctx.fd=idle_fds[0];
+	idle_source=belle_sip_socket_source_new(on_fd_readable,&idle_ctx,idle_fds[0],BELLE_SIP_EVENT_READ,-1);
+	belle_sip_main_loop_add_source(ctx.ml,idle_source);
+
+	/*only a timer fires at each iteration, the fd source stays idle*/
+	timer=belle_sip_main_loop_create_timeout(ctx.ml,on_iteration,&ctx,0,"allocation free timer");
+	count_iteration_allocations(&ctx,100); /*warm up, for the tables that grow with the number of sources*/
+	BC_ASSERT_EQUAL(count_iteration_allocations(&ctx,ALLOC_FREE_ITERATIONS),0,int,"%i");
+	belle_sip_main_loop_remove_source(ctx.ml,timer);
+	belle_sip_object_unref(timer);
+
+	/*an fd source that is never drained is notified at each iteration*/
+	BC_ASSERT_EQUAL((int)write(ready_fds[1],"a",1),1,int,"%i");
+	ready_source=belle_sip_socket_source_new(on_iteration,&ctx,ready_fds[0],BELLE_SIP_EVENT_READ,-1);
+	belle_sip_main_loop_add_source(ctx.ml,ready_source);
+	count_iteration_allocations(&ctx,100);
+	BC_ASSERT_EQUAL(count_iteration_allocations(&ctx,ALLOC_FREE_ITERATIONS),0,int,"%i");
+	BC_ASSERT_EQUAL(idle_ctx.read_count,0,int,"%i");
+
+	belle_sip_main_loop_remove_source(ctx.ml,ready_source);
+	belle_sip_main_loop_remove_source(ctx.ml,idle_source);
+	belle_sip_object_unref(ready_source);
+	belle_sip_object_unref(idle_source);
+	belle_sip_object_unref(ctx.ml);
+	close(idle_fds[0]);
+	close(idle_fds[1]);
+	close(ready_fds[0]);
+	close(ready_fds[1]);
+}
+
+static void poll_allocation_free_iterations(void){
+	allocation_free_iterations(BELLE_SIP_MAIN_LOOP_BACKEND_POLL);
+}
+
+static void epoll_allocation_free_iterations(void){
+	allocation_free_iterations(BELLE_SIP_MAIN_LOOP_BACKEND_EPOLL);
+}
+
+#endif
+
+#define TIMER_WHEEL_ENTRIES 5000
+
+/*mix of short, transaction like and registration like delays, plus some beyond the wheel range*/
+static uint64_t random_delay(void){
+	switch(belle_sip_random() % 4){
+		case 0: return belle_sip_random() % 300;
+		case 1: return belle_sip_random() % 64000;
+		case 2: return belle_sip_random() % 7200000;
+		default: return ((uint64_t)belle_sip_random())<<12;
+	}
+}
+
+static int entry_is_late(const belle_sip_timer_wheel_entry_t *entry, const void *pnow){
+	return entry->expire_ms <= *(const uint64_t*)pnow ? 0 : -1;
+}
+
+static void timer_wheel_expiration(void){
+	belle_sip_timer_wheel_t *tw=belle_sip_new0(belle_sip_timer_wheel_t);
+	belle_sip_timer_wheel_entry_t *entries=belle_sip_malloc0(TIMER_WHEEL_ENTRIES*sizeof(belle_sip_timer_wheel_entry_t));
+	int *fired=belle_sip_malloc0(TIMER_WHEEL_ENTRIES*sizeof(int));
+	uint64_t now=belle_sip_time_ms();
+	int i;
+	int expected=0;
+	int count=0;
+
+	belle_sip_timer_wheel_init(tw,now);
+	for(i=0;i<TIMER_WHEEL_ENTRIES;++i){
+		entries[i].data=&fired[i];
+		belle_sip_timer_wheel_insert(tw,&entries[i],now+random_delay());
+	}
+	for(i=0;i<TIMER_WHEEL_ENTRIES;i+=7){
+		belle_sip_timer_wheel_remove(tw,&entries[i]);
+		fired[i]=-1;
+	}
+	expected=TIMER_WHEEL_ENTRIES-(TIMER_WHEEL_ENTRIES+6)/7;
+	BC_ASSERT_EQUAL((int)belle_sip_timer_wheel_size(tw),expected,int,"%i");
+
+	while(belle_sip_timer_wheel_size(tw)>0){
+		belle_sip_timer_wheel_entry_t *entry;
+		uint64_t next;
+
+		if (!BC_ASSERT_TRUE(belle_sip_timer_wheel_get_next_expiry(tw,&next))) break;
+		if (!BC_ASSERT_GREATER(next,now,uint64_t,"%" PRIu64)) break;
+		/*sometimes wake up late, like a busy main loop would*/
+		now=next+((belle_sip_random()%3)==0 ? belle_sip_random()%50 : 0);
+		belle_sip_timer_wheel_advance(tw,now);
+		while((entry=belle_sip_timer_wheel_get_expired(tw))!=NULL){
+			int *entry_fired=(int*)entry->data;
+			BC_ASSERT_LOWER(entry->expire_ms,now,uint64_t,"%" PRIu64);
+			BC_ASSERT_EQUAL(*entry_fired,0,int,"%i");
+			*entry_fired=1;
+			count++;
+			belle_sip_timer_wheel_remove(tw,entry);
+		}
+		/*no entry must be left behind in the wheel once its expiration time is reached*/
+		if (!BC_ASSERT_PTR_NULL(belle_sip_timer_wheel_find_custom(tw,entry_is_late,&now))) break;
+	}
+	BC_ASSERT_EQUAL(count,expected,int,"%i");
+	belle_sip_free(fired);
+	belle_sip_free(entries);
+	belle_sip_free(tw);
+}
+
+#define TIMER_BENCH_ENTRIES 100000
+
+/*
+ * Compares the timer wheel with the bctbx multimap that used to store timer sources, doing what the main loop does
+ * to its timers: insertion, re-arming, cancellation and expiration.
+ */
+static void timer_wheel_perf(void){
+	belle_sip_timer_wheel_t *tw=belle_sip_new0(belle_sip_timer_wheel_t);
+	belle_sip_timer_wheel_entry_t *entries=belle_sip_malloc0(TIMER_BENCH_ENTRIES*sizeof(belle_sip_timer_wheel_entry_t));
+	bctbx_iterator_t **its=belle_sip_malloc0(TIMER_BENCH_ENTRIES*sizeof(bctbx_iterator_t*));
+	uint64_t *delays=belle_sip_malloc0(TIMER_BENCH_ENTRIES*sizeof(uint64_t));
+	bctbx_map_t *map=bctbx_mmap_ullong_new();
+	uint64_t base=belle_sip_time_ms();
+	uint64_t now;
+	uint64_t start,t_map,t_wheel;
+	int i;
+
+	for(i=0;i<TIMER_BENCH_ENTRIES;++i){
+		delays[i]=belle_sip_random() % 64000;
+	}
+
+	start=bctbx_get_cur_time_ms();
+	for(i=0;i<TIMER_BENCH_ENTRIES;++i){
+		its[i]=bctbx_map_insert_and_delete_with_returned_it(map,(bctbx_pair_t*)bctbx_pair_ullong_new(base+delays[i],&its[i]));
+	}
+	for(i=0;i<TIMER_BENCH_ENTRIES;++i){
+		bctbx_map_erase(map,its[i]);
+		bctbx_iterator_delete(its[i]);
+		its[i]=bctbx_map_insert_and_delete_with_returned_it(map,(bctbx_pair_t*)bctbx_pair_ullong_new(base+delays[i]/2,&its[i]));
+	}
+	for(i=0;i<TIMER_BENCH_ENTRIES;i+=2){
+		bctbx_map_erase(map,its[i]);
+		bctbx_iterator_delete(its[i]);
+		its[i]=bctbx_map_insert_and_delete_with_returned_it(map,(bctbx_pair_t*)bctbx_pair_ullong_new(0,&its[i]));
+	}
+	for(now=base;bctbx_map_size(map)>0;now+=10){
+		bctbx_iterator_t *it=bctbx_map_begin(map);
+		bctbx_iterator_t *end=bctbx_map_end(map);
+		while(!bctbx_iterator_equals(it,end) && bctbx_pair_ullong_get_first((const bctbx_pair_ullong_t*)bctbx_iterator_get_pair(it))<=now){
+			bctbx_iterator_t **pit=(bctbx_iterator_t**)bctbx_pair_get_second(bctbx_iterator_get_pair(it));
+			it=bctbx_map_erase(map,it);
+			bctbx_iterator_delete(*pit);
+		}
+		bctbx_iterator_delete(it);
+		bctbx_iterator_delete(end);
+	}
+	t_map=bctbx_get_cur_time_ms()-start;
+	belle_sip_message("bctbx_mmap_ullong: %i timers in %" PRIu64 " ms",TIMER_BENCH_ENTRIES,t_map);
+
+	start=bctbx_get_cur_time_ms();
+	belle_sip_timer_wheel_init(tw,base);
+	for(i=0;i<TIMER_BENCH_ENTRIES;++i){
+		belle_sip_timer_wheel_insert(tw,&entries[i],base+delays[i]);
+	}
+	for(i=0;i<TIMER_BENCH_ENTRIES;++i){
+		belle_sip_timer_wheel_insert(tw,&entries[i],base+delays[i]/2);
+	}
+	for(i=0;i<TIMER_BENCH_ENTRIES;i+=2){
+		belle_sip_timer_wheel_insert_expired(tw,&entries[i]);
+	}
+	for(now=base;belle_sip_timer_wheel_size(tw)>0;now+=10){
+		belle_sip_timer_wheel_entry_t *entry;
+		belle_sip_timer_wheel_advance(tw,now);
+		while((entry=belle_sip_timer_wheel_get_expired(tw))!=NULL){
+			belle_sip_timer_wheel_remove(tw,entry);
+		}
+	}
+	t_wheel=bctbx_get_cur_time_ms()-start;
+	belle_sip_message("timer wheel: %i timers in %" PRIu64 " ms",TIMER_BENCH_ENTRIES,t_wheel);
+	/*timings depend on the load of the machine, only the result is checked*/
+	BC_ASSERT_EQUAL((int)belle_sip_timer_wheel_size(tw),0,int,"%i");
+	BC_ASSERT_PTR_NULL(belle_sip_timer_wheel_get_first(tw));
+
+	bctbx_mmap_ullong_delete(map);
+	belle_sip_free(delays);
+	belle_sip_free(its);
+	belle_sip_free(entries);
+	belle_sip_free(tw);
+}
+
+static int on_slow_timer(void *user_data, unsigned int events){
+	loop_test_ctx_t *ctx=(loop_test_ctx_t*)user_data;
+	(void)events;
+	belle_sip_sleep(2);
+	ctx->timer_count++;
+	return BELLE_SIP_STOP;
+}
+
+static void on_task(void *user_data){
+	loop_test_ctx_t *ctx=(loop_test_ctx_t*)user_data;
+	ctx->read_count++;
+}
+
+static void check_callback_duration(const char *name, const belle_sip_main_loop_histogram_t *histogram, void *user_data){
+	loop_test_ctx_t *ctx=(loop_test_ctx_t*)user_data;
+	if (strcmp(name,"slow timer")==0){
+		BC_ASSERT_EQUAL((int)histogram->count,1,int,"%i");
+		BC_ASSERT_GREATER((int)histogram->max_us,1000,int,"%i");
+		ctx->removed++;
+	}else if (strcmp(name,"defered task")==0){
+		BC_ASSERT_EQUAL((int)histogram->count,1,int,"%i");
+		ctx->removed++;
+	}
+}
+
+static void main_loop_instrumentation(void){
+	belle_sip_main_loop_t *ml=belle_sip_main_loop_new();
+	loop_test_ctx_t ctx={0};
+	belle_sip_main_loop_histogram_t histogram;
+	belle_sip_source_t *timer;
+
+	/*nothing is measured until instrumentation is enabled*/
+	BC_ASSERT_FALSE(belle_sip_main_loop_instrumentation_enabled(ml));
+	belle_sip_main_loop_sleep(ml,10);
+	belle_sip_main_loop_get_poll_wait(ml,&histogram);
+	BC_ASSERT_EQUAL((int)histogram.count,0,int,"%i");
+
+	belle_sip_main_loop_enable_instrumentation(ml,TRUE);
+	belle_sip_main_loop_set_instrumentation_dump_interval(ml,20);
+	timer=belle_sip_main_loop_create_timeout(ml,on_slow_timer,&ctx,10,"slow timer");
+	belle_sip_main_loop_do_later(ml,on_task,&ctx);
+	belle_sip_main_loop_sleep(ml,50);
+	BC_ASSERT_EQUAL(ctx.timer_count,1,int,"%i");
+	BC_ASSERT_EQUAL(ctx.read_count,1,int,"%i");
+
+	belle_sip_main_loop_get_loop_lag(ml,&histogram);
+	BC_ASSERT_GREATER_STRICT((int)histogram.count,1,int,"%i"); /*slow timer, main loop sleep timer and dump timer*/
+	belle_sip_main_loop_get_poll_wait(ml,&histogram);
+	BC_ASSERT_GREATER_STRICT((int)histogram.count,0,int,"%i");
+	belle_sip_main_loop_foreach_callback_duration(ml,check_callback_duration,&ctx);
+	BC_ASSERT_EQUAL(ctx.removed,2,int,"%i");
+	belle_sip_main_loop_dump_instrumentation(ml);
+
+	belle_sip_main_loop_reset_instrumentation(ml);
+	belle_sip_main_loop_get_poll_wait(ml,&histogram);
+	BC_ASSERT_EQUAL((int)histogram.count,0,int,"%i");
+	belle_sip_main_loop_set_instrumentation_dump_interval(ml,0);
+
+	belle_sip_object_unref(timer);
+	belle_sip_object_unref(ml);
+}
+
+#define INDEXED_SOURCES 10000
+
+static void find_and_cancel_sources(void){
+	belle_sip_main_loop_t *ml=belle_sip_main_loop_new();
+	loop_test_ctx_t ctx={0};
+	unsigned long *ids=belle_sip_malloc0(INDEXED_SOURCES*sizeof(unsigned long));
+	uint64_t start,elapsed;
+	int i;
+
+	for(i=0;i<INDEXED_SOURCES;++i){
+		belle_sip_source_t *s=belle_sip_main_loop_create_timeout_with_remove_cb(ml,on_timer,&ctx,100000,"indexed timer",on_source_removed);
+		ids[i]=belle_sip_source_get_id(s);
+		belle_sip_object_unref(s);
+	}
+	for(i=0;i<INDEXED_SOURCES;++i){
+		belle_sip_source_t *s=belle_sip_main_loop_find_source(ml,ids[i]);
+		if (!BC_ASSERT_PTR_NOT_NULL(s)) break;
+		BC_ASSERT_EQUAL((int)belle_sip_source_get_id(s),(int)ids[i],int,"%i");
+	}
+
+	start=bctbx_get_cur_time_ms();
+	for(i=0;i<INDEXED_SOURCES;i+=2){
+		belle_sip_main_loop_cancel_source(ml,ids[i]);
+	}
+	elapsed=bctbx_get_cur_time_ms()-start;
+	belle_sip_message("%i sources cancelled by id in %" PRIu64 " ms",INDEXED_SOURCES/2,elapsed);
+
+	/*cancelled sources are removed by next iterations, and can no longer be found*/
+	belle_sip_main_loop_sleep(ml,50);
+	BC_ASSERT_EQUAL(ctx.removed,INDEXED_SOURCES/2,int,"%i");
+	BC_ASSERT_EQUAL(ctx.timer_count,0,int,"%i");
+	for(i=0;i<INDEXED_SOURCES;++i){
+		belle_sip_source_t *s=belle_sip_main_loop_find_source(ml,ids[i]);
+		if (i%2==0) BC_ASSERT_PTR_NULL(s);
+		else BC_ASSERT_PTR_NOT_NULL(s);
+	}
+	belle_sip_object_unref(ml);
+	belle_sip_free(ids);
+}
+
+typedef struct clock_test_ctx{
+	belle_sip_main_loop_t *ml;
+	uint64_t first;
+	uint64_t second;
+	uint64_t read;
+	int fired;
+}clock_test_ctx_t;
+
+static int on_clock_timer(void *user_data, unsigned int events){
+	clock_test_ctx_t *ctx=(clock_test_ctx_t*)user_data;
+	(void)events;
+	ctx->first=belle_sip_main_loop_get_time_ms(ctx->ml);
+	bctbx_sleep_ms(5);
+	ctx->second=belle_sip_main_loop_get_time_ms(ctx->ml);
+	ctx->read=belle_sip_time_ms();
+	ctx->fired++;
+	return BELLE_SIP_STOP;
+}
+
+static void check_cached_clock(int coarse){
+	clock_test_ctx_t ctx;
+	uint64_t start;
+
+	memset(&ctx,0,sizeof(ctx));
+	ctx.ml=belle_sip_main_loop_new();
+	belle_sip_main_loop_enable_coarse_clock(ctx.ml,coarse);
+	BC_ASSERT_EQUAL(belle_sip_main_loop_coarse_clock_enabled(ctx.ml),coarse,int,"%i");
+	start=belle_sip_time_ms();
+	belle_sip_main_loop_add_timeout(ctx.ml,on_clock_timer,&ctx,20);
+	belle_sip_main_loop_sleep(ctx.ml,100);
+	BC_ASSERT_EQUAL(ctx.fired,1,int,"%i");
+	/*within a callback the time does not move, and lags behind the clock by the time spent in the iteration*/
+	BC_ASSERT_TRUE(ctx.first==ctx.second);
+	BC_ASSERT_TRUE(ctx.first+5<=ctx.read);
+	BC_ASSERT_TRUE(ctx.first>=start+20-(coarse ? 10 : 0));
+	/*outside of an iteration the clock is read*/
+	BC_ASSERT_TRUE(belle_sip_main_loop_get_time_ms(ctx.ml)>=ctx.read-(coarse ? 10 : 0));
+	belle_sip_object_unref(ctx.ml);
+}
+
+static void cached_clock(void){
+	check_cached_clock(FALSE);
+	check_cached_clock(TRUE);
+}
+
+#define BUDGET_TIMERS 25
+#define TIMER_BUDGET 10
+
+typedef struct budget_test_ctx{
+	belle_sip_main_loop_t *ml;
+	uint64_t current_iteration;
+	int fired_in_iteration;
+	int max_fired_in_iteration;
+	int fired;
+}budget_test_ctx_t;
+
+static int on_budget_timer(void *user_data, unsigned int events){
+	budget_test_ctx_t *ctx=(budget_test_ctx_t*)user_data;
+	belle_sip_main_loop_stats_t stats;
+	(void)events;
+	belle_sip_main_loop_get_stats(ctx->ml,&stats);
+	if (stats.iterations!=ctx->current_iteration){
+		ctx->current_iteration=stats.iterations;
+		ctx->fired_in_iteration=0;
+	}
+	ctx->fired_in_iteration++;
+	if (ctx->fired_in_iteration>ctx->max_fired_in_iteration) ctx->max_fired_in_iteration=ctx->fired_in_iteration;
+	ctx->fired++;
+	return BELLE_SIP_STOP;
+}
+
+static void timer_budget(void){
+	budget_test_ctx_t ctx;
+	int i;
+
+	memset(&ctx,0,sizeof(ctx));
+	ctx.ml=belle_sip_main_loop_new();
+	BC_ASSERT_GREATER_STRICT(belle_sip_main_loop_get_timer_budget(ctx.ml),0,int,"%i");
+	belle_sip_main_loop_set_timer_budget(ctx.ml,TIMER_BUDGET);
+	for(i=0;i<BUDGET_TIMERS;++i){
+		belle_sip_main_loop_add_timeout(ctx.ml,on_budget_timer,&ctx,0);
+	}
+	belle_sip_main_loop_sleep(ctx.ml,20);
+	BC_ASSERT_EQUAL(ctx.fired,BUDGET_TIMERS,int,"%i");
+	BC_ASSERT_EQUAL(ctx.max_fired_in_iteration,TIMER_BUDGET,int,"%i");
+	belle_sip_object_unref(ctx.ml);
+}
+
+#ifndef _WIN32
+
+#define WAKEUP_TIMERS 100
+
+static void *add_timers_thread(void *data){
+	loop_test_ctx_t *ctx=(loop_test_ctx_t*)data;
+	belle_sip_main_loop_t *ml=(belle_sip_main_loop_t*)ctx->user_data;
+	int i;
+	for(i=0;i<WAKEUP_TIMERS;++i){
+		belle_sip_main_loop_add_timeout(ml,on_timer,ctx,0);
+	}
+	return NULL;
+}
+
+static void coalesced_wakeups(void){
+	belle_sip_main_loop_t *ml=belle_sip_main_loop_new();
+	loop_test_ctx_t ctx={0};
+	belle_sip_main_loop_stats_t stats;
+	bctbx_thread_t thread;
+
+	ctx.user_data=ml;
+	bctbx_thread_create(&thread,NULL,add_timers_thread,&ctx);
+	bctbx_thread_join(thread,NULL);
+
+	/*the main loop is not running: all requests but the first one are coalesced*/
+	belle_sip_main_loop_get_stats(ml,&stats);
+	BC_ASSERT_EQUAL((int)stats.wakeup_requests,WAKEUP_TIMERS,int,"%i");
+	BC_ASSERT_EQUAL((int)stats.wakeups,1,int,"%i");
+
+	belle_sip_main_loop_sleep(ml,20);
+	BC_ASSERT_EQUAL(ctx.timer_count,WAKEUP_TIMERS,int,"%i");
+	belle_sip_main_loop_get_stats(ml,&stats);
+	BC_ASSERT_EQUAL((int)stats.wakeups_received,1,int,"%i");
+	BC_ASSERT_EQUAL((int)stats.spurious_wakeups,0,int,"%i");
+	BC_ASSERT_GREATER_STRICT((int)stats.iterations,0,int,"%i");
+
+	/*once read, next request needs a new wake up*/
+	bctbx_thread_create(&thread,NULL,add_timers_thread,&ctx);
+	bctbx_thread_join(thread,NULL);
+	belle_sip_main_loop_get_stats(ml,&stats);
+	BC_ASSERT_EQUAL((int)stats.wakeups,2,int,"%i");
+	belle_sip_main_loop_sleep(ml,20);
+	BC_ASSERT_EQUAL(ctx.timer_count,2*WAKEUP_TIMERS,int,"%i");
+
+	belle_sip_main_loop_reset_stats(ml);
+	belle_sip_main_loop_get_stats(ml,&stats);
+	BC_ASSERT_EQUAL((int)stats.wakeups,0,int,"%i");
+	BC_ASSERT_EQUAL((int)stats.iterations,0,int,"%i");
+	belle_sip_object_unref(ml);
+}
+
+#define PIPELINED_MESSAGES 5
+
+static void pipelined_process_request(void *user_data, const belle_sip_request_event_t *event){
+	(*(int*)user_data)++;
+}
+
+/*
+ * Messages sent in a single TCP segment, to a stack parsing one message per read: the remaining ones must be parsed
+ * by the next iterations without waiting for more data nor for a timer.
+ */
+static void pipelined_stream_messages(void){
+	belle_sip_stack_t *stack=belle_sip_stack_new(NULL);
+	belle_sip_listening_point_t *lp=belle_sip_stack_create_listening_point(stack,"127.0.0.1",BELLE_SIP_LISTENING_POINT_RANDOM_PORT,"TCP");
+	belle_sip_provider_t *prov;
+	belle_sip_listener_callbacks_t cbs={0};
+	belle_sip_listener_t *listener;
+	struct sockaddr_in addr;
+	char buf[4096];
+	size_t len=0;
+	int sock,i,received=0;
+
+	if (!BC_ASSERT_PTR_NOT_NULL(lp)){
+		belle_sip_object_unref(stack);
+		return;
+	}
+	belle_sip_stack_set_max_messages_per_read(stack,1);
+	prov=belle_sip_stack_create_provider(stack,lp);
+	cbs.process_request_event=pipelined_process_request;
+	listener=belle_sip_listener_create_from_callbacks(&cbs,&received);
+	belle_sip_provider_add_sip_listener(prov,listener);
+
+	sock=socket(AF_INET,SOCK_STREAM,0);
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	addr.sin_port=htons((unsigned short)belle_sip_listening_point_get_port(lp));
+	BC_ASSERT_EQUAL(connect(sock,(struct sockaddr*)&addr,sizeof(addr)),0,int,"%i");
+	/*let the stack accept the connection*/
+	belle_sip_stack_sleep(stack,100);
+
+	for(i=0;i<PIPELINED_MESSAGES;++i){
+		len+=(size_t)snprintf(buf+len,sizeof(buf)-len,
+			"MESSAGE sip:bob@127.0.0.1 SIP/2.0\r\n"
+			"Via: SIP/2.0/TCP 127.0.0.1:5060;branch=z9hG4bK-pipelined-%i\r\n"
+			"From: <sip:alice@127.0.0.1>;tag=%i\r\n"
+			"To: <sip:bob@127.0.0.1>\r\n"
+			"Call-ID: pipelined-%i@127.0.0.1\r\n"
+			"CSeq: 1 MESSAGE\r\n"
+			"Max-Forwards: 70\r\n"
+			"Content-Length: 0\r\n"
+			"\r\n",i,i,i);
+	}
+	BC_ASSERT_EQUAL((int)send(sock,buf,len,0),(int)len,int,"%i");
+	/*nothing else is sent and no timer expires before the end of the sleep*/
+	belle_sip_stack_sleep(stack,500);
+	BC_ASSERT_EQUAL(received,PIPELINED_MESSAGES,int,"%i");
+
+	close(sock);
+	belle_sip_provider_remove_sip_listener(prov,listener);
+	belle_sip_object_unref(listener);
+	belle_sip_object_unref(prov);
+	belle_sip_object_unref(stack);
+}
+
+#endif
+
+#define TASK_PRODUCERS 4
+#define TASKS_PER_PRODUCER 20000
+/*more than the main loop task ring can hold, so that some of them are spilled*/
+#define ORDERED_TASKS 10000
+
+typedef struct task_test_ctx{
+	belle_sip_main_loop_t *ml;
+	int last[TASK_PRODUCERS];
+	int executed;
+	int out_of_order;
+}task_test_ctx_t;
+
+typedef struct task_producer{
+	task_test_ctx_t *ctx;
+	int index;
+	bctbx_thread_t thread;
+}task_producer_t;
+
+static void posted_task(void *data){
+	task_producer_t *producer=(task_producer_t*)data;
+	task_test_ctx_t *ctx=producer->ctx;
+	/*only run by the main loop thread, no locking needed*/
+	ctx->last[producer->index]++;
+	ctx->executed++;
+}
+
+typedef struct ordered_task{
+	task_test_ctx_t *ctx;
+	int index;
+}ordered_task_t;
+
+static void ordered_task(void *data){
+	ordered_task_t *task=(ordered_task_t*)data;
+	task_test_ctx_t *ctx=task->ctx;
+	if (task->index!=ctx->executed) ctx->out_of_order++;
+	ctx->executed++;
+}
+
+static void *task_producer_thread(void *data){
+	task_producer_t *producer=(task_producer_t*)data;
+	int i;
+	for(i=0;i<TASKS_PER_PRODUCER;++i){
+		belle_sip_main_loop_do_later(producer->ctx->ml,posted_task,producer);
+	}
+	return NULL;
+}
+
+static void cross_thread_tasks(void){
+	task_test_ctx_t ctx;
+	task_producer_t producers[TASK_PRODUCERS];
+	ordered_task_t *ordered;
+	uint64_t start,elapsed;
+	int i;
+
+	memset(&ctx,0,sizeof(ctx));
+	ctx.ml=belle_sip_main_loop_new();
+
+	/*tasks posted by the main loop thread are run in order, including the ones that did not fit in the ring*/
+	ordered=(ordered_task_t*)belle_sip_malloc(ORDERED_TASKS*sizeof(ordered_task_t));
+	for(i=0;i<ORDERED_TASKS;++i){
+		ordered[i].ctx=&ctx;
+		ordered[i].index=i;
+		belle_sip_main_loop_do_later(ctx.ml,ordered_task,&ordered[i]);
+	}
+	belle_sip_main_loop_sleep(ctx.ml,10);
+	BC_ASSERT_EQUAL(ctx.executed,ORDERED_TASKS,int,"%i");
+	BC_ASSERT_EQUAL(ctx.out_of_order,0,int,"%i");
+	belle_sip_free(ordered);
+	ctx.executed=0;
+
+	start=bctbx_get_cur_time_ms();
+	for(i=0;i<TASK_PRODUCERS;++i){
+		producers[i].ctx=&ctx;
+		producers[i].index=i;
+		bctbx_thread_create(&producers[i].thread,NULL,task_producer_thread,&producers[i]);
+	}
+	while(ctx.executed<TASK_PRODUCERS*TASKS_PER_PRODUCER && bctbx_get_cur_time_ms()-start<10000){
+		belle_sip_main_loop_sleep(ctx.ml,10);
+	}
+	elapsed=bctbx_get_cur_time_ms()-start;
+	for(i=0;i<TASK_PRODUCERS;++i){
+		bctbx_thread_join(producers[i].thread,NULL);
+		BC_ASSERT_EQUAL(ctx.last[i],TASKS_PER_PRODUCER,int,"%i");
+	}
+	BC_ASSERT_EQUAL(ctx.executed,TASK_PRODUCERS*TASKS_PER_PRODUCER,int,"%i");
+	belle_sip_message("%i tasks posted by %i threads run in %" PRIu64 " ms",TASK_PRODUCERS*TASKS_PER_PRODUCER,TASK_PRODUCERS,elapsed);
+	belle_sip_object_unref(ctx.ml);
+}
+
+#define SHARD_COUNT 4
+#define SHARD_CALLS 50
+#define SHARD_TASKS_PER_CALL 20
+
+typedef struct shard_test_ctx shard_test_ctx_t;
+
+typedef struct shard_listener_data{
+	shard_test_ctx_t *ctx;
+	int index;
+}shard_listener_data_t;
+
+struct shard_test_ctx{
+	bctbx_mutex_t mutex;
+	belle_sip_sharded_stack_t *sharded;
+	int port;
+	int lp_created;
+	belle_sip_listening_point_t *lps[SHARD_COUNT];
+	belle_sip_provider_t *provs[SHARD_COUNT];
+	belle_sip_listener_t *listeners[SHARD_COUNT];
+	shard_listener_data_t listener_data[SHARD_COUNT];
+	int received;
+	int bad_bodies;
+	int executed;
+	int misplaced;
+	bctbx_thread_t call_threads[SHARD_CALLS];
+	int call_thread_set[SHARD_CALLS];
+};
+
+typedef struct shard_task{
+	shard_test_ctx_t *ctx;
+	int call;
+}shard_task_t;
+
+static void shard_task_run(void *data){
+	shard_task_t *task=(shard_task_t*)data;
+	shard_test_ctx_t *ctx=task->ctx;
+	bctbx_thread_t self=bctbx_thread_self();
+
+	bctbx_mutex_lock(&ctx->mutex);
+	if (!ctx->call_thread_set[task->call]){
+		ctx->call_threads[task->call]=self;
+		ctx->call_thread_set[task->call]=TRUE;
+	}else if (ctx->call_threads[task->call]!=self){
+		ctx->misplaced++;
+	}
+	ctx->executed++;
+	bctbx_mutex_unlock(&ctx->mutex);
+	belle_sip_free(task);
+}
+
+static void sharded_stack_call_id_affinity(void){
+	shard_test_ctx_t ctx;
+	int call,i;
+	uint64_t begin;
+
+	memset(&ctx,0,sizeof(ctx));
+	bctbx_mutex_init(&ctx.mutex,NULL);
+	ctx.sharded=belle_sip_sharded_stack_new(SHARD_COUNT,NULL,NULL,NULL,NULL);
+	if (!BC_ASSERT_PTR_NOT_NULL(ctx.sharded)) return;
+	BC_ASSERT_EQUAL(belle_sip_sharded_stack_get_shard_count(ctx.sharded),SHARD_COUNT,int,"%i");
+
+	for(i=0;i<SHARD_TASKS_PER_CALL;++i){
+		for(call=0;call<SHARD_CALLS;++call){
+			char call_id[32];
+			shard_task_t *task=belle_sip_new0(shard_task_t);
+			task->ctx=&ctx;
+			task->call=call;
+			snprintf(call_id,sizeof(call_id),"call-%i@sharded.test",call);
+			BC_ASSERT_EQUAL(belle_sip_sharded_stack_get_shard_for_call_id(ctx.sharded,call_id),
+				belle_sip_sharded_stack_get_shard_for_call_id(ctx.sharded,call_id),int,"%i");
+			belle_sip_sharded_stack_post_for_call_id(ctx.sharded,call_id,shard_task_run,task);
+		}
+	}
+	begin=bctbx_get_cur_time_ms();
+	while(bctbx_get_cur_time_ms()-begin<5000){
+		int executed;
+		bctbx_mutex_lock(&ctx.mutex);
+		executed=ctx.executed;
+		bctbx_mutex_unlock(&ctx.mutex);
+		if (executed==SHARD_CALLS*SHARD_TASKS_PER_CALL) break;
+		belle_sip_sleep(10);
+	}
+	BC_ASSERT_EQUAL(ctx.executed,SHARD_CALLS*SHARD_TASKS_PER_CALL,int,"%i");
+	BC_ASSERT_EQUAL(ctx.misplaced,0,int,"%i");
+	belle_sip_object_unref(ctx.sharded);
+	bctbx_mutex_destroy(&ctx.mutex);
+}
+
+#ifdef SO_REUSEPORT
+static void on_shard_start(belle_sip_stack_t *stack, int shard_index, void *user_data){
+	shard_test_ctx_t *ctx=(shard_test_ctx_t*)user_data;
+	belle_sip_listening_point_t *lp;
+
+	BC_ASSERT_TRUE(belle_sip_stack_reuse_port_enabled(stack));
+	/*shards are started in sequence, so the first one chooses the port for the others*/
+	lp=belle_sip_stack_create_listening_point(stack,"127.0.0.1",shard_index==0 ? BELLE_SIP_LISTENING_POINT_RANDOM_PORT : ctx->port,"UDP");
+	if (!lp) return;
+	if (shard_index==0) ctx->port=belle_sip_listening_point_get_port(lp);
+	/*keep it bound until the shard stops, so that both sockets share the port*/
+	ctx->lps[shard_index]=(belle_sip_listening_point_t*)belle_sip_object_ref(lp);
+	ctx->lp_created++;
+}
+
+static void on_shard_stop(belle_sip_stack_t *stack, int shard_index, void *user_data){
+	shard_test_ctx_t *ctx=(shard_test_ctx_t*)user_data;
+	if (ctx->lps[shard_index]) belle_sip_object_unref(ctx->lps[shard_index]);
+}
+
+static void sharded_stack_reuse_port(void){
+	shard_test_ctx_t ctx;
+	belle_sip_sharded_stack_t *sharded;
+
+	memset(&ctx,0,sizeof(ctx));
+	sharded=belle_sip_sharded_stack_new(2,NULL,on_shard_start,on_shard_stop,&ctx);
+	if (!BC_ASSERT_PTR_NOT_NULL(sharded)) return;
+	BC_ASSERT_EQUAL(ctx.lp_created,2,int,"%i");
+	belle_sip_object_unref(sharded);
+}
+
+static void shard_process_request(void *user_data, const belle_sip_request_event_t *event){
+	shard_listener_data_t *data=(shard_listener_data_t*)user_data;
+	shard_test_ctx_t *ctx=data->ctx;
+	belle_sip_message_t *msg=BELLE_SIP_MESSAGE(belle_sip_request_event_get_request(event));
+	belle_sip_header_call_id_t *call_id=belle_sip_message_get_header_by_type(msg,belle_sip_header_call_id_t);
+	const char *body=belle_sip_message_get_body(msg);
+
+	bctbx_mutex_lock(&ctx->mutex);
+	if (belle_sip_sharded_stack_get_shard_for_call_id(ctx->sharded,belle_sip_header_call_id_get_call_id(call_id))!=data->index)
+		ctx->misplaced++;
+	if (!body || belle_sip_message_get_body_size(msg)!=5 || strncmp(body,"hello",5)!=0)
+		ctx->bad_bodies++;
+	ctx->received++;
+	bctbx_mutex_unlock(&ctx->mutex);
+}
+
+static void on_dispatch_shard_start(belle_sip_stack_t *stack, int shard_index, void *user_data){
+	shard_test_ctx_t *ctx=(shard_test_ctx_t*)user_data;
+	belle_sip_listener_callbacks_t cbs={0};
+	belle_sip_listening_point_t *lp;
+
+	lp=belle_sip_stack_create_listening_point(stack,"127.0.0.1",shard_index==0 ? BELLE_SIP_LISTENING_POINT_RANDOM_PORT : ctx->port,"UDP");
+	if (!lp) return;
+	if (shard_index==0) ctx->port=belle_sip_listening_point_get_port(lp);
+	cbs.process_request_event=shard_process_request;
+	ctx->listener_data[shard_index].ctx=ctx;
+	ctx->listener_data[shard_index].index=shard_index;
+	ctx->provs[shard_index]=belle_sip_stack_create_provider(stack,lp);
+	ctx->listeners[shard_index]=belle_sip_listener_create_from_callbacks(&cbs,&ctx->listener_data[shard_index]);
+	belle_sip_provider_add_sip_listener(ctx->provs[shard_index],ctx->listeners[shard_index]);
+	ctx->lp_created++;
+}
+
+static void on_dispatch_shard_stop(belle_sip_stack_t *stack, int shard_index, void *user_data){
+	shard_test_ctx_t *ctx=(shard_test_ctx_t*)user_data;
+	if (!ctx->provs[shard_index]) return;
+	belle_sip_provider_remove_sip_listener(ctx->provs[shard_index],ctx->listeners[shard_index]);
+	belle_sip_object_unref(ctx->listeners[shard_index]);
+	belle_sip_object_unref(ctx->provs[shard_index]);
+}
+
+static int shard_test_received(shard_test_ctx_t *ctx){
+	int received;
+	bctbx_mutex_lock(&ctx->mutex);
+	received=ctx->received;
+	bctbx_mutex_unlock(&ctx->mutex);
+	return received;
+}
+
+static int loopback_socket(struct sockaddr_in *addr){
+	socklen_t addrlen=sizeof(*addr);
+	int sock=socket(AF_INET,SOCK_DGRAM,0);
+	memset(addr,0,sizeof(*addr));
+	addr->sin_family=AF_INET;
+	addr->sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	if (sock==-1 || bind(sock,(struct sockaddr*)addr,sizeof(*addr))!=0 || getsockname(sock,(struct sockaddr*)addr,&addrlen)!=0){
+		belle_sip_error("Cannot create loopback socket: %s",strerror(errno));
+	}
+	return sock;
+}
+
+/*
+ * Sends a MESSAGE per call to a sharded stack, round robin from nsockets client sockets, and returns the time
+ * taken until all of them are processed. At most SHARD_IN_FLIGHT requests are in flight, so that none is dropped
+ * by the socket buffers.
+ */
+#define SHARD_IN_FLIGHT 64
+#define SHARD_MAX_SOCKETS 8
+
+static uint64_t sharded_stack_send_requests(int nshards, int nsockets, int ncalls){
+	shard_test_ctx_t ctx;
+	struct sockaddr_in client_addrs[SHARD_MAX_SOCKETS],server_addr;
+	int socks[SHARD_MAX_SOCKETS];
+	int i,call;
+	uint64_t begin,elapsed=0;
+
+	memset(&ctx,0,sizeof(ctx));
+	bctbx_mutex_init(&ctx.mutex,NULL);
+	ctx.sharded=belle_sip_sharded_stack_new(nshards,NULL,on_dispatch_shard_start,on_dispatch_shard_stop,&ctx);
+	if (!BC_ASSERT_PTR_NOT_NULL(ctx.sharded)) goto end;
+	if (!BC_ASSERT_EQUAL(ctx.lp_created,nshards,int,"%i")) goto end;
+
+	for(i=0;i<nsockets;++i) socks[i]=loopback_socket(&client_addrs[i]);
+	memset(&server_addr,0,sizeof(server_addr));
+	server_addr.sin_family=AF_INET;
+	server_addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	server_addr.sin_port=htons((unsigned short)ctx.port);
+	begin=bctbx_get_cur_time_ms();
+	for(call=0;call<ncalls;++call){
+		char request[512];
+		int sock=call%nsockets;
+		int len=snprintf(request,sizeof(request),
+			"MESSAGE sip:bob@127.0.0.1:%i SIP/2.0\r\n"
+			"Via: SIP/2.0/UDP 127.0.0.1:%i;branch=z9hG4bK-shard-%i\r\n"
+			"From: <sip:alice@127.0.0.1>;tag=%i\r\n"
+			"To: <sip:bob@127.0.0.1>\r\n"
+			"Call-ID: call-%i@sharded.test\r\n"
+			"CSeq: 1 MESSAGE\r\n"
+			"Max-Forwards: 70\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: 5\r\n"
+			"\r\n"
+			"hello",ctx.port,(int)ntohs(client_addrs[sock].sin_port),call,call,call);
+		while(call-shard_test_received(&ctx)>=SHARD_IN_FLIGHT && bctbx_get_cur_time_ms()-begin<10000) belle_sip_sleep(1);
+		sendto(socks[sock],request,(size_t)len,0,(struct sockaddr*)&server_addr,sizeof(server_addr));
+	}
+	while(shard_test_received(&ctx)<ncalls && bctbx_get_cur_time_ms()-begin<10000) belle_sip_sleep(1);
+	elapsed=bctbx_get_cur_time_ms()-begin;
+	BC_ASSERT_EQUAL(shard_test_received(&ctx),ncalls,int,"%i");
+	BC_ASSERT_EQUAL(ctx.misplaced,0,int,"%i");
+	BC_ASSERT_EQUAL(ctx.bad_bodies,0,int,"%i");
+	for(i=0;i<nsockets;++i) close(socks[i]);
+end:
+	if (ctx.sharded) belle_sip_object_unref(ctx.sharded);
+	bctbx_mutex_destroy(&ctx.mutex);
+	return elapsed;
+}
+
+/*
+ * All the datagrams are sent from a single socket, so the kernel hands them to a single shard: those of the calls
+ * owned by the other shard are received there only if they are forwarded by Call-ID.
+ */
+static void sharded_stack_datagram_dispatch(void){
+	sharded_stack_send_requests(2,1,SHARD_CALLS);
+}
+
+static void sharded_stack_scaling_benchmark(void){
+	int ncalls=5000;
+	uint64_t t_single=sharded_stack_send_requests(1,SHARD_MAX_SOCKETS,ncalls);
+	uint64_t t_sharded=sharded_stack_send_requests(SHARD_COUNT,SHARD_MAX_SOCKETS,ncalls);
+	belle_sip_message("%i requests from %i sockets processed in %" PRIu64 " ms by 1 shard, in %" PRIu64 " ms by %i shards",
+		ncalls,SHARD_MAX_SOCKETS,t_single,t_sharded,SHARD_COUNT);
+}
+#endif
+
+test_t loop_tests[] = {
+	TEST_NO_TAG("Backend selection", main_loop_backend_selection),
+#ifndef _WIN32
+	TEST_NO_TAG("Fd and timer sources with poll", poll_fd_and_timer_sources),
+	TEST_NO_TAG("Fd and timer sources with epoll", epoll_fd_and_timer_sources),
+	TEST_NO_TAG("Allocation free iterations with poll", poll_allocation_free_iterations),
+	TEST_NO_TAG("Allocation free iterations with epoll", epoll_allocation_free_iterations),
+#endif
+	TEST_NO_TAG("Timer wheel expiration", timer_wheel_expiration),
+	TEST_NO_TAG("Timer wheel performance", timer_wheel_perf),
+	TEST_NO_TAG("Cross-thread tasks", cross_thread_tasks),
+	TEST_NO_TAG("Instrumentation", main_loop_instrumentation),
+	TEST_NO_TAG("Timer budget", timer_budget),
+	TEST_NO_TAG("Find and cancel sources by id", find_and_cancel_sources),
+	TEST_NO_TAG("Cached clock", cached_clock),
+#ifndef _WIN32
+	TEST_NO_TAG("Coalesced wake ups", coalesced_wakeups),
+	TEST_NO_TAG("Pipelined stream messages", pipelined_stream_messages),
+#endif
+	TEST_NO_TAG("Sharded stack Call-ID affinity", sharded_stack_call_id_affinity),
+#ifdef SO_REUSEPORT
+	TEST_NO_TAG("Sharded stack with SO_REUSEPORT", sharded_stack_reuse_port),
+	TEST_NO_TAG("Sharded stack datagram dispatch by Call-ID", sharded_stack_datagram_dispatch),
+	TEST_NO_TAG("Sharded stack scaling benchmark", sharded_stack_scaling_benchmark),
+#endif
+};
+
+test_suite_t loop_test_suite = {"Main loop", NULL, NULL, belle_sip_tester_before_each, belle_sip_tester_after_each,
+								sizeof(loop_tests) / sizeof(loop_tests[0]), loop_tests};
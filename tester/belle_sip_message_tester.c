@@ -20,6 +20,7 @@
 #include "belle-sip/belle-sip.h"
 #include "belle_sip_tester.h"
 #include "belle_sip_internal.h"
+#include <inttypes.h>
 
 
 static void check_uri_and_headers(belle_sip_message_t* message) {
@@ -543,6 +544,169 @@ void channel_parser_truncated_start_with_garbage(void) {
 	channel_parser_tester_recovery_from_error_base (prelude, raw_message);
 }
 
+static void channel_parser_max_messages_per_read(void) {
+	belle_sip_stack_t* stack = belle_sip_stack_new(NULL);
+	belle_sip_channel_t* channel = belle_sip_stream_channel_new_client(stack
+																	, NULL
+																	, 45421
+																	, NULL
+																	, "127.0.0.1"
+																	, 45421);
+	const char * raw_message=	"OPTIONS sip:192.168.0.20 SIP/2.0\r\n"
+			"Via: SIP/2.0/TCP 192.168.1.8:5062;branch=z9hG4bK1439638806\r\n"
+			"From: <sip:jehan-mac@sip.linphone.org>;tag=465687829\r\n"
+			"To: <sip:jehan-mac@sip.linphone.org>\r\n"
+			"Call-ID: 1053183492\r\n"
+			"CSeq: 1 OPTIONS\r\n"
+			"Max-Forwards: 70\r\n"
+			"Content-Length: 0\r\n"
+			"\r\n";
+	int i;
+
+	belle_sip_stack_set_max_messages_per_read(stack,2);
+	for(i=0;i<5;++i){
+		channel->input_stream.write_ptr = strcpy(channel->input_stream.write_ptr,raw_message);
+		channel->input_stream.write_ptr+=strlen(raw_message);
+	}
+
+	/*messages beyond the limit are left in the buffer until the channel is notified again*/
+	belle_sip_channel_parse_stream(channel,FALSE);
+	BC_ASSERT_EQUAL((int)belle_sip_list_size(channel->incoming_messages),2,int,"%d");
+	BC_ASSERT_TRUE(channel->parse_pending);
+	belle_sip_channel_parse_stream(channel,FALSE);
+	BC_ASSERT_EQUAL((int)belle_sip_list_size(channel->incoming_messages),4,int,"%d");
+	BC_ASSERT_TRUE(channel->parse_pending);
+	belle_sip_channel_parse_stream(channel,FALSE);
+	BC_ASSERT_EQUAL((int)belle_sip_list_size(channel->incoming_messages),5,int,"%d");
+	BC_ASSERT_FALSE(channel->parse_pending);
+
+	belle_sip_object_unref(channel);
+	belle_sip_object_unref(stack);
+}
+
+static const char *segmented_stream_messages[]={
+	"REGISTER sip:192.168.0.20 SIP/2.0\r\n"
+	"Via: SIP/2.0/TCP 192.168.1.8:5062;rport;branch=z9hG4bK1439638806\r\n"
+	"From: <sip:jehan-mac@sip.linphone.org>;tag=465687829\r\n"
+	"To: <sip:jehan-mac@sip.linphone.org>\r\n"
+	"Call-ID: 1053183492\r\n"
+	"CSeq: 1 REGISTER\r\n"
+	"Contact: <sip:jehan-mac@192.168.1.8:5062>\r\n"
+	"Max-Forwards: 70\r\n"
+	"User-Agent: Linphone/3.3.99.10 (eXosip2/3.3.0)\r\n"
+	"Expires: 3600\r\n"
+	"Proxy-Authorization: Digest username=\"8117396\", realm=\"Realm\", nonce=\"MTMwNDAwMjIxMjA4NzVkODY4ZmZhODMzMzU4ZDJkOTA1NzM2NTQ2NDZlNmIz\""
+	", uri=\"sip:linphone.net\", response=\"eed376ff7c963441255ec66594e470e7\", algorithm=MD5, cnonce=\"0a4f113b\", qop=auth, nc=00000001\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n",
+	"INVITE sip:jehan@sip.linphone.org SIP/2.0\r\n"
+	"Via: SIP/2.0/TCP 192.168.1.12:15060;rport=15060;branch=z9hG4bK1596944937;received=81.56.113.2\r\n"
+	"Record-Route: <sip:37.59.129.73;lr;transport=tcp>\r\n"
+	"Max-Forwards: 70\r\n"
+	"From: <sip:jehan@sip.linphone.org>;tag=711138653\r\n"
+	"To: <sip:jehan@sip.linphone.org>\r\n"
+	"Call-ID: 977107319\r\n"
+	"CSeq: 21 INVITE\r\n"
+	"Contact: <sip:jehan-mac@192.168.1.8:5062>\r\n"
+	"Subject: Phone call\r\n"
+	"User-Agent: Linphone/3.5.2 (eXosip2/3.6.0)\r\n"
+	"Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO\r\n"
+	"Content-Type: application/sdp\r\n"
+	"Content-Length: 80\r\n"
+	"\r\n"
+	"v=0\r\n"
+	"o=jehan 3102 3102 IN IP4 192.168.1.8\r\n"
+	"s=Talk\r\n"
+	"c=IN IP4 192.168.1.8\r\n"
+	"t=0 0\r\n",
+	"\r\n\r\n" /*keep alive*/
+	"SIP/2.0 200 Ok\r\n"
+	"Via: SIP/2.0/TCP 192.168.1.8:5062;rport=5062;branch=z9hG4bK1439638806\r\n"
+	"From: <sip:jehan-mac@sip.linphone.org>;tag=465687829\r\n"
+	"To: <sip:jehan-mac@sip.linphone.org>;tag=bc7d4c8\r\n"
+	"Call-ID: 1053183492\r\n"
+	"CSeq: 1 REGISTER\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n"
+};
+
+#define SEGMENTED_STREAM_ITERATIONS 200
+
+/*feeds the channel parser with the test messages, cut in segments of the given size, and returns the number of messages
+ parsed*/
+static int feed_segmented_stream(belle_sip_channel_t *channel, size_t segment_size){
+	char *stream=NULL;
+	size_t stream_len=0;
+	size_t offset;
+	int parsed=0;
+	int i;
+
+	for(i=0;i<(int)(sizeof(segmented_stream_messages)/sizeof(segmented_stream_messages[0]));++i){
+		size_t len=strlen(segmented_stream_messages[i]);
+		stream=belle_sip_realloc(stream,stream_len+len+1);
+		memcpy(stream+stream_len,segmented_stream_messages[i],len+1);
+		stream_len+=len;
+	}
+	for(offset=0;offset<stream_len;offset+=segment_size){
+		size_t len=MIN(segment_size,stream_len-offset);
+		memcpy(channel->input_stream.write_ptr,stream+offset,len);
+		channel->input_stream.write_ptr+=len;
+		*channel->input_stream.write_ptr='\0';
+		belle_sip_channel_parse_stream(channel,FALSE);
+		parsed+=(int)belle_sip_list_size(channel->incoming_messages);
+		channel->incoming_messages=belle_sip_list_free_with_data(channel->incoming_messages,belle_sip_object_unref);
+	}
+	belle_sip_free(stream);
+	return parsed;
+}
+
+static void channel_parser_segmented_stream(void){
+	belle_sip_stack_t* stack = belle_sip_stack_new(NULL);
+	belle_sip_channel_t* channel = belle_sip_stream_channel_new_client(stack
+																	, NULL
+																	, 45421
+																	, NULL
+																	, "127.0.0.1"
+																	, 45421);
+	const size_t segment_sizes[]={1,2,3,5,16,100,1500};
+	int expected=(int)(sizeof(segmented_stream_messages)/sizeof(segmented_stream_messages[0]));
+	int i;
+
+	for(i=0;i<(int)(sizeof(segment_sizes)/sizeof(segment_sizes[0]));++i){
+		BC_ASSERT_EQUAL(feed_segmented_stream(channel,segment_sizes[i]),expected,int,"%d");
+		BC_ASSERT_TRUE(channel->input_stream.state==WAITING_MESSAGE_START);
+		BC_ASSERT_PTR_EQUAL(channel->input_stream.read_ptr,channel->input_stream.write_ptr);
+	}
+	belle_sip_object_unref(channel);
+	belle_sip_object_unref(stack);
+}
+
+static void channel_parser_segmented_stream_benchmark(void){
+	belle_sip_stack_t* stack = belle_sip_stack_new(NULL);
+	belle_sip_channel_t* channel = belle_sip_stream_channel_new_client(stack
+																	, NULL
+																	, 45421
+																	, NULL
+																	, "127.0.0.1"
+																	, 45421);
+	const size_t segment_sizes[]={1,16,128,512,1500};
+	int expected=SEGMENTED_STREAM_ITERATIONS*(int)(sizeof(segmented_stream_messages)/sizeof(segmented_stream_messages[0]));
+	int i,j;
+
+	for(i=0;i<(int)(sizeof(segment_sizes)/sizeof(segment_sizes[0]));++i){
+		uint64_t begin=bctbx_get_cur_time_ms();
+		int parsed=0;
+		for(j=0;j<SEGMENTED_STREAM_ITERATIONS;++j){
+			parsed+=feed_segmented_stream(channel,segment_sizes[i]);
+		}
+		BC_ASSERT_EQUAL(parsed,expected,int,"%d");
+		belle_sip_message("%i messages received in segments of %i bytes parsed in %" PRIu64 " ms",parsed,(int)segment_sizes[i]
+			,bctbx_get_cur_time_ms()-begin);
+	}
+	belle_sip_object_unref(channel);
+	belle_sip_object_unref(stack);
+}
+
 static void testMalformedFrom_process_response_cb(void *user_ctx, const belle_sip_response_event_t *event){
 	int status = belle_sip_response_get_status_code(belle_sip_response_event_get_response(event));
 
@@ -1103,6 +1267,398 @@ static void testHop(void){
 }
 
 
+static const char *invite_headers="INVITE sip:bob@sip.example.org SIP/2.0\r\n"
+				"Via: SIP/2.0/UDP 192.168.1.12:5060;rport;branch=z9hG4bK1596944937\r\n"
+				"Record-Route: <sip:37.59.129.73;lr;transport=tcp>\r\n"
+				"Record-Route: <sip:37.59.129.73;lr>\r\n"
+				"Max-Forwards: 70\r\n"
+				"From: <sip:alice@sip.example.org>;tag=711138653\r\n"
+				"To: <sip:bob@sip.example.org>\r\n"
+				"Call-ID: 977107319\r\n"
+				"CSeq: 21 INVITE\r\n"
+				"Contact: <sip:alice@192.168.1.12:5060>\r\n"
+				"Subject: Phone call\r\n"
+				"User-Agent: Linphone/3.5.2 (eXosip2/3.6.0)\r\n"
+				"Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO\r\n"
+				"Content-Type: application/sdp\r\n"
+				"Content-Length: 232\r\n"
+				"\r\n";
+
+static const char *invite_sdp="v=0\r\n"
+				"o=alice 3102 1 IN IP4 192.168.1.12\r\n"
+				"s=Talk\r\n"
+				"c=IN IP4 192.168.1.12\r\n"
+				"t=0 0\r\n"
+				"m=audio 7078 RTP/AVP 111 110 0 8 101\r\n"
+				"a=rtpmap:111 speex/16000\r\n"
+				"a=rtpmap:110 speex/8000\r\n"
+				"a=rtpmap:101 telephone-event/8000\r\n"
+				"a=fmtp:101 0-15\r\n"
+				"a=sendrecv\r\n";
+
+static belle_sip_message_t *parse_invite_with_sdp(void){
+	belle_sip_message_t *msg=belle_sip_message_parse(invite_headers);
+	if (msg) belle_sip_message_set_body(msg,invite_sdp,strlen(invite_sdp));
+	return msg;
+}
+
+static void testCloneIsCopyOnWrite(void){
+	belle_sip_message_t *orig=parse_invite_with_sdp();
+	belle_sip_header_cseq_t *orig_cseq;
+	belle_sip_request_t *clone;
+	belle_sip_request_t *clone2;
+	belle_sip_header_cseq_t *cseq;
+	char *orig_str;
+	char *str;
+
+	if (!BC_ASSERT_PTR_NOT_NULL(orig)) return;
+	orig_cseq=belle_sip_message_get_header_by_type(orig,belle_sip_header_cseq_t);
+	if (!BC_ASSERT_PTR_NOT_NULL(orig_cseq)){
+		belle_sip_object_unref(orig);
+		return;
+	}
+	orig_str=belle_sip_object_to_string(orig);
+	clone=belle_sip_request_clone_with_body(BELLE_SIP_REQUEST(orig));
+	clone2=belle_sip_request_clone_with_body(clone);
+
+	/*untouched clones marshal the same way as the original*/
+	str=belle_sip_object_to_string(clone2);
+	BC_ASSERT_STRING_EQUAL(str,orig_str);
+	belle_sip_free(str);
+
+	/*the read only accessors of the stack do not copy shared headers*/
+	BC_ASSERT_PTR_NOT_NULL(belle_sip_message_peek_header(orig,"Via"));
+	BC_ASSERT_PTR_EQUAL(belle_sip_message_peek_header(BELLE_SIP_MESSAGE(clone),"Via"),belle_sip_message_peek_header(orig,"Via"));
+	BC_ASSERT_PTR_EQUAL(belle_sip_message_peek_header_by_type(clone2,belle_sip_header_via_t),belle_sip_message_peek_header(orig,"Via"));
+
+	/*headers modified in the clone do not change the original*/
+	cseq=belle_sip_message_get_header_by_type(clone,belle_sip_header_cseq_t);
+	BC_ASSERT_PTR_NOT_EQUAL(cseq,orig_cseq);
+	belle_sip_header_cseq_set_seq_number(cseq,22);
+	belle_sip_message_remove_header(BELLE_SIP_MESSAGE(clone),"Subject");
+	belle_sip_message_add_header(BELLE_SIP_MESSAGE(clone),belle_sip_header_create("Subject","Another call"));
+	BC_ASSERT_EQUAL(belle_sip_header_cseq_get_seq_number(orig_cseq),21,unsigned int,"%u");
+	str=belle_sip_object_to_string(orig);
+	BC_ASSERT_STRING_EQUAL(str,orig_str);
+	belle_sip_free(str);
+
+	/*headers obtained from the original before cloning stay the ones of the original*/
+	belle_sip_header_cseq_set_seq_number(orig_cseq,23);
+	cseq=belle_sip_message_get_header_by_type(clone2,belle_sip_header_cseq_t);
+	BC_ASSERT_EQUAL(belle_sip_header_cseq_get_seq_number(cseq),21,unsigned int,"%u");
+	BC_ASSERT_PTR_EQUAL(belle_sip_message_get_header_by_type(orig,belle_sip_header_cseq_t),orig_cseq);
+	BC_ASSERT_PTR_NOT_NULL(belle_sip_message_get_header(BELLE_SIP_MESSAGE(clone2),"Subject"));
+	BC_ASSERT_EQUAL((unsigned int)belle_sip_list_size(belle_sip_message_get_headers(BELLE_SIP_MESSAGE(clone2),"Record-Route")),2,unsigned int,"%u");
+	BC_ASSERT_STRING_EQUAL(belle_sip_message_get_body(BELLE_SIP_MESSAGE(clone2)),belle_sip_message_get_body(orig));
+
+	/*the original can be released before its clones*/
+	belle_sip_object_unref(orig);
+	belle_sip_message_remove_header_from_ptr(BELLE_SIP_MESSAGE(clone2),BELLE_SIP_HEADER(cseq));
+	BC_ASSERT_PTR_NULL(belle_sip_message_get_header(BELLE_SIP_MESSAGE(clone2),"CSeq"));
+	BC_ASSERT_EQUAL(belle_sip_header_cseq_get_seq_number(belle_sip_message_get_header_by_type(clone,belle_sip_header_cseq_t)),22,unsigned int,"%u");
+	belle_sip_object_unref(clone);
+	belle_sip_object_unref(clone2);
+	belle_sip_free(orig_str);
+}
+
+static void testCheckCloneWithoutCopy(void){
+	belle_sip_message_t *orig=parse_invite_with_sdp();
+	belle_sip_request_t *clone;
+	int headers_ok,uris_ok,allocations;
+
+	if (!BC_ASSERT_PTR_NOT_NULL(orig)) return;
+	clone=belle_sip_request_clone_with_body(BELLE_SIP_REQUEST(orig));
+	/*checks only read the headers: the containers shared with the original are not copied*/
+	belle_sip_tester_start_counting_allocations();
+	headers_ok=belle_sip_message_check_headers(BELLE_SIP_MESSAGE(clone));
+	uris_ok=belle_sip_request_check_uris_components(clone);
+	allocations=belle_sip_tester_stop_counting_allocations();
+	BC_ASSERT_EQUAL(allocations,0,int,"%i");
+	BC_ASSERT_EQUAL(headers_ok,belle_sip_message_check_headers(orig),int,"%i");
+	BC_ASSERT_EQUAL(uris_ok,belle_sip_request_check_uris_components(BELLE_SIP_REQUEST(orig)),int,"%i");
+	belle_sip_object_unref(clone);
+	belle_sip_object_unref(orig);
+}
+
+#define CLONE_ITERATIONS 100000
+
+static void testCloneBenchmark(void){
+	belle_sip_request_t *req=BELLE_SIP_REQUEST(parse_invite_with_sdp());
+	uint64_t start,elapsed;
+	int i;
+
+	start=bctbx_get_cur_time_ms();
+	for(i=0;i<CLONE_ITERATIONS;++i){
+		belle_sip_request_t *clone=belle_sip_request_clone_with_body(req);
+		belle_sip_object_unref(clone);
+	}
+	elapsed=bctbx_get_cur_time_ms()-start;
+	belle_sip_message("%i INVITE clones in %" PRIu64 " ms",CLONE_ITERATIONS,elapsed);
+	belle_sip_object_unref(req);
+}
+
+
+/*header lines parsed by both parsers, that must give the same message*/
+static const char *fast_parser_corpus[]={
+	"Via: SIP/2.0/UDP 192.168.1.1:5060;branch=z9hG4bK776;received=10.0.0.1;rport",
+	"v: SIP/2.0/TCP [2001:db8::1]:5070;branch=z9hG4bK77;rport=5070",
+	"Via: SIP/2.0/UDP 192.168.1.1;branch=z9hG4bK1, SIP/2.0/TCP 10.0.0.2:5061;branch=z9hG4bK2",
+	"Via: SIP/2.0/UDP host.example.com;received=host.example.com",
+	"From: \"Alice \\\"A\\\"\" <sip:alice@atlanta.com>;tag=1928",
+	"f: Alice <sips:alice@atlanta.com:5061;transport=tls>;tag=1928",
+	"From: sip:alice@atlanta.com;tag=1928",
+	"From: <sip:alice%40home@atlanta.com>;tag=1928",
+	"To: Bob <sip:bob@biloxi.com>",
+	"t: <sip:bob@[2001:db8::2]:5060>",
+	"Call-ID: a84b4c76e66710@pc33.atlanta.com",
+	"i: a84b4c76e66710",
+	"CSeq: 314159 INVITE",
+	"Contact: <sip:alice@[2001:db8::1]:5070;transport=tcp>;expires=30, sip:x@y.com",
+	"m: \"Bob\" <sip:bob@192.0.2.4>;q=0.7;+sip.instance=\"<urn:uuid:00000000-0000-1000-8000-000A95A0E128>\"",
+	"Contact: *",
+	"Contact: <sip:bob@192.0.2.4?Subject=hello>",
+	"Route: <sip:p1.example.com;lr>, <sip:p2.example.com;lr>",
+	"Route: <sip:p1.example.com;lr>,\r\n <sip:p2.example.com;lr>",
+	"Record-Route: <sip:p1.example.com;lr;transport=udp>",
+	"Max-Forwards: 70",
+	"Expires: 3600",
+	"Content-Type: application/sdp",
+	"c: multipart/mixed;boundary=toto",
+	"Content-Length: 0",
+	"l: 12",
+	"Subject:",
+	"X-Custom:   value with spaces   ",
+	"User-Agent: belle-sip/1.0",
+	"Max-Forwards: seventy",
+	"CSeq: INVITE",
+	"Via: SIP/2.0/UDP",
+	"From: <sip:alice@>",
+	"Contact: <sip:bob@192.0.2.4"
+};
+
+static belle_sip_message_t *parse_with(belle_sip_message_parser_t parser, const char *raw){
+	belle_sip_message_parser_t previous=belle_sip_message_get_parser();
+	belle_sip_message_t *msg;
+	belle_sip_message_set_parser(parser);
+	msg=belle_sip_message_parse(raw);
+	belle_sip_message_set_parser(previous);
+	return msg;
+}
+
+static void check_same_parsing(belle_sip_message_parser_t parser, const char *raw){
+	belle_sip_message_t *antlr_msg=parse_with(BELLE_SIP_MESSAGE_PARSER_ANTLR,raw);
+	belle_sip_message_t *msg=parse_with(parser,raw);
+
+	if (antlr_msg==NULL || msg==NULL){
+		BC_ASSERT_PTR_NULL(antlr_msg);
+		BC_ASSERT_PTR_NULL(msg);
+	}else{
+		char *antlr_str;
+		char *str;
+		/*accessing all headers makes the lazy parser parse them*/
+		belle_sip_list_free(belle_sip_message_get_all_headers(msg));
+		antlr_str=belle_sip_object_to_string(antlr_msg);
+		str=belle_sip_object_to_string(msg);
+		if (!BC_ASSERT_STRING_EQUAL(str,antlr_str)){
+			belle_sip_error("Parsers differ on [%s]",raw);
+		}
+		belle_sip_free(antlr_str);
+		belle_sip_free(str);
+	}
+	if (antlr_msg) belle_sip_object_unref(antlr_msg);
+	if (msg) belle_sip_object_unref(msg);
+}
+
+static void check_corpus(belle_sip_message_parser_t parser){
+	char raw[512];
+	size_t i;
+
+	for(i=0;i<sizeof(fast_parser_corpus)/sizeof(fast_parser_corpus[0]);++i){
+		snprintf(raw,sizeof(raw),"REGISTER sip:192.168.0.20 SIP/2.0\r\n%s\r\nCall-ID: 1234\r\n\r\n",fast_parser_corpus[i]);
+		check_same_parsing(parser,raw);
+		snprintf(raw,sizeof(raw),"SIP/2.0 180 Ringing\r\n%s\r\n\r\n",fast_parser_corpus[i]);
+		check_same_parsing(parser,raw);
+	}
+	check_same_parsing(parser,invite_headers);
+	check_same_parsing(parser,"SIP/2.0 401 \r\nCall-ID: 1234\r\n\r\n");
+	check_same_parsing(parser,"INVITE tel:11234567888 SIP/2.0\r\nCall-ID: 1234\r\n\r\n");
+	check_same_parsing(parser,"sip:bob@example.com SIP/2.0\r\nCall-ID: 1234\r\n\r\n");
+}
+
+static void testFastParserEquivalence(void){
+	check_corpus(BELLE_SIP_MESSAGE_PARSER_FAST);
+}
+
+static void testLazyParserEquivalence(void){
+	check_corpus(BELLE_SIP_MESSAGE_PARSER_LAZY);
+}
+
+static void testLazyHeaders(void){
+	const char *raw="INVITE sip:bob@sip.example.org SIP/2.0\r\n"
+				"v: SIP/2.0/UDP 192.168.1.12:5060;rport;branch=z9hG4bK1596944937\r\n"
+				"f:<sip:alice@sip.example.org>;tag=711138653\r\n"
+				"To:   <sip:bob@sip.example.org>  \r\n"
+				"Call-ID: 977107319\r\n"
+				"CSeq: 21 INVITE\r\n"
+				"Route: <sip:37.59.129.73;lr>,\r\n <sip:37.59.129.74;lr>\r\n"
+				"X-Custom: not parsed\r\n"
+				"\r\n";
+	belle_sip_message_t *msg=parse_with(BELLE_SIP_MESSAGE_PARSER_LAZY,raw);
+	belle_sip_message_t *clone;
+	belle_sip_header_from_t *from;
+	belle_sip_header_via_t *via;
+	char *str;
+
+	if (!BC_ASSERT_PTR_NOT_NULL(msg)) return;
+	/*nothing accessed, sent as received*/
+	str=belle_sip_object_to_string(msg);
+	BC_ASSERT_STRING_EQUAL(str,raw);
+	belle_sip_free(str);
+
+	from=belle_sip_message_get_header_by_type(msg,belle_sip_header_from_t);
+	if (BC_ASSERT_PTR_NOT_NULL(from)){
+		BC_ASSERT_STRING_EQUAL(belle_sip_header_from_get_tag(from),"711138653");
+	}
+	via=belle_sip_message_get_header_by_type(msg,belle_sip_header_via_t);
+	if (BC_ASSERT_PTR_NOT_NULL(via)){
+		BC_ASSERT_STRING_EQUAL(belle_sip_header_via_get_host(via),"192.168.1.12");
+	}
+	BC_ASSERT_EQUAL((int)belle_sip_list_size(belle_sip_message_get_headers(msg,BELLE_SIP_ROUTE)),2,int,"%i");
+
+	/*only accessed headers are marshalled again*/
+	str=belle_sip_object_to_string(msg);
+	BC_ASSERT_PTR_NOT_NULL(strstr(str,"From: <sip:alice@sip.example.org>;tag=711138653\r\n"));
+	BC_ASSERT_PTR_NOT_NULL(strstr(str,"To:   <sip:bob@sip.example.org>  \r\n"));
+	BC_ASSERT_PTR_NOT_NULL(strstr(str,"X-Custom: not parsed\r\n"));
+	belle_sip_free(str);
+
+	clone=BELLE_SIP_MESSAGE(belle_sip_object_clone(BELLE_SIP_OBJECT(msg)));
+	BC_ASSERT_PTR_NOT_NULL(belle_sip_message_get_header_by_type(clone,belle_sip_header_to_t));
+	BC_ASSERT_PTR_NOT_NULL(belle_sip_message_get_header(clone,"X-Custom"));
+	belle_sip_object_unref(clone);
+	belle_sip_object_unref(msg);
+}
+
+static void check_lazy_malformed_headers(const char *to, const char *cseq){
+	char raw[512];
+	belle_sip_message_t *msg;
+	snprintf(raw,sizeof(raw),"INVITE sip:bob@sip.example.org SIP/2.0\r\n"
+				"Via: SIP/2.0/UDP 192.168.1.12:5060;rport;branch=z9hG4bK1596944937\r\n"
+				"From: <sip:alice@sip.example.org>;tag=711138653\r\n"
+				"To: %s\r\n"
+				"Call-ID: 977107319\r\n"
+				"CSeq: %s\r\n"
+				"Contact: <sip:alice@192.168.1.12:5060>\r\n"
+				"Max-Forwards: 70\r\n"
+				"\r\n",to,cseq);
+	msg=parse_with(BELLE_SIP_MESSAGE_PARSER_LAZY,raw);
+	if (!BC_ASSERT_PTR_NOT_NULL(msg)) return;
+	/*malformed raw lines are dropped when parsed, they must not count as present*/
+	if (!BC_ASSERT_FALSE(belle_sip_message_check_headers(msg))){
+		belle_sip_error("Malformed mandatory header accepted in [%s]",raw);
+	}
+	belle_sip_object_unref(msg);
+}
+
+static void testLazyMalformedMandatoryHeaders(void){
+	check_lazy_malformed_headers("<sip:bob@sip.example.org>","INVITE");
+	check_lazy_malformed_headers("<sip:bob@","21 INVITE");
+}
+
+#define FORWARDING_PORT 45422
+#define FORWARDED_TO_PORT 45423
+
+static void forwarded_process_request_cb(void *user_ctx, const belle_sip_request_event_t *event){
+	char **received=(char**)user_ctx;
+	if (*received==NULL) *received=belle_sip_object_to_string(belle_sip_request_event_get_request(event));
+}
+
+static void testLazyRequestForwarding(void){
+	const char *raw="INVITE sip:bob@127.0.0.1:45423 SIP/2.0\r\n"
+				"Via: SIP/2.0/UDP 192.168.1.12:5060;rport;branch=z9hG4bK1596944937\r\n"
+				"From: <sip:alice@sip.example.org>;tag=711138653\r\n"
+				"To: <sip:bob@sip.example.org>\r\n"
+				"Call-ID: 977107319-forwarded\r\n"
+				"CSeq: 21 INVITE\r\n"
+				"Contact: <sip:alice@192.168.1.12:5060>\r\n"
+				"Max-Forwards: 70\r\n"
+				"Supported:  replaces,outbound\r\n"
+				"X-Custom:   not  parsed ;at=all \r\n"
+				"Subject: lazy\tforwarding\r\n"
+				"Content-Length: 0\r\n"
+				"\r\n";
+	belle_sip_message_parser_t previous=belle_sip_message_get_parser();
+	belle_sip_stack_t *stack=belle_sip_stack_new(NULL);
+	belle_sip_provider_t *forwarder=belle_sip_provider_new(stack,
+		belle_sip_stack_create_listening_point(stack,"127.0.0.1",FORWARDING_PORT,"UDP"));
+	belle_sip_provider_t *receiver=belle_sip_provider_new(stack,
+		belle_sip_stack_create_listening_point(stack,"127.0.0.1",FORWARDED_TO_PORT,"UDP"));
+	belle_sip_listener_callbacks_t listener_cbs={0};
+	belle_sip_listener_t *listener;
+	belle_sip_request_t *request;
+	belle_sip_client_transaction_t *t;
+	char *received=NULL;
+
+	/*the received request is parsed lazily too, so that untouched headers are marshalled as they came on the wire*/
+	belle_sip_message_set_parser(BELLE_SIP_MESSAGE_PARSER_LAZY);
+	listener_cbs.process_request_event=forwarded_process_request_cb;
+	listener=belle_sip_listener_create_from_callbacks(&listener_cbs,&received);
+	belle_sip_provider_add_sip_listener(receiver,listener);
+
+	request=BELLE_SIP_REQUEST(belle_sip_message_parse(raw));
+	if (!BC_ASSERT_PTR_NOT_NULL(request)) goto end;
+	belle_sip_object_ref(request);
+	/*as a proxy does*/
+	belle_sip_message_add_first(BELLE_SIP_MESSAGE(request),BELLE_SIP_HEADER(belle_sip_header_via_new()));
+	t=belle_sip_provider_create_client_transaction(forwarder,request);
+	BC_ASSERT_EQUAL(belle_sip_client_transaction_send_request(t),0,int,"%d");
+	belle_sip_object_unref(request);
+	belle_sip_stack_sleep(stack,500);
+
+	if (BC_ASSERT_PTR_NOT_NULL(received)){
+		BC_ASSERT_PTR_NOT_NULL(strstr(received,"\r\nSupported:  replaces,outbound\r\n"));
+		BC_ASSERT_PTR_NOT_NULL(strstr(received,"\r\nX-Custom:   not  parsed ;at=all \r\n"));
+		BC_ASSERT_PTR_NOT_NULL(strstr(received,"\r\nSubject: lazy\tforwarding\r\n"));
+		belle_sip_free(received);
+	}
+
+end:
+	belle_sip_provider_remove_sip_listener(receiver,listener);
+	belle_sip_object_unref(listener);
+	belle_sip_object_unref(forwarder);
+	belle_sip_object_unref(receiver);
+	belle_sip_object_unref(stack);
+	belle_sip_message_set_parser(previous);
+}
+
+#define PARSE_ITERATIONS 20000
+
+/*parsing, reading a few headers and marshalling, as a proxy forwarding a request does*/
+static uint64_t parse_benchmark(belle_sip_message_parser_t parser){
+	uint64_t start=bctbx_get_cur_time_ms();
+	char buff[2048];
+	int i;
+
+	for(i=0;i<PARSE_ITERATIONS;++i){
+		size_t offset=0;
+		belle_sip_message_t *msg=parse_with(parser,invite_headers);
+		belle_sip_message_get_header_by_type(msg,belle_sip_header_via_t);
+		belle_sip_message_get_header_by_type(msg,belle_sip_header_cseq_t);
+		belle_sip_message_get_header_by_type(msg,belle_sip_header_call_id_t);
+		belle_sip_object_marshal(BELLE_SIP_OBJECT(msg),buff,sizeof(buff),&offset);
+		belle_sip_object_unref(msg);
+	}
+	return bctbx_get_cur_time_ms()-start;
+}
+
+static void testFastParserBenchmark(void){
+	uint64_t antlr_time=parse_benchmark(BELLE_SIP_MESSAGE_PARSER_ANTLR);
+	uint64_t fast_time=parse_benchmark(BELLE_SIP_MESSAGE_PARSER_FAST);
+	uint64_t lazy_time=parse_benchmark(BELLE_SIP_MESSAGE_PARSER_LAZY);
+	belle_sip_message("%i INVITE parsed and marshalled in %" PRIu64 " ms with the grammar, %" PRIu64 " ms with the fast parser"
+		", %" PRIu64 " ms with the lazy parser",PARSE_ITERATIONS,antlr_time,fast_time,lazy_time);
+}
+
 /* NOTE - ORDER IS IMPORTANT - MUST TEST fread() AFTER fprintf() */
 test_t message_tests[] = {
 	TEST_NO_TAG("REGISTER", testRegisterMessage),
@@ -1124,6 +1680,8 @@ test_t message_tests[] = {
 	TEST_NO_TAG("Channel parser malformed start", channel_parser_malformed_start),
 	TEST_NO_TAG("Channel parser truncated start", channel_parser_truncated_start),
 	TEST_NO_TAG("Channel parser truncated start with garbage",channel_parser_truncated_start_with_garbage),
+	TEST_NO_TAG("Channel parser max messages per read",channel_parser_max_messages_per_read),
+	TEST_NO_TAG("Channel parser segmented stream",channel_parser_segmented_stream),
 	TEST_ONE_TAG("RFC2543 compatibility", testRFC2543Compat, "LeaksMemory"),
 	TEST_ONE_TAG("RFC2543 compatibility with branch id",testRFC2543CompatWithBranch, "LeaksMemory"),
 	TEST_NO_TAG("Uri headers in sip INVITE",testUriHeadersInInvite),
@@ -1133,8 +1691,24 @@ test_t message_tests[] = {
 	TEST_NO_TAG("HTTP 200 Ok",testHttp200Ok),
 	TEST_NO_TAG("Channel parser for HTTP reponse",channel_parser_http_response),
 	TEST_NO_TAG("Get body size",testGetBody),
-	TEST_NO_TAG("Create hop from uri", testHop)
+	TEST_NO_TAG("Create hop from uri", testHop),
+	TEST_NO_TAG("Copy on write clone", testCloneIsCopyOnWrite),
+	TEST_NO_TAG("Checking a clone does not copy it", testCheckCloneWithoutCopy),
+	TEST_NO_TAG("Fast parser equivalence", testFastParserEquivalence),
+	TEST_NO_TAG("Lazy parser equivalence", testLazyParserEquivalence),
+	TEST_NO_TAG("Lazy headers", testLazyHeaders),
+	TEST_NO_TAG("Lazy malformed mandatory headers", testLazyMalformedMandatoryHeaders),
+	TEST_NO_TAG("Lazy request forwarding", testLazyRequestForwarding),
+	/*benchmarks come last, see BELLE_SIP_TESTER_COUNT_WITHOUT_BENCHMARKS()*/
+	TEST_NO_TAG("Channel parser segmented stream benchmark",channel_parser_segmented_stream_benchmark),
+	TEST_NO_TAG("Clone benchmark", testCloneBenchmark),
+	TEST_NO_TAG("Fast parser benchmark", testFastParserBenchmark)
 };
 
 test_suite_t message_test_suite = {"Message", NULL, NULL, belle_sip_tester_before_each, belle_sip_tester_after_each,
 								   sizeof(message_tests) / sizeof(message_tests[0]), message_tests};
+
+/*same tests but the benchmarks, with the hand-written parser*/
+test_suite_t message_fast_parser_test_suite = {"Message (fast parser)", belle_sip_tester_fast_parser_before_all,
+								   belle_sip_tester_fast_parser_after_all, belle_sip_tester_before_each, belle_sip_tester_after_each,
+								   BELLE_SIP_TESTER_COUNT_WITHOUT_BENCHMARKS(message_tests, 3), message_tests};
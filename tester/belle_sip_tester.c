@@ -141,12 +141,14 @@ void belle_sip_tester_init(void(*ftester_printf)(int level, const char *fmt, va_
 	bc_tester_add_suite(&sdp_test_suite);
 	bc_tester_add_suite(&resolver_test_suite);
 	bc_tester_add_suite(&message_test_suite);
+	bc_tester_add_suite(&message_fast_parser_test_suite);
 	bc_tester_add_suite(&authentication_helper_test_suite);
 	bc_tester_add_suite(&register_test_suite);
 	bc_tester_add_suite(&dialog_test_suite);
 	bc_tester_add_suite(&refresher_test_suite);
 	bc_tester_add_suite(&http_test_suite);
 	bc_tester_add_suite(&object_test_suite);
+	bc_tester_add_suite(&loop_test_suite);
 }
 
 void belle_sip_tester_uninit(void) {
@@ -196,6 +198,55 @@ void belle_sip_tester_after_each(void) {
 	}
 }
 
+/*
+ * bctoolbox has no getter for its memory functions: the ones installed through the tester are remembered here, so
+ * that allocation counting can chain to them and put them back.
+ */
+static BctoolboxMemoryFunctions tester_memory_functions={malloc,realloc,free};
+static BctoolboxMemoryFunctions counted_memory_functions={malloc,realloc,free};
+static volatile int tester_allocations=0;
+
+static void *counting_malloc(size_t size){
+	tester_allocations++;
+	return counted_memory_functions.malloc_fun(size);
+}
+
+static void *counting_realloc(void *ptr, size_t size){
+	tester_allocations++;
+	return counted_memory_functions.realloc_fun(ptr,size);
+}
+
+static void counting_free(void *ptr){
+	counted_memory_functions.free_fun(ptr);
+}
+
+void belle_sip_tester_set_memory_functions(const BctoolboxMemoryFunctions *functions){
+	tester_memory_functions=*functions;
+	bctbx_set_memory_functions(&tester_memory_functions);
+}
+
+void belle_sip_tester_start_counting_allocations(void){
+	BctoolboxMemoryFunctions counting={counting_malloc,counting_realloc,counting_free};
+	counted_memory_functions=tester_memory_functions;
+	tester_allocations=0;
+	belle_sip_tester_set_memory_functions(&counting);
+}
+
+int belle_sip_tester_stop_counting_allocations(void){
+	belle_sip_tester_set_memory_functions(&counted_memory_functions);
+	return tester_allocations;
+}
+
+int belle_sip_tester_fast_parser_before_all(void){
+	belle_sip_message_set_parser(BELLE_SIP_MESSAGE_PARSER_FAST);
+	return 0;
+}
+
+int belle_sip_tester_fast_parser_after_all(void){
+	belle_sip_message_set_parser(BELLE_SIP_MESSAGE_PARSER_ANTLR);
+	return 0;
+}
+
 void belle_sip_tester_set_dns_host_file(belle_sip_stack_t *stack){
 	if (userhostsfile){
 		belle_sip_stack_set_dns_user_hosts_file(stack, userhostsfile);
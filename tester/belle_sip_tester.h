@@ -21,6 +21,7 @@
 #define _BELLE_SIP_TESTER_H
 
 #include <bctoolbox/tester.h>
+#include <bctoolbox/port.h>
 
 #include "belle-sip/belle-sip.h"
 
@@ -42,12 +43,14 @@ extern test_suite_t core_test_suite;
 extern test_suite_t sdp_test_suite;
 extern test_suite_t resolver_test_suite;
 extern test_suite_t message_test_suite;
+extern test_suite_t message_fast_parser_test_suite;
 extern test_suite_t authentication_helper_test_suite;
 extern test_suite_t register_test_suite;
 extern test_suite_t dialog_test_suite;
 extern test_suite_t refresher_test_suite;
 extern test_suite_t http_test_suite;
 extern test_suite_t object_test_suite;
+extern test_suite_t loop_test_suite;
 
 extern const char* belle_sip_tester_client_cert;
 extern const char* belle_sip_tester_client_cert_fingerprint;
@@ -63,6 +66,15 @@ void belle_sip_tester_before_each(void);
 void belle_sip_tester_after_each(void);
 int belle_sip_tester_set_log_file(const char *filename);
 void belle_sip_tester_set_dns_host_file(belle_sip_stack_t *stack);
+void belle_sip_tester_set_memory_functions(const BctoolboxMemoryFunctions *functions);
+/*counts the allocations done by belle-sip between these two calls, with the memory functions in use*/
+void belle_sip_tester_start_counting_allocations(void);
+int belle_sip_tester_stop_counting_allocations(void);
+/*suite fixtures running the tests with the hand-written message parser, see belle_sip_message_set_parser()*/
+int belle_sip_tester_fast_parser_before_all(void);
+int belle_sip_tester_fast_parser_after_all(void);
+/*number of tests of a suite leaving out the benchmarks, listed last, so that they are not run twice*/
+#define BELLE_SIP_TESTER_COUNT_WITHOUT_BENCHMARKS(tests, benchmark_count) (sizeof(tests) / sizeof(tests[0]) - (benchmark_count))
 
 #ifdef __cplusplus
 };
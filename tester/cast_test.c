@@ -19,6 +19,7 @@
 
 #include "belle-sip/belle-sip.h"
 #include "belle_sip_tester.h"
+#include <inttypes.h>
 
 static void cast_test(void){
 	belle_sip_stack_t *stack=belle_sip_stack_new(NULL);
@@ -53,9 +54,49 @@ static void cast_test(void){
 	belle_sip_object_unref(stack);
 }
 
+#define CAST_ITERATIONS 1000000
+
+static void cast_benchmark(void){
+	belle_sip_stack_t *stack=belle_sip_stack_new(NULL);
+	belle_sip_provider_t *provider=belle_sip_stack_create_provider(stack,NULL);
+	belle_sip_request_t *req=belle_sip_request_new();
+	belle_sip_header_t *via=BELLE_SIP_HEADER(belle_sip_header_via_new());
+	uint64_t start,type_checks,interface_lookups;
+	int matches=0;
+	int i;
+
+	belle_sip_object_ref(via);
+	start=bctbx_get_cur_time_ms();
+	for(i=0;i<CAST_ITERATIONS;++i){
+		matches+=BELLE_SIP_OBJECT_IS_INSTANCE_OF(req,belle_sip_message_t);
+		matches+=BELLE_SIP_OBJECT_IS_INSTANCE_OF(req,belle_sip_response_t);
+		matches+=BELLE_SIP_OBJECT_IS_INSTANCE_OF(via,belle_sip_header_t);
+		matches+=BELLE_SIP_OBJECT_IS_INSTANCE_OF(via,belle_sip_uri_t);
+	}
+	type_checks=bctbx_get_cur_time_ms()-start;
+	BC_ASSERT_EQUAL(matches,2*CAST_ITERATIONS,int,"%d");
+
+	matches=0;
+	start=bctbx_get_cur_time_ms();
+	for(i=0;i<CAST_ITERATIONS;++i){
+		matches+=BELLE_SIP_IMPLEMENTS(provider,belle_sip_channel_listener_t);
+		matches+=BELLE_SIP_IMPLEMENTS(provider,belle_http_request_listener_t);
+		matches+=BELLE_SIP_IMPLEMENTS(req,belle_sip_channel_listener_t);
+	}
+	interface_lookups=bctbx_get_cur_time_ms()-start;
+	BC_ASSERT_EQUAL(matches,CAST_ITERATIONS,int,"%d");
+
+	belle_sip_message("%i type checks in %" PRIu64 " ms, %i interface lookups in %" PRIu64 " ms",
+		4*CAST_ITERATIONS,type_checks,3*CAST_ITERATIONS,interface_lookups);
+	belle_sip_object_unref(via);
+	belle_sip_object_unref(req);
+	belle_sip_object_unref(provider);
+	belle_sip_object_unref(stack);
+}
 
 test_t cast_tests[] = {
-	TEST_NO_TAG("Casting requests and responses", cast_test)
+	TEST_NO_TAG("Casting requests and responses", cast_test),
+	TEST_NO_TAG("Type checks and interface lookups benchmark", cast_benchmark)
 };
 
 test_suite_t cast_test_suite = {"Object inheritance", NULL, NULL, NULL, NULL,
@@ -41,9 +41,10 @@ int main(int argc, char *argv[]){
 	int i;
 	const char *filename=NULL;
 	const char *protocol="sip";
+	int print_stats=FALSE;
 
 	if (argc<2){
-		fprintf(stderr,"Usage:\n%s [--protocol sip|http|sdp] <text file containing messages>\n",argv[0]);
+		fprintf(stderr,"Usage:\n%s [--protocol sip|http|sdp] [--stats] <text file containing messages>\n",argv[0]);
 		return -1;
 	}
 	for(i=1;i<argc;++i){
@@ -55,6 +56,8 @@ int main(int argc, char *argv[]){
 				fprintf(stderr,"Missing argument for --protocol\n");
 				return -1;
 			}
+		}else if (strcmp(argv[i],"--stats")==0){
+			print_stats=TRUE;
 		}else filename=argv[i];
 	}
 	if (!filename){
@@ -107,5 +110,11 @@ int main(int argc, char *argv[]){
 		}
 	}
 	belle_sip_free(str);
+	if (print_stats){
+		/*parsed messages are kept alive, so that the objects they are made of can be seen*/
+		str=belle_sip_object_type_stats_to_string();
+		printf("%s",str);
+		belle_sip_free(str);
+	}
 	return 0;
 }